@@ -1,10 +1,16 @@
 #pragma once
 #include "Util.h"
 
-// Hard-coded k to 32
-#define _K 32
+// k is fixed at compile time. It defaults to 32, the only size farmed on mainnet.
+// Smaller sizes (down to chiapos' minimum of 18) are for development builds
+// that plot in seconds, see the bladebit_small_k target.
+#ifndef _K
+    #define _K 32
+#endif
 #define ENTRIES_PER_TABLE ( 1ull << _K )
 
+static_assert( _K >= 18 && _K <= 32, "k must be between 18 and 32." );
+
 enum class TableId
 {
     Table1 = 0,
@@ -138,6 +144,9 @@ inline size_t CalculateParkSize( TableId tableId )
 // values of k, we need extra space to account for the additional variability.
 constexpr inline static size_t CalculateC3Size()
 {
+    if constexpr ( _K < 20 )
+        return (size_t)CDiv( 8 * kCheckpoint1Interval, 8 );
+
     return (size_t)CDiv( kC3BitsPerEntry * kCheckpoint1Interval, 8 );
 }
 
@@ -8,6 +8,26 @@
 // Unrolling loops by chacha block size.
 #define Y_SORT_BLOCK_MODE 1
 
+// Number of threads used to read/write spilled tables (--spill-dir)
+#define SPILL_IO_THREADS 8
+
+// Number of threads used to save/load plot checkpoints (--checkpoint-dir)
+#define CHECKPOINT_IO_THREADS 8
+
+// Maximum number of times threads spin on a barrier or
+// on the thread pool's job signal before blocking on a futex.
+#define THREAD_SPIN_COUNT 16384
+
+// Events kept by each thread between trace dumps (--trace), and
+// the maximum number of threads traced. Each event takes 40 bytes.
+#define TRACE_BUFFER_EVENTS (1ull << 16)
+#define TRACE_MAX_THREADS   1024
+
+// Phase 3 lookup tables of at least this many entries are written one
+// L2-sized region at a time. Smaller ones are written directly, as they
+// stay in the last level cache anyway.
+#define P3_LOOKUP_REGION_MIN_ENTRIES (1ull << 27)
+
 ///
 /// Debug Stuff
 ///
@@ -38,6 +58,6 @@
 // #define DBG_WRITE_LINE_POINTS 1
 // #define DBG_WRITE_SORTED_F7_TABLE 1
 
-// Enable to test plotting times without writing to disk
+// Enable to test plotting times without writing to disk by default (same as --benchmark)
 // #define BB_BENCHMARK_MODE 1
 
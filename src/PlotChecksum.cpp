@@ -0,0 +1,263 @@
+#include "PlotChecksum.h"
+#include "SysHost.h"
+#include "Util.h"
+
+extern "C" {
+    #include "b3/blake3_impl.h"
+}
+
+// Number of chunks that are hashed at a time with SIMD
+#define CHECKSUM_BATCH_CHUNKS 64
+
+//-----------------------------------------------------------
+inline static void ParentCV( const byte left[32], const byte right[32], byte outCV[32] )
+{
+    byte block[BLAKE3_BLOCK_LEN];
+    memcpy( block     , left , 32 );
+    memcpy( block + 32, right, 32 );
+
+    uint32 cv[8];
+    memcpy( cv, IV, sizeof( cv ) );
+
+    blake3_compress_in_place( cv, block, BLAKE3_BLOCK_LEN, 0, PARENT );
+    memcpy( outCV, cv, 32 );
+}
+
+//-----------------------------------------------------------
+inline static void ChunkCVs( const byte* chunks, size_t chunkCount, uint64 chunkCounter, byte* outCVs )
+{
+    const byte* inputs[CHECKSUM_BATCH_CHUNKS];
+
+    while( chunkCount )
+    {
+        const size_t count = std::min( chunkCount, (size_t)CHECKSUM_BATCH_CHUNKS );
+
+        for( size_t i = 0; i < count; i++ )
+            inputs[i] = chunks + i * BLAKE3_CHUNK_LEN;
+
+        blake3_hash_many( inputs, count, BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN, IV,
+                          chunkCounter, true, 0, CHUNK_START, CHUNK_END, outCVs );
+
+        chunks       += count * BLAKE3_CHUNK_LEN;
+        outCVs       += count * BLAKE3_OUT_LEN;
+        chunkCounter += count;
+        chunkCount   -= count;
+    }
+}
+
+//-----------------------------------------------------------
+PlotChecksum::PlotChecksum()
+{}
+
+//-----------------------------------------------------------
+PlotChecksum::~PlotChecksum()
+{
+    if( _prefixBuffer )
+        SysHost::VirtualFree( _prefixBuffer );
+}
+
+//-----------------------------------------------------------
+void PlotChecksum::Begin( size_t prefixSize )
+{
+    ASSERT( prefixSize );
+
+    // The prefix is contained in the smallest power-of-2 subtree of chunks that covers it.
+    size_t prefixChunks = 1;
+    while( prefixChunks * BLAKE3_CHUNK_LEN < prefixSize )
+        prefixChunks <<= 1;
+
+    _prefixSize   = prefixSize;
+    _prefixRegion = prefixChunks * BLAKE3_CHUNK_LEN;
+
+    if( _prefixCapacity < _prefixRegion )
+    {
+        if( _prefixBuffer )
+            SysHost::VirtualFree( _prefixBuffer );
+
+        _prefixCapacity = _prefixRegion;
+        _prefixBuffer   = (byte*)SysHost::VirtualAlloc( _prefixCapacity );
+
+        if( !_prefixBuffer )
+            Fatal( "Failed to allocate plot checksum buffer." );
+    }
+
+    _position     = prefixSize;
+    _chunkCounter = prefixChunks;
+    _chunkLength  = 0;
+    _stackLength  = 1;      // The deferred prefix subtree
+    _spineLength  = 0;
+}
+
+//-----------------------------------------------------------
+void PlotChecksum::Update( const void* data, size_t size )
+{
+    const byte* input = (const byte*)data;
+
+    // Table bytes that share chunks with the prefix are hashed along with it
+    if( _position < _prefixRegion )
+    {
+        const size_t copySize = (size_t)std::min( (uint64)size, _prefixRegion - _position );
+        memcpy( _prefixBuffer + _position, input, copySize );
+
+        _position += copySize;
+        input     += copySize;
+        size      -= copySize;
+    }
+
+    while( size )
+    {
+        // A buffered chunk is only hashed once we know it is not the last one
+        if( _chunkLength == BLAKE3_CHUNK_LEN )
+        {
+            byte cv[32];
+            ChunkCVs( _chunk, 1, _chunkCounter, cv );
+            PushChunkCV( cv );
+            _chunkLength = 0;
+        }
+
+        // Hash whole chunks directly from the input, keeping at least 1 byte for the chunk buffer
+        if( _chunkLength == 0 && size > BLAKE3_CHUNK_LEN )
+        {
+            byte cvs[CHECKSUM_BATCH_CHUNKS][32];
+
+            size_t chunkCount = ( size - 1 ) / BLAKE3_CHUNK_LEN;
+
+            while( chunkCount )
+            {
+                const size_t count = std::min( chunkCount, (size_t)CHECKSUM_BATCH_CHUNKS );
+                ChunkCVs( input, count, _chunkCounter, (byte*)cvs );
+
+                for( size_t i = 0; i < count; i++ )
+                    PushChunkCV( cvs[i] );
+
+                const size_t byteCount = count * BLAKE3_CHUNK_LEN;
+                input      += byteCount;
+                size       -= byteCount;
+                _position  += byteCount;
+                chunkCount -= count;
+            }
+        }
+
+        const size_t copySize = std::min( size, BLAKE3_CHUNK_LEN - _chunkLength );
+        memcpy( _chunk + _chunkLength, input, copySize );
+
+        _chunkLength += copySize;
+        _position    += copySize;
+        input        += copySize;
+        size         -= copySize;
+    }
+}
+
+//-----------------------------------------------------------
+void PlotChecksum::Finish( const void* prefix, byte digest[32] )
+{
+    ASSERT( prefix );
+    memcpy( _prefixBuffer, prefix, _prefixSize );
+
+    // The whole file fits in the prefix region, so it can be hashed directly.
+    // (Never the case for actual plots.)
+    if( _position <= _prefixRegion )
+    {
+        blake3_hasher hasher;
+        blake3_hasher_init( &hasher );
+        blake3_hasher_update( &hasher, _prefixBuffer, (size_t)_position );
+        blake3_hasher_finalize( &hasher, digest, 32 );
+        return;
+    }
+
+    ASSERT( _chunkLength > 0 );
+    MergeStack( _chunkCounter );
+
+    // Hash the prefix subtree and join it with the subtrees that completed to its right
+    const size_t prefixChunks = _prefixRegion / BLAKE3_CHUNK_LEN;
+
+    byte  prefixCVsStack[4][32];
+    byte* prefixCVs = prefixChunks > 4 ? (byte*)malloc( prefixChunks * 32 ) : (byte*)prefixCVsStack;
+
+    ChunkCVs( _prefixBuffer, prefixChunks, 0, prefixCVs );
+
+    for( size_t count = prefixChunks; count > 1; count >>= 1 )
+    {
+        for( size_t i = 0; i < count; i += 2 )
+            ParentCV( prefixCVs + i * 32, prefixCVs + (i+1) * 32, prefixCVs + i / 2 * 32 );
+    }
+
+    memcpy( _stack[0], prefixCVs, 32 );
+
+    if( prefixCVs != (byte*)prefixCVsStack )
+        free( prefixCVs );
+
+    for( uint i = 0; i < _spineLength; i++ )
+        ParentCV( _stack[0], _spine[i], _stack[0] );
+
+    // Output of the last chunk
+    uint32 cv[8];
+    memcpy( cv, IV, sizeof( cv ) );
+
+    const size_t blockCount = CDiv( _chunkLength, BLAKE3_BLOCK_LEN );
+
+    for( size_t i = 0; i < blockCount-1; i++ )
+        blake3_compress_in_place( cv, _chunk + i * BLAKE3_BLOCK_LEN, BLAKE3_BLOCK_LEN, _chunkCounter, i == 0 ? CHUNK_START : 0 );
+
+    byte  block[BLAKE3_BLOCK_LEN] = { 0 };
+    const size_t blockLength = _chunkLength - ( blockCount - 1 ) * BLAKE3_BLOCK_LEN;
+    memcpy( block, _chunk + ( blockCount - 1 ) * BLAKE3_BLOCK_LEN, blockLength );
+
+    uint64 counter = _chunkCounter;
+    uint8  flags   = CHUNK_END | ( blockCount == 1 ? CHUNK_START : 0 );
+    size_t length  = blockLength;
+
+    // Roll-up merge with every subtree in the stack
+    for( uint i = _stackLength; i > 0; i-- )
+    {
+        byte outCV[32];
+        blake3_compress_in_place( cv, block, (uint8)length, counter, flags );
+        memcpy( outCV, cv, 32 );
+
+        memcpy( block     , _stack[i-1], 32 );
+        memcpy( block + 32, outCV      , 32 );
+        memcpy( cv, IV, sizeof( cv ) );
+
+        counter = 0;
+        flags   = PARENT;
+        length  = BLAKE3_BLOCK_LEN;
+    }
+
+    byte rootOutput[64];
+    blake3_compress_xof( cv, block, (uint8)length, 0, flags | ROOT, rootOutput );
+    memcpy( digest, rootOutput, 32 );
+}
+
+//-----------------------------------------------------------
+void PlotChecksum::PushChunkCV( const byte cv[32] )
+{
+    MergeStack( _chunkCounter );
+
+    ASSERT( _stackLength < sizeof( _stack ) / sizeof( _stack[0] ) );
+    memcpy( _stack[_stackLength++], cv, 32 );
+
+    _chunkCounter++;
+}
+
+//-----------------------------------------------------------
+void PlotChecksum::MergeStack( uint64 totalChunks )
+{
+    // Same lazy merge as the reference hasher, but merges into
+    // the prefix subtree (entry 0) are deferred until Finish().
+    const uint mergedLength = (uint)popcnt( totalChunks );
+
+    while( _stackLength > mergedLength )
+    {
+        if( _stackLength == 2 )
+        {
+            memcpy( _spine[_spineLength++], _stack[1], 32 );
+        }
+        else
+        {
+            byte* left = _stack[_stackLength-2];
+            ParentCV( left, _stack[_stackLength-1], left );
+        }
+
+        _stackLength--;
+    }
+}
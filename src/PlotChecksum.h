@@ -0,0 +1,54 @@
+#pragma once
+
+/**
+ * Computes the BLAKE3 hash of a plot file while it is being written.
+ *
+ * The plot header (which contains the table pointers) is only known once
+ * all tables have been written, but it sits at the start of the file.
+ * To avoid re-reading the file, the chunks that overlap the header are
+ * deferred: The table data is hashed as it is written, and the complete
+ * subtrees that would have been merged with the header subtree are kept
+ * aside. On Finish() the header chunks are hashed and merged with them.
+ *
+ * The resulting digest is the standard BLAKE3 hash of the whole file,
+ * so it can be checked with any BLAKE3 tool (ex: b3sum --check).
+ */
+class PlotChecksum
+{
+public:
+    PlotChecksum();
+    ~PlotChecksum();
+
+    // Start hashing a new file whose first prefixSize bytes are only provided on Finish()
+    void Begin( size_t prefixSize );
+
+    // Hash the next bytes of the file, in file order, starting at file offset prefixSize
+    void Update( const void* data, size_t size );
+
+    // Hash the deferred prefix and output the final digest
+    void Finish( const void* prefix, byte digest[32] );
+
+private:
+    void PushChunkCV( const byte cv[32] );
+    void MergeStack( uint64 totalChunks );
+
+private:
+    size_t _prefixSize     = 0;         // Size of the deferred prefix (the header)
+    size_t _prefixRegion   = 0;         // Size in bytes of the power-of-2 chunk subtree which contains the prefix
+    byte*  _prefixBuffer   = nullptr;   // Holds the prefix region, including any table bytes that fall in it
+    size_t _prefixCapacity = 0;
+    uint64 _position       = 0;         // Current file offset
+
+    uint64 _chunkCounter   = 0;         // Index of the chunk currently being buffered
+    size_t _chunkLength    = 0;
+    byte   _chunk[1024];                // One BLAKE3 chunk
+
+    // CV stack as in the reference hasher, except that
+    // entry 0 always represents the deferred prefix subtree.
+    byte   _stack[64][32];
+    uint   _stackLength    = 0;
+
+    // Right-hand siblings of the prefix subtree, in the order they were completed
+    byte   _spine[64][32];
+    uint   _spineLength    = 0;
+};
@@ -3,6 +3,12 @@
 #include "ChiaConsts.h"
 #include "threading/ThreadPool.h"
 #include "PlotWriter.h"
+#include "PlotStats.h"
+
+class MemSpill;
+class MemCheckpoint;
+class MemArena;
+class PerfCounters;
 
 struct PlotRequest
 {
@@ -20,6 +26,42 @@ struct Pair
 };
 static_assert( sizeof( Pair ) == 8, "Invalid Pair struct." );
 
+///
+/// L/R pairs stored as the left index plus the distance to the right index,
+/// in 2 separate planes (6 bytes per entry instead of 8).
+/// The right entry is always in the kBC group that follows the left entry's
+/// group, so the distance is bounded by the size of 2 groups and fits in 16 bits.
+///
+struct PackedPairs
+{
+    uint32* left;
+    uint16* offset;
+
+    // Size in bytes of a whole table of packed pairs
+    static constexpr size_t TableSize = ENTRIES_PER_TABLE * ( sizeof( uint32 ) + sizeof( uint16 ) );
+
+    inline PackedPairs() = default;
+    
+    // Map the planes on to a buffer of TableSize bytes
+    inline explicit PackedPairs( void* buffer )
+        : left  ( (uint32*)buffer )
+        , offset( (uint16*)( (uint32*)buffer + ENTRIES_PER_TABLE ) )
+    {}
+
+    inline Pair Get( uint64 index ) const
+    {
+        const uint32 l = left[index];
+        return { l, l + offset[index] };
+    }
+
+    inline void Set( uint64 index, const Pair& pair )
+    {
+        ASSERT( pair.right > pair.left && pair.right - pair.left <= 0xFFFF );
+        left  [index] = pair.left;
+        offset[index] = (uint16)( pair.right - pair.left );
+    }
+};
+
 
 ///
 /// Context for a in-memory plotting
@@ -43,6 +85,8 @@ struct MemPlotContext
     /// Buffers
     ///
     // Permanent table data buffers
+    // If compactPairs is set, tables 2-6 are stored as PackedPairs (24 GiB each).
+    // When spilling, table 1 and tables 2-6 point to the spill/load buffers below.
     uint32* t1XBuffer ;       // 16 GiB
     Pair*   t2LRBuffer;       // 32 GiB
     Pair*   t3LRBuffer;       // 32 GiB
@@ -60,6 +104,24 @@ struct MemPlotContext
     uint64* metaBuffer0;      // 64GiB each
     uint64* metaBuffer1;
 
+    // Scratch buffers for phases 2-4. These share memory with
+    // the phase 1 temporary buffers once those are no longer live.
+    byte*   markingBuffer;    // 20 GiB, Phase 2 marked entries
+    uint64* lpBuffer;         // 32 GiB, Phase 3 line points (and the table 6 park)
+    uint64* lpSortTmp;        // 32 GiB
+    uint32* lpMapBuffer;      // 32 GiB, Phase 3 line point to entry index map
+    uint32* f7SortTmp;        // 16 GiB
+    uint32* t7IdxSortTmp;     // 16 GiB
+    byte*   p4Buffer;         // 32 GiB, Phase 4 parks and C tables
+
+    // Spill mode buffers. Tables 2-6 go through 2 alternating slots
+    // in Phase 1 before being spilled, and are loaded back into 2 other
+    // alternating slots for Phases 2 and 3.
+    uint32* t1XSpillBuffer;   // 16 GiB, table 1 x during Phase 1
+    uint32* t1XLoadBuffer;    // 16 GiB, table 1 x (and lookup table) during Phases 2-4
+    Pair*   spillSlots[2];    // 32 GiB each
+    Pair*   loadSlots [2];    // 32 GiB each
+
     uint64  maxKBCGroups;
     uint64  maxPairs;         // Max total pairs our buffer can hold
     
@@ -69,18 +131,40 @@ struct MemPlotContext
     // Added by Phase 2:
     byte* usedEntries[6];   // Used entries per each table.
                             // These are only used for tables 2-6 (inclusive).
-                            // These buffers map to regions in yBuffer0.
+                            // These buffers map to regions in markingBuffer.
 
     DiskPlotWriter* plotWriter;
 
     // The buffer used to write to disk the Phase 4 data.
-    // This may be metaBuffer0 or a an L/R buffer from
-    // table 3 and up, the highest one available to use.
+    // This is p4Buffer while the plot is being written.
     // If null, then no buffer is in use.
     byte* p4WriteBuffer;
     byte* p4WriteBufferWriter;
 
     // How many plots we've made so far
     uint64 plotCount;
+
+    // Store the L/R pairs of tables 2-6 as PackedPairs
+    bool   compactPairs;
+
+    // If set, tables are spilled to this directory while they are not used
+    const char* spillDir;
+    MemSpill*   spill;
+
+    // If set, the state of the plot is saved at the end of Phases 1 and 2 so it can be resumed
+    MemCheckpoint* checkpoint;
+
+    // Keep the buffers the previous plot is writing to disk out of the way
+    // of the whole of Phase 1, so that it can run while the writes drain.
+    bool        overlapWrites;
+
+    // Memory layout of the buffers above
+    const MemArena* arena;
+
+    // Metrics of the plot being made
+    PlotStats   stats;
+
+    // Hardware counters sampled at each stage, if enabled
+    PerfCounters* perf;
 };
 
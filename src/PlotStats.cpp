@@ -0,0 +1,78 @@
+#include "PlotStats.h"
+#include "ChiaConsts.h"
+#include "Util.h"
+
+//-----------------------------------------------------------
+bool PlotStats::AppendJsonLine( const char* path ) const
+{
+    ASSERT( path );
+
+    FILE* file = fopen( path, "a" );
+    if( !file )
+        return false;
+
+    uint64 totalBytes = 0;
+    for( uint i = 0; i < 10; i++ )
+        totalBytes += tableBytes[i];
+
+    fprintf( file, "{\"plot_id\":\"%s\",\"plot_index\":%llu,\"k\":%u,\"seconds\":%.3lf",
+        plotId, plotIndex, (uint)_K, seconds );
+
+    if( benchmark )
+        fprintf( file, ",\"benchmark\":true,\"simulated_write_speed\":%llu", simulatedWriteSpeed );
+
+    fprintf( file, ",\"phase_seconds\":[%.3lf,%.3lf,%.3lf,%.3lf]",
+        phaseSeconds[0], phaseSeconds[1], phaseSeconds[2], phaseSeconds[3] );
+
+    fprintf( file, ",\"final_write_seconds\":%.3lf,\"prev_write_overlap_seconds\":%.3lf,\"prev_write_wait_seconds\":%.3lf",
+        finalWriteSeconds, prevWriteOverlapSeconds, prevWriteWaitSeconds );
+
+    // Phase 1
+    fprintf( file, ",\"phase1\":{\"f1_seconds\":%.3lf,\"f1_sort_seconds\":%.3lf,\"tables\":[", f1Seconds, f1SortSeconds );
+
+    for( uint i = (uint)TableId::Table2; i <= (uint)TableId::Table7; i++ )
+    {
+        const P1Table& t = p1Tables[i];
+
+        fprintf( file, "%s{\"table\":%u,\"seconds\":%.3lf,\"pair_seconds\":%.3lf,\"fx_seconds\":%.3lf,"
+                       "\"sort_seconds\":%.3lf,\"groups\":%llu,\"entries\":%llu}",
+            i > (uint)TableId::Table2 ? "," : "", i+1, t.seconds, t.pairSeconds, t.fxSeconds,
+            t.sortSeconds, t.groupCount, t.entryCount );
+    }
+
+    // Phase 2
+    fprintf( file, "]},\"phase2\":{\"tables\":[" );
+
+    for( uint i = (uint)TableId::Table2; i <= (uint)TableId::Table6; i++ )
+    {
+        fprintf( file, "%s{\"table\":%u,\"seconds\":%.3lf}",
+            i > (uint)TableId::Table2 ? "," : "", i+1, p2TableSeconds[i] );
+    }
+
+    // Phase 3
+    fprintf( file, "]},\"phase3\":{\"tables\":[" );
+
+    for( uint i = (uint)TableId::Table1; i <= (uint)TableId::Table6; i++ )
+    {
+        const P3Table& t = p3Tables[i];
+        const double   keptRatio = t.entryCount ? t.keptCount / (double)t.entryCount : 0;
+
+        fprintf( file, "%s{\"table\":%u,\"seconds\":%.3lf,\"entries\":%llu,\"entries_kept\":%llu,"
+                       "\"kept_ratio\":%.6lf,\"park_bytes\":%llu}",
+            i > (uint)TableId::Table1 ? "," : "", i+1, t.seconds, t.entryCount, t.keptCount,
+            keptRatio, tableBytes[i] );
+    }
+
+    // Phase 4
+    fprintf( file, "]},\"phase4\":{\"tables_seconds\":%.3lf}", p4TablesSeconds );
+
+    fprintf( file, ",\"bytes_written\":%llu,\"table_bytes\":[", totalBytes );
+
+    for( uint i = 0; i < 10; i++ )
+        fprintf( file, "%s%llu", i ? "," : "", tableBytes[i] );
+
+    fprintf( file, "]}\n" );
+
+    const bool ok = !ferror( file );
+    return fclose( file ) == 0 && ok;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+/**
+ * Metrics collected while making a single plot.
+ *
+ * Each plot is appended to the stats file as a single JSON object
+ * on its own line (JSON Lines), so that a file can be shared by
+ * multiple plots and runs, and be read back one plot at a time.
+ *
+ * Table numbers are 1-based, as in the log output.
+ */
+struct PlotStats
+{
+    struct P1Table
+    {
+        double seconds;
+        double pairSeconds;     // kBC group scan and pairing
+        double fxSeconds;
+        double sortSeconds;     // Sort on y and mapping of the metadata and pairs
+        uint64 groupCount;      // kBC groups in the left table
+        uint64 entryCount;      // Pairs found, which are this table's entries
+    };
+
+    struct P3Table
+    {
+        double seconds;
+        uint64 entryCount;      // Entries before pruning
+        uint64 keptCount;       // Entries left after pruning
+    };
+
+    char    plotId[65];
+    uint64  plotIndex;          // Index of the plot in this run
+
+    bool    benchmark;          // The plot was discarded instead of written
+    uint64  simulatedWriteSpeed;// Write speed of the simulated drive when benchmarking, in bytes per second. 0 = unthrottled
+
+    double  seconds;            // Whole plot, including the final write, if any
+    double  phaseSeconds[4];
+    double  finalWriteSeconds;  // Wait for the last plot of a run to be written
+
+    // Time during which the previous plot was still being written,
+    // and how much of it this plot spent blocked on it.
+    double  prevWriteOverlapSeconds;
+    double  prevWriteWaitSeconds;
+
+    // Phase 1
+    double  f1Seconds;
+    double  f1SortSeconds;
+    P1Table p1Tables[7];        // Tables 2-7
+
+    // Phase 2: Time to mark the entries of each table using the table after it
+    double  p2TableSeconds[7];  // Tables 2-6
+
+    // Phase 3: Compression of each table with the one after it
+    P3Table p3Tables[7];        // Tables 1-6
+
+    // Phase 4: P7, C1, C2 and C3 are written in a single pass
+    double  p4TablesSeconds;
+
+    // Bytes submitted to the plot writer for each table of the plot file
+    uint64  tableBytes[10];
+
+    // Appends the stats as a JSON line to the given file
+    bool AppendJsonLine( const char* path ) const;
+};
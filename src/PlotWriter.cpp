@@ -2,26 +2,31 @@
 #include "ChiaConsts.h"
 #include "SysHost.h"
 #include "Config.h"
+#include <thread>
+
+// Block size used when the plot is discarded, as there's no file to get it from
+#define DISCARD_BLOCK_SIZE 4096
+
+// Largest single write when throttling, so that the simulated drive is paced smoothly
+#define THROTTLE_MAX_WRITE_SIZE ( 64ull MB )
 
 //-----------------------------------------------------------
-DiskPlotWriter::DiskPlotWriter()
-    : _writeSignal       ( 0 )
+DiskPlotWriter::DiskPlotWriter( bool discard, uint64 maxWriteSpeed )
+    : _discard           ( discard       )
+    , _maxWriteSpeed     ( maxWriteSpeed )
+    , _writeSignal       ( 0 )
     , _plotFinishedSignal( 0 )
+    , _hashSignal        ( 0 )
+    , _hashFinishedSignal( 0 )
 {
-    #if BB_BENCHMARK_MODE
-        return;
-    #endif
-    // Start writer thread
+    // Start writer and hasher threads
     _writerThread.Run( WriterMain, this );
+    _hasherThread.Run( HasherMain, this );
 }
 
 //-----------------------------------------------------------
 DiskPlotWriter::~DiskPlotWriter()
 {
-    #if BB_BENCHMARK_MODE
-        return;
-    #endif
-
     // Signal writer thread to exit, if it hasn't already
     _terminateSignal.store( true, std::memory_order_release );
     _writeSignal.Release();
@@ -29,6 +34,9 @@ DiskPlotWriter::~DiskPlotWriter()
     // Wait for thread to exit
     _plotFinishedSignal.Wait();
 
+    _hashSignal.Release();
+    _hasherThread.WaitForExit();
+
     if( _headerBuffer )
         SysHost::VirtualFree( _headerBuffer );
 
@@ -39,18 +47,15 @@ DiskPlotWriter::~DiskPlotWriter()
 //-----------------------------------------------------------
 bool DiskPlotWriter::BeginPlot( const char* plotFilePath, FileStream& file, const byte plotId[32], const byte* plotMemo, const uint16 plotMemoSize )
 {
-    #if BB_BENCHMARK_MODE
-        _filePath = plotFilePath;
-        return true;
-    #endif
-
     ASSERT( plotMemo     );
     ASSERT( plotMemoSize );
 
     // Make sure we're not still writing a plot
-    if( _file || _error || !file.IsOpen() )
+    if( _file || _error || ( !_discard && !file.IsOpen() ) )
         return false;
 
+    const int blockSize = _discard ? DISCARD_BLOCK_SIZE : (int)file.BlockSize();
+
     const size_t headerSize =
         ( sizeof( kPOSMagic ) - 1 ) +
         32 +            // plot id
@@ -66,7 +71,7 @@ bool DiskPlotWriter::BeginPlot( const char* plotFilePath, FileStream& file, cons
     _filePath = plotFilePath;
 
 
-    const size_t paddedHeaderSize = RoundUpToNextBoundary( headerSize, (int)file.BlockSize() );
+    const size_t paddedHeaderSize = RoundUpToNextBoundary( headerSize, blockSize );
     
     byte* header = _headerBuffer;
     
@@ -75,7 +80,7 @@ bool DiskPlotWriter::BeginPlot( const char* plotFilePath, FileStream& file, cons
     {
         ASSERT( _headerBuffer );
 
-        const size_t currentPaddedHeaderSize = RoundUpToNextBoundary( _headerSize, (int)file.BlockSize() );
+        const size_t currentPaddedHeaderSize = RoundUpToNextBoundary( _headerSize, blockSize );
 
         if( currentPaddedHeaderSize != paddedHeaderSize )
         {
@@ -86,12 +91,11 @@ bool DiskPlotWriter::BeginPlot( const char* plotFilePath, FileStream& file, cons
 
     // Alloc the header buffer if we need to
     if( !header )
-    {
         header = (byte*)SysHost::VirtualAlloc( paddedHeaderSize );
 
-        // Zero-out padded portion and table pointers
-        memset( header+headerSize-80, 0, paddedHeaderSize-headerSize-80 );
-    }
+    // Zero-out padded portion and table pointers
+    // (The buffer may hold a previous header with a different memo size)
+    memset( header+headerSize-80, 0, paddedHeaderSize-(headerSize-80) );
 
 
     // Write the header
@@ -124,7 +128,7 @@ bool DiskPlotWriter::BeginPlot( const char* plotFilePath, FileStream& file, cons
     }
 
     // Seek to the aligned position after the header
-    if( !file.Seek( (int64)paddedHeaderSize, SeekOrigin::Begin ) )
+    if( !_discard && !file.Seek( (int64)paddedHeaderSize, SeekOrigin::Begin ) )
     {
         _error = file.GetError();
         return false;
@@ -138,8 +142,12 @@ bool DiskPlotWriter::BeginPlot( const char* plotFilePath, FileStream& file, cons
     _tablePointers[0] = paddedHeaderSize;
     _position         = paddedHeaderSize;
 
+    // The header is hashed last, once the table pointers are known
+    _checksum.Begin( paddedHeaderSize );
+
     // Give ownership of the file to the writer thread and signal it
     _tableIndex = 0;
+    _lastTableIndexWritten.store( 0, std::memory_order_release );
     _file       = &file;
     _writeSignal.Release();
 
@@ -149,10 +157,6 @@ bool DiskPlotWriter::BeginPlot( const char* plotFilePath, FileStream& file, cons
 //-----------------------------------------------------------
 bool DiskPlotWriter::WriteTable( const void* buffer, size_t size )
 {
-    #if BB_BENCHMARK_MODE
-        return true;
-    #endif
-
     if( !SubmitTable( buffer, size ) )
         return false;
 
@@ -165,10 +169,6 @@ bool DiskPlotWriter::WriteTable( const void* buffer, size_t size )
 //-----------------------------------------------------------
 bool DiskPlotWriter::SubmitTable( const void* buffer, size_t size )
 {
-    #if BB_BENCHMARK_MODE
-        return true;
-    #endif
-
     // Make sure the thread has already started.
     // We must have no errors
     if( !_file || _error )
@@ -216,10 +216,6 @@ bool DiskPlotWriter::SubmitTable( const void* buffer, size_t size )
 //-----------------------------------------------------------
 bool DiskPlotWriter::WaitUntilFinishedWriting()
 {
-#if BB_BENCHMARK_MODE
-    return true;
-#else
-
     // For re-entry checks
     if( !_file && _plotFinishedSignal.GetCount() == 0 )
         return true;
@@ -231,9 +227,49 @@ bool DiskPlotWriter::WaitUntilFinishedWriting()
     ASSERT( _file == nullptr );
 
     return _error == 0;
-#endif
 }
 
+//-----------------------------------------------------------
+bool DiskPlotWriter::WaitForTablesWritten( uint tableCount )
+{
+    ASSERT( tableCount <= 10 );
+
+    // Tables take seconds to write, so polling is good enough here
+    while( TablesWritten() < tableCount )
+    {
+        if( _error )
+            return false;
+
+        Thread::Sleep( 5 );
+    }
+
+    return _error == 0;
+}
+
+//-----------------------------------------------------------
+bool DiskPlotWriter::WaitForBufferReleased( const void* buffer, size_t size )
+{
+    const byte* start = (const byte*)buffer;
+    const byte* end   = start + size;
+
+    // Find the last pending table that overlaps the buffer.
+    // Tables are written in order, so we only need to wait for that one.
+    const uint tableCount = _tableIndex.load( std::memory_order_acquire );
+    uint       waitCount  = 0;
+
+    for( uint i = TablesWritten(); i < tableCount; i++ )
+    {
+        const TableBuffer& table = _tablebuffers[i];
+
+        if( table.buffer < end && start < table.buffer + table.size )
+            waitCount = i + 1;
+    }
+
+    if( waitCount )
+        return WaitForTablesWritten( waitCount );
+
+    return _error == 0;
+}
 
 ///
 /// Writer thread
@@ -287,8 +323,11 @@ void DiskPlotWriter::WriterThread()
             tableIndex = 0;
             _lastTableIndexWritten.store( 0, std::memory_order_release );
 
+            // The simulated drive starts idle
+            _throttleEnd = std::chrono::steady_clock::now();
+
             // Allocate a new block buffer, if we need to
-            blockSize = file->BlockSize();
+            blockSize = _discard ? DISCARD_BLOCK_SIZE : file->BlockSize();
             if( blockSize > blockBufferSize )
             {
                 if( blockBuffer )
@@ -318,9 +357,18 @@ void DiskPlotWriter::WriterThread()
 
             const size_t remainder   = table.size - sizeToWrite;
 
+            // Hash the blocks while they are being written
+            const bool hashing = sizeToWrite > 0;
+            if( hashing )
+            {
+                _hashBuffer = writeBuffer;
+                _hashSize   = sizeToWrite;
+                _hashSignal.Release();
+            }
+
             while( sizeToWrite )
             {
-                ssize_t sizeWritten = file->Write( writeBuffer, sizeToWrite );
+                ssize_t sizeWritten = WriteToFile( *file, writeBuffer, sizeToWrite );
                 if( sizeWritten < 1 )
                 {
                     // Error occurred, stop writing.
@@ -333,6 +381,10 @@ void DiskPlotWriter::WriterThread()
                 writeBuffer += sizeWritten;
             };
 
+            // The table buffer can't be released until it has been hashed
+            if( hashing )
+                _hashFinishedSignal.Wait();
+
             // Break out if we got a write error
             if( _error )
                 break;
@@ -343,7 +395,7 @@ void DiskPlotWriter::WriterThread()
                 memset( blockBuffer, 0, blockSize );
                 memcpy( blockBuffer, writeBuffer, remainder );
 
-                ssize_t sizeWritten = file->Write( blockBuffer, blockSize );
+                ssize_t sizeWritten = WriteToFile( *file, blockBuffer, blockSize );
                 if( sizeWritten < 1 )
                 {
                     _error = file->GetError();
@@ -351,9 +403,11 @@ void DiskPlotWriter::WriterThread()
                 }
 
                 ASSERT( (size_t)sizeWritten == blockSize );
+
+                _checksum.Update( blockBuffer, blockSize );
             }
 
-            if( !file->Flush() )
+            if( !_discard && !file->Flush() )
             {
                 _error = file->GetError();
                 break;
@@ -379,7 +433,7 @@ void DiskPlotWriter::WriterThread()
 
             // We now need to seek to the beginning so that we can write the header
             // with the table pointers set
-            if( file->Seek( 0, SeekOrigin::Begin ) )
+            if( _discard || file->Seek( 0, SeekOrigin::Begin ) )
             {
                 const size_t alignedHeaderSize = _tablePointers[0];
 
@@ -389,14 +443,19 @@ void DiskPlotWriter::WriterThread()
 
                 memcpy( _headerBuffer + (_headerSize-80), _tablePointers, 80 );
 
-                if( file->Write( _headerBuffer, alignedHeaderSize ) != (ssize_t)alignedHeaderSize )
+                if( WriteToFile( *file, _headerBuffer, alignedHeaderSize ) != (ssize_t)alignedHeaderSize )
                     _error = file->GetError();
+
+                byte   digest[32];
+                size_t numEncoded;
+                _checksum.Finish( _headerBuffer, digest );
+                BytesToHexStr( digest, sizeof( digest ), _checksumStr, sizeof( _checksumStr ), numEncoded );
             }
             else
                 _error = file->GetError();
 
             // Plot data cleanup
-            if( !file->Flush() )
+            if( !_discard && !file->Flush() )
                 _error = file->GetError();
             
             file->Close();
@@ -431,12 +490,59 @@ void DiskPlotWriter::WriterThread()
     _plotFinishedSignal.Release();
 }
 
+//-----------------------------------------------------------
+void DiskPlotWriter::HasherMain( void* data )
+{
+    ASSERT( data );
+    DiskPlotWriter* self = reinterpret_cast<DiskPlotWriter*>( data );
+    
+    self->HasherThread();
+}
+
+//-----------------------------------------------------------
+void DiskPlotWriter::HasherThread()
+{
+    for( ;; )
+    {
+        _hashSignal.Wait();
+
+        if( _terminateSignal.load( std::memory_order_relaxed ) )
+            break;
+
+        _checksum.Update( _hashBuffer, _hashSize );
+        _hashFinishedSignal.Release();
+    }
+}
+
+//-----------------------------------------------------------
+bool DiskPlotWriter::WriteChecksumFile( const char* plotFilePath )
+{
+    ASSERT( plotFilePath );
+
+    // The sidecar references the plot by file name so that it can be checked from the plot's directory
+    const char* fileName = plotFilePath;
+    for( const char* c = plotFilePath; *c; c++ )
+    {
+        if( *c == '/' || *c == '\\' )
+            fileName = c + 1;
+    }
+
+    std::string checksumPath = plotFilePath;
+    checksumPath += ".b3";
+
+    FILE* file = fopen( checksumPath.c_str(), "wb" );
+    if( !file )
+        return false;
+
+    const bool ok = fprintf( file, "%s  %s\n", _checksumStr, fileName ) > 0;
+    return fclose( file ) == 0 && ok;
+}
+
 //-----------------------------------------------------------
 size_t DiskPlotWriter::AlignToBlockSize( size_t size )
 {
-    #if BB_BENCHMARK_MODE
-        return RoundUpToNextBoundary( size, 4096 );
-    #endif
+    if( _discard )
+        return RoundUpToNextBoundary( size, DISCARD_BLOCK_SIZE );
 
     ASSERT( _file );
 
@@ -447,4 +553,36 @@ size_t DiskPlotWriter::AlignToBlockSize( size_t size )
     return RoundUpToNextBoundary( size, (int)_file->BlockSize() );
 }
 
+//-----------------------------------------------------------
+ssize_t DiskPlotWriter::WriteToFile( FileStream& file, const void* buffer, size_t size )
+{
+    if( _maxWriteSpeed )
+        size = std::min( size, (size_t)THROTTLE_MAX_WRITE_SIZE );
+
+    ssize_t sizeWritten = (ssize_t)size;
+
+    if( !_discard )
+    {
+        sizeWritten = file.Write( buffer, size );
+        if( sizeWritten < 1 )
+            return sizeWritten;
+    }
+
+    // The simulated drive starts on this write once it has finished the previous ones,
+    // or right away if it has been idle.
+    if( _maxWriteSpeed )
+    {
+        const auto now = std::chrono::steady_clock::now();
+        if( _throttleEnd < now )
+            _throttleEnd = now;
+
+        _throttleEnd += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                            std::chrono::duration<double>( (double)sizeWritten / _maxWriteSpeed ) );
+
+        std::this_thread::sleep_until( _throttleEnd );
+    }
+
+    return sizeWritten;
+}
+
 
@@ -2,6 +2,7 @@
 #include "io/FileStream.h"
 #include "threading/Thread.h"
 #include "threading/Semaphore.h"
+#include "PlotChecksum.h"
 
 /**
  * Handles writing the final plot to disk
@@ -27,11 +28,20 @@
  * [C1_Table]
  * [C2_Table]
  * [C3_Table_Parks]
+ *
+ * While writing, the BLAKE3 hash of the final file is calculated,
+ * so that plots don't need to be read back to be checksummed.
+ *
+ * For benchmarking, the writer can discard the plot instead. Tables are still
+ * hashed and go through the writer thread, so the plotter waits on them as it would
+ * on a real drive, optionally throttled to a given write speed.
  */
 class DiskPlotWriter
 {
 public:
-    DiskPlotWriter();
+    // If discard is set, nothing is written, and the file given to BeginPlot() is not opened.
+    // maxWriteSpeed, in bytes per second, throttles writing to simulate a slower drive. 0 = unthrottled.
+    DiskPlotWriter( bool discard = false, uint64 maxWriteSpeed = 0 );
     ~DiskPlotWriter();
 
     // Begins writing a new plot. Any previous plot must have finished before calling this
@@ -66,16 +76,39 @@ public:
 
     inline int  GetError() { return _error; }
 
+    inline bool IsDiscarding() const { return _discard; }
+
     inline const std::string& FilePath() { return _filePath; }
 
+    // BLAKE3 hash of the whole plot file, as a hex string.
+    // Valid once the plot has finished writing.
+    inline const char* GetChecksum() { return _checksumStr; }
+
+    // Writes the checksum in b3sum format to a sidecar file named <plotFilePath>.b3
+    bool WriteChecksumFile( const char* plotFilePath );
+
     // Number of tables written
     inline uint TablesWritten() { return _lastTableIndexWritten.load( std::memory_order_acquire ); }
 
+    // Blocks until at least tableCount tables of the current plot have been written.
+    // Returns false if there was an error writing the plot.
+    bool WaitForTablesWritten( uint tableCount );
+
+    // Blocks until no table that is pending to be written uses any of the given memory.
+    // Returns false if there was an error writing the plot.
+    bool WaitForBufferReleased( const void* buffer, size_t size );
+
 private:
     static void WriterMain( void* data );
     void WriterThread();
+
+    static void HasherMain( void* data );
+    void HasherThread();
     size_t AlignToBlockSize( size_t size );
 
+    // Writes a buffer to the file, or discards it. Blocks as long as the write speed limit requires.
+    ssize_t WriteToFile( FileStream& file, const void* buffer, size_t size );
+
     struct TableBuffer
     {
         const byte*  buffer;
@@ -99,9 +132,22 @@ private:
 
     int               _error              = 0;      // Set if there was an error writing the plot file
 
+    bool              _discard            = false;  // Don't write the plot file anywhere
+    uint64            _maxWriteSpeed      = 0;      // In bytes per second, 0 = unthrottled
+    std::chrono::steady_clock::time_point _throttleEnd;  // When the simulated drive finishes the data written so far
+
     Thread            _writerThread;
     Semaphore         _writeSignal;                 // Main thread signals writer thread to write a new table
     Semaphore         _plotFinishedSignal;          // Writer thread signals that it's finished writing a plot
     std::atomic<bool> _terminateSignal    = false;  // Main thread signals us to exit
+
+    // Table data is hashed on a separate thread while it is being written
+    PlotChecksum      _checksum;
+    char              _checksumStr[65]    = { 0 };
+    Thread            _hasherThread;
+    Semaphore         _hashSignal;                  // Writer thread signals hasher thread to hash a buffer
+    Semaphore         _hashFinishedSignal;          // Hasher thread signals that it finished hashing the buffer
+    const byte*       _hashBuffer         = nullptr;
+    size_t            _hashSize           = 0;
 };
 
@@ -12,6 +12,34 @@ enum class VProtect : uint
 };
 ImplementFlagOps( VProtect );
 
+// Page backing requested for large allocations
+enum class HugePageMode : uint
+{
+    None        = 0,    // Use the system's default page size
+    Transparent = 1,    // Hint the system to back the memory with transparent huge pages
+    Huge2MiB    = 2,    // Reserved 2 MiB huge pages. Falls back to Transparent.
+    Huge1GiB    = 3,    // Reserved 1 GiB huge pages. Falls back to Huge2MiB.
+};
+
+// Hardware performance counters that can be opened per thread
+enum class PerfCounter : uint
+{
+    Cycles = 0,
+    Instructions,
+    LLCMisses,
+    DTLBMisses,
+    BranchMisses,
+
+    _Count
+};
+
+// Performance counters of a single thread, opened as a group
+// so that they are all scheduled on the CPU at the same time.
+struct PerfCounterGroup
+{
+    int fds[(uint)PerfCounter::_Count];     // -1 for counters that are not available
+};
+
 struct NumaInfo
 {
     uint        nodeCount;  // How many NUMA nodes in the system
@@ -39,10 +67,21 @@ public:
     /// Get the total number of logical CPUs in the system
     static uint GetLogicalCPUCount();
 
+    /// Get the lowest logical CPU id that shares a physical core with cpuId.
+    /// CPUs with the same result are SMT siblings.
+    /// Returns cpuId itself if the topology is unknown.
+    static uint GetCpuCoreId( uint cpuId );
+
     /// Create an allocation in the virtual memory space
     /// If initialize == true, then all pages are touched so that
     /// the pages are actually assigned.
     static void* VirtualAlloc( size_t size, bool initialize = false );
+
+    /// Create an allocation backed by huge pages, if possible.
+    /// Falls back to the next supported mode when the requested one is unavailable.
+    /// The mode actually used is returned in outMode.
+    /// The allocation is released with VirtualFree.
+    static void* VirtualAlloc( size_t size, HugePageMode mode, HugePageMode& outMode );
     
     static void VirtualFree( void* ptr );
 
@@ -82,4 +121,15 @@ public:
     /// NOTE: Pages must first be faulted on linuz.
     static int NumaGetNodeFromPage( void* ptr );
 
+    /// Open the hardware performance counters for the calling thread (user mode only).
+    /// Counters unsupported by the CPU are left out.
+    /// Returns false if none could be opened (ex: not permitted, or unsupported platform).
+    static bool PerfCountersOpen( PerfCounterGroup& group );
+
+    /// Read the current values of a counter group, indexed by PerfCounter.
+    /// Values are scaled if the counters were multiplexed. Unavailable counters read as 0.
+    static bool PerfCountersRead( const PerfCounterGroup& group, uint64 values[(uint)PerfCounter::_Count] );
+
+    static void PerfCountersClose( PerfCounterGroup& group );
+
 };
\ No newline at end of file
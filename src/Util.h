@@ -260,6 +260,22 @@ inline void HexStrToBytes( const char* str, const size_t strSize,
     }
 }
 
+//-----------------------------------------------------------
+// Returns true if the string is made of hex digits only
+inline bool IsHexStr( const char* str, const size_t strSize )
+{
+    ASSERT( str );
+
+    for( size_t i = 0; i < strSize; i++ )
+    {
+        const char c = str[i];
+        if( !( ( c >= '0' && c <= '9' ) || ( c >= 'a' && c <= 'f' ) || ( c >= 'A' && c <= 'F' ) ) )
+            return false;
+    }
+
+    return true;
+}
+
 //-----------------------------------------------------------
 // Encode bytes into hex format
 // Return:
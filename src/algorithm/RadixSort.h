@@ -1,5 +1,6 @@
 #pragma once
 #include "threading/ThreadPool.h"
+#include "threading/Barrier.h"
 #include <cstring>
 
 class RadixSort256
@@ -7,13 +8,12 @@ class RadixSort256
     template<typename T1, typename T2>
     struct SortJob
     {
-        uint id;                    // Id 0 is in charge of performing the non-parallel steps.
+        uint id;
         uint threadCount;           // How many threads are participating in the sort
         
-        // When All threads have finished, we can
-        // thread 0 (the control thread) can calculate jobs and signal them to continue
-        std::atomic<uint>* finishedCount;
-        std::atomic<uint>* releaseLock;
+        // Once all threads have finished counting, the last
+        // thread to arrive computes the prefix sums for everyone.
+        Barrier* barrier;
 
         uint64* counts;             // Counts array for each thread
         uint64* pfxSums;            // Prefix sums for each thread. We use a different buffers to avoid copying to tmp buffers.
@@ -46,6 +46,11 @@ public:
     template<uint32 ThreadCount>
     static void SortY( ThreadPool& pool, uint64* input, uint64* tmp, uint64 length );
 
+    // Sorts on the ByteCount least significant bytes of the values only.
+    // The sorted values end up in tmp if ByteCount is odd.
+    template<uint32 ThreadCount, int ByteCount, typename T1>
+    static void SortOnLowBytes( ThreadPool& pool, T1* input, T1* tmp, uint64 length );
+
     template<uint32 ThreadCount>
     static void SortYWithKey( ThreadPool& pool, uint64* input, uint64* tmp, uint32* keyInput, uint32* keyTmp, uint64 length );
 
@@ -80,6 +85,14 @@ inline void RadixSort256::SortY( ThreadPool& pool, uint64* input, uint64* tmp, u
     DoSort<ThreadCount, ModeSingle, uint64, void, 5>( pool, input, tmp, nullptr, nullptr, length );
 }
 
+//-----------------------------------------------------------
+template<uint32 ThreadCount, int ByteCount, typename T1>
+inline void RadixSort256::SortOnLowBytes( ThreadPool& pool, T1* input, T1* tmp, uint64 length )
+{
+    static_assert( ByteCount > 0 && ByteCount <= (int)sizeof( T1 ) );
+    DoSort<ThreadCount, ModeSingle, T1, void, ByteCount>( pool, input, tmp, nullptr, nullptr, length );
+}
+
 //-----------------------------------------------------------
 template<uint32 ThreadCount>
 inline void RadixSort256::SortYWithKey( ThreadPool& pool, uint64* input, uint64* tmp, uint32* keyInput, uint32* keyTmp, uint64 length )
@@ -103,8 +116,7 @@ void inline RadixSort256::DoSort( ThreadPool& pool, T1* input, T1* tmp, TK* keyI
     uint64 counts    [ThreadCount*256]; 
     uint64 prefixSums[ThreadCount*256]; 
 
-    std::atomic<uint> finishedCount = 0;
-    std::atomic<uint> releaseLock   = 0;
+    Barrier barrier( threadCount );
     SortJob<T1, TK> jobs[ThreadCount];
     
     for( uint i = 0; i < threadCount; i++ )
@@ -113,8 +125,7 @@ void inline RadixSort256::DoSort( ThreadPool& pool, T1* input, T1* tmp, TK* keyI
 
         job.id            = i;
         job.threadCount   = threadCount;
-        job.finishedCount = &finishedCount;
-        job.releaseLock   = &releaseLock;
+        job.barrier       = &barrier;
         job.counts        = counts;
         job.pfxSums       = prefixSums;
         job.startIndex    = i * entriesPerThread;
@@ -148,10 +159,9 @@ void RadixSort256::RadixSortThread( SortJob<T1, T2>* job )
     
     uint32 shift = 0;
 
-    const uint         id            = job->id;
-    const uint         threadCount   = job->threadCount;
-    std::atomic<uint>& finishedCount = *job->finishedCount;
-    std::atomic<uint>& releaseLock   = *job->releaseLock;
+    const uint   id          = job->id;
+    const uint   threadCount = job->threadCount;
+    Barrier&     barrier     = *job->barrier;
 
     uint64*      counts    = job->counts  + id * Radix;
     uint64*      prefixSum = job->pfxSums + id * Radix;
@@ -186,14 +196,9 @@ void RadixSort256::RadixSortThread( SortJob<T1, T2>* job )
         for( uint64 i = 0; i < length; i++ )
             counts[(src[i] >> shift) & 0xFF]++;
         
-        // Synchronize with other threads to comput the correct prefix sum
-        if( id == 0 )
-        {
-            // This is the control thread, it is in charge of computing the shared prefix sums.
+        // Synchronize with other threads to compute the correct prefix sum
+        barrier.Wait( [=]() {
             
-            // Wait for all threads to finish
-            while( finishedCount.load( std::memory_order_relaxed ) != threadCount-1 );
-
             uint64* allCounts  = job->counts;
             uint64* allPfxSums = job->pfxSums;
 
@@ -201,8 +206,8 @@ void RadixSort256::RadixSortThread( SortJob<T1, T2>* job )
             // it does not require a second pass
             uint64* prefixSumBuffer = allPfxSums + (threadCount - 1) * Radix;
 
-            // First sum all the counts. Start by copying ours to the last
-            memcpy( prefixSumBuffer, counts, sizeof( uint64 ) * Radix );
+            // First sum all the counts. Start by copying the first thread's to the last
+            memcpy( prefixSumBuffer, allCounts, sizeof( uint64 ) * Radix );
 
             // Now add the rest of the thread's counts
             for( uint i = 1; i < threadCount; i++ )
@@ -235,27 +240,7 @@ void RadixSort256::RadixSortThread( SortJob<T1, T2>* job )
                 prefixSumBuffer       = tPrefixSum;
                 nextThreadCountBuffer -= Radix;
             }
-
-            // Finished, init release lock & signal other threads
-            releaseLock  .store( 0, std::memory_order_release );
-            finishedCount.store( 0, std::memory_order_release );
-        }
-        else
-        {
-            // Signal we've finished so we can calculate the shared prefix sum
-            uint count = finishedCount.load( std::memory_order_acquire );
-
-            while( !finishedCount.compare_exchange_weak( count, count+1, std::memory_order_release, std::memory_order_relaxed ) );
-            
-            // Wait for the control thread (id == 0 ) to signal us so
-            // that we can continue working.
-            while( finishedCount.load( std::memory_order_relaxed ) != 0 );
-
-            // Ensure all threads have been released
-            count = releaseLock.load( std::memory_order_acquire );
-            while( !releaseLock.compare_exchange_weak( count, count+1, std::memory_order_release, std::memory_order_relaxed ) );
-            while( releaseLock.load( std::memory_order_relaxed ) != threadCount-1 );
-        }
+        });
         
         // Populate output array (access input in reverse now)
         // This writes to the whole output array, not just our section.
@@ -292,32 +277,7 @@ void RadixSort256::RadixSortThread( SortJob<T1, T2>* job )
         // If not the last iteration, signal we've finished so we can
         // safely read from the arrays after swapped. (all threads must finish writing)
         if( (iter+1) < iterations )
-        {
-            if( id == 0 )
-            {
-                // Wait for all threads
-                while( finishedCount.load( std::memory_order_relaxed ) != (threadCount-1) );
-                
-                // Finished, init release lock & signal other threads
-                releaseLock  .store( 0, std::memory_order_release );
-                finishedCount.store( 0, std::memory_order_release );
-            }
-            else
-            {
-                // Signal control thread
-                uint count = finishedCount.load( std::memory_order_acquire );
-
-                while( !finishedCount.compare_exchange_weak( count, count+1, std::memory_order_release, std::memory_order_relaxed ) );
-
-                // Wait for control thread to signal us
-                while( finishedCount.load( std::memory_order_relaxed ) != 0 );
-
-                // Ensure all threads have been released
-                count = releaseLock.load( std::memory_order_acquire );
-                while( !releaseLock.compare_exchange_weak( count, count+1, std::memory_order_release, std::memory_order_relaxed ) );
-                while( releaseLock.load( std::memory_order_relaxed ) != threadCount-1 );
-            }
-        }
+            barrier.Wait();
     }
 }
 
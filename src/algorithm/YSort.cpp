@@ -1,6 +1,7 @@
 #include "YSort.h"
 #include "SysHost.h"
 #include "threading/ThreadPool.h"
+#include "threading/Barrier.h"
 #include "Util.h"
 #include "util/Log.h"
 #include "Config.h"
@@ -12,8 +13,7 @@ struct SortYBaseJob
 {
     JobT* jobs;
 
-    std::atomic<uint>* finishedCount;
-    std::atomic<uint>* releaseLock;
+    Barrier* barrier;
 
     // #TODO: Convert these to a pointer of pointers so that we don't have to
     //        load to iterate on the job struct itself, which is really heavy,
@@ -28,10 +28,7 @@ protected:
     template<uint Radix, typename TPrefix>
     void CalculatePrefixSum( uint id, uint32* counts, TPrefix* pfxSum );
 
-    void SyncThreads();
-    void LockThreads();
-    void ReleaseThreads();
-
+    inline void SyncThreads() { barrier->Wait(); }
 };
 
 struct SortYJob : SortYBaseJob<SortYJob>
@@ -68,8 +65,7 @@ struct NumaSortJob
     uint pageStart;
     uint trailers;
 
-    std::atomic<uint>* finishedCount;
-    std::atomic<uint>* releaseLock;
+    Barrier* barrier;
 
     byte* pages;
     byte* tmpPages;
@@ -128,16 +124,14 @@ void YSorter::DoSort( bool useSortKey, uint64 length,
 
     SortYJob jobs[MAX_THREADS];
 
-    std::atomic<uint> finishedCount = 0;
-    std::atomic<uint> releaseLock   = 0;
+    Barrier barrier( threadCount );
 
     for( uint i = 0; i < MAX_THREADS; i++ )
     {
         SortYJob& job = jobs[i];
 
         job.jobs          = jobs;
-        job.finishedCount = &finishedCount;
-        job.releaseLock   = &releaseLock;
+        job.barrier       = &barrier;
         job.length        = length;
         job.counts        = nullptr;
         job.pfxSum        = nullptr;
@@ -448,63 +442,5 @@ FORCE_INLINE void SortYBaseJob<JobT>::CalculatePrefixSum( uint id, uint32* count
     }
 }
 
-//-----------------------------------------------------------
-template<typename JobT>
-FORCE_INLINE void SortYBaseJob<JobT>::SyncThreads()
-{
-    auto& finishedCount        = *this->finishedCount;
-    auto& releaseLock          = *this->releaseLock;
-    const uint threadThreshold = this->threadCount - 1;
-
-    // Reset the release lock
-    if( id == 0 ) 
-    {
-        // Wait for all threads to finish
-        while( finishedCount.load( std::memory_order_relaxed ) != threadThreshold );
-
-        // Finished, initialize release lock & signal other threads
-        releaseLock  .store( 0, std::memory_order_release );
-        finishedCount.store( 0, std::memory_order_release );
-    }
-    else
-    {
-        // Signal we've finished so we can calculate the shared prefix sum
-        uint count = finishedCount.load( std::memory_order_acquire );
-
-        while( !finishedCount.compare_exchange_weak( count, count+1, std::memory_order_release, std::memory_order_relaxed ) );
-        
-        // Wait for the control thread (id == 0 ) to signal us
-        while( finishedCount.load( std::memory_order_relaxed ) != 0 );
-
-        // Ensure all threads have been released
-        count = releaseLock.load( std::memory_order_acquire );
-        while( !releaseLock.compare_exchange_weak( count, count+1, std::memory_order_release, std::memory_order_relaxed ) );
-        while( releaseLock.load( std::memory_order_relaxed ) != threadThreshold );
-    }
-}
-
-//-----------------------------------------------------------
-template<typename JobT>
-FORCE_INLINE void SortYBaseJob<JobT>::LockThreads()
-{
-    auto& finishedCount        = *this->finishedCount;
-    const uint threadThreshold = this->threadCount - 1;
-    
-    // Wait for all threads to finish
-    while( finishedCount.load( std::memory_order_relaxed ) != threadThreshold );
-}
-
-//-----------------------------------------------------------
-template<typename JobT>
-FORCE_INLINE void SortYBaseJob<JobT>::ReleaseThreads()
-{
-    auto& finishedCount = *this->finishedCount;
-    auto& releaseLock   = *this->releaseLock;
-
-    // Finished, init release lock & signal other threads
-    releaseLock  .store( 0, std::memory_order_release );
-    finishedCount.store( 0, std::memory_order_release );
-}
-
 #pragma GCC diagnostic pop
 
@@ -0,0 +1,531 @@
+#include "PhaseBench.h"
+#include "memplot/MemPhase1.h"
+#include "memplot/MemPhase2.h"
+#include "memplot/MemPhase4.h"
+#include "memplot/LPGen.h"
+#include "memplot/ParkWriter.h"
+#include "algorithm/YSort.h"
+#include "algorithm/RadixSort.h"
+#include "SysHost.h"
+#include "Util.h"
+#include "util/Log.h"
+#include <cmath>
+#include <limits>
+
+static void*  BenchAlloc( size_t size );
+static uint64 NextRandom( uint64& state );
+
+template<typename TFunc>
+static void ParallelRandom( ThreadPool& pool, uint64 count, uint64 seed, const TFunc& func );
+
+static void   ParallelCopy( ThreadPool& pool, void* dst, const void* src, size_t size );
+static uint64 LPChunkSize( uint64 entryCount );
+
+//-----------------------------------------------------------
+PhaseBench::PhaseBench( ThreadPool& pool, const BenchConfig& cfg )
+    : _pool( pool )
+    , _cfg ( cfg  )
+{
+    // Whole parks keep the park and checkpoint writers on their fast paths
+    const uint64 n = RoundUpToNextBoundary( std::max( cfg.entryCount, (uint64)kEntriesPerPark ), kEntriesPerPark );
+    _entryCount = n;
+
+    #if PLATFORM_IS_WINDOWS
+        _nullStream = fopen( "NUL", "w" );
+    #else
+        _nullStream = fopen( "/dev/null", "w" );
+    #endif
+
+    if( !_nullStream )
+        Fatal( "Failed to open the null device." );
+
+    const size_t chachaBlockSize = kF1BlockSizeBits / 8;
+
+    _y          = (uint64*)BenchAlloc( n * sizeof( uint64 ) );
+    _pairs      = (Pair*  )BenchAlloc( n * 2 * sizeof( Pair ) );
+    _meta       = (byte*  )BenchAlloc( n * 16 );
+    _x          = (uint32*)BenchAlloc( n * sizeof( uint32 ) );
+    _marks      = (byte*  )BenchAlloc( n );
+    _linePoints = (uint64*)BenchAlloc( n * sizeof( uint64 ) );
+    _f7         = (uint32*)BenchAlloc( n * sizeof( uint32 ) );
+
+    _bufferA    = (uint64*)BenchAlloc( n * sizeof( uint64 ) + chachaBlockSize );
+    _bufferB    = (uint64*)BenchAlloc( n * sizeof( uint64 ) );
+    _pairsTmp   = (Pair*  )BenchAlloc( n * 2 * sizeof( Pair ) );
+    _map        = (uint32*)BenchAlloc( n * 2 * sizeof( uint32 ) );
+    _marksOut   = (byte*  )BenchAlloc( n );
+
+    // Phase kernels get their threads and buffer sizes from the context
+    ZeroMem( &_cx );
+    _cx.threadCount  = pool.ThreadCount();
+    _cx.threadPool   = &pool;
+    _cx.maxKBCGroups = n * sizeof( uint64 ) / sizeof( uint32 );  // Group boundaries go in buffer B
+    _cx.maxPairs     = n * 2;                                     // Pairs are first written to _pairsTmp
+}
+
+//-----------------------------------------------------------
+PhaseBench::~PhaseBench()
+{
+    void* buffers[] = { _y, _pairs, _meta, _x, _marks, _linePoints, _f7,
+                        _bufferA, _bufferB, _pairsTmp, _map, _marksOut };
+
+    for( void* buffer : buffers )
+        SysHost::VirtualFree( buffer );
+
+    fclose( _nullStream );
+}
+
+//-----------------------------------------------------------
+void PhaseBench::Run()
+{
+    Log::Line( "%-24s %12s %10s %10s %12s %9s", "Benchmark", "Entries", "Best (s)", "Mean (s)", "M entries/s", "GB/s" );
+
+    // F1 overwrites the x values, so it runs before the tables are generated
+    BenchF1();
+
+    GenerateTables();
+    BenchSorts();
+
+    PreparePairs();
+    BenchPairing();
+    BenchFx();
+
+    BenchMarking();
+    BenchLinePoints();
+    BenchParks();
+    BenchCheckpoints();
+}
+
+//-----------------------------------------------------------
+template<typename TSetup, typename TRun>
+void PhaseBench::Measure( const char* name, const TSetup& setup, const TRun& run )
+{
+    if( !IsSelected( name ) )
+        return;
+
+    double best  = std::numeric_limits<double>::max();
+    double total = 0;
+    Work   work  = {};
+
+    for( uint i = 0; i < _cfg.iterations; i++ )
+    {
+        // Kernels log their progress, which would drown the results
+        Log::SetOutStream( _nullStream );
+
+        setup();
+
+        // TimerEnd() only has millisecond resolution
+        auto timer = TimerBegin();
+        work = run();
+        double elapsed = std::chrono::duration<double>( TimerBegin() - timer ).count();
+
+        Log::SetOutStream( nullptr );
+
+        if( work.seconds > 0 )
+            elapsed = work.seconds;
+
+        best   = std::min( best, elapsed );
+        total += elapsed;
+    }
+
+    best = std::max( best, 1e-9 );
+
+    Log::Line( "%-24s %12llu %10.4lf %10.4lf %12.2lf %9.2lf", name, work.entries, best, total / _cfg.iterations,
+        work.entries / best / 1e6, work.bytes / best / 1e9 );
+}
+
+//-----------------------------------------------------------
+bool PhaseBench::IsSelected( const char* name ) const
+{
+    if( _cfg.filterCount == 0 )
+        return true;
+
+    for( uint i = 0; i < _cfg.filterCount; i++ )
+    {
+        if( strstr( name, _cfg.filters[i] ) )
+            return true;
+    }
+
+    return false;
+}
+
+//-----------------------------------------------------------
+void PhaseBench::GenerateTables()
+{
+    const uint64 n = _entryCount;
+
+    // y spans kExtraBits more bits than the entry count, like in a real table,
+    // so that kBC groups hold as many entries and yield as many pairs.
+    const uint64 yRange = n << kExtraBits;
+
+    ParallelRandom( _pool, n, 1, [=]( uint64 i, uint64 r ) { _y[i] = r % yRange; } );
+    ParallelRandom( _pool, n, 2, [=]( uint64 i, uint64 r ) { _x[i] = (uint32)( r & ( ( 1ull << _K ) - 1 ) ); } );
+    ParallelRandom( _pool, n, 3, [=]( uint64 i, uint64 r ) { _marks[i] = ( r % 10 ) < 8 ? 1 : 0; } );
+
+    ParallelRandom( _pool, n * 2, 4, [=]( uint64 i, uint64 r ) { ((uint64*)_meta)[i] = r; } );
+
+    // Line points of a pruned table are spread over 2k-1 bits,
+    // so the gap between them averages 2^(k-1) / 0.8.
+    {
+        const double meanGap = (double)( 1ull << ( _K - 1 ) ) * 1.25;
+
+        uint64 state = 5;
+        uint64 lp    = 0;
+
+        for( uint64 i = 0; i < n; i++ )
+        {
+            const double u = ( NextRandom( state ) >> 11 ) * ( 1.0 / ( 1ull << 53 ) );
+            lp += 1 + (uint64)( -std::log( 1.0 - u ) * meanGap );
+            _linePoints[i] = lp;
+        }
+    }
+
+    // There are about as many f7 values as 32-bit values
+    {
+        uint64 state = 6;
+        uint32 f7    = 0;
+
+        for( uint64 i = 0; i < n; i++ )
+        {
+            f7 += (uint32)( NextRandom( state ) % 3 );
+            _f7[i] = f7;
+        }
+    }
+}
+
+//-----------------------------------------------------------
+void PhaseBench::PreparePairs()
+{
+    MemPhase1 phase1( _cx );
+    kBCJob    jobs[MAX_THREADS];
+
+    Log::SetOutStream( _nullStream );
+
+    const uint64 groupCount = phase1.FpScan( _entryCount, _y, (uint32*)_bufferB, jobs );
+    const uint64 pairCount  = phase1.FpPair( _y, jobs, groupCount, _pairsTmp, _pairs );
+
+    Log::SetOutStream( nullptr );
+
+    // The later kernels index their entries with the pairs
+    _pairCount = std::min( pairCount, _entryCount );
+}
+
+//-----------------------------------------------------------
+void PhaseBench::BenchF1()
+{
+    const uint64 n = _entryCount;
+
+    static const byte plotId[32] = { 0x0b, 0x1a, 0xde, 0xb1, 0x70 };
+
+    MemPlotContext& cx = _cx;
+    cx.plotId      = plotId;
+    cx.yBuffer0    = _bufferA;              // ChaCha blocks, then the sorted y
+    cx.metaBuffer1 = (uint64*)_pairsTmp;    // Unsorted y and x
+    cx.t1XBuffer   = _x;
+
+    MemPhase1 phase1( cx );
+
+    // F1 sorts its entries as well, which YSorter::Sort (key) measures
+    Measure( "F1 (ChaCha8)", [](){}, [&]() {
+        phase1.GenerateF1( n );
+        return Work{ n, n * ( sizeof( uint64 ) + sizeof( uint32 ) ), cx.stats.f1Seconds };
+    });
+}
+
+//-----------------------------------------------------------
+void PhaseBench::BenchSorts()
+{
+    const uint64 n = _entryCount;
+
+    YSorter sorter( _pool );
+
+    auto seqKey = [=]() {
+        _pool.ParallelFor( n, 64 * 1024, [=]( uint64 start, uint64 end, uint ) {
+            for( uint64 i = start; i < end; i++ )
+                _map[i] = (uint32)i;
+        });
+    };
+
+    Measure( "YSorter::Sort",
+        [=]() { ParallelCopy( _pool, _bufferA, _y, n * sizeof( uint64 ) ); },
+        [&]() {
+            sorter.Sort( n, _bufferA, _bufferB );
+            return Work{ n, n * sizeof( uint64 ) * 2 };
+        });
+
+    Measure( "YSorter::Sort (key)",
+        [=]() { ParallelCopy( _pool, _bufferA, _y, n * sizeof( uint64 ) ); seqKey(); },
+        [&]() {
+            sorter.Sort( n, _bufferA, _bufferB, _map, _map + n );
+            return Work{ n, n * ( sizeof( uint64 ) + sizeof( uint32 ) ) * 2 };
+        });
+
+    uint32* values = (uint32*)_bufferA;
+
+    Measure( "RadixSort (u32, key)",
+        [=]() { ParallelCopy( _pool, values, _x, n * sizeof( uint32 ) ); seqKey(); },
+        [&]() {
+            RadixSort256::SortWithKey<MAX_THREADS>( _pool, values, values + n, _map, _map + n, n );
+            return Work{ n, n * sizeof( uint32 ) * 2 * 2 };
+        });
+
+    // Phase 3's line point sort
+    Measure( "RadixSort (u64, key)",
+        [=]() {
+            ParallelRandom( _pool, n, 7, [=]( uint64 i, uint64 r ) { _bufferA[i] = r >> 1; } );
+            seqKey();
+        },
+        [&]() {
+            RadixSort256::SortWithKey<MAX_THREADS>( _pool, _bufferA, _bufferB, _map, _map + n, n );
+            return Work{ n, n * ( sizeof( uint64 ) + sizeof( uint32 ) ) * 2 };
+        });
+
+    // The sorted y values are the input of the other Phase 1 kernels.
+    // The sort ends in the temporary buffer.
+    sorter.Sort( n, _y, _bufferA );
+    ParallelCopy( _pool, _y, _bufferA, n * sizeof( uint64 ) );
+}
+
+//-----------------------------------------------------------
+void PhaseBench::BenchPairing()
+{
+    const uint64 n = _entryCount;
+
+    MemPhase1 phase1( _cx );
+    kBCJob    jobs[MAX_THREADS];
+
+    uint32* groupBoundaries = (uint32*)_bufferB;
+    uint64  groupCount      = 0;
+
+    Measure( "FpScan", [](){}, [&]() {
+        groupCount = phase1.FpScan( n, _y, groupBoundaries, jobs );
+        return Work{ n, n * sizeof( uint64 ) + groupCount * sizeof( uint32 ) };
+    });
+
+    Measure( "FpPair",
+        [&]() { groupCount = phase1.FpScan( n, _y, groupBoundaries, jobs ); },
+        [&]() {
+            const uint64 pairCount = phase1.FpPair( _y, jobs, groupCount, _pairsTmp, _pairs );
+
+            // Pairs are written to a temporary buffer, then copied to their final location
+            return Work{ n, n * sizeof( uint64 ) + pairCount * sizeof( Pair ) * 3 };
+        });
+}
+
+//-----------------------------------------------------------
+void PhaseBench::BenchFx()
+{
+    BenchFxTable<TableId::Table2>( "Fx table 2" );
+    BenchFxTable<TableId::Table3>( "Fx table 3" );
+    BenchFxTable<TableId::Table4>( "Fx table 4" );
+    BenchFxTable<TableId::Table5>( "Fx table 5" );
+    BenchFxTable<TableId::Table6>( "Fx table 6" );
+    BenchFxTable<TableId::Table7>( "Fx table 7" );
+}
+
+//-----------------------------------------------------------
+template<TableId table>
+void PhaseBench::BenchFxTable( const char* name )
+{
+    using TMetaIn  = typename TableMetaType<table>::MetaIn;
+    using TMetaOut = typename TableMetaType<table>::MetaOut;
+    using TYOut    = typename YOut<table>::Type;
+
+    const uint64 count = _pairCount;
+
+    // Metadata holds multiples of k bits
+    const size_t metaInSize  = SizeForMeta<TMetaIn >::Value * sizeof( uint32 );
+    const size_t metaOutSize = SizeForMeta<TMetaOut>::Value * sizeof( uint32 );
+
+    // Each pair reads the y and metadata of 2 entries
+    const size_t entrySize = sizeof( Pair ) + ( sizeof( uint64 ) + metaInSize ) * 2 + metaOutSize + sizeof( TYOut );
+
+    MemPhase1 phase1( _cx );
+
+    Measure( name, [](){}, [&]() {
+        phase1.FpComputeFx<table, TMetaIn, TMetaOut>( count, _pairs, (const TMetaIn*)_meta, _y,
+                                                      (TMetaOut*)_pairsTmp, _bufferA );
+        return Work{ count, count * entrySize };
+    });
+}
+
+//-----------------------------------------------------------
+void PhaseBench::BenchMarking()
+{
+    const uint64 n     = _entryCount;
+    const uint64 count = _pairCount;
+
+    MemPhase2 phase2( _cx );
+
+    Measure( "MarkTable",
+        [=]() { memset( _marksOut, 0, n ); },
+        [&]() {
+            phase2.MarkTable<true>( (const Pair*)_pairs, count, _marks, _marksOut );
+            return Work{ count, count * ( sizeof( Pair ) + 1 ) + n };
+        });
+}
+
+//-----------------------------------------------------------
+void PhaseBench::BenchLinePoints()
+{
+    const uint64 n     = _entryCount;
+    const uint64 count = _pairCount;
+
+    LPJob job;
+    ZeroMem( &job );
+    job.lTable        = _x;
+    job.rTable        = _pairs;
+    job.lpBuffer      = _bufferA;
+    job.markedEntries = _marks;
+    job.map           = _map;
+
+    // Same chunking as Phase 3
+    const uint64 MAX_CHUNKS      = 4096;
+    const uint64 entriesPerChunk = LPChunkSize( count );
+    const uint64 chunkCount      = CDiv( count, (int)entriesPerChunk );
+
+    uint64 chunkCounts [MAX_CHUNKS];
+    uint64 chunkOffsets[MAX_CHUNKS];
+
+    uint64 newLength = 0;
+
+    Measure( "LP convert", [](){}, [&]() {
+
+        _pool.ParallelFor( count, entriesPerChunk, [&]( uint64 start, uint64 end, uint ) {
+            chunkCounts[start / entriesPerChunk] = CountMarkedEntries( _marks, start, end );
+        });
+
+        newLength = 0;
+        for( uint64 i = 0; i < chunkCount; i++ )
+        {
+            chunkOffsets[i] = newLength;
+            newLength += chunkCounts[i];
+        }
+
+        _pool.ParallelFor( count, entriesPerChunk, [&]( uint64 start, uint64 end, uint ) {
+
+            const uint64 chunk = start / entriesPerChunk;
+
+            PruneAndMap<false>( job, start, end, chunkOffsets[chunk] );
+            ConvertToLinePoints( job, chunkOffsets[chunk], chunkOffsets[chunk] + chunkCounts[chunk] );
+        });
+
+        // Marks and pairs are read, the kept pairs are copied along with their index,
+        // and then converted in place using 2 x values each.
+        return Work{ count, count * ( 1 + sizeof( Pair ) ) +
+                            newLength * ( sizeof( Pair ) * 2 + sizeof( uint32 ) * 3 + sizeof( uint64 ) ) };
+    });
+
+    // Scatter the final index of each entry to its original index
+    job.lTable = (uint32*)_bufferB;
+
+    const uint64 lookupCount = newLength ? newLength : count;
+    const uint64 lookupChunk = LPChunkSize( lookupCount );
+
+    Measure( "Lookup table",
+        [&]() { ParallelRandom( _pool, lookupCount, 8, [=]( uint64 i, uint64 r ) { _map[i] = (uint32)( r % n ); } ); },
+        [&]() {
+            _pool.ParallelFor( lookupCount, lookupChunk, [&]( uint64 start, uint64 end, uint ) {
+                WriteLookupTable( job, start, end );
+            });
+
+            return Work{ lookupCount, lookupCount * sizeof( uint32 ) * 2 };
+        });
+
+    // Same, grouping the entries by region of the lookup table first
+    Measure( "Lookup table by region",
+        [&]() { ParallelRandom( _pool, lookupCount, 8, [=]( uint64 i, uint64 r ) { _map[i] = (uint32)( r % n ); } ); },
+        [&]() {
+            WriteLookupTableByRegion( _pool, job, lookupCount, (uint64*)_pairsTmp, (uint64*)_map );
+
+            // The packed entries are written and read once per sort pass, plus the packing and the scatter
+            return Work{ lookupCount, lookupCount * ( sizeof( uint32 ) * 2 + sizeof( uint64 ) * 6 ) };
+        });
+}
+
+//-----------------------------------------------------------
+void PhaseBench::BenchParks()
+{
+    const uint64 n = _entryCount;
+
+    Measure( "WriteParks",
+        [=]() { ParallelCopy( _pool, _bufferA, _linePoints, n * sizeof( uint64 ) ); },
+        [&]() {
+            const size_t size = WriteParks( _pool, n, _bufferA, (byte*)_bufferB, TableId::Table1 );
+            return Work{ n, n * sizeof( uint64 ) + size };
+        });
+}
+
+//-----------------------------------------------------------
+void PhaseBench::BenchCheckpoints()
+{
+    const uint64 n = _entryCount;
+
+    size_t sizes[4];
+    GetP4TableSizes( n, sizes );
+
+    P4Tables tables;
+    tables.p7 = (byte*)_bufferB;
+    tables.c1 = (uint32*)( tables.p7 + sizes[0] );
+    tables.c2 = (uint32*)( ((byte*)tables.c1) + sizes[1] );
+    tables.c3 = ((byte*)tables.c2) + sizes[2];
+
+    // C3 converts the f7 values to deltas in place
+    uint32* f7 = (uint32*)_bufferA;
+
+    Measure( "P7-C3",
+        [=]() { ParallelCopy( _pool, f7, _f7, n * sizeof( uint32 ) ); },
+        [&]() {
+            WriteP4Parallel<MAX_THREADS>( _pool, n, _x, f7, tables );
+            return Work{ n, n * sizeof( uint32 ) * 2 + sizes[0] + sizes[1] + sizes[2] + sizes[3] };
+        });
+}
+
+//-----------------------------------------------------------
+void* BenchAlloc( size_t size )
+{
+    void* buffer = SysHost::VirtualAlloc( size, true );
+    if( !buffer )
+        Fatal( "Failed to allocate %llu MiB for the benchmark tables.", (uint64)( size BtoMB ) );
+
+    return buffer;
+}
+
+// SplitMix64
+//-----------------------------------------------------------
+inline uint64 NextRandom( uint64& state )
+{
+    uint64 z = ( state += 0x9E3779B97F4A7C15ull );
+    z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ull;
+    z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBull;
+    return z ^ ( z >> 31 );
+}
+
+// Calls func( index, randomValue ) for each index in [0, count).
+// The values only depend on the seed, not on the thread count.
+//-----------------------------------------------------------
+template<typename TFunc>
+void ParallelRandom( ThreadPool& pool, uint64 count, uint64 seed, const TFunc& func )
+{
+    pool.ParallelFor( count, 64 * 1024, [&]( uint64 start, uint64 end, uint ) {
+
+        uint64 state = seed * 0xD1B54A32D192ED03ull + start;
+
+        for( uint64 i = start; i < end; i++ )
+            func( i, NextRandom( state ) );
+    });
+}
+
+//-----------------------------------------------------------
+void ParallelCopy( ThreadPool& pool, void* dst, const void* src, size_t size )
+{
+    pool.ParallelFor( size, 4 MB, [=]( uint64 start, uint64 end, uint ) {
+        memcpy( (byte*)dst + start, (const byte*)src + start, end - start );
+    });
+}
+
+//-----------------------------------------------------------
+uint64 LPChunkSize( uint64 entryCount )
+{
+    return std::max( ( entryCount + 4095 ) / 4096, (uint64)( 64 * 1024 ) );
+}
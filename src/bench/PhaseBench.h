@@ -0,0 +1,83 @@
+#pragma once
+#include "PlotContext.h"
+
+struct BenchConfig
+{
+    uint64       entryCount;    // Entries in each synthetic table
+    uint         iterations;    // Runs of each benchmark
+    const char** filters;       // If set, only run the benchmarks whose name contains one of these
+    uint         filterCount;
+};
+
+/**
+ * Micro-benchmarks of the kernels of each phase, run on synthetic tables
+ * with the same value distributions as the tables of a k32 plot.
+ *
+ * Each benchmark runs its kernel on the same input a number of times, restoring
+ * the input before each run, and reports its fastest run as entries per second
+ * and GB per second. GB/s counts each of the kernel's input and output streams once,
+ * so it's a lower bound of the memory bandwidth used.
+ */
+class PhaseBench
+{
+public:
+    PhaseBench( ThreadPool& pool, const BenchConfig& cfg );
+    ~PhaseBench();
+
+    void Run();
+
+private:
+    // Work done by a run of a kernel
+    struct Work
+    {
+        uint64 entries;
+        uint64 bytes;
+        double seconds;     // If set, the time reported by the kernel itself
+    };
+
+    template<typename TSetup, typename TRun>
+    void Measure( const char* name, const TSetup& setup, const TRun& run );
+
+    bool IsSelected( const char* name ) const;
+
+    void GenerateTables();
+    void PreparePairs();
+
+    void BenchF1();
+    void BenchSorts();
+    void BenchPairing();
+    void BenchFx();
+    void BenchMarking();
+    void BenchLinePoints();
+    void BenchParks();
+    void BenchCheckpoints();
+
+    template<TableId table>
+    void BenchFxTable( const char* name );
+
+private:
+    ThreadPool&    _pool;
+    BenchConfig    _cfg;
+    FILE*          _nullStream = nullptr;
+
+    MemPlotContext _cx;
+
+    // Synthetic tables
+    uint64  _entryCount;
+    uint64  _pairCount = 0;
+
+    uint64* _y;             // y values, sorted after BenchSorts()
+    Pair*   _pairs;         // Pairs found in _y
+    byte*   _meta;          // Random metadata for every entry
+    uint32* _x;             // Random k-bit values
+    byte*   _marks;         // Random marks, about 80% set
+    uint64* _linePoints;    // Sorted line points
+    uint32* _f7;            // Sorted f7 values
+
+    // Scratch buffers
+    uint64* _bufferA;       // 8 bytes per entry, plus a ChaCha block
+    uint64* _bufferB;       // 8 bytes per entry
+    Pair*   _pairsTmp;      // 16 bytes per entry
+    uint32* _map;           // 8 bytes per entry
+    byte*   _marksOut;      // 1 byte per entry
+};
@@ -0,0 +1,145 @@
+#include "PhaseBench.h"
+#include "threading/ThreadPool.h"
+#include "SysHost.h"
+#include "Util.h"
+#include "util/Log.h"
+#include "Config.h"
+
+//-----------------------------------------------------------
+const char* USAGE = "bladebit_bench [<OPTIONS>] [<benchmark>...]\n"
+R"(
+<benchmark>: Only run the benchmarks whose name contains one of these.
+             For example: bladebit_bench "Fx table" Sort
+
+OPTIONS:
+
+ -h, --help           : Shows this message and exits.
+
+ -t, --threads        : Maximum number of threads to use.
+                        For best performance, use all available threads (default behavior).
+                        Values below 2 are not recommended.
+
+ -n, --entries        : Number of entries in each synthetic table.
+                        Accepts a K, M or G suffix (powers of 2). Default: 16M.
+                        About 100 bytes of memory are used per entry.
+
+ -i, --iterations     : Number of runs of each benchmark. The fastest one is reported.
+                        Default: 3.
+
+ --no-cpu-affinity    : Disable assigning automatically thread affinity.
+)";
+
+//-----------------------------------------------------------
+static void PrintUsage()
+{
+    fputs( USAGE, stdout );
+    fflush( stdout );
+}
+
+//-----------------------------------------------------------
+int main( int argc, const char* argv[] )
+{
+    uint   threadCount   = 0;
+    uint64 entryCount    = 16ull << 20;
+    uint   iterations    = 3;
+    bool   noCpuAffinity = false;
+
+    const char* filters[64];
+    uint        filterCount = 0;
+
+    for( int i = 1; i < argc; i++ )
+    {
+        const char* arg = argv[i];
+
+        auto check = [&]( const char* name ) {
+            return strcmp( arg, name ) == 0;
+        };
+
+        auto value = [&]() {
+            if( ++i >= argc )
+                Fatal( "Expected a value for argument '%s'.", arg );
+
+            return argv[i];
+        };
+
+        auto uvalue = [&]() {
+
+            const char* val = value();
+
+            char   suffix = 0;
+            uint64 v      = 0;
+            if( sscanf( val, "%llu%c", &v, &suffix ) < 1 )
+                Fatal( "Invalid value for argument '%s'.", arg );
+
+            switch( suffix )
+            {
+                case 0  :            break;
+                case 'k':
+                case 'K': v <<= 10; break;
+                case 'm':
+                case 'M': v <<= 20; break;
+                case 'g':
+                case 'G': v <<= 30; break;
+                default :
+                    Fatal( "Invalid value for argument '%s'.", arg );
+            }
+
+            return v;
+        };
+
+        if( check( "-h" ) || check( "--help" ) )
+        {
+            PrintUsage();
+            return 0;
+        }
+        else if( check( "-t" ) || check( "--threads" ) )
+            threadCount = (uint)uvalue();
+        else if( check( "-n" ) || check( "--entries" ) )
+            entryCount = uvalue();
+        else if( check( "-i" ) || check( "--iterations" ) )
+            iterations = (uint)uvalue();
+        else if( check( "--no-cpu-affinity" ) )
+            noCpuAffinity = true;
+        else if( arg[0] == '-' )
+            Fatal( "Unexpected argument '%s'.", arg );
+        else
+        {
+            if( filterCount == sizeof( filters ) / sizeof( filters[0] ) )
+                Fatal( "Too many benchmark names." );
+
+            filters[filterCount++] = arg;
+        }
+    }
+
+    const uint cpuCount = SysHost::GetLogicalCPUCount();
+    if( threadCount == 0 || threadCount > cpuCount )
+        threadCount = cpuCount;
+
+    threadCount = std::min( threadCount, (uint)MAX_THREADS );
+
+    // Pair indices and f7 values are 32 bits
+    if( entryCount < 1 || entryCount > 1ull << _K )
+        Fatal( "The entry count must be between 1 and %llu.", 1ull << _K );
+
+    if( iterations < 1 )
+        iterations = 1;
+
+    Log::Line( "Threads    : %u", threadCount );
+    Log::Line( "Entries    : %llu", entryCount );
+    Log::Line( "Iterations : %u", iterations );
+    Log::Line( "" );
+
+    ThreadPool pool( threadCount, ThreadPool::Mode::Fixed, noCpuAffinity );
+
+    BenchConfig cfg;
+    cfg.entryCount  = entryCount;
+    cfg.iterations  = iterations;
+    cfg.filters     = filters;
+    cfg.filterCount = filterCount;
+
+    PhaseBench bench( pool, cfg );
+    bench.Run();
+
+    Log::Flush();
+    return 0;
+}
@@ -12,9 +12,10 @@ ImplementFlagOps( FileAccess );
 
 enum class FileMode : uint16
 {
-    Open   = 0,
-    Create = 1,
-    Append = 2
+    Open         = 0,
+    Create       = 1,
+    Append       = 2,
+    OpenExisting = 3    // Fails if the file doesn't exist, on all platforms
 };
 
 enum class FileFlags : uint32
@@ -22,6 +23,7 @@ enum class FileFlags : uint32
     None        = 0,
     NoBuffering = 1 << 0,
     LargeFile   = 1 << 1,
+    Shared      = 1 << 2,   // Let other handles read and write the file while it's open
 };
 ImplementFlagOps( FileFlags );
 
@@ -51,6 +53,10 @@ public:
     bool Open( const char* path, FileMode mode, FileAccess access, FileFlags flags = FileFlags::None );
 
     ssize_t Read( void* buffer, size_t size );
+
+    // Reads at the given offset, without moving the file position.
+    // Safe to call concurrently from multiple threads.
+    ssize_t ReadAt( void* buffer, size_t size, uint64 offset );
     ssize_t Write( const void* buffer, size_t size );
 
     bool Reserve( ssize_t size );
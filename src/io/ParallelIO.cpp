@@ -0,0 +1,176 @@
+#include "ParallelIO.h"
+#include "Config.h"
+#include "FileStream.h"
+#include "threading/ThreadPool.h"
+#include "Util.h"
+
+struct ParallelIOJob
+{
+    const char* path;
+    FileFlags   flags;
+    uint64      fileOffset;
+    byte*       buffer;
+    size_t      size;
+    int         error;
+};
+
+template<bool IsWrite>
+static bool ParallelIO( ThreadPool& pool, const char* path, uint64 fileOffset, byte* buffer, size_t size, int& outError );
+
+template<bool IsWrite>
+static void ParallelIOThread( ParallelIOJob* job );
+
+//-----------------------------------------------------------
+bool ParallelWriteFile( ThreadPool& pool, const char* path, uint64 fileOffset,
+                        const void* buffer, size_t size, int& outError )
+{
+    return ParallelIO<true>( pool, path, fileOffset, (byte*)buffer, size, outError );
+}
+
+//-----------------------------------------------------------
+bool ParallelReadFile( ThreadPool& pool, const char* path, uint64 fileOffset,
+                       void* buffer, size_t size, int& outError )
+{
+    return ParallelIO<false>( pool, path, fileOffset, (byte*)buffer, size, outError );
+}
+
+//-----------------------------------------------------------
+bool CreateParallelIOFile( const char* path, uint64 size, int& outError )
+{
+    ASSERT( path );
+
+    outError = 0;
+
+    FileStream file;
+    if( !file.Open( path, FileMode::Create, FileAccess::Write, FileFlags::LargeFile ) )
+    {
+        outError = file.GetError();
+        if( !outError )
+            outError = -1;
+        return false;
+    }
+
+    // Not supported on all platforms, in which case the file grows as it's written
+    if( size )
+        file.Reserve( (ssize_t)size );
+
+    return true;
+}
+
+//-----------------------------------------------------------
+template<bool IsWrite>
+bool ParallelIO( ThreadPool& pool, const char* path, uint64 fileOffset, byte* buffer, size_t size, int& outError )
+{
+    ASSERT( path   );
+    ASSERT( buffer );
+
+    outError = 0;
+
+    if( size == 0 )
+        return true;
+
+    // Get the block size of the file
+    size_t blockSize;
+    {
+        FileStream file;
+
+        if( !file.Open( path, FileMode::OpenExisting, IsWrite ? FileAccess::Write : FileAccess::Read, FileFlags::Shared ) )
+        {
+            outError = file.GetError();
+            if( !outError )
+                outError = -1;
+            return false;
+        }
+
+        blockSize = file.BlockSize();
+    }
+
+    const bool isAligned =
+        ( (uintptr_t)buffer % blockSize ) == 0 &&
+        ( fileOffset        % blockSize ) == 0 &&
+        ( size              % blockSize ) == 0;
+
+    // Each thread opens its own handle, so they must share the file
+    const FileFlags flags = FileFlags::LargeFile | FileFlags::Shared | ( isAligned ? FileFlags::NoBuffering : FileFlags::None );
+
+    // Split in block-aligned chunks
+    const uint   threadCount = pool.ThreadCount();
+    const size_t blockCount  = CDiv( size, (int)blockSize );
+    const size_t chunkSize   = CDiv( blockCount, (int)threadCount ) * blockSize;
+
+    ParallelIOJob jobs[MAX_THREADS];
+
+    uint jobCount = 0;
+    for( size_t offset = 0; offset < size; offset += chunkSize )
+    {
+        ParallelIOJob& job = jobs[jobCount++];
+
+        job.path       = path;
+        job.flags      = flags;
+        job.fileOffset = fileOffset + offset;
+        job.buffer     = buffer + offset;
+        job.size       = std::min( chunkSize, size - offset );
+        job.error      = 0;
+    }
+
+    ASSERT( jobCount <= threadCount );
+    pool.RunJob( ParallelIOThread<IsWrite>, jobs, jobCount );
+
+    for( uint i = 0; i < jobCount; i++ )
+    {
+        if( jobs[i].error )
+        {
+            outError = jobs[i].error;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+template<bool IsWrite>
+void ParallelIOThread( ParallelIOJob* job )
+{
+    FileStream file;
+
+    const FileAccess access = IsWrite ? FileAccess::Write : FileAccess::Read;
+
+    if( !file.Open( job->path, FileMode::OpenExisting, access, job->flags ) )
+    {
+        job->error = file.GetError();
+        if( !job->error )
+            job->error = -1;
+        return;
+    }
+
+    if( !file.Seek( (int64)job->fileOffset, SeekOrigin::Begin ) )
+    {
+        job->error = file.GetError();
+        return;
+    }
+
+    byte*  buffer = job->buffer;
+    size_t size   = job->size;
+
+    while( size )
+    {
+        ssize_t r;
+        if constexpr ( IsWrite )
+            r = file.Write( buffer, size );
+        else
+            r = file.Read( buffer, size );
+
+        if( r <= 0 )
+        {
+            // Reading 0 bytes means we've hit the end of file
+            job->error = r < 0 ? file.GetError() : -1;
+            return;
+        }
+
+        ASSERT( (size_t)r <= size );
+
+        buffer += r;
+        size   -= (size_t)r;
+    }
+}
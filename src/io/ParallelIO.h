@@ -0,0 +1,26 @@
+#pragma once
+
+class ThreadPool;
+
+/**
+ * Reads or writes a large buffer from/to a file at a given offset,
+ * splitting it in block-aligned chunks across the threads of a pool.
+ * Each thread uses its own file handle.
+ *
+ * If the buffer, file offset and size are all aligned to the file's
+ * block size, the file is accessed with direct (unbuffered) I/O.
+ * Otherwise it falls back to buffered I/O.
+ *
+ * The file must exist. Files to write are created with CreateParallelIOFile() first,
+ * as the threads open them without creating or truncating them.
+ *
+ * Returns false on failure, and outError is set to the OS error code.
+ */
+bool ParallelWriteFile( ThreadPool& pool, const char* path, uint64 fileOffset,
+                        const void* buffer, size_t size, int& outError );
+
+bool ParallelReadFile( ThreadPool& pool, const char* path, uint64 fileOffset,
+                       void* buffer, size_t size, int& outError );
+
+// Creates the file, or truncates it if it exists, and reserves size bytes for it.
+bool CreateParallelIOFile( const char* path, uint64 size, int& outError );
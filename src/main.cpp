@@ -1,13 +1,25 @@
 #include <thread>
 #include <cstdlib>
 #include <string>
+#include <atomic>
 #include <thread>
 
 #include "Version.h"
 #include "Util.h"
 #include "util/Log.h"
 #include "SysHost.h"
+#include "threading/Thread.h"
+#include "threading/Semaphore.h"
 #include "memplot/MemPlotter.h"
+#include "tools/PlotValidator.h"
+#include "threading/ThreadPool.h"
+#include "memplot/MemCheckpoint.h"
+#include "memplot/MemSpill.h"
+#include "b3/blake3.h"
+
+#if PLATFORM_IS_UNIX
+    #include <dirent.h>
+#endif
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wreturn-type"
@@ -36,13 +48,15 @@ extern "C" {
 #pragma GCC diagnostic pop
 #pragma warning( pop )
 
-#define PLOT_FILE_FMT "plot-k32-%Y-%m-%d-%H-%M-"
-#define PLOT_FILE_PREFIX_LEN (sizeof("plot-k32-2021-08-05-18-55-")-1)
-#define PLOT_FILE_FMT_LEN (sizeof( "/plot-k32-2021-08-05-18-55-77a011fc20f0003c3adcc739b615041ae56351a22b690fd854ccb6726e5f43b7.plot.tmp" ))
+#define PLOT_K_STR STR( _K )
+
+#define PLOT_FILE_FMT "plot-k" PLOT_K_STR "-%Y-%m-%d-%H-%M-"
+#define PLOT_FILE_PREFIX_LEN (sizeof("plot-k" PLOT_K_STR "-2021-08-05-18-55-")-1)
+#define PLOT_FILE_FMT_LEN (sizeof( "/plot-k" PLOT_K_STR "-2021-08-05-18-55-77a011fc20f0003c3adcc739b615041ae56351a22b690fd854ccb6726e5f43b7.plot.tmp" ))
 #define PLOT_CHIA_PORT 11337
-#define PLOT_MMX_FILE_FMT "plot-mmx-k32-%Y-%m-%d-%H-%M-"
-#define PLOT_MMX_FILE_PREFIX_LEN (sizeof("plot-mmx-k32-2077-11-45-14-19-")-1)
-#define PLOT_MMX_FILE_FMT_LEN (sizeof( "/plot-mmx-k32-2077-11-45-14-19-19a011fc20f0003c3adcc739b615041ae56351a22b690fd854ccb6726e5f43b7.plot.tmp" ))
+#define PLOT_MMX_FILE_FMT "plot-mmx-k" PLOT_K_STR "-%Y-%m-%d-%H-%M-"
+#define PLOT_MMX_FILE_PREFIX_LEN (sizeof("plot-mmx-k" PLOT_K_STR "-2077-11-45-14-19-")-1)
+#define PLOT_MMX_FILE_FMT_LEN (sizeof( "/plot-mmx-k" PLOT_K_STR "-2077-11-45-14-19-19a011fc20f0003c3adcc739b615041ae56351a22b690fd854ccb6726e5f43b7.plot.tmp" ))
 #define PLOT_MMX_PORT 11337
 
 /// Internal Data Structures
@@ -53,6 +67,16 @@ struct Config
     bool            warmStart          = false;
     bool            disableNuma        = false;
     bool            disableCpuAffinity = false;
+    HugePageMode    hugePages          = HugePageMode::None;
+    bool            compactPairs       = false;
+    const char*     spillDir           = nullptr;
+    bool            overlapWrites      = false;
+    const char*     statsPath          = nullptr;
+    bool            perfCounters       = false;
+    const char*     traceDir           = nullptr;
+    bool            benchmark          = false;
+    uint64          benchmarkWriteSpeed = 0;     // In bytes per second
+    const char*     checkpointDir      = nullptr;
 
     bls::G1Element  farmerPublicKey;
     bls::G1Element* poolPublicKey      = nullptr;
@@ -66,11 +90,76 @@ struct Config
     const char*     plotMemo           = nullptr;
     bool            showMemo           = false;
     bool            isMMX              = false;
+
+    const char*     daemonDir          = nullptr;   // Spool directory to take jobs from, in daemon mode
+};
+
+struct PlotResult
+{
+    std::string plotId;
+    std::string path;
+    bool        success;
+    double      setupSeconds;
+    double      plotSeconds;
+};
+
+// A plot job read from the daemon's spool directory
+struct DaemonJob
+{
+    std::string outputFolder;
+    std::string plotId;
+    std::string memo;
+};
+
+struct PlotIdEntry
+{
+    byte   plotId[32];
+    byte   memo  [48+48+32];
+    uint16 memoSize;
+};
+
+// Generates the plot ids and memos of upcoming plots ahead of time on a
+// background thread, so that the BLS key derivation doesn't stall the plotter.
+class PlotIdQueue
+{
+public:
+    PlotIdQueue( Config& cfg, uint plotCount );
+    ~PlotIdQueue();
+
+    // Blocks until the next entry is ready.
+    // Returns the time spent waiting, in seconds.
+    double Pop( PlotIdEntry& outEntry );
+
+private:
+    static void GeneratorMain( void* param );
+
+private:
+    static constexpr uint DEPTH = 2;
+
+    Config&     _cfg;
+    uint        _plotCount;
+    uint        _popCount = 0;
+    PlotIdEntry _entries[DEPTH];
+    Semaphore   _freeSlots;
+    Semaphore   _readySlots;
+    Thread      _thread;
+
+    std::atomic<bool> _stopSignal = false;  // Tells the generator to exit after the current entry
 };
 
 /// Internal Functions
 void            ParseCommandLine( int argc, const char* argv[], Config& cfg );
+int             RunCheck( int argc, const char* argv[] );
+int             RunReplay( int argc, const char* argv[] );
+bool            HashFile( const char* path, char outChecksum[65] );
+uint            RunPlots( Config& cfg, MemPlotter& plotter, std::vector<PlotResult>* results );
+void            RunDaemon( Config& cfg, MemPlotter& plotter );
+bool            ParseDaemonJob( const std::string& path, Config& jobCfg, DaemonJob& job, std::string& outError );
+void            WriteDaemonJobResult( const std::string& path, const std::string& jobName, bool success, const std::string& error,
+                                      time_t startTime, double elapsed, const std::vector<PlotResult>& results );
+bool            FindSpoolFile( const std::string& dir, const char* extension, std::string& outName );
 bool            HexPKeyToG1Element( const char* hexKey, bls::G1Element& pkey );
+bool            IsValidPlotMemo( const char* hexMemo, size_t length );
 
 ByteSpan        DecodePuzzleHash( const char* poolContractAddress );
 void            GeneratePlotIdAndMemo( Config& cfg, byte plotId[32], byte plotMemo[48+48+32], uint16& outMemoSize );
@@ -93,10 +182,24 @@ void PrintUsage();
 
 //-----------------------------------------------------------
 const char* USAGE = "bladebit [<OPTIONS>] [<out_dir>]\n"
+                    "bladebit check [<CHECK_OPTIONS>] <plot_file>\n"
+                    "bladebit replay [<REPLAY_OPTIONS>] <checkpoint_dir> [<reference_plot>]\n"
 R"(
 <out_dir>: Output directory in which to output the plots.
            This directory must exist.
 
+check    : Look up random challenges in a finished plot, fetching and validating
+           the full proofs found. Reports the proofs found per challenge (about 1
+           is expected), the quality lookup latency and the lookup rate.
+           Exits with an error if a proof is invalid.
+
+replay   : Rerun the plot saved in a --checkpoint-dir directory from Phase 2 or 3,
+           without running Phase 1 and without writing the plot. Reports the timings
+           of each run of the phases replayed. If a reference plot of the same plot id
+           is given, each run's checksum is compared to it, and bladebit exits with an
+           error if any differs. The checkpoint is kept, and its tables are read again
+           before each run, as Phase 3 overwrites them.
+
 OPTIONS:
 
  --mmx                : Plot for MMX. MMX plots are not compatible with Chia.
@@ -121,6 +224,57 @@ OPTIONS:
 
  -w, --warm-start     : Touch all pages of buffer allocations before starting to plot.
 
+ --huge-pages <mode>  : Back the plotting buffers with huge pages to reduce TLB misses.
+                        off : Use the default page size (default).
+                        thp : Use transparent huge pages.
+                        2m  : Use reserved 2 MiB huge pages. Falls back to thp.
+                        1g  : Use reserved 1 GiB huge pages. Falls back to 2m.
+                        Reserved huge pages must be set up in the system beforehand.
+                        (ex: /proc/sys/vm/nr_hugepages). Only 2m is supported on Windows.
+
+ --compact-pairs      : Store the back pointers of tables 2 to 6 in a compact format
+                        to lower the memory required, at a small performance cost.
+
+ --spill-dir <path>   : Move finished tables to scratch files in this directory
+                        while they are not needed, to lower the memory required.
+                        Should be on a fast local NVMe drive, with at least
+                        %s of free space (%s with --compact-pairs).
+
+ --overlap-writes     : When making multiple plots, let all of Phase 1 of the next plot
+                        run while the previous plot is still being written to disk.
+                        Useful with slow destination drives. Requires 64 GiB more memory.
+
+ --stats-json <path>  : Append the timings, entry counts and sizes of the phases and tables
+                        of each plot to this file. Each plot is written as a JSON object
+                        on its own line.
+
+ --perf-counters      : Report the IPC and the LLC, dTLB and branch miss rates of each stage
+                        of each phase, from hardware performance counters. Linux only.
+                        May require a lower /proc/sys/kernel/perf_event_paranoid setting.
+
+ --trace <path>       : Record when each thread runs thread pool jobs and waits on barriers,
+                        and write it for each plot to a Chrome trace-event file in this
+                        directory. Open it in chrome://tracing or ui.perfetto.dev.
+                        Jobs that can't be named are shown as an offset in the executable,
+                        which `addr2line -f -C -e bladebit <offset>` resolves.
+
+ --checkpoint-dir <path>
+                      : Save the tables of each plot to this directory at the end of Phase 1,
+                        and its marked entries at the end of Phase 2. If bladebit is stopped
+                        (ex: crash, out of memory kill, preempted node), running it again with
+                        the same directory resumes the plot from the last phase saved.
+                        Needs about %s of free space (%s with --compact-pairs).
+                        Tables are saved in the background during Phase 2.
+                        Can't be used with --spill-dir.
+
+ --benchmark          : Run the whole plotting process, but discard the plots instead of
+                        writing them. Each plot is still timed and hashed, and its compute
+                        throughput is reported, to measure plotting speed without a drive.
+
+ --benchmark-write-speed <MiB/s>
+                      : Same as --benchmark, but the discarded plots are written at this speed,
+                        to simulate a destination drive and see how much plotting waits on it.
+
  -i, --plot-id        : Specify a plot id for debugging.
 
  --memo               : Specify a plot memo for debugging.
@@ -140,10 +294,49 @@ OPTIONS:
  
  --memory             : Display system memory available, in bytes, and the 
                         required memory to run Bladebit, in bytes.
+                        Options that change the required memory (ex: --compact-pairs)
+                        must be specified before it.
  
  --memory-json        : Same as --memory, but formats the output as json.
 
+ --daemon <spool_dir>  : Run as a daemon, keeping the plotting buffers allocated between
+                        jobs. Jobs are read from <name>.job files in the spool directory,
+                        in name order. A job file has one 'key = value' per line:
+                          farmer-key    : Farmer public key. *REQUIRED*
+                          pool-key      : Pool public key.
+                          pool-contract : Pool contract address (if no pool key).
+                          out-dir       : Output directory. *REQUIRED*
+                          count         : Number of plots. Default = 1.
+                          plot-id       : Plot id, for a plot made from the given memo.
+                                          Only valid with a count of 1.
+                          memo          : Plot memo. Requires the plot id derived from it.
+                        While running, a job is renamed to <name>.running, and then to
+                        <name>.done or <name>.failed. Its results are written to <name>.json.
+                        Create a file named 'shutdown' in the spool directory to exit.
+                        Command line keys and output directory are ignored in this mode.
+
  --version            : Display current version.
+
+CHECK_OPTIONS:
+
+ -t, --threads        : Maximum number of threads to use. Challenges are looked up in parallel.
+
+ -n, --challenges     : Number of random challenges to look up. Default = 100.
+
+ -q, --qualities-only : Only look up the qualities of the challenges, as a farmer does,
+                        without fetching the full proofs.
+
+REPLAY_OPTIONS:
+
+ -t, --threads        : Maximum number of threads to use.
+
+ -n, --runs           : Number of times to replay the phases. Default = 1.
+
+ --from <phase>       : Phase to replay from, 2 or 3. Replaying from Phase 3 requires
+                        a checkpoint saved at the end of Phase 2. Default = 2.
+
+ --huge-pages, -m, --no-cpu-affinity, --stats-json, --perf-counters, --trace
+                      : Same as the plotting options. --compact-pairs is taken from the checkpoint.
 )";
 
 
@@ -153,10 +346,48 @@ int main( int argc, const char* argv[] )
     // Install a crash handler to dump our stack traces
     SysHost::InstallCrashHandler();
 
+    if( argc > 1 && strcmp( argv[1], "check" ) == 0 )
+        return RunCheck( argc-2, argv+2 );
+
+    if( argc > 1 && strcmp( argv[1], "replay" ) == 0 )
+        return RunReplay( argc-2, argv+2 );
+
     // Parse command line info
     Config cfg;
     ParseCommandLine( argc-1, argv+1, cfg );
 
+    // #TODO: Don't let this config to permanently remain on the stack
+    MemPlotConfig plotCfg;
+    plotCfg.threadCount   = cfg.threads;
+    plotCfg.noNUMA        = cfg.disableNuma;
+    plotCfg.noCPUAffinity = cfg.disableCpuAffinity;
+    plotCfg.warmStart     = cfg.warmStart;
+    plotCfg.hugePages     = cfg.hugePages;
+    plotCfg.compactPairs  = cfg.compactPairs;
+    plotCfg.spillDir      = cfg.spillDir;
+    plotCfg.overlapWrites = cfg.overlapWrites;
+    plotCfg.statsPath     = cfg.statsPath;
+    plotCfg.perfCounters  = cfg.perfCounters;
+    plotCfg.traceDir      = cfg.traceDir;
+    plotCfg.benchmark     = cfg.benchmark;
+    plotCfg.benchmarkWriteSpeed = cfg.benchmarkWriteSpeed;
+    plotCfg.checkpointDir = cfg.checkpointDir;
+    plotCfg.replayPhase   = 0;
+
+    MemPlotter plotter( plotCfg );
+
+    if( cfg.daemonDir )
+        RunDaemon( cfg, plotter );
+    else
+        RunPlots( cfg, plotter, nullptr );
+    
+    Log::Flush();
+    return 0;
+}
+
+//-----------------------------------------------------------
+uint RunPlots( Config& cfg, MemPlotter& plotter, std::vector<PlotResult>* results )
+{
     // Create the plot output path
     size_t outputFolderLen = strlen( cfg.outputFolder );
     
@@ -175,25 +406,27 @@ int main( int argc, const char* argv[] )
     PlotRequest req;
     ZeroMem( &req );
 
-    // #TODO: Don't let this config to permanently remain on the stack
-    MemPlotConfig plotCfg;
-    plotCfg.threadCount   = cfg.threads;
-    plotCfg.noNUMA        = cfg.disableNuma;
-    plotCfg.noCPUAffinity = cfg.disableCpuAffinity;
-    plotCfg.warmStart     = cfg.warmStart;
+    // Start generating plot ids in the background
+    PlotIdQueue plotIdQueue( cfg, cfg.plotCount );
 
-    MemPlotter plotter( plotCfg );
+    PlotIdEntry plotIdEntry;
+    byte*       plotId   = plotIdEntry.plotId;
+    byte*       memo     = plotIdEntry.memo;
+    uint16&     memoSize = plotIdEntry.memoSize;
+    char        plotIdStr[65] = { 0 };
 
-    byte   plotId[32];
-    byte   memo  [48+48+32];
-    uint16 memoSize;
-    char   plotIdStr[65] = { 0 };
+    // Measures the gap between the end of a plot and the start of the next one
+    auto setupTimer = TimerBegin();
 
-    int failCount = 0;
+    uint failCount = 0;
     for( uint i = 0; i < cfg.plotCount; i++ )
     {
-        // Generate a new plot id
-        GeneratePlotIdAndMemo( cfg, plotId, memo, memoSize );
+        // Get the next plot id
+        const double plotIdWaitTime = plotIdQueue.Pop( plotIdEntry );
+
+        // Finish a plot that was interrupted first
+        if( i == 0 && plotter.GetCheckpointedPlot( plotId, memo, memoSize ) )
+            Log::Line( "Found a checkpoint of an interrupted plot. Resuming it." );
 
         // Apply debug plot id and/or memo
         if( cfg.plotId )
@@ -203,12 +436,13 @@ int main( int argc, const char* argv[] )
         {
             const size_t memoLen = strlen( cfg.plotMemo );
             HexStrToBytes( cfg.plotMemo, memoLen, memo, memoLen/2 );
+            memoSize = (uint16)( memoLen/2 );
         }
         
         // Convert plot id to string
         {
             size_t numEncoded = 0;
-            BytesToHexStr( plotId, sizeof( plotId), plotIdStr, sizeof( plotIdStr ), numEncoded );
+            BytesToHexStr( plotId, sizeof( plotIdEntry.plotId ), plotIdStr, sizeof( plotIdStr ), numEncoded );
 
             ASSERT( numEncoded == 32 );
             plotIdStr[64] = 0;
@@ -238,6 +472,10 @@ int main( int argc, const char* argv[] )
 
             Log::Line( "Plot Memo: %s", memoStr );
         }
+
+        const double setupTime = TimerEnd( setupTimer );
+        Log::Line( "Plot setup time: %.3lf seconds ( %.3lf seconds waiting for the plot id ).",
+            setupTime, plotIdWaitTime );
         Log::Line( "" );
 
         // Prepare the request
@@ -248,10 +486,30 @@ int main( int argc, const char* argv[] )
         req.IsFinalPlot = i+1 == cfg.plotCount;
 
         // Plot it
-        if( !plotter.Run( req ) )
+        const auto plotTimer = TimerBegin();
+        const bool plotOk    = plotter.Run( req );
+        const double plotTime = TimerEnd( plotTimer );
+
+        setupTimer = TimerBegin();
+
+        if( results )
+        {
+            PlotResult result;
+            result.plotId       = plotIdStr;
+            result.path         = std::string( plotOutPath, strlen( plotOutPath ) - ( sizeof( ".tmp" ) - 1 ) );
+            result.success      = plotOk;
+            result.setupSeconds = setupTime;
+            result.plotSeconds  = plotTime;
+
+            results->push_back( result );
+        }
+
+        if( !plotOk )
         {
+            failCount++;
+
             Log::Error( "Error: Plot %s failed... Trying next plot.", plotIdStr );
-            if( cfg.maxFailCount > 0 && ++failCount >= cfg.maxFailCount )
+            if( cfg.maxFailCount > 0 && (int)failCount >= cfg.maxFailCount )
             {
                 // #TODO: Wait for pending plot writes to disk
                 Fatal( "Maximum number of plot failures reached. Exiting." );
@@ -260,9 +518,410 @@ int main( int argc, const char* argv[] )
 
         Log::Line( "" );
     }
-    
+
+    delete[] plotOutPath;
+    return failCount;
+}
+
+//-----------------------------------------------------------
+void RunDaemon( Config& cfg, MemPlotter& plotter )
+{
+    std::string dir = cfg.daemonDir;
+    if( dir.length() && dir.back() != '/' && dir.back() != '\\' )
+        dir += '/';
+
+    std::string jobName;
+
+    // Jobs left running by a previous instance were interrupted
+    while( FindSpoolFile( dir, ".running", jobName ) )
+    {
+        const std::string jobPath = dir + jobName;
+
+        Log::Line( "Daemon: Job %s was interrupted.", jobName.c_str() );
+        WriteDaemonJobResult( jobPath, jobName, false, "The daemon exited while running this job.", time( nullptr ), 0, {} );
+
+        if( rename( ( jobPath + ".running" ).c_str(), ( jobPath + ".failed" ).c_str() ) != 0 )
+            Fatal( "Failed to rename job file %s.running with error: %d.", jobPath.c_str(), errno );
+    }
+
+    Log::Line( "Daemon: Waiting for jobs in %s", cfg.daemonDir );
     Log::Flush();
-    return 0;
+
+    const std::string shutdownPath = dir + "shutdown";
+
+    for( ;; )
+    {
+        // Exit if requested
+        if( FILE* f = fopen( shutdownPath.c_str(), "rb" ) )
+        {
+            fclose( f );
+            remove( shutdownPath.c_str() );
+
+            Log::Line( "Daemon: Shutting down." );
+            break;
+        }
+
+        if( !FindSpoolFile( dir, ".job", jobName ) )
+        {
+            Thread::Sleep( 1000 );
+            continue;
+        }
+
+        // Claim the job
+        const std::string jobPath     = dir + jobName;
+        const std::string runningPath = jobPath + ".running";
+
+        if( rename( ( jobPath + ".job" ).c_str(), runningPath.c_str() ) != 0 )
+        {
+            // It may have been removed or claimed by someone else
+            Log::Error( "Daemon: Failed to claim job %s with error: %d.", jobName.c_str(), errno );
+            Thread::Sleep( 1000 );
+            continue;
+        }
+
+        Log::Line( "Daemon: Starting job %s", jobName.c_str() );
+        Log::Line( "" );
+
+        const time_t startTime = time( nullptr );
+        const auto   jobTimer  = TimerBegin();
+
+        // Jobs only override the keys, output and count
+        Config jobCfg = cfg;
+        jobCfg.plotCount          = 1;
+        jobCfg.outputFolder       = nullptr;
+        jobCfg.poolPublicKey      = nullptr;
+        jobCfg.contractPuzzleHash = nullptr;
+        jobCfg.plotId             = nullptr;
+        jobCfg.plotMemo           = nullptr;
+        jobCfg.maxFailCount       = 0;
+
+        DaemonJob               job;
+        std::vector<PlotResult> results;
+        std::string             error;
+
+        bool success = ParseDaemonJob( runningPath, jobCfg, job, error );
+        if( success )
+        {
+            const uint failCount = RunPlots( jobCfg, plotter, &results );
+
+            if( failCount )
+            {
+                success = false;
+                error   = std::to_string( failCount ) + " of " + std::to_string( jobCfg.plotCount ) + " plots failed.";
+            }
+        }
+
+        const double elapsed = TimerEnd( jobTimer );
+
+        WriteDaemonJobResult( jobPath, jobName, success, error, startTime, elapsed, results );
+
+        if( rename( runningPath.c_str(), ( jobPath + ( success ? ".done" : ".failed" ) ).c_str() ) != 0 )
+            Log::Error( "Daemon: Failed to rename job file %s with error: %d.", runningPath.c_str(), errno );
+
+        if( success )
+            Log::Line( "Daemon: Finished job %s in %.2lf seconds.", jobName.c_str(), elapsed );
+        else
+            Log::Error( "Daemon: Job %s failed: %s", jobName.c_str(), error.c_str() );
+
+        Log::Line( "" );
+        Log::Flush();
+
+        delete jobCfg.poolPublicKey;
+        if( jobCfg.contractPuzzleHash )
+        {
+            free( jobCfg.contractPuzzleHash->values );
+            delete jobCfg.contractPuzzleHash;
+        }
+    }
+}
+
+//-----------------------------------------------------------
+bool ParseDaemonJob( const std::string& path, Config& jobCfg, DaemonJob& job, std::string& outError )
+{
+    FILE* file = fopen( path.c_str(), "r" );
+    if( !file )
+    {
+        outError = "Failed to open job file with error: " + std::to_string( errno ) + ".";
+        return false;
+    }
+
+    std::string farmerKey, poolKey, poolContract;
+
+    auto trim = []( std::string str ) {
+        const char* ws = " \t\r\n";
+        const size_t start = str.find_first_not_of( ws );
+        if( start == std::string::npos )
+            return std::string();
+
+        return str.substr( start, str.find_last_not_of( ws ) - start + 1 );
+    };
+
+    bool ok = true;
+    char line[1024];
+
+    while( ok && fgets( line, sizeof( line ), file ) )
+    {
+        const std::string l = trim( line );
+        if( l.empty() || l[0] == '#' )
+            continue;
+
+        const size_t sep = l.find( '=' );
+        if( sep == std::string::npos )
+        {
+            outError = "Invalid line in job file: '" + l + "'.";
+            ok = false;
+            break;
+        }
+
+        const std::string key   = trim( l.substr( 0, sep ) );
+        const std::string value = trim( l.substr( sep + 1 ) );
+
+        if( key == "farmer-key" )
+            farmerKey = value;
+        else if( key == "pool-key" )
+            poolKey = value;
+        else if( key == "pool-contract" )
+            poolContract = value;
+        else if( key == "out-dir" )
+            job.outputFolder = value;
+        else if( key == "plot-id" )
+            job.plotId = value;
+        else if( key == "memo" )
+            job.memo = value;
+        else if( key == "count" )
+        {
+            const long count = strtol( value.c_str(), nullptr, 10 );
+            if( count < 1 || count > 0xFFFF )
+            {
+                outError = "Invalid plot count '" + value + "'.";
+                ok = false;
+            }
+            else
+                jobCfg.plotCount = (uint)count;
+        }
+        else
+        {
+            outError = "Unknown job key '" + key + "'.";
+            ok = false;
+        }
+    }
+
+    fclose( file );
+
+    if( !ok )
+        return false;
+
+    // Validate the job
+    if( job.outputFolder.empty() )
+    {
+        outError = "An output directory (out-dir) is required.";
+        return false;
+    }
+
+    if( farmerKey.empty() )
+    {
+        outError = "A farmer public key (farmer-key) is required.";
+        return false;
+    }
+
+    if( poolKey.empty() && poolContract.empty() )
+    {
+        outError = "Either a pool public key (pool-key) or a pool contract address (pool-contract) is required.";
+        return false;
+    }
+
+    // A memo holds the keys its plot id was derived from, so they must be given together
+    if( job.plotId.empty() != job.memo.empty() )
+    {
+        outError = "A plot id (plot-id) and a memo (memo) must be given together.";
+        return false;
+    }
+
+    if( job.plotId.length() )
+    {
+        if( job.plotId.length() > 2 && job.plotId[0] == '0' && job.plotId[1] == 'x' )
+            job.plotId = job.plotId.substr( 2 );
+
+        if( job.plotId.length() != 64 || !IsHexStr( job.plotId.c_str(), job.plotId.length() ) )
+        {
+            outError = "Invalid plot id.";
+            return false;
+        }
+
+        if( jobCfg.plotCount > 1 )
+        {
+            outError = "A job with a plot id (plot-id) can only make 1 plot.";
+            return false;
+        }
+
+        if( job.memo.length() > 2 && job.memo[0] == '0' && job.memo[1] == 'x' )
+            job.memo = job.memo.substr( 2 );
+
+        if( !IsValidPlotMemo( job.memo.c_str(), job.memo.length() ) )
+        {
+            outError = "Invalid plot memo.";
+            return false;
+        }
+
+        jobCfg.plotId   = job.plotId.c_str();
+        jobCfg.plotMemo = job.memo.c_str();
+    }
+
+    try
+    {
+        if( !HexPKeyToG1Element( farmerKey.c_str(), jobCfg.farmerPublicKey ) )
+        {
+            outError = "Failed to parse farmer public key '" + farmerKey + "'.";
+            return false;
+        }
+
+        if( poolKey.length() )
+        {
+            bls::G1Element poolPubG1;
+            if( !HexPKeyToG1Element( poolKey.c_str(), poolPubG1 ) )
+            {
+                outError = "Failed to parse pool public key '" + poolKey + "'.";
+                return false;
+            }
+
+            jobCfg.poolPublicKey = new bls::G1Element( std::move( poolPubG1 ) );
+        }
+        else
+        {
+            // DecodePuzzleHash() is fatal on errors, so check that it's valid bech32 first
+            std::vector<char> hrp ( poolContract.length() + 1 );
+            std::vector<byte> data( poolContract.length() + 1 );
+            size_t dataLength = 0;
+
+            if( poolContract.length() < 9 ||
+                bech32_decode( hrp.data(), data.data(), &dataLength, poolContract.c_str() ) == BECH32_ENCODING_NONE )
+            {
+                outError = "Failed to decode pool contract address '" + poolContract + "'.";
+                return false;
+            }
+
+            jobCfg.contractPuzzleHash = new ByteSpan( std::move( DecodePuzzleHash( poolContract.c_str() ) ) );
+        }
+    }
+    catch( const std::exception& e )
+    {
+        outError = std::string( "Invalid key: " ) + e.what();
+        return false;
+    }
+
+    jobCfg.outputFolder = job.outputFolder.c_str();
+    return true;
+}
+
+//-----------------------------------------------------------
+void WriteDaemonJobResult( const std::string& path, const std::string& jobName, bool success, const std::string& error,
+                           time_t startTime, double elapsed, const std::vector<PlotResult>& results )
+{
+    auto escape = []( const std::string& str ) {
+        std::string r;
+        for( const char c : str )
+        {
+            if( c == '"' || c == '\\' )
+            {
+                r += '\\';
+                r += c;
+            }
+            else if( (unsigned char)c < 0x20 )
+                r += ' ';
+            else
+                r += c;
+        }
+        return r;
+    };
+
+    // Write to a temporary file first so that the result appears atomically
+    const std::string tmpPath  = path + ".json.tmp";
+    const std::string jsonPath = path + ".json";
+
+    FILE* file = fopen( tmpPath.c_str(), "w" );
+    if( !file )
+    {
+        Log::Error( "Daemon: Failed to write job result %s with error: %d.", jsonPath.c_str(), errno );
+        return;
+    }
+
+    fprintf( file, "{\n" );
+    fprintf( file, "  \"job\": \"%s\",\n", escape( jobName ).c_str() );
+    fprintf( file, "  \"success\": %s,\n", success ? "true" : "false" );
+
+    if( error.length() )
+        fprintf( file, "  \"error\": \"%s\",\n", escape( error ).c_str() );
+    else
+        fprintf( file, "  \"error\": null,\n" );
+
+    fprintf( file, "  \"start_time\": %lld,\n", (long long)startTime );
+    fprintf( file, "  \"elapsed_seconds\": %.3lf,\n", elapsed );
+    fprintf( file, "  \"plots\": [" );
+
+    for( size_t i = 0; i < results.size(); i++ )
+    {
+        const PlotResult& r = results[i];
+
+        fprintf( file, "%s\n    { \"id\": \"%s\", \"path\": \"%s\", \"success\": %s, \"setup_seconds\": %.3lf, \"plot_seconds\": %.3lf }",
+            i ? "," : "", r.plotId.c_str(), escape( r.path ).c_str(), r.success ? "true" : "false",
+            r.setupSeconds, r.plotSeconds );
+    }
+
+    fprintf( file, "%s]\n}\n", results.size() ? "\n  " : "" );
+    fclose( file );
+
+    remove( jsonPath.c_str() );
+    if( rename( tmpPath.c_str(), jsonPath.c_str() ) != 0 )
+        Log::Error( "Daemon: Failed to write job result %s with error: %d.", jsonPath.c_str(), errno );
+}
+
+//-----------------------------------------------------------
+bool FindSpoolFile( const std::string& dir, const char* extension, std::string& outName )
+{
+    // Returns the name, without extension, of the first file in name order with the given extension
+    const size_t extLength = strlen( extension );
+    bool found = false;
+
+    auto check = [&]( const char* fileName ) {
+
+        const size_t length = strlen( fileName );
+        if( length <= extLength || strcmp( fileName + length - extLength, extension ) != 0 )
+            return;
+
+        std::string name( fileName, length - extLength );
+        if( !found || name < outName )
+        {
+            outName = std::move( name );
+            found   = true;
+        }
+    };
+
+    #if PLATFORM_IS_UNIX
+        DIR* d = opendir( dir.c_str() );
+        if( !d )
+            Fatal( "Failed to open spool directory %s with error: %d.", dir.c_str(), errno );
+
+        while( const dirent* entry = readdir( d ) )
+            check( entry->d_name );
+
+        closedir( d );
+    #elif PLATFORM_IS_WINDOWS
+        WIN32_FIND_DATAA data;
+        HANDLE h = FindFirstFileA( ( dir + "*" + extension ).c_str(), &data );
+
+        if( h != INVALID_HANDLE_VALUE )
+        {
+            do {
+                check( data.cFileName );
+            } while( FindNextFileA( h, &data ) );
+
+            FindClose( h );
+        }
+    #else
+        #error Unimplemented
+    #endif
+
+    return found;
 }
 
 //-----------------------------------------------------------
@@ -351,6 +1010,58 @@ void ParseCommandLine( int argc, const char* argv[], Config& cfg )
         {
             cfg.warmStart = true;
         }
+        else if( check( "--huge-pages" ) )
+        {
+            const char* mode = value();
+
+            if( strcmp( mode, "off" ) == 0 )
+                cfg.hugePages = HugePageMode::None;
+            else if( strcmp( mode, "thp" ) == 0 )
+                cfg.hugePages = HugePageMode::Transparent;
+            else if( strcmp( mode, "2m" ) == 0 )
+                cfg.hugePages = HugePageMode::Huge2MiB;
+            else if( strcmp( mode, "1g" ) == 0 )
+                cfg.hugePages = HugePageMode::Huge1GiB;
+            else
+                Fatal( "Invalid huge page mode '%s'. Expected one of: off, thp, 2m, 1g.", mode );
+        }
+        else if( check( "--compact-pairs" ) )
+        {
+            cfg.compactPairs = true;
+        }
+        else if( check( "--spill-dir" ) )
+        {
+            cfg.spillDir = value();
+        }
+        else if( check( "--overlap-writes" ) )
+        {
+            cfg.overlapWrites = true;
+        }
+        else if( check( "--stats-json" ) )
+        {
+            cfg.statsPath = value();
+        }
+        else if( check( "--perf-counters" ) )
+        {
+            cfg.perfCounters = true;
+        }
+        else if( check( "--trace" ) )
+        {
+            cfg.traceDir = value();
+        }
+        else if( check( "--checkpoint-dir" ) )
+        {
+            cfg.checkpointDir = value();
+        }
+        else if( check( "--benchmark" ) )
+        {
+            cfg.benchmark = true;
+        }
+        else if( check( "--benchmark-write-speed" ) )
+        {
+            cfg.benchmark           = true;
+            cfg.benchmarkWriteSpeed = (uint64)uvalue() MB;
+        }
         else if( check( "-i" ) || check( "--plot-id" ) )
         {
             cfg.plotId = value();
@@ -378,7 +1089,7 @@ void ParseCommandLine( int argc, const char* argv[], Config& cfg )
                 len -= 2;
             }
             
-            if( len/2 != (48 + 48 + 32) && len != (32 + 48 + 32) )
+            if( !IsValidPlotMemo( cfg.plotMemo, len ) )
                 Fatal( "Invalid plot memo." );
         }
         else if( check( "--show-memo" ) )
@@ -399,8 +1110,12 @@ void ParseCommandLine( int argc, const char* argv[], Config& cfg )
         }
         else if( check( "--memory" ) )
         {
-            // #TODO: Get this value from Memplotter
-            const size_t requiredMem  = 416ull GB;
+            MemPlotConfig memCfg = {};
+            memCfg.compactPairs  = cfg.compactPairs;
+            memCfg.spillDir      = cfg.spillDir;
+            memCfg.overlapWrites = cfg.overlapWrites;
+
+            const size_t requiredMem  = MemPlotter::GetRequiredMemory( memCfg );
             const size_t availableMem = SysHost::GetAvailableSystemMemory();
             const size_t totalMem     = SysHost::GetTotalSystemMemory();
 
@@ -412,8 +1127,12 @@ void ParseCommandLine( int argc, const char* argv[], Config& cfg )
         }
         else if( check( "--memory-json" ) )
         {
-            // #TODO: Get this value from Memplotter
-            const size_t requiredMem  = 416ull GB;
+            MemPlotConfig memCfg = {};
+            memCfg.compactPairs  = cfg.compactPairs;
+            memCfg.spillDir      = cfg.spillDir;
+            memCfg.overlapWrites = cfg.overlapWrites;
+
+            const size_t requiredMem  = MemPlotter::GetRequiredMemory( memCfg );
             const size_t availableMem = SysHost::GetAvailableSystemMemory();
             const size_t totalMem     = SysHost::GetTotalSystemMemory();
 
@@ -422,6 +1141,10 @@ void ParseCommandLine( int argc, const char* argv[], Config& cfg )
 
             exit( 0 );
         }
+        else if( check( "--daemon" ) )
+        {
+            cfg.daemonDir = value();
+        }
         else if( check( "--version" ) )
         {
             Log::Line( BLADEBIT_VERSION_STR );
@@ -438,6 +1161,14 @@ void ParseCommandLine( int argc, const char* argv[], Config& cfg )
             cfg.outputFolder = arg;
         }
     }
+    #if BB_BENCHMARK_MODE
+        cfg.benchmark = true;
+    #endif
+
+    // Spilled tables are not kept in memory, so there's nothing to save at the end of a phase
+    if( cfg.checkpointDir && cfg.spillDir )
+        Fatal( "--checkpoint-dir can't be used with --spill-dir." );
+
     if ( cfg.isMMX )
     {
         Log::Line( "Plotting for MMX!" );
@@ -447,40 +1178,50 @@ void ParseCommandLine( int argc, const char* argv[], Config& cfg )
     #undef check
 
 
-    if( farmerPublicKey )
+    // Keys are given per job in daemon mode
+    if( cfg.daemonDir )
     {
-        if( !HexPKeyToG1Element( farmerPublicKey, cfg.farmerPublicKey ) )
-            Fatal( "Failed to parse farmer public key '%s'.", farmerPublicKey );
-        
-        // Remove 0x prefix for printing
-        if( farmerPublicKey[0] == '0' && farmerPublicKey[1] == 'x' )
-            farmerPublicKey += 2;
+        farmerPublicKey     = nullptr;
+        poolPublicKey       = nullptr;
+        poolContractAddress = nullptr;
     }
     else
-        Fatal( "A farmer public key is required. Please specify a farmer public key." );
-
-    if( poolPublicKey )
     {
-        if( poolContractAddress )
-            Log::Write( "Warning: Pool contract address will not be used. A pool public key was specified." );
-        
-        // cfg.poolPublicKey = new bls::G1Element()
-        bls::G1Element poolPubG1;
-        if( !HexPKeyToG1Element( poolPublicKey, poolPubG1 ) )
-            Fatal( "Error: Failed to parse pool public key '%s'.", poolPublicKey );
+        if( farmerPublicKey )
+        {
+            if( !HexPKeyToG1Element( farmerPublicKey, cfg.farmerPublicKey ) )
+                Fatal( "Failed to parse farmer public key '%s'.", farmerPublicKey );
+            
+            // Remove 0x prefix for printing
+            if( farmerPublicKey[0] == '0' && farmerPublicKey[1] == 'x' )
+                farmerPublicKey += 2;
+        }
+        else
+            Fatal( "A farmer public key is required. Please specify a farmer public key." );
 
-        cfg.poolPublicKey = new bls::G1Element( std::move( poolPubG1 ) );
+        if( poolPublicKey )
+        {
+            if( poolContractAddress )
+                Log::Write( "Warning: Pool contract address will not be used. A pool public key was specified." );
+            
+            // cfg.poolPublicKey = new bls::G1Element()
+            bls::G1Element poolPubG1;
+            if( !HexPKeyToG1Element( poolPublicKey, poolPubG1 ) )
+                Fatal( "Error: Failed to parse pool public key '%s'.", poolPublicKey );
 
-        // Remove 0x prefix for printing
-        if( poolPublicKey[0] == '0' && poolPublicKey[1] == 'x' )
-            poolPublicKey += 2;
-    }
-    else if( poolContractAddress )
-    {
-        cfg.contractPuzzleHash = new ByteSpan( std::move( DecodePuzzleHash( poolContractAddress ) ) );
+            cfg.poolPublicKey = new bls::G1Element( std::move( poolPubG1 ) );
+
+            // Remove 0x prefix for printing
+            if( poolPublicKey[0] == '0' && poolPublicKey[1] == 'x' )
+                poolPublicKey += 2;
+        }
+        else if( poolContractAddress )
+        {
+            cfg.contractPuzzleHash = new ByteSpan( std::move( DecodePuzzleHash( poolContractAddress ) ) );
+        }
+        else
+            Fatal( "Error: Either a pool public key or a pool contract address must be specified." );
     }
-    else
-        Fatal( "Error: Either a pool public key or a pool contract address must be specified." );
 
 
     const uint threadCount = SysHost::GetLogicalCPUCount();
@@ -498,24 +1239,60 @@ void ParseCommandLine( int argc, const char* argv[], Config& cfg )
     if( cfg.plotCount < 1 )
         cfg.plotCount = 1;
 
-    if( cfg.outputFolder == nullptr )
+    if( cfg.outputFolder == nullptr && !cfg.daemonDir )
     {
         Log::Line( "Warning: No output folder specified. Using current directory." );
         cfg.outputFolder = "";
     }
 
-    Log::Line( "Creating %d plots:", cfg.plotCount );
-    
-    if( cfg.outputFolder )
-        Log::Line( " Output path           : %s", cfg.outputFolder );
+    if( cfg.daemonDir )
+    {
+        Log::Line( "Running as a daemon:" );
+        Log::Line( " Spool directory       : %s", cfg.daemonDir );
+    }
     else
-        Log::Line( " Output path           : Current directory." );
+    {
+        Log::Line( "Creating %d plots:", cfg.plotCount );
+        
+        if( cfg.outputFolder )
+            Log::Line( " Output path           : %s", cfg.outputFolder );
+        else
+            Log::Line( " Output path           : Current directory." );
+    }
 
     Log::Line( " Thread count          : %d", cfg.threads );
     Log::Line( " Warm start enabled    : %s", cfg.warmStart ? "true" : "false" );
+    {
+        const char* hugePageModes[] = { "off", "thp", "2m", "1g" };
+        Log::Line( " Huge pages            : %s", hugePageModes[(int)cfg.hugePages] );
+    }
+    Log::Line( " Compact pairs         : %s", cfg.compactPairs ? "true" : "false" );
+
+    if( cfg.spillDir )
+        Log::Line( " Spill directory       : %s", cfg.spillDir );
+
+    Log::Line( " Overlap writes        : %s", cfg.overlapWrites ? "true" : "false" );
+
+    if( cfg.statsPath )
+        Log::Line( " Stats file            : %s", cfg.statsPath );
 
+    if( cfg.traceDir )
+        Log::Line( " Trace directory       : %s", cfg.traceDir );
 
-    Log::Line( " Farmer public key     : %s", farmerPublicKey );
+    if( cfg.checkpointDir )
+        Log::Line( " Checkpoint directory  : %s", cfg.checkpointDir );
+
+    if( cfg.benchmark )
+    {
+        if( cfg.benchmarkWriteSpeed )
+            Log::Line( " Benchmark mode        : Plots are discarded, simulating a %llu MiB/s drive", cfg.benchmarkWriteSpeed BtoMB );
+        else
+            Log::Line( " Benchmark mode        : Plots are discarded" );
+    }
+
+
+    if( farmerPublicKey )
+        Log::Line( " Farmer public key     : %s", farmerPublicKey );
 
     if( poolPublicKey )
         Log::Line( " Pool public key       : %s", poolPublicKey   );
@@ -615,6 +1392,65 @@ void GeneratePlotIdAndMemo( Config& cfg, byte plotId[32], byte plotMemo[48+48+32
     }
 }
 
+//-----------------------------------------------------------
+PlotIdQueue::PlotIdQueue( Config& cfg, uint plotCount )
+    : _cfg       ( cfg )
+    , _plotCount ( plotCount )
+    , _freeSlots ( (int)DEPTH )
+    , _readySlots( 0 )
+{
+    _thread.Run( GeneratorMain, this );
+}
+
+//-----------------------------------------------------------
+PlotIdQueue::~PlotIdQueue()
+{
+    // Don't wait for the remaining entries if we stopped early.
+    // Wake the generator in case it's waiting for a free slot.
+    _stopSignal.store( true, std::memory_order_release );
+    _freeSlots.Release();
+
+    _thread.WaitForExit();
+}
+
+//-----------------------------------------------------------
+double PlotIdQueue::Pop( PlotIdEntry& outEntry )
+{
+    ASSERT( _popCount < _plotCount );
+
+    const auto timer = TimerBegin();
+    _readySlots.Wait();
+    const double elapsed = TimerEnd( timer );
+
+    outEntry = _entries[_popCount++ % DEPTH];
+    _freeSlots.Release();
+
+    return elapsed;
+}
+
+//-----------------------------------------------------------
+void PlotIdQueue::GeneratorMain( void* param )
+{
+    ASSERT( param );
+    PlotIdQueue& queue = *(PlotIdQueue*)param;
+
+    // relic keeps its context per-thread when built with multi-threading support
+    bls::BLS::Init();
+
+    for( uint i = 0; i < queue._plotCount; i++ )
+    {
+        queue._freeSlots.Wait();
+
+        if( queue._stopSignal.load( std::memory_order_acquire ) )
+            break;
+
+        PlotIdEntry& entry = queue._entries[i % DEPTH];
+        GeneratePlotIdAndMemo( queue._cfg, entry.plotId, entry.memo, entry.memoSize );
+
+        queue._readySlots.Release();
+    }
+}
+
 //-----------------------------------------------------------
 bls::PrivateKey MasterSkToLocalSK( bls::PrivateKey& sk, bool isMMX )
 {
@@ -753,6 +1589,18 @@ bool HexPKeyToG1Element( const char* hexKey, bls::G1Element& pkey )
     return pkey.IsValid();
 }
 
+//-----------------------------------------------------------
+bool IsValidPlotMemo( const char* hexMemo, size_t length )
+{
+    ASSERT( hexMemo );
+
+    // Pool public key or pool contract puzzle hash, farmer public key and local master secret key
+    const size_t memoSize = length / 2;
+
+    return ( length & 1 ) == 0 && ( memoSize == 48 + 48 + 32 || memoSize == 32 + 48 + 32 ) &&
+           IsHexStr( hexMemo, length );
+}
+
 //-----------------------------------------------------------
 void GetPlotIdBytes( const std::string& plotId, byte outBytes[32] )
 {
@@ -775,12 +1623,344 @@ inline std::vector<uint8_t> BytesConcat( std::vector<uint8_t> a, std::vector<uin
     return a;
 }
 
+//-----------------------------------------------------------
+int RunCheck( int argc, const char* argv[] )
+{
+    #define check( a ) (strcmp( a, arg ) == 0)
+    int i;
+    const char* arg = nullptr;
+
+    auto value = [&](){
+
+        if( ++i >= argc )
+            Fatal( "Expected a value for parameter '%s'", arg );
+
+        return argv[i];
+    };
+
+    auto uvalue = [&]() {
+
+        const char* val = value();
+        int64 v = 0;
+
+        if( sscanf( val, "%lld", &v ) != 1 || v < 0 )
+            Fatal( "Invalid value for argument '%s'.", arg );
+
+        return (uint64)v;
+    };
+
+    uint            threads = 0;
+    PlotCheckConfig checkCfg;
+
+    for( i = 0; i < argc; i++ )
+    {
+        arg = argv[i];
+
+        if( check( "-h" ) || check( "--help" ) )
+        {
+            PrintUsage();
+            exit( 0 );
+        }
+        else if( check( "-t" ) || check( "--threads" ) )
+            threads = (uint)uvalue();
+        else if( check( "-n" ) || check( "--challenges" ) )
+            checkCfg.challengeCount = uvalue();
+        else if( check( "-q" ) || check( "--qualities-only" ) )
+            checkCfg.qualitiesOnly = true;
+        else if( i == argc - 1 )
+            checkCfg.plotPath = arg;
+        else
+            Fatal( "Error: Unexpected argument '%s'.", arg );
+    }
+    #undef check
+
+    if( !checkCfg.plotPath )
+        Fatal( "Error: No plot file specified." );
+
+    if( checkCfg.challengeCount < 1 )
+        Fatal( "Error: At least 1 challenge must be looked up." );
+
+    const uint threadCount = SysHost::GetLogicalCPUCount();
+    if( threads == 0 || threads > threadCount )
+        threads = threadCount;
+
+    ThreadPool pool( std::min( threads, (uint)MAX_THREADS ) );
+
+    return CheckPlot( pool, checkCfg ) ? 0 : 1;
+}
+
+//-----------------------------------------------------------
+int RunReplay( int argc, const char* argv[] )
+{
+    #define check( a ) (strcmp( a, arg ) == 0)
+    int i;
+    const char* arg = nullptr;
+
+    auto value = [&](){
+
+        if( ++i >= argc )
+            Fatal( "Expected a value for parameter '%s'", arg );
+
+        return argv[i];
+    };
+
+    auto uvalue = [&]() {
+
+        const char* val = value();
+        int64 v = 0;
+
+        if( sscanf( val, "%lld", &v ) != 1 || v < 0 )
+            Fatal( "Invalid value for argument '%s'.", arg );
+
+        return (uint64)v;
+    };
+
+    MemPlotConfig plotCfg;
+    ZeroMem( &plotCfg );
+    plotCfg.hugePages   = HugePageMode::None;
+    plotCfg.benchmark   = true;
+    plotCfg.replayPhase = 2;
+
+    uint        runCount      = 1;
+    const char* referencePath = nullptr;
+
+    for( i = 0; i < argc; i++ )
+    {
+        arg = argv[i];
+
+        if( check( "-h" ) || check( "--help" ) )
+        {
+            PrintUsage();
+            exit( 0 );
+        }
+        else if( check( "-t" ) || check( "--threads" ) )
+            plotCfg.threadCount = (uint)uvalue();
+        else if( check( "-n" ) || check( "--runs" ) )
+            runCount = (uint)uvalue();
+        else if( check( "--from" ) )
+            plotCfg.replayPhase = (uint)uvalue();
+        else if( check( "--huge-pages" ) )
+        {
+            const char* mode = value();
+
+            if( strcmp( mode, "off" ) == 0 )
+                plotCfg.hugePages = HugePageMode::None;
+            else if( strcmp( mode, "thp" ) == 0 )
+                plotCfg.hugePages = HugePageMode::Transparent;
+            else if( strcmp( mode, "2m" ) == 0 )
+                plotCfg.hugePages = HugePageMode::Huge2MiB;
+            else if( strcmp( mode, "1g" ) == 0 )
+                plotCfg.hugePages = HugePageMode::Huge1GiB;
+            else
+                Fatal( "Invalid huge page mode '%s'. Expected one of: off, thp, 2m, 1g.", mode );
+        }
+        else if( check( "-m" ) || check( "--no-numa" ) )
+            plotCfg.noNUMA = true;
+        else if( check( "--no-cpu-affinity" ) )
+            plotCfg.noCPUAffinity = true;
+        else if( check( "--stats-json" ) )
+            plotCfg.statsPath = value();
+        else if( check( "--perf-counters" ) )
+            plotCfg.perfCounters = true;
+        else if( check( "--trace" ) )
+            plotCfg.traceDir = value();
+        else if( !plotCfg.checkpointDir )
+            plotCfg.checkpointDir = arg;
+        else if( !referencePath )
+            referencePath = arg;
+        else
+            Fatal( "Error: Unexpected argument '%s'.", arg );
+    }
+    #undef check
+
+    if( !plotCfg.checkpointDir )
+        Fatal( "Error: No checkpoint directory specified." );
+
+    if( plotCfg.replayPhase < 2 || plotCfg.replayPhase > 3 )
+        Fatal( "Error: Phases can only be replayed from Phase 2 or 3." );
+
+    if( runCount < 1 )
+        Fatal( "Error: At least 1 run must be made." );
+
+    const uint threadCount = SysHost::GetLogicalCPUCount();
+    if( plotCfg.threadCount == 0 || plotCfg.threadCount > threadCount )
+        plotCfg.threadCount = threadCount;
+
+    plotCfg.threadCount = std::min( plotCfg.threadCount, (uint)MAX_THREADS );
+
+    // Get the plot saved in the checkpoint, and the pair format its tables use
+    byte   plotId[32];
+    byte   memo[128];
+    uint16 memoSize = 0;
+    {
+        MemCheckpoint checkpoint( plotCfg.checkpointDir, 1 );
+
+        const CheckpointPhase phase = checkpoint.Find( plotId, memo, memoSize, plotCfg.compactPairs );
+
+        if( phase == CheckpointPhase::None )
+            Fatal( "Error: No checkpoint found in %s.", plotCfg.checkpointDir );
+    }
+
+    char plotIdStr[65] = { 0 };
+    {
+        size_t numEncoded = 0;
+        BytesToHexStr( plotId, sizeof( plotId ), plotIdStr, sizeof( plotIdStr ), numEncoded );
+    }
+
+    // Hash the reference plot first, so that its result is known once the runs start
+    char referenceChecksum[65] = { 0 };
+
+    if( referencePath )
+    {
+        Log::Line( "Hashing reference plot %s...", referencePath );
+        auto timer = TimerBegin();
+
+        if( !HashFile( referencePath, referenceChecksum ) )
+            Fatal( "Error: Failed to read reference plot %s.", referencePath );
+
+        Log::Line( "Reference checksum (BLAKE3): %s ( %.2lf seconds )", referenceChecksum, TimerEnd( timer ) );
+    }
+
+    Log::Line( "Replaying plot %s from Phase %u, %u time(s).", plotIdStr, plotCfg.replayPhase, runCount );
+    Log::Line( " Threads        : %u", plotCfg.threadCount );
+    Log::Line( " Compact pairs  : %s", plotCfg.compactPairs ? "true" : "false" );
+    Log::Line( "" );
+
+    MemPlotter plotter( plotCfg );
+
+    // The plot is discarded, the path is only used to name it in the log
+    std::string outPath = plotCfg.checkpointDir;
+    outPath += "/plot-replay-";
+    outPath += plotIdStr;
+    outPath += ".plot.tmp";
+
+    PlotRequest req;
+    ZeroMem( &req );
+    req.plotId      = plotId;
+    req.memo        = memo;
+    req.memoSize    = memoSize;
+    req.outPath     = outPath.c_str();
+    req.IsFinalPlot = true;
+
+    const uint firstPhase = plotCfg.replayPhase - 1;
+
+    double minSeconds[4] = { 0 };
+    double maxSeconds[4] = { 0 };
+    double sumSeconds[4] = { 0 };
+    uint   mismatchCount = 0;
+
+    for( uint run = 0; run < runCount; run++ )
+    {
+        Log::Line( "Replay run %u/%u", run+1, runCount );
+
+        if( !plotter.Run( req ) )
+            return 1;
+
+        const PlotStats& stats = plotter.LastPlotStats();
+
+        for( uint p = firstPhase; p < 4; p++ )
+        {
+            const double s = stats.phaseSeconds[p];
+
+            minSeconds[p]  = run == 0 ? s : std::min( minSeconds[p], s );
+            maxSeconds[p]  = std::max( maxSeconds[p], s );
+            sumSeconds[p] += s;
+        }
+
+        if( referencePath )
+        {
+            const char* checksum = plotter.LastPlotChecksum();
+            const bool  match    = checksum && strcmp( checksum, referenceChecksum ) == 0;
+
+            if( !match )
+                mismatchCount++;
+
+            Log::Line( "Run %u checksum %s the reference plot.", run+1, match ? "matches" : "DOES NOT MATCH" );
+            Log::Line( "" );
+        }
+    }
+
+    Log::Line( "Replayed %u run(s) from Phase %u:", runCount, plotCfg.replayPhase );
+    Log::Line( "            min (s)    avg (s)    max (s)" );
+
+    for( uint p = firstPhase; p < 4; p++ )
+    {
+        Log::Line( " Phase %u : %10.3lf %10.3lf %10.3lf", p+1,
+            minSeconds[p], sumSeconds[p] / runCount, maxSeconds[p] );
+    }
+
+    if( referencePath )
+    {
+        if( mismatchCount )
+        {
+            Log::Error( "Error: %u of %u run(s) did not match the reference plot.", mismatchCount, runCount );
+            return 1;
+        }
+
+        Log::Line( "All runs match the reference plot." );
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------
+bool HashFile( const char* path, char outChecksum[65] )
+{
+    FILE* file = fopen( path, "rb" );
+    if( !file )
+        return false;
+
+    const size_t BUFFER_SIZE = 8ull MB;
+    byte* buffer = (byte*)malloc( BUFFER_SIZE );
+    ASSERT( buffer );
+
+    blake3_hasher hasher;
+    blake3_hasher_init( &hasher );
+
+    size_t sizeRead;
+    while( ( sizeRead = fread( buffer, 1, BUFFER_SIZE, file ) ) > 0 )
+        blake3_hasher_update( &hasher, buffer, sizeRead );
+
+    const bool ok = !ferror( file );
+    fclose( file );
+    free( buffer );
+
+    if( !ok )
+        return false;
+
+    byte digest[32];
+    blake3_hasher_finalize( &hasher, digest, sizeof( digest ) );
+
+    size_t numEncoded = 0;
+    BytesToHexStr( digest, sizeof( digest ), outChecksum, 65, numEncoded );
+    outChecksum[64] = 0;
+
+    return true;
+}
+
 //-----------------------------------------------------------
 void PrintUsage()
 {
     Log::Line( "bladebit v%s-%s\n", BLADEBIT_VERSION_STR, BLADEBIT_GIT_COMMIT );
     Log::Line( "Usage:" );
-    fputs( USAGE, stdout );
+
+    // Disk space depends on k
+    auto formatSize = []( uint64 size, char str[32] ) {
+        if( size >= 1ull << 30 )
+            snprintf( str, 32, "%llu GiB", CDiv( size, 1 << 30 ) );
+        else
+            snprintf( str, 32, "%llu MiB", CDiv( size, 1 << 20 ) );
+        return str;
+    };
+
+    char spillSize[32], spillCompactSize[32], checkpointSize[32], checkpointCompactSize[32];
+
+    // USAGE is the format string, so it must not contain any other conversions
+    fprintf( stdout, USAGE,
+        formatSize( MemSpill::GetRequiredDiskSpace( false ), spillSize        ),
+        formatSize( MemSpill::GetRequiredDiskSpace( true  ), spillCompactSize ),
+        formatSize( MemCheckpoint::GetRequiredDiskSpace( false ), checkpointSize        ),
+        formatSize( MemCheckpoint::GetRequiredDiskSpace( true  ), checkpointCompactSize ) );
     fflush( stdout );
 }
 
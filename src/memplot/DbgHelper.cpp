@@ -18,17 +18,22 @@ void DumpTestProofs( const MemPlotContext& cx, const uint64 f7Index )
     const uint32* t1xTable = cx.t1XBuffer;
 
     const uint32 f7     = cx.t7YBuffer [f7Index];
-    const Pair&  f7Pair = cx.t7LRBuffer[f7Index];
+    const Pair   f7Pair = cx.t7LRBuffer[f7Index];
 
     Log::Line( "T7 [%-2llu] f7  : %llu : 0x%08lx", f7Index, f7, f7 );
     Log::Line( "T7 [%-2llu] L/R : %-8lu | %-8lu", f7Index, f7Pair.left, f7Pair.right );
 
-    const Pair* rPairs[16]; // R table pairs
-    const Pair* lPairs[32]; // L table pairs
+    // Tables 2-6 may be packed
+    auto getPair = [&]( const Pair* table, uint64 index ) {
+        return cx.compactPairs ? PackedPairs( (void*)table ).Get( index ) : table[index];
+    };
+
+    Pair rPairs[16]; // R table pairs
+    Pair lPairs[32]; // L table pairs
     memset( rPairs, 0, sizeof( rPairs ) );
     memset( lPairs, 0, sizeof( lPairs ) );
 
-    rPairs[0] = &f7Pair;
+    rPairs[0] = f7Pair;
 
     // Get all pairs up to the 2nd table
     for( uint i = 1; i < 6; i++ )
@@ -41,26 +46,26 @@ void DumpTestProofs( const MemPlotContext& cx, const uint64 f7Index )
 
         for( uint r = 0, l = 0; r < rCount; r++ )
         {
-            const Pair* rPair = rPairs[r];
+            const Pair rPair = rPairs[r];
             
             Log::Line( "T%d [%-2lu] L/R: %-10lu | %-10lu", 7-i, r, 
-                        rPair->left, rPair->right );
+                        rPair.left, rPair.right );
 
-            lPairs[l++] = &table[rPair->left ];
-            lPairs[l++] = &table[rPair->right];
+            lPairs[l++] = getPair( table, rPair.left  );
+            lPairs[l++] = getPair( table, rPair.right );
         }
 
         // Copy pairs to rTable
-        memcpy( rPairs, lPairs, sizeof( Pair* ) * lCount );
+        memcpy( rPairs, lPairs, sizeof( Pair ) * lCount );
     }
 
     // Grab all x values pointed by the pairs
     for( uint i = 0, p = 0; i < 32; i++ )
     {
-        const Pair* pair = lPairs[i];
+        const Pair pair = lPairs[i];
 
-        proof[p++] = t1xTable[pair->left ];
-        proof[p++] = t1xTable[pair->right];
+        proof[p++] = t1xTable[pair.left ];
+        proof[p++] = t1xTable[pair.right];
     }
 
     Log::Line( "Proof x's:" );
@@ -75,6 +80,9 @@ void DumpTestProofs( const MemPlotContext& cx, const uint64 f7Index )
 //-----------------------------------------------------------
 void WritePhaseTableFiles( MemPlotContext& cx )
 {
+    if( cx.compactPairs || cx.spill )
+        Fatal( "Writing phase 1 tables is not supported with compact pairs or spilling." );
+
     DbgWriteTableToFile( *cx.threadPool, DBG_P1_TABLE1_FNAME  , cx.entryCount[0], cx.t1XBuffer  );
     DbgWriteTableToFile( *cx.threadPool, DBG_P1_TABLE2_FNAME  , cx.entryCount[1], cx.t2LRBuffer );
     DbgWriteTableToFile( *cx.threadPool, DBG_P1_TABLE3_FNAME  , cx.entryCount[2], cx.t3LRBuffer );
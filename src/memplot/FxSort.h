@@ -6,7 +6,8 @@
 #include "ChiaConsts.h"
 #include "PlotContext.h"
 
-template<typename TMeta>
+// TPairs is either Pair* or PackedPairs
+template<typename TMeta, typename TPairs>
 struct MapFxJob
 {
     uint64        offset;
@@ -15,7 +16,7 @@ struct MapFxJob
     const TMeta*  metaSrc;
     TMeta*        metaDst;
     const Pair*   pairSrc;
-    Pair*         pairDst;
+    TPairs        pairDst;
 };
 
 struct GenSortKeyJob
@@ -28,8 +29,8 @@ struct GenSortKeyJob
 template<size_t MAX_JOBS>
 void GenSortKey( ThreadPool& pool, uint64 length, uint32* keyBuffer );
 
-template<typename TMeta>
-void MapFxThread( MapFxJob<TMeta>* job );
+template<typename TMeta, typename TPairs>
+void MapFxThread( MapFxJob<TMeta, TPairs>* job );
 void GenSortKeyThread( GenSortKeyJob* job );
 
 //-----------------------------------------------------------
@@ -48,19 +49,19 @@ inline void SortFx(
 
 
 //-----------------------------------------------------------
-template<typename TMeta, size_t MAX_JOBS>
+template<typename TMeta, typename TPairs, size_t MAX_JOBS>
 inline void MapFxWithSortKey(
     ThreadPool&   pool,    uint64  length,  
     const uint32* sortKey,
     const TMeta*  metaSrc, TMeta*  metaDst,
-    const Pair*   pairSrc, Pair*   pairDst )
+    const Pair*   pairSrc, TPairs  pairDst )
 {
     // Sort metadata and pairs on y via the sort key
     const uint32 threadCount      = pool.ThreadCount();
     const uint64 entriesPerThread = length / threadCount;
     const uint64 trailingEntries  = length - ( entriesPerThread * threadCount );
 
-    MapFxJob<TMeta> jobs[MAX_JOBS];
+    MapFxJob<TMeta, TPairs> jobs[MAX_JOBS];
 
     for( uint32 i = 0; i < threadCount; i++ )
     {
@@ -77,12 +78,12 @@ inline void MapFxWithSortKey(
 
     jobs[threadCount-1].length += trailingEntries;
 
-    pool.RunJob( MapFxThread<TMeta>, jobs, threadCount );
+    pool.RunJob( MapFxThread<TMeta, TPairs>, jobs, threadCount );
 }
 
 //-----------------------------------------------------------
-template<typename TMeta>
-void MapFxThread( MapFxJob<TMeta>* job )
+template<typename TMeta, typename TPairs>
+void MapFxThread( MapFxJob<TMeta, TPairs>* job )
 {
     const uint64 length   = job->length;
     const uint64 offset   = job->offset;
@@ -98,10 +99,21 @@ void MapFxThread( MapFxJob<TMeta>* job )
 
     // Map pairs
     const Pair*  pairSrc  = job->pairSrc;
-    Pair*        pairDst  = job->pairDst + offset;
 
-    for( uint64 i = 0; i < length; i++ )
-        pairDst[i] = pairSrc[sortKey[i]];
+    if constexpr ( std::is_same<TPairs, PackedPairs>::value )
+    {
+        PackedPairs pairDst = job->pairDst;
+
+        for( uint64 i = 0; i < length; i++ )
+            pairDst.Set( offset + i, pairSrc[sortKey[i]] );
+    }
+    else
+    {
+        Pair* pairDst = job->pairDst + offset;
+
+        for( uint64 i = 0; i < length; i++ )
+            pairDst[i] = pairSrc[sortKey[i]];
+    }
 }
 
 
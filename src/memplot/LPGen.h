@@ -5,40 +5,34 @@
 ///
 /// Job structs
 ///
-
-struct SyncedJob
-{   
-    uint               _threadId;
-    uint               _threadCount;
-    std::atomic<uint>* _readyCount;
-    std::atomic<uint>* _releaseLock;
-    
-    inline void Init( const uint threadId, const uint threadCount, std::atomic<uint>& signal, std::atomic<uint>& releaseLock );
-    inline void WaitForThreads();
-};
-
-struct LPJob : public SyncedJob
+struct LPJob
 {
     uint32* lTable;             // Left table (x for Table 1, or lookup table to new indices otherwise)
     
-    uint64  length;             // R Table length
-    uint64  offset;             // Offset in R table to our entries
     Pair*   rTable;             // R table
+    PackedPairs packedRTable;   // R table, when stored as packed pairs
     uint64* lpBuffer;           // Where to store the pruned Pairs as line points
 
-    LPJob*  jobs;               // All threads participating in this job
-
     const byte* markedEntries;  // Marked entries that will not be pruned
     
     uint32* map;
 };
 
-template<bool PruneTable>
-void ProcessTableThread( LPJob* job );
+// These process the entries in [start, end)
+uint64 CountMarkedEntries( const byte* markedEntries, uint64 start, uint64 end );
+
+// Copies the marked entries to the LP buffer, starting at dstOffset
+template<bool CompactPairs>
+void PruneAndMap( const LPJob& job, uint64 start, uint64 end, uint64 dstOffset );
+
+void ConvertToLinePoints( const LPJob& job, uint64 start, uint64 end );
+void WriteLookupTable( const LPJob& job, uint64 start, uint64 end );
 
-void PruneAndMapThread( LPJob* job );
-void ConverToLinePointThread( LPJob* job );
-void WriteLookupTableThread( LPJob* job );
+// Writes the same lookup table as WriteLookupTable, for the first length entries of the map,
+// but groups them by L2-sized regions of the lookup table first, so that the writes stay
+// within one region at a time instead of being scattered all over the table.
+// packed and tmp must hold length uint64s each. tmp may be the map itself.
+void WriteLookupTableByRegion( ThreadPool& pool, const LPJob& job, uint64 length, uint64* packed, uint64* tmp );
 
 // Calculates x * (x-1) / 2. Division is done before multiplication.
 inline uint64 GetXEnc( uint64 x );
@@ -85,52 +79,3 @@ FORCE_INLINE uint64 SquareToLinePoint( uint64 x, uint64 y )
     return GetXEnc( x ) + y;
 }
 #pragma GCC diagnostic pop
-
-
-//-----------------------------------------------------------
-inline void SyncedJob::Init( const uint threadId, const uint threadCount, std::atomic<uint>& signal, std::atomic<uint>& releaseLock )
-{
-    _threadId    = threadId;
-    _threadCount = threadCount;
-    _readyCount  = &signal;
-    _releaseLock = &releaseLock;
-}
-
-//-----------------------------------------------------------
-inline void SyncedJob::WaitForThreads()
-{
-    std::atomic<uint>& readyCount  = *_readyCount;
-    std::atomic<uint>& releaseLock = *_releaseLock;
-
-    const uint targetCount = _threadCount - 1;
-
-    if( _threadId == 0 )
-    {
-        // Wait for all threads
-        while( readyCount.load( std::memory_order_relaxed ) != targetCount );
-        
-        // Signal all threads
-        releaseLock .store( 0, std::memory_order_release );
-        readyCount  .store( 0, std::memory_order_release );
-    }
-    else
-    {
-        // Signal control thread
-        uint count = readyCount.load( std::memory_order_acquire );
-
-        while( !readyCount.compare_exchange_weak( count, count+1, std::memory_order_release, std::memory_order_relaxed ) );
-
-        // Wait for control thread to signal us
-        while( readyCount.load( std::memory_order_relaxed ) != 0 );
-
-        // Ensure all threads have been released
-        count = releaseLock.load( std::memory_order_acquire );
-        while( !releaseLock.compare_exchange_weak( count, count+1, std::memory_order_release, std::memory_order_relaxed ) );
-        while( releaseLock.load( std::memory_order_relaxed ) != targetCount );
-    }
-}
-
-
-
-
-
@@ -0,0 +1,154 @@
+#include "MemArena.h"
+#include "Util.h"
+#include "util/Log.h"
+#include <algorithm>
+
+//-----------------------------------------------------------
+void MemArena::DeclareRegion( const char* name, void** target, size_t size, MemStep first, MemStep last )
+{
+    ASSERT( name );
+    ASSERT( target );
+    ASSERT( size );
+    ASSERT( first < MemStep::_Count && last < MemStep::_Count );
+
+    if( _regionCount >= MAX_REGIONS )
+        Fatal( "Too many memory regions declared." );
+
+    // Expand the lifetime to a step mask, wrapping around to the next plot if needed
+    const uint32 stepCount = (uint32)MemStep::_Count;
+
+    uint32 steps = 0;
+    for( uint32 i = (uint32)first; ; i = ( i + 1 ) % stepCount )
+    {
+        steps |= 1u << i;
+
+        if( i == (uint32)last )
+            break;
+    }
+
+    Region& region = _regions[_regionCount++];
+
+    region.name   = name;
+    region.target = target;
+    region.size   = RoundUpToNextBoundary( size, (int)Alignment );
+    region.steps  = steps;
+    region.first  = first;
+    region.last   = last;
+    region.offset = 0;
+}
+
+//-----------------------------------------------------------
+size_t MemArena::Plan()
+{
+    // Greedy by size: Place the largest (then longest-lived) regions first,
+    // each one at the lowest offset where it does not overlap any
+    // already-placed region that is live at the same time.
+    uint order[MAX_REGIONS];
+    for( uint i = 0; i < _regionCount; i++ )
+        order[i] = i;
+
+    auto stepCount = []( uint32 steps ) {
+        uint count = 0;
+        for( ; steps; steps &= steps - 1 )
+            count++;
+        return count;
+    };
+
+    std::stable_sort( order, order + _regionCount, [this, stepCount]( uint a, uint b ) {
+        const Region& ra = _regions[a];
+        const Region& rb = _regions[b];
+
+        if( ra.size != rb.size )
+            return ra.size > rb.size;
+
+        return stepCount( ra.steps ) > stepCount( rb.steps );
+    });
+
+    const Region* placed[MAX_REGIONS];
+    uint          placedCount = 0;
+
+    _size = 0;
+
+    for( uint i = 0; i < _regionCount; i++ )
+    {
+        Region& region = _regions[order[i]];
+
+        // Gather the placed regions that are live at the same time, in offset order
+        const Region* conflicts[MAX_REGIONS];
+        uint          conflictCount = 0;
+
+        for( uint j = 0; j < placedCount; j++ )
+        {
+            if( placed[j]->steps & region.steps )
+                conflicts[conflictCount++] = placed[j];
+        }
+
+        std::sort( conflicts, conflicts + conflictCount, []( const Region* a, const Region* b ) {
+            return a->offset < b->offset;
+        });
+
+        // Find the first gap that fits
+        size_t offset = 0;
+        for( uint j = 0; j < conflictCount; j++ )
+        {
+            const Region* r = conflicts[j];
+
+            if( offset + region.size <= r->offset )
+                break;
+
+            offset = std::max( offset, r->offset + r->size );
+        }
+
+        region.offset = offset;
+        placed[placedCount++] = &region;
+
+        _size = std::max( _size, offset + region.size );
+    }
+
+    return _size;
+}
+
+//-----------------------------------------------------------
+void MemArena::Bind( byte* arena )
+{
+    ASSERT( arena );
+    _base = arena;
+
+    for( uint i = 0; i < _regionCount; i++ )
+    {
+        const Region& region = _regions[i];
+        *region.target = arena + region.offset;
+    }
+}
+
+//-----------------------------------------------------------
+size_t MemArena::UnplannedSize() const
+{
+    size_t size = 0;
+    for( uint i = 0; i < _regionCount; i++ )
+        size += _regions[i].size;
+
+    return size;
+}
+
+//-----------------------------------------------------------
+void MemArena::PrintPlan() const
+{
+    // Lifetimes are printed with a character per step
+    const char stepNames[] = "F2234567P2345674";
+    static_assert( sizeof( stepNames ) - 1 == (size_t)MemStep::_Count );
+
+    Log::Verbose( "  %-15s   %-9s   %-9s   %s", "Buffer", "Offset", "Size", stepNames );
+
+    for( uint i = 0; i < _regionCount; i++ )
+    {
+        const Region& region = _regions[i];
+
+        char lifetime[sizeof( stepNames )] = { 0 };
+        for( uint j = 0; j < (uint)MemStep::_Count; j++ )
+            lifetime[j] = ( region.steps & ( 1u << j ) ) ? '#' : '.';
+
+        Log::Verbose( "  %-15s : %6.2lf GiB : %6.2lf GiB : %s", region.name,
+            (double)region.offset / (1ull GB), (double)region.size / (1ull GB), lifetime );
+    }
+}
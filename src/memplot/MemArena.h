@@ -0,0 +1,111 @@
+#pragma once
+
+// Steps of a single in-memory plot, in the order in which they run.
+// Buffer lifetimes are declared as inclusive ranges of these steps.
+enum class MemStep : uint
+{
+    F1 = 0,
+    P1Table2Fx,     // Table 2 pairing and fx. The previous plot may still be writing to disk during it.
+    P1Table2,       // Table 2 sort. The previous plot has finished writing by now.
+    P1Table3,
+    P1Table4,
+    P1Table5,
+    P1Table6,
+    P1Table7,
+    P2,
+    P3Table2,       // Compression of table n (the right table) with table n-1 (the left table)
+    P3Table3,
+    P3Table4,
+    P3Table5,
+    P3Table6,
+    P3Table7,
+    P4,
+
+    _Count
+};
+
+/**
+ * Plans the memory used by the in-memory plotter.
+ *
+ * Every phase declares the buffers it needs along with the steps during which
+ * they are live. The planner then assigns each buffer an offset in a single
+ * arena so that buffers whose lifetimes overlap never overlap in memory.
+ *
+ * A lifetime whose last step comes before its first step wraps around into
+ * the next plot. This is used for buffers that are still being written to
+ * disk in the background while the next plot starts. The next plot must
+ * not write to that memory until the writer has released it, see ForEachRegionInStep().
+ */
+class MemArena
+{
+public:
+    struct Region
+    {
+        const char* name;
+        void**      target;     // Pointer that will be bound to the region's address
+        size_t      size;
+        uint32      steps;      // Bit mask of the steps in which this region is live
+        MemStep     first;
+        MemStep     last;
+        size_t      offset;
+    };
+
+    template<typename T>
+    inline void Declare( const char* name, T*& target, size_t size, MemStep first, MemStep last )
+    {
+        DeclareRegion( name, (void**)&target, size, first, last );
+    }
+
+    // Assign offsets to all regions and return the total size required for the arena
+    size_t Plan();
+
+    // Assign the address of each region in the given arena to its target
+    void Bind( byte* arena );
+
+    // Calls func( void* address, size_t size ) for each region that a plot uses in the given step.
+    // The wrapped-around tail of a region's lifetime belongs to the previous plot, so it is skipped.
+    template<typename TFunc>
+    void ForEachRegionInStep( MemStep step, const TFunc& func ) const;
+
+    inline size_t Size() const { return _size; }
+
+    // Size that would be required if no buffers shared memory
+    size_t UnplannedSize() const;
+
+    void PrintPlan() const;
+
+    // Regions are aligned to this boundary
+    static constexpr size_t Alignment = 4096;
+
+private:
+    void DeclareRegion( const char* name, void** target, size_t size, MemStep first, MemStep last );
+
+private:
+    static constexpr uint MAX_REGIONS = 32;
+
+    Region _regions[MAX_REGIONS];
+    uint   _regionCount = 0;
+    size_t _size        = 0;
+    byte*  _base        = nullptr;
+};
+
+//-----------------------------------------------------------
+template<typename TFunc>
+inline void MemArena::ForEachRegionInStep( MemStep step, const TFunc& func ) const
+{
+    ASSERT( _base );
+
+    for( uint i = 0; i < _regionCount; i++ )
+    {
+        const Region& region = _regions[i];
+
+        const bool inPlot = region.first <= region.last ?
+            step >= region.first && step <= region.last :
+            step >= region.first;
+
+        if( inPlot )
+            func( (void*)( _base + region.offset ), region.size );
+    }
+}
+
+static_assert( (uint)MemStep::_Count <= 32, "Too many steps for the region step mask." );
@@ -0,0 +1,349 @@
+#include "MemCheckpoint.h"
+#include "PlotContext.h"
+#include "io/ParallelIO.h"
+#include "io/FileStream.h"
+#include "threading/ThreadPool.h"
+#include "threading/Thread.h"
+#include "util/Log.h"
+#include "Util.h"
+
+#define CHECKPOINT_MAGIC     "BBCKPT01"
+#define CHECKPOINT_VERSION   1
+#define CHECKPOINT_ALIGNMENT 4096
+
+//-----------------------------------------------------------
+MemCheckpoint::MemCheckpoint( const char* dir, uint ioThreadCount )
+    : _dir( dir )
+{
+    ASSERT( dir );
+    ASSERT( ioThreadCount );
+
+    // I/O threads are mostly blocked, so don't pin them to the plotting cores
+    _ioPool = new ThreadPool( ioThreadCount, ThreadPool::Mode::Fixed, true );
+
+    ZeroMem( &_header );
+
+    // Fail early if we can't write to the checkpoint directory.
+    // Use a file of its own, as the directory may hold a checkpoint to resume.
+    {
+        char path[1024];
+        GetProbePath( path, sizeof( path ) );
+
+        FileStream file;
+        if( !file.Open( path, FileMode::Create, FileAccess::Write ) )
+            Fatal( "Failed to create checkpoint file %s with error: %d", path, file.GetError() );
+
+        file.Close();
+        remove( path );
+    }
+}
+
+//-----------------------------------------------------------
+MemCheckpoint::~MemCheckpoint()
+{
+    WaitForSave();
+    delete _ioPool;
+}
+
+//-----------------------------------------------------------
+uint64 MemCheckpoint::GetRequiredDiskSpace( bool compactPairs )
+{
+    // Table 1's x values, the pairs of tables 2-7, table 7's y and the marks of tables 2-6
+    const uint64 pairsSize = compactPairs ? PackedPairs::TableSize : ENTRIES_PER_TABLE * sizeof( Pair );
+
+    return ENTRIES_PER_TABLE * ( sizeof( uint32 ) * 2 + sizeof( Pair ) + 5 ) + pairsSize * 5;
+}
+
+//-----------------------------------------------------------
+CheckpointPhase MemCheckpoint::Find( byte outPlotId[32], byte outMemo[128], uint16& outMemoSize, bool& outCompactPairs )
+{
+    Header header;
+    if( !ReadHeader( header ) )
+        return CheckpointPhase::None;
+
+    if( header.k != _K )
+    {
+        Log::Line( "Ignoring the checkpoint in %s, as it was saved for k%u.", _dir, header.k );
+        return CheckpointPhase::None;
+    }
+
+    memcpy( outPlotId, header.plotId, 32 );
+    memcpy( outMemo, header.memo, header.memoSize );
+    outMemoSize     = header.memoSize;
+    outCompactPairs = header.compactPairs != 0;
+
+    return (CheckpointPhase)header.phase;
+}
+
+//-----------------------------------------------------------
+CheckpointPhase MemCheckpoint::Restore( MemPlotContext& cx, CheckpointPhase maxPhase )
+{
+    ASSERT( !cx.spill );
+
+    Header header;
+    if( !ReadHeader( header ) || header.k != _K || header.compactPairs != (uint32)cx.compactPairs ||
+        memcmp( header.plotId, cx.plotId, 32 ) != 0 )
+        return CheckpointPhase::None;
+
+    _header = header;
+
+    Pair* lrTables[7] = { nullptr, cx.t2LRBuffer, cx.t3LRBuffer, cx.t4LRBuffer, cx.t5LRBuffer, cx.t6LRBuffer, cx.t7LRBuffer };
+
+    memcpy( cx.entryCount, header.entryCount, sizeof( cx.entryCount ) );
+
+    TransferFile( FileId::Table1X, cx.t1XBuffer, cx.entryCount[0], false );
+
+    for( uint i = (uint)TableId::Table2; i <= (uint)TableId::Table7; i++ )
+        TransferFile( (FileId)i, lrTables[i], cx.entryCount[i], false );
+
+    TransferFile( FileId::Table7Y, cx.t7YBuffer, cx.entryCount[6], false );
+
+    const CheckpointPhase phase = std::min( (CheckpointPhase)header.phase, maxPhase );
+
+    if( phase == CheckpointPhase::Phase2 )
+    {
+        TransferFile( FileId::Marks, cx.markingBuffer, ENTRIES_PER_TABLE * 5, false );
+
+        // Same layout as MemPhase2::ClearMarkingBuffers()
+        cx.usedEntries[0] = nullptr;
+
+        for( uint i = 0; i < 5; i++ )
+            cx.usedEntries[i+1] = cx.markingBuffer + i * ENTRIES_PER_TABLE;
+    }
+
+    return phase;
+}
+
+//-----------------------------------------------------------
+void MemCheckpoint::SaveTables( MemPlotContext& cx )
+{
+    ASSERT( !cx.spill );
+    WaitForSave();
+
+    // Invalidate the current checkpoint before its files are overwritten
+    Clear();
+
+    ZeroMem( &_header );
+    memcpy( _header.plotId, cx.plotId, 32 );
+    memcpy( _header.memo, cx.plotMemo, cx.plotMemoSize );
+    memcpy( _header.entryCount, cx.entryCount, sizeof( _header.entryCount ) );
+    _header.memoSize     = cx.plotMemoSize;
+    _header.compactPairs = cx.compactPairs ? 1 : 0;
+
+    _cx         = &cx;
+    _saveThread = new Thread();
+    _saveThread->Run( SaveTablesMain, this );
+}
+
+//-----------------------------------------------------------
+void MemCheckpoint::SaveMarks( MemPlotContext& cx )
+{
+    WaitForSave();
+
+    TransferFile( FileId::Marks, cx.markingBuffer, ENTRIES_PER_TABLE * 5, true );
+    WriteHeader( CheckpointPhase::Phase2 );
+}
+
+//-----------------------------------------------------------
+void MemCheckpoint::WaitForSave()
+{
+    if( !_saveThread )
+        return;
+
+    _saveThread->WaitForExit();
+    delete _saveThread;
+    _saveThread = nullptr;
+}
+
+//-----------------------------------------------------------
+void MemCheckpoint::Clear()
+{
+    WaitForSave();
+
+    char path[1024];
+    GetHeaderPath( path, sizeof( path ), false );
+    remove( path );
+
+    for( uint i = 0; i < (uint)FileId::_Count; i++ )
+    {
+        GetFilePath( (FileId)i, path, sizeof( path ) );
+        remove( path );
+    }
+}
+
+//-----------------------------------------------------------
+void MemCheckpoint::SaveTablesMain( void* data )
+{
+    ASSERT( data );
+    reinterpret_cast<MemCheckpoint*>( data )->SaveTablesThread();
+}
+
+//-----------------------------------------------------------
+void MemCheckpoint::SaveTablesThread()
+{
+    MemPlotContext& cx = *_cx;
+
+    auto timer = TimerBegin();
+
+    Pair* lrTables[7] = { nullptr, cx.t2LRBuffer, cx.t3LRBuffer, cx.t4LRBuffer, cx.t5LRBuffer, cx.t6LRBuffer, cx.t7LRBuffer };
+
+    TransferFile( FileId::Table1X, cx.t1XBuffer, cx.entryCount[0], true );
+
+    for( uint i = (uint)TableId::Table2; i <= (uint)TableId::Table7; i++ )
+        TransferFile( (FileId)i, lrTables[i], cx.entryCount[i], true );
+
+    TransferFile( FileId::Table7Y, cx.t7YBuffer, cx.entryCount[6], true );
+
+    WriteHeader( CheckpointPhase::Phase1 );
+
+    Log::Line( "  Saved the Phase 1 checkpoint in %.2lf seconds.", TimerEnd( timer ) );
+}
+
+//-----------------------------------------------------------
+bool MemCheckpoint::ReadHeader( Header& header )
+{
+    char path[1024];
+    GetHeaderPath( path, sizeof( path ), false );
+
+    FILE* file = fopen( path, "rb" );
+    if( !file )
+        return false;
+
+    const bool ok = fread( &header, sizeof( header ), 1, file ) == 1;
+    fclose( file );
+
+    if( !ok || memcmp( header.magic, CHECKPOINT_MAGIC, sizeof( header.magic ) ) != 0 ||
+        header.version != CHECKPOINT_VERSION || header.memoSize > sizeof( header.memo ) ||
+        header.phase < (uint32)CheckpointPhase::Phase1 || header.phase > (uint32)CheckpointPhase::Phase2 )
+    {
+        Log::Error( "Warning: Ignoring invalid checkpoint file %s.", path );
+        return false;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+void MemCheckpoint::WriteHeader( CheckpointPhase phase )
+{
+    memcpy( _header.magic, CHECKPOINT_MAGIC, sizeof( _header.magic ) );
+    _header.version = CHECKPOINT_VERSION;
+    _header.k       = _K;
+    _header.phase   = (uint32)phase;
+
+    char tmpPath[1024], path[1024];
+    GetHeaderPath( tmpPath, sizeof( tmpPath ), true  );
+    GetHeaderPath( path   , sizeof( path    ), false );
+
+    // Write to a temporary file which replaces the header once it's on disk
+    FileStream file;
+    if( !file.Open( tmpPath, FileMode::Create, FileAccess::Write ) ||
+        file.Write( &_header, sizeof( _header ) ) != (ssize_t)sizeof( _header ) ||
+        !file.Flush() )
+    {
+        Fatal( "Failed to write checkpoint file %s with error: %d", tmpPath, file.GetError() );
+    }
+    file.Close();
+
+    if( rename( tmpPath, path ) != 0 )
+        Fatal( "Failed to rename checkpoint file %s to %s.", tmpPath, path );
+}
+
+//-----------------------------------------------------------
+void MemCheckpoint::TransferFile( FileId id, void* buffer, uint64 entryCount, bool write )
+{
+    char path[1024];
+    GetFilePath( id, path, sizeof( path ) );
+
+    // Files hold 1 or 2 planes: a single buffer or packed pair planes
+    struct Plane
+    {
+        byte*  buffer;
+        uint64 fileOffset;
+        size_t size;
+    };
+
+    Plane planes[2];
+    uint  planeCount = 1;
+
+    const bool isPairTable = id >= (FileId)TableId::Table2 && id <= (FileId)TableId::Table7;
+    const bool isPacked    = _header.compactPairs && id >= (FileId)TableId::Table2 && id <= (FileId)TableId::Table6;
+
+    if( isPacked )
+    {
+        PackedPairs pairs( buffer );
+
+        const size_t leftSize   = RoundUpToNextBoundary( entryCount * sizeof( uint32 ), CHECKPOINT_ALIGNMENT );
+        const size_t offsetSize = RoundUpToNextBoundary( entryCount * sizeof( uint16 ), CHECKPOINT_ALIGNMENT );
+
+        planes[0] = { (byte*)pairs.left  , 0       , leftSize   };
+        planes[1] = { (byte*)pairs.offset, leftSize, offsetSize };
+        planeCount = 2;
+    }
+    else
+    {
+        const size_t entrySize = id == FileId::Marks ? sizeof( byte ) :
+                                 isPairTable         ? sizeof( Pair ) : sizeof( uint32 );
+
+        planes[0] = { (byte*)buffer, 0, RoundUpToNextBoundary( entryCount * entrySize, CHECKPOINT_ALIGNMENT ) };
+    }
+
+    // Create the file once, as the planes are written to it separately
+    if( write )
+    {
+        const Plane& last = planes[planeCount-1];
+
+        int error = 0;
+        if( !CreateParallelIOFile( path, last.fileOffset + last.size, error ) )
+            Fatal( "Failed to create checkpoint file %s with error: %d", path, error );
+    }
+
+    for( uint i = 0; i < planeCount; i++ )
+    {
+        const Plane& plane = planes[i];
+
+        int  error = 0;
+        bool ok;
+
+        if( write )
+            ok = ParallelWriteFile( *_ioPool, path, plane.fileOffset, plane.buffer, plane.size, error );
+        else
+            ok = ParallelReadFile( *_ioPool, path, plane.fileOffset, plane.buffer, plane.size, error );
+
+        if( !ok )
+            Fatal( "Failed to %s checkpoint file %s with error: %d", write ? "write" : "read", path, error );
+    }
+}
+
+//-----------------------------------------------------------
+void MemCheckpoint::GetFilePath( FileId id, char* path, size_t pathSize )
+{
+    const size_t dirLength = strlen( _dir );
+    const bool   hasSlash  = dirLength && ( _dir[dirLength-1] == '/' || _dir[dirLength-1] == '\\' );
+    const char*  sep       = hasSlash ? "" : "/";
+
+    if( id == FileId::Table7Y )
+        snprintf( path, pathSize, "%s%sbladebit_checkpoint_t7_y.tmp", _dir, sep );
+    else if( id == FileId::Marks )
+        snprintf( path, pathSize, "%s%sbladebit_checkpoint_marks.tmp", _dir, sep );
+    else
+        snprintf( path, pathSize, "%s%sbladebit_checkpoint_t%u.tmp", _dir, sep, (uint)id+1 );
+}
+
+//-----------------------------------------------------------
+void MemCheckpoint::GetProbePath( char* path, size_t pathSize )
+{
+    const size_t dirLength = strlen( _dir );
+    const bool   hasSlash  = dirLength && ( _dir[dirLength-1] == '/' || _dir[dirLength-1] == '\\' );
+
+    snprintf( path, pathSize, "%s%sbladebit_checkpoint_probe.tmp", _dir, hasSlash ? "" : "/" );
+}
+
+//-----------------------------------------------------------
+void MemCheckpoint::GetHeaderPath( char* path, size_t pathSize, bool tmp )
+{
+    const size_t dirLength = strlen( _dir );
+    const bool   hasSlash  = dirLength && ( _dir[dirLength-1] == '/' || _dir[dirLength-1] == '\\' );
+
+    snprintf( path, pathSize, "%s%sbladebit_checkpoint%s", _dir, hasSlash ? "" : "/", tmp ? ".hdr.tmp" : ".hdr" );
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include "ChiaConsts.h"
+
+class ThreadPool;
+class Thread;
+struct MemPlotContext;
+
+// Last phase whose state was saved to a checkpoint
+enum class CheckpointPhase : uint32
+{
+    None   = 0,
+    Phase1 = 1,     // Tables 1-7 and table 7's y
+    Phase2 = 2      // Same as Phase1 plus the marked entries of tables 2-6
+};
+
+/**
+ * Saves the state of a plot at the end of Phases 1 and 2 to a directory,
+ * so that a plot interrupted by a crash or a kill can be resumed from the
+ * last phase completed instead of starting over.
+ *
+ * Each buffer is saved to its own file with parallel direct I/O. A small header
+ * file describing the plot and the last phase saved is written last, and is
+ * replaced atomically, so a checkpoint is only ever seen once all its files are complete.
+ *
+ * Phase 1's tables are saved in the background while Phase 2 runs, as it only reads them.
+ */
+class MemCheckpoint
+{
+public:
+    MemCheckpoint( const char* dir, uint ioThreadCount );
+    ~MemCheckpoint();
+
+    // Free space needed in the checkpoint directory
+    static uint64 GetRequiredDiskSpace( bool compactPairs );
+
+    // Finds a checkpoint left in the directory.
+    // Returns the phase it was saved at, or None if there's none.
+    CheckpointPhase Find( byte outPlotId[32], byte outMemo[128], uint16& outMemoSize, bool& outCompactPairs );
+
+    // Loads the tables, and the marked entries if they were saved and maxPhase allows it,
+    // of the checkpoint of the given plot into the context's buffers. Returns the phase
+    // that was loaded, or None if the directory has no checkpoint of that plot.
+    CheckpointPhase Restore( MemPlotContext& cx, CheckpointPhase maxPhase = CheckpointPhase::Phase2 );
+
+    // Starts saving the tables at the end of Phase 1 in the background.
+    // The tables must not be modified until WaitForSave() returns.
+    void SaveTables( MemPlotContext& cx );
+
+    // Saves the marked entries at the end of Phase 2. Waits for the tables to be saved first.
+    void SaveMarks( MemPlotContext& cx );
+
+    // Waits until the tables have been saved
+    void WaitForSave();
+
+    // Deletes the checkpoint, once its plot has been written
+    void Clear();
+
+private:
+    struct Header
+    {
+        char   magic[8];
+        uint32 version;
+        uint32 k;
+        uint32 compactPairs;
+        uint32 phase;
+        byte   plotId[32];
+        uint16 memoSize;
+        byte   memo[128];
+        uint64 entryCount[7];
+    };
+
+    enum class FileId : uint
+    {
+        Table1X = 0,    // Tables 1-7 are files 0-6
+        Table7Y = 7,
+        Marks   = 8,
+
+        _Count
+    };
+
+    static void SaveTablesMain( void* data );
+    void SaveTablesThread();
+
+    bool ReadHeader( Header& header );
+    void WriteHeader( CheckpointPhase phase );
+
+    // Writes or reads table 1's x, the pairs of tables 2-7, table 7's y or the marked entries
+    void TransferFile( FileId id, void* buffer, uint64 entryCount, bool write );
+
+    void GetFilePath( FileId id, char* path, size_t pathSize );
+    void GetHeaderPath( char* path, size_t pathSize, bool tmp );
+    void GetProbePath( char* path, size_t pathSize );
+
+private:
+    const char*     _dir;
+    ThreadPool*     _ioPool;
+    Thread*         _saveThread = nullptr;
+
+    // State of the plot being saved
+    MemPlotContext* _cx         = nullptr;
+    Header          _header;
+};
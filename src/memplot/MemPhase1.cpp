@@ -6,9 +6,13 @@
 #include "FxSort.h"
 #include "algorithm/YSort.h"
 #include "SysHost.h"
+#include "MemSpill.h"
+#include "MemCheckpoint.h"
 #include <cmath>
+#include <numeric>
 
 #include "DbgHelper.h"
+#include "util/PerfCounters.h"
     
     bool DbgVerifySortedY( const uint64 entryCount, const uint64* yBuffer );
     
@@ -44,27 +48,6 @@ struct F1GenJob
     uint32* xBuffer;
 };
 
-struct kBCJob
-{
-    const uint64* yBuffer;
-    uint64        maxCount;         // Max group count for scan job, pair count for pair job.
-    uint64        groupCount;
-    uint32*       groupBoundaries;
-    uint64        startIndex;
-
-    // For scan job
-    uint64 endIndex;
-
-    // For scan job
-    uint64 pairCount;        // Group count for scan job, pair count for pair job.
-    Pair*  pairs;
-    Pair*  copyDst;          // For second pass
-
-#if DEBUG
-    uint32 jobIdx;
-#endif
-};
-
 
 template<typename TYOut, typename TMetaIn, typename TMetaOut>
 struct FpFxJob
@@ -82,7 +65,7 @@ void F1JobThread( F1GenJob* job );
 void F1NumaJobThread( F1GenJob* job );
 
 void FpScanThread( kBCJob* job );
-void FpPairThread( kBCJob* job );
+uint64 FpPairGroups( const kBCJob& job, uint64 groupStart, uint64 groupEnd, Pair* pairs, uint64 maxPairs );
 
 template<typename TYOut, typename TMetaIn, typename TMetaOut>
 void ComputeFxJob( FpFxJob<TYOut, TMetaIn, TMetaOut>* job );
@@ -90,6 +73,9 @@ void ComputeFxJob( FpFxJob<TYOut, TMetaIn, TMetaOut>* job );
 template<size_t metaKMultiplierIn, size_t metaKMultiplierOut, uint ShiftBits>
 FORCE_INLINE uint64 ComputeFx( uint64 y, uint64* metaData, uint64* metaOut );
 
+template<size_t metaKMultiplierIn, size_t metaKMultiplierOut, uint ShiftBits>
+uint64 ComputeFxAnyK( uint64 y, const uint64* metaData, uint64* metaOut );
+
 
 
 //----------------------------------------------------------
@@ -99,24 +85,134 @@ MemPhase1::MemPhase1( MemPlotContext& context )
     LoadLTargets();
 }
 
+//-----------------------------------------------------------
+void MemPhase1::DeclareBuffers( MemArena& arena, MemPlotContext& cx )
+{
+    // YBuffers need to round up to chacha block size, so we just add an extra block always
+    const size_t chachaBlockSize = kF1BlockSizeBits / 8;
+
+    const size_t yBufferSize     = ENTRIES_PER_TABLE * sizeof( uint64 ) + chachaBlockSize;
+    const size_t metaBufferSize  = ENTRIES_PER_TABLE * sizeof( Meta4 );
+    const size_t xBufferSize     = ENTRIES_PER_TABLE * sizeof( uint32 );
+
+    // Table 7's pairs are not packed as its buffer is used for the unsorted pairs of every table
+    const size_t pairBufferSize  = ENTRIES_PER_TABLE * sizeof( Pair );
+    const size_t lrBufferSize    = cx.compactPairs ? PackedPairs::TableSize : pairBufferSize;
+
+    if( cx.spillDir )
+    {
+        // Finished tables are spilled to disk, so only the table being
+        // written (and the previous one, which may still be spilling) stay in memory.
+        // Table 1's x values are not needed again in this phase after table 2's fx.
+        arena.Declare( "t1XSpill"   , cx.t1XSpillBuffer, xBufferSize , MemStep::F1      , MemStep::P1Table2 );
+        arena.Declare( "spillSlot0" , cx.spillSlots[0] , lrBufferSize, MemStep::P1Table2, MemStep::P1Table7 );
+        arena.Declare( "spillSlot1" , cx.spillSlots[1] , lrBufferSize, MemStep::P1Table3, MemStep::P1Table7 );
+    }
+    else
+    {
+        // The table 2-6 L/R buffers hold the parks of the previous plot
+        // until this plot writes its own pairs to them, so they are live throughout.
+        arena.Declare( "t1XBuffer"  , cx.t1XBuffer  , xBufferSize   , MemStep::F1        , MemStep::P4         );
+        arena.Declare( "t2LRBuffer" , cx.t2LRBuffer , lrBufferSize  , MemStep::P1Table2  , MemStep::P1Table2Fx );
+        arena.Declare( "t3LRBuffer" , cx.t3LRBuffer , lrBufferSize  , MemStep::P1Table3  , MemStep::P1Table2   );
+        arena.Declare( "t4LRBuffer" , cx.t4LRBuffer , lrBufferSize  , MemStep::P1Table4  , MemStep::P1Table3   );
+        arena.Declare( "t5LRBuffer" , cx.t5LRBuffer , lrBufferSize  , MemStep::P1Table5  , MemStep::P1Table4   );
+        arena.Declare( "t6LRBuffer" , cx.t6LRBuffer , lrBufferSize  , MemStep::P1Table6  , MemStep::P1Table5   );
+    }
+
+    arena.Declare( "t7LRBuffer" , cx.t7LRBuffer , pairBufferSize, MemStep::P1Table2Fx, MemStep::P3Table7 );
+    arena.Declare( "t7YBuffer"  , cx.t7YBuffer  , xBufferSize   , MemStep::P1Table2  , MemStep::P4       );
+
+    arena.Declare( "yBuffer0"   , cx.yBuffer0   , yBufferSize   , MemStep::F1        , MemStep::P1Table7 );
+    arena.Declare( "yBuffer1"   , cx.yBuffer1   , yBufferSize   , MemStep::F1        , MemStep::P1Table7 );
+    arena.Declare( "metaBuffer1", cx.metaBuffer1, metaBufferSize, MemStep::F1        , MemStep::P1Table7 );
+
+    // meta0 is not touched until the previous plot has finished writing
+    arena.Declare( "metaBuffer0", cx.metaBuffer0, metaBufferSize, MemStep::P1Table2  , MemStep::P1Table7 );
+
+    // Some table's kBC group pairings yield more values than 2^k. 
+    // Therefore, we need to have some overflow space for kBC pairs.
+    // We get an average of 236 entries per group.
+    // We use a yBuffer for to mark group boundaries, 
+    // so we fit as many as we can in it.
+    cx.maxKBCGroups = yBufferSize / sizeof( uint32 );
+
+    // Since we use a meta buffer (64GiB at k32) for pairing,
+    // we can just use all its space to fit pairs.
+    cx.maxPairs     = metaBufferSize / sizeof( Pair );
+}
+
+//-----------------------------------------------------------
+void MemPhase1::WaitForPreviousPlotBuffers( MemStep step )
+{
+    MemPlotContext& cx = _context;
+
+    // No previous plot being written
+    if( !cx.p4WriteBuffer )
+        return;
+
+    auto timer = TimerBegin();
+
+    cx.arena->ForEachRegionInStep( step, [&]( void* address, size_t size ) {
+
+        if( !cx.plotWriter->WaitForBufferReleased( address, size ) )
+            Fatal( "Failed to write previous plot file %s with error: %d", 
+                cx.plotWriter->FilePath().c_str(), cx.plotWriter->GetError() );
+    });
+
+    _writerWaitTime += TimerEnd( timer );
+
+    if( cx.plotWriter->HasFinishedWriting() )
+        WaitForPreviousPlotWriter();
+}
+
 //-----------------------------------------------------------
 void MemPhase1::WaitForPreviousPlotWriter()
 {
     // Wait until the current plot has finished writing
+    auto timer = TimerBegin();
+
     if( !_context.plotWriter->WaitUntilFinishedWriting() )
         Fatal( "Failed to write previous plot file %s with error: %d", 
             _context.plotWriter->FilePath().c_str(),
             _context.plotWriter->GetError() );
 
+    _writerWaitTime += TimerEnd( timer );
+    const double overlapTime = TimerEnd( _startTime );
+
+    _context.stats.prevWriteOverlapSeconds = overlapTime;
+    _context.stats.prevWriteWaitSeconds    = _writerWaitTime;
+
+    // The previous plot is complete, its checkpoint is no longer needed
+    if( _context.checkpoint )
+        _context.checkpoint->Clear();
+
+    if( _context.plotWriter->IsDiscarding() )
+    {
+        Log::Line( "" );
+        Log::Line( "Previous plot %s was discarded (benchmark mode).", _context.plotWriter->FilePath().c_str() );
+        Log::Line( "  Checksum (BLAKE3) : %s", _context.plotWriter->GetChecksum() );
+        Log::Line( "  Overlapped this plot for %.2lf seconds, %.2lf of which were spent waiting for it.",
+            overlapTime, _writerWaitTime );
+        Log::Line( "" );
+
+        _context.p4WriteBuffer = nullptr;
+        return;
+    }
+
     const char* curname = _context.plotWriter->FilePath().c_str();
     char* newname = new char[strlen(curname) - 3]();
     memcpy(newname, curname, strlen(curname) - 4);
 
-    rename(curname, newname);
+    const int r = rename(curname, newname);
 
     // Print final pointer offsets
     Log::Line( "" );
     Log::Line( "Previous plot %s finished writing to disk:", _context.plotWriter->FilePath().c_str() );
+
+    if( !_context.plotWriter->WriteChecksumFile( r ? curname : newname ) )
+        Log::Error( "Warning: Failed to write checksum file for plot %s.", r ? curname : newname );
+
     const uint64* tablePointers = _context.plotWriter->GetTablePointers();
     for( uint i = 0; i < 7; i++ )
     {
@@ -129,18 +225,47 @@ void MemPhase1::WaitForPreviousPlotWriter()
         const uint64 ptr = Swap64( tablePointers[i] );
         Log::Line( "  C%u table pointer : %16lu ( 0x%016lx )", i+1-7, ptr, ptr);
     }
+    Log::Line( "  Checksum (BLAKE3) : %s", _context.plotWriter->GetChecksum() );
+    Log::Line( "  Overlapped this plot for %.2lf seconds, %.2lf of which were spent waiting for it.",
+        overlapTime, _writerWaitTime );
     Log::Line( "" );
 
+    delete[] newname;
     _context.p4WriteBuffer = nullptr;
 }
 
 //----------------------------------------------------------
 void MemPhase1::Run()
 {
-    const uint64 entryCount = GenerateF1();
+    MemPlotContext& cx = _context;
+
+    // When spilling, tables alternate between the 2 spill slots
+    if( cx.spill )
+    {
+        cx.t1XBuffer  = cx.t1XSpillBuffer;
+        cx.t2LRBuffer = cx.spillSlots[0];
+        cx.t3LRBuffer = cx.spillSlots[1];
+        cx.t4LRBuffer = cx.spillSlots[0];
+        cx.t5LRBuffer = cx.spillSlots[1];
+        cx.t6LRBuffer = cx.spillSlots[0];
+    }
+
+    _startTime      = TimerBegin();
+    _writerWaitTime = 0;
+
+    WaitForPreviousPlotBuffers( MemStep::F1 );
+
+    const uint64 entryCount = GenerateF1( 1ull << _K );
 
     ForwardPropagate( entryCount );
 
+    // The previous plot must have finished before this one starts writing
+    if( cx.p4WriteBuffer )
+    {
+        Log::Line( " Waiting for last plot to finish being written to disk..." );
+        WaitForPreviousPlotWriter();
+    }
+
 
     #if DBG_WRITE_PHASE_1_TABLES
         WritePhaseTableFiles( _context );
@@ -166,7 +291,7 @@ void MemPhase1::Run()
 
 
 //-----------------------------------------------------------
-uint64 MemPhase1::GenerateF1()
+uint64 MemPhase1::GenerateF1( const uint64 totalEntries )
 {
     MemPlotContext& cx  = _context;
 
@@ -180,20 +305,23 @@ uint64 MemPhase1::GenerateF1()
     ///
     /// Prepare jobs
     ///
-    const uint   k                  = _K;
     const size_t CHACHA_BLOCK_SIZE  = kF1BlockSizeBits / 8;
     const uint   numThreads         = cx.threadCount;
 
-    const uint64 totalEntries       = 1ull << k;
-    const uint64 entriesPerBlock    = CHACHA_BLOCK_SIZE / sizeof( uint32 );
-    const uint64 totalBlocks        = totalEntries / entriesPerBlock;
-    const uint64 blocksPerThread    = totalBlocks / numThreads;
-    const uint64 entriesPerThread   = blocksPerThread * entriesPerBlock;
+    // Each y is the next k bits of the chacha keystream.
+    // Threads are given whole units of blocks which hold a whole number of entries:
+    // A single block of 16 entries at k32.
+    const uint64 unitGcd            = std::gcd( (uint64)kF1BlockSizeBits, (uint64)_K );
+    const uint64 entriesPerUnit     = kF1BlockSizeBits / unitGcd;
+    const uint64 blocksPerUnit      = _K / unitGcd;
 
-    const uint64 trailingEntries    = totalEntries - ( entriesPerThread * numThreads );
-    const uint64 trailingBlocks     = CDiv( trailingEntries, entriesPerBlock );
+    const uint64 totalUnits         = totalEntries / entriesPerUnit;
+    const uint64 unitsPerThread     = totalUnits / numThreads;
+    const uint64 blocksPerThread    = unitsPerThread * blocksPerUnit;
+    const uint64 entriesPerThread   = unitsPerThread * entriesPerUnit;
 
-    ASSERT( entriesPerBlock * sizeof( uint32 ) == CHACHA_BLOCK_SIZE );  // Must fit exactly within a block
+    const uint64 trailingEntries    = totalEntries - ( entriesPerThread * numThreads );
+    const uint64 trailingBlocks     = CDiv( trailingEntries * _K, kF1BlockSizeBits );
 
     // Generate all of the y values to a metabuffer first
     byte*   blocks  = (byte*)cx.yBuffer0;
@@ -267,22 +395,28 @@ uint64 MemPhase1::GenerateF1()
 
         Log::Line( "Generating F1..." );
         auto timeStart = TimerBegin();
+        PerfSpan perf( cx.perf );
 
         // cx.threadPool->RunJob( numa ? F1NumaJobThread : F1JobThread, jobs, numThreads );
         cx.threadPool->RunJob( F1JobThread, jobs, numThreads );
 
         double elapsed = TimerEnd( timeStart );
         Log::Line( "Finished F1 generation in %.2lf seconds.", elapsed );
+        perf.Log( "F1 generation" );
+        cx.stats.f1Seconds = elapsed;
     }
 
     Log::Line( "Sorting F1..." );
     auto timeStart = TimerBegin();
+    PerfSpan perf( cx.perf );
 
     YSorter sorter( *cx.threadPool );
     sorter.Sort( totalEntries, yTmp, yBuffer, xTmp, xBuffer );
 
     double elapsed = TimerEnd( timeStart );
     Log::Line( "Finished F1 sort in %.2lf seconds.", elapsed );
+    perf.Log( "F1 sort" );
+    cx.stats.f1SortSeconds = elapsed;
 
 
     #if DBG_VERIFY_SORT_F1
@@ -332,6 +466,18 @@ void MemPhase1::ForwardPropagate( uint64 table1EntryCount )
     cx.entryCount[4] = table5EntryCount;
     cx.entryCount[5] = table6EntryCount;
     cx.entryCount[6] = table7EntryCount;
+
+    // The spill slots are released after this phase
+    if( cx.spill )
+    {
+        Log::Line( " Waiting for tables to finish spilling to disk..." );
+        auto timer = TimerBegin();
+
+        cx.spill->WaitAll();
+
+        double elapsed = TimerEnd( timer );
+        Log::Line( " Waited %.2lf seconds for tables to spill.", elapsed );
+    }
 }
 
 //-----------------------------------------------------------
@@ -388,17 +534,40 @@ uint64 MemPhase1::FpComputeSingleTable(
 
     auto tableTimer = TimerBegin();
 
+    // Make sure the previous plot is done with the memory this table uses
+    if constexpr ( tableId == TableId::Table2 )
+        WaitForPreviousPlotBuffers( MemStep::P1Table2Fx );
+    else
+        WaitForPreviousPlotBuffers( MemStep( (uint)MemStep::P1Table2 + (uint)tableId - (uint)TableId::Table2 ) );
+
+    // Spill slot 1 may share memory with table 1's x values
+    if constexpr ( tableId == TableId::Table3 )
+    {
+        if( cx.spill )
+            cx.spill->WaitForTable( TableId::Table1 );
+    }
+
+    PlotStats::P1Table& stats = cx.stats.p1Tables[(uint)tableId];
+
     uint64 pairCount;
     {
+        auto timer = TimerBegin();
+
         kBCJob jobs[MAX_THREADS];
 
         // Scan for kBC groups
+        PerfSpan scanPerf( cx.perf );
         const uint64 groupCount = FpScan( entryCount, yBuffer.read, groupBoundaries, jobs );
+        scanPerf.Log( "  Scan" );
         
         // Generate L/R pairs from kBC groups (writes to unsorted pair buffer)
         Pair* tmpPairBuffer = (Pair*)metaBuffer.write;
 
         pairCount = FpPair( yBuffer.read, jobs, groupCount, tmpPairBuffer, unsortedPairBuffer );
+
+        stats.pairSeconds = TimerEnd( timer );
+        stats.groupCount  = groupCount;
+        stats.entryCount  = pairCount;
     }
 
     // Compute fx values for this new table
@@ -418,14 +587,17 @@ uint64 MemPhase1::FpComputeSingleTable(
 
     // DbgVerifyPairsKBCGroups( pairCount, yBuffer.read, unsortedPairBuffer );
 
-    // If a previous plot was being written to disk, we need to ensure
-    // it finished as we are about to use meta0 which is used to write the
-    // last buffers written to disk.
-    if( cx.p4WriteBuffer )
+    // Table 1's x values are not used again until Phase 3
+    if constexpr ( tableId == TableId::Table2 )
     {
-        Log::Line( " Waiting for last plot to finish being written to disk..." );
-        WaitForPreviousPlotWriter();
-    }   
+        if( cx.spill )
+            cx.spill->SpillTable( TableId::Table1, cx.t1XBuffer, entryCount, false );
+    }
+
+    // We are about to use meta0 and this table's pair buffer,
+    // which may share memory with the previous plot's last tables.
+    if constexpr ( tableId == TableId::Table2 )
+        WaitForPreviousPlotBuffers( MemStep::P1Table2 );
 
     // Swap buffers here, ready for sort
     yBuffer   .Swap();
@@ -436,6 +608,7 @@ uint64 MemPhase1::FpComputeSingleTable(
     {
         Log::Line( "  Sorting entries..." );
         auto timer = TimerBegin();
+        PerfSpan perf( cx.perf );
 
         // Use table 7's buffers as a temporary buffer
         uint32* sortKey    = cx.t7YBuffer;
@@ -450,19 +623,40 @@ uint64 MemPhase1::FpComputeSingleTable(
 
         // DbgVerifyPairsKBCGroups( pairCount, yBuffer.write, unsortedPairBuffer );
 
-        MapFxWithSortKey<TMetaOut, MAX_THREADS>(
-            *cx.threadPool, pairCount, sortKey,
-            (TMetaOut*)metaBuffer.read, (TMetaOut*)metaBuffer.write,
-            unsortedPairBuffer,         pairBuffer   // Write to the final pair buffer
-        );
+        // Our pair buffer is the spill slot of table n-2, make sure it's been spilled
+        if( cx.spill && tableId >= TableId::Table4 )
+            cx.spill->WaitForTable( TableId( (uint)tableId - 2 ) );
+
+        // Write to the final pair buffer
+        if( cx.compactPairs )
+        {
+            MapFxWithSortKey<TMetaOut, PackedPairs, MAX_THREADS>(
+                *cx.threadPool, pairCount, sortKey,
+                (TMetaOut*)metaBuffer.read, (TMetaOut*)metaBuffer.write,
+                unsortedPairBuffer,         PackedPairs( pairBuffer )
+            );
+        }
+        else
+        {
+            MapFxWithSortKey<TMetaOut, Pair*, MAX_THREADS>(
+                *cx.threadPool, pairCount, sortKey,
+                (TMetaOut*)metaBuffer.read, (TMetaOut*)metaBuffer.write,
+                unsortedPairBuffer,         pairBuffer
+            );
+        }
 
         // DbgVerifyPairsKBCGroups( pairCount, yBuffer.write, pairBuffer );
 
+        if( cx.spill )
+            cx.spill->SpillTable( tableId, pairBuffer, pairCount, cx.compactPairs );
+
         // Use the sorted metabuffer as the read buffer for the next table
         metaBuffer.Swap();
 
         double elapsed = TimerEnd( timer );
         Log::Line( "  Finished sorting in %.2lf seconds.", elapsed );
+        perf.Log( "  Sort" );
+        stats.sortSeconds = elapsed;
         // Log::Line( "  Entries after sort: %llu/%llu (%.2lf%%).", entryCount, pairCount, (entryCount / (f64)pairCount) * 100 );
 
         #if DBG_VERIFY_SORT_FX
@@ -492,6 +686,7 @@ uint64 MemPhase1::FpComputeSingleTable(
 
     double tableElapsed = TimerEnd( tableTimer );
     Log::Line( "Finished forward propagating table %d in %.2lf seconds.", (int)tableId+1, tableElapsed );
+    stats.seconds = tableElapsed;
 
     return pairCount;
 }
@@ -516,10 +711,34 @@ void F1JobThread( F1GenJob* job )
     chacha8_get_keystream( &chacha, blockIdx, blockCount, (byte*)blocks );
 
     // chacha output is treated as big endian, therefore swap, as required by chiapos
-    for( uint64 i = 0; i < entryCount; i++ )
+    if constexpr ( _K == 32 )
     {
-        const uint64 y = Swap32( blocks[i] );
-        yBuffer[i] = ( y << kExtraBits ) | ( (x+i) >> (_K - kExtraBits) );
+        for( uint64 i = 0; i < entryCount; i++ )
+        {
+            const uint64 y = Swap32( blocks[i] );
+            yBuffer[i] = ( y << kExtraBits ) | ( (x+i) >> (_K - kExtraBits) );
+        }
+    }
+    else
+    {
+        // Entries straddle bytes. Read only the bytes holding each one,
+        // as the next thread's blocks may still be being generated.
+        const byte* bytes = (byte*)blocks;
+
+        for( uint64 i = 0; i < entryCount; i++ )
+        {
+            const uint64 bitStart  = i * _K;
+            const uint   bitOffset = (uint)( bitStart % 8 );
+            const uint   byteCount = (uint)CDiv( bitOffset + _K, 8 );
+            const byte*  src       = bytes + bitStart / 8;
+
+            uint64 field = 0;
+            for( uint b = 0; b < byteCount; b++ )
+                field = ( field << 8 ) | src[b];
+
+            const uint64 y = ( field >> ( byteCount * 8 - bitOffset - _K ) ) & ( ( 1ull << _K ) - 1 );
+            yBuffer[i] = ( y << kExtraBits ) | ( (x+i) >> (_K - kExtraBits) );
+        }
     }
 
     // Gen the x that generated the y
@@ -673,7 +892,6 @@ uint64 MemPhase1::FpScan( const uint64 entryCount, const uint64* yBuffer, uint32
 
         job.yBuffer    = yBuffer;
         job.groupCount = 0;
-        job.copyDst    = nullptr;
 
         const uint64 idx      = entryCount / threadCount * i;
         const uint64 y        = yBuffer[idx];
@@ -891,62 +1109,97 @@ uint64 MemPhase1::FpPair( const uint64* yBuffer, kBCJob jobs[MAX_THREADS],
 
     Log::Line( "  Pairing L/R groups..." );
     auto timer = TimerBegin();
+    PerfSpan perf( cx.perf );
 
-    const uint64 maxTotalpairs     = cx.maxPairs;
-    const uint64 maxPairsPerThread = maxTotalpairs / threadCount;
+    // Groups are paired in small chunks, so that threads can balance the load.
+    // Each chunk writes its pairs to a fixed slot of the temporary buffer,
+    // and the slots are then copied, in order, to the destination buffer.
+    const uint64 MAX_CHUNKS      = 4096;
+    const uint64 chunksPerThread = 16;
+
+    uint64 chunkCount = std::min( std::min( (uint64)threadCount * chunksPerThread, MAX_CHUNKS ), groupCount );
+    chunkCount        = std::max( chunkCount, (uint64)1 );
+
+    const uint64 groupsPerChunk   = std::max( ( groupCount + chunkCount - 1 ) / chunkCount, (uint64)1 );
+    chunkCount                    = std::max( ( groupCount + groupsPerChunk - 1 ) / groupsPerChunk, (uint64)1 );
+    
+    const uint64 maxPairsPerChunk = cx.maxPairs / chunkCount;
+
+    // Index of the first group of each scan job
+    uint64 jobGroupStart[MAX_THREADS+1];
+    jobGroupStart[0] = 0;
 
     for( uint32 i = 0; i < threadCount; i++ )
-    {
-        auto& job = jobs[i];
+        jobGroupStart[i+1] = jobGroupStart[i] + jobs[i].groupCount;
 
-        job.pairs     = tmpPairBuffer + i * maxPairsPerThread;
-        job.maxCount  = maxPairsPerThread;
-        job.pairCount = 0;
-        job.copyDst   = nullptr;
+    ASSERT( jobGroupStart[threadCount] == groupCount );
 
-        // Test
-        // job.groupBoundariesIdx = i * groupsPerThread;
-        // job.jobIdx          = (uint32)i;
-    }
+    uint64 chunkPairCounts[MAX_CHUNKS];
 
-    cx.threadPool->RunJob( FpPairThread, jobs, threadCount );
+    cx.threadPool->ParallelFor( groupCount, groupsPerChunk, [&]( uint64 start, uint64 end, uint ) {
 
-    // Count the total pairs and copy the pair buffers
-    // to the actual destination pair buffer.
-    pairCount = jobs[0].pairCount;
-    jobs[0].copyDst = outPairBuffer;
-    ASSERT( pairCount > 0 );
+        const uint64 chunk = start / groupsPerChunk;
 
-    for( uint32 i = 1; i < threadCount; i++ )
-    {
-        auto& job = jobs[i];
-        ASSERT( job.pairCount > 0 );
+        Pair*  pairs      = tmpPairBuffer + chunk * maxPairsPerChunk;
+        uint64 chunkPairs = 0;
 
-        job.copyDst = outPairBuffer + pairCount;
-        pairCount += job.pairCount;
+        // Find the scan job that contains the first group
+        uint32 jobIdx = 0;
+        while( jobGroupStart[jobIdx+1] <= start )
+            jobIdx++;
+
+        // A chunk may span more than 1 scan job
+        while( start < end && chunkPairs < maxPairsPerChunk )
+        {
+            const uint64 jobEnd = std::min( end, jobGroupStart[jobIdx+1] );
+
+            chunkPairs += FpPairGroups( jobs[jobIdx],
+                                        start  - jobGroupStart[jobIdx],
+                                        jobEnd - jobGroupStart[jobIdx],
+                                        pairs + chunkPairs, maxPairsPerChunk - chunkPairs );
+            start = jobEnd;
+            jobIdx++;
+        }
+
+        chunkPairCounts[chunk] = chunkPairs;
+    });
+
+    // Count the total pairs and get the copy offset for each chunk
+    uint64 chunkOffsets[MAX_CHUNKS];
+
+    for( uint64 i = 0; i < chunkCount; i++ )
+    {
+        chunkOffsets[i] = pairCount;
+        pairCount += chunkPairCounts[i];
     }
 
+    ASSERT( pairCount > 0 );
+
     // Sometimes we get more pairs than we support, so cap it.
     if( pairCount > ENTRIES_PER_TABLE )
     {
-        const uint64 overflowEntries = pairCount - ENTRIES_PER_TABLE;
+        uint64 overflowEntries = pairCount - ENTRIES_PER_TABLE;
+
+        for( uint64 i = chunkCount; i-- > 0 && overflowEntries; )
+        {
+            const uint64 trimCount = std::min( chunkPairCounts[i], overflowEntries );
 
-        auto& lastJob = jobs[threadCount-1];
-        ASSERT( lastJob.pairCount >= overflowEntries );
-        lastJob.pairCount -= overflowEntries;
+            chunkPairCounts[i] -= trimCount;
+            overflowEntries    -= trimCount;
+        }
        
         pairCount = ENTRIES_PER_TABLE;
     }
 
-    cx.threadPool->RunJob( (JobFunc)[]( void* pdata ) {
-
-        auto* job = (kBCJob*)pdata;
-        memcpy( job->copyDst, job->pairs, job->pairCount * sizeof( Pair ) );
+    cx.threadPool->ParallelFor( chunkCount, 1, [&]( uint64 start, uint64 end, uint ) {
 
-    }, jobs, threadCount, sizeof( kBCJob ) );
+        for( uint64 i = start; i < end; i++ )
+            memcpy( outPairBuffer + chunkOffsets[i], tmpPairBuffer + i * maxPairsPerChunk, chunkPairCounts[i] * sizeof( Pair ) );
+    });
 
     auto elapsed = TimerEnd( timer );
     Log::Line( "  Finished pairing L/R groups in %.4lf seconds. Created %llu pairs.", elapsed, pairCount );
+    perf.Log( "  Pairing" );
     Log::Line( "  Average of %.4lf pairs per group.", pairCount / (float64)groupCount );
 
     ASSERT( pairCount <= ENTRIES_PER_TABLE );
@@ -958,24 +1211,24 @@ uint64 MemPhase1::FpPair( const uint64* yBuffer, kBCJob jobs[MAX_THREADS],
     return pairCount;
 }
 
+// Pair the groups [groupStart, groupEnd) found by a scan job.
+// Returns the number of pairs written.
 //-----------------------------------------------------------
-void FpPairThread( kBCJob* job )
+uint64 FpPairGroups( const kBCJob& job, uint64 groupStart, uint64 groupEnd, Pair* pairs, uint64 maxPairs )
 {
-    const uint64  maxPairs        = job->maxCount;
-    const uint32  groupCount      = (uint32)job->groupCount;
-    const uint32* groupBoundaries = job->groupBoundaries;
-    const uint64* yBuffer         = job->yBuffer;
+    const uint32* groupBoundaries = job.groupBoundaries;
+    const uint64* yBuffer         = job.yBuffer;
 
-    Pair*  pairs     = job->pairs;
     uint64 pairCount = 0;
 
     uint8  rMapCounts [kBC];
     uint16 rMapIndices[kBC];
 
-    uint64 groupLStart = job->startIndex;
+    // Each group is paired with the one before it
+    uint64 groupLStart = groupStart == 0 ? job.startIndex : groupBoundaries[groupStart-1];
     uint64 groupL      = yBuffer[groupLStart] / kBC;
 
-    for( uint32 i = 0; i < groupCount; i++ )
+    for( uint64 i = groupStart; i < groupEnd; i++ )
     {
         const uint64 groupRStart = groupBoundaries[i];
         const uint64 groupR      = yBuffer[groupRStart] / kBC;
@@ -1047,7 +1300,7 @@ void FpPairThread( kBCJob* job )
     }
 
 RETURN:
-    job->pairCount = pairCount;
+    return pairCount;
 }
 
 ///
@@ -1065,41 +1318,50 @@ void MemPhase1::FpComputeFx( const uint64 entryCount, const Pair* lrPairs,
 
     Log::Line( "  Computing Fx..." );
     auto timer = TimerBegin();
+    PerfSpan perf( cx.perf );
     
-    const uint   threadCount     = cx.threadCount;
-    const uint64 entriesPerThred = entryCount / threadCount;
-    const uint64 trailingEntries = entryCount - (entriesPerThred * threadCount);
+    // Entries are handed out in small chunks so that threads can balance the load
+    const uint64 entriesPerChunk = 32 * 1024;
 
     // Table 7 needs 32-bit y outputs, so we have to change it here
     TYOut* tYOut = (TYOut*)outYBuffer;
 
     using Job = FpFxJob<TYOut, TMetaIn, TMetaOut>;
-    Job jobs[MAX_THREADS];
 
-    for( uint i = 0; i < threadCount; i++ )
-    {
-        Job& job = jobs[i];
-
-        const size_t offset = entriesPerThred * i;
+    // Calculate Fx
+    cx.threadPool->ParallelFor( entryCount, entriesPerChunk, [=]( uint64 start, uint64 end, uint ) {
 
-        job.entryCount    = entriesPerThred;
+        Job job;
+        job.entryCount    = end - start;
         job.inMetaBuffer  = inMetaBuffer;             // These should NOT be offseted as we 
         job.inYBuffer     = inYBuffer;                // use them as lookup tables based on the lrPairs
-        job.lrPairs       = lrPairs       + offset;
-        job.outMetaBuffer = outMetaBuffer + offset;
-        job.outYBuffer    = tYOut         + offset;
-    }
-
-    // Add trailing entries to the last job
-    jobs[threadCount-1].entryCount += trailingEntries;
+        job.lrPairs       = lrPairs       + start;
+        job.outMetaBuffer = outMetaBuffer + start;
+        job.outYBuffer    = tYOut         + start;
 
-    // Calculate Fx
-    cx.threadPool->RunJob( ComputeFxJob<TYOut, TMetaIn, TMetaOut>, jobs, threadCount );
+        ComputeFxJob<TYOut, TMetaIn, TMetaOut>( &job );
+    });
 
     auto elapsed = TimerEnd( timer );
     Log::Line( "  Finished computing Fx in %.4lf seconds.", elapsed );
+    perf.Log( "  Fx" );
+    cx.stats.p1Tables[(uint)tableId].fxSeconds = elapsed;
 }
 
+// The benchmarks run each table's fx on its own
+#define FP_FX_INSTANTIATE( table ) \
+    template void MemPhase1::FpComputeFx<table, TableMetaType<table>::MetaIn, TableMetaType<table>::MetaOut>( \
+        const uint64, const Pair*, const TableMetaType<table>::MetaIn*, const uint64*, TableMetaType<table>::MetaOut*, uint64* );
+
+FP_FX_INSTANTIATE( TableId::Table2 )
+FP_FX_INSTANTIATE( TableId::Table3 )
+FP_FX_INSTANTIATE( TableId::Table4 )
+FP_FX_INSTANTIATE( TableId::Table5 )
+FP_FX_INSTANTIATE( TableId::Table6 )
+FP_FX_INSTANTIATE( TableId::Table7 )
+
+#undef FP_FX_INSTANTIATE
+
 //-----------------------------------------------------------
 template<typename TYOut, typename TMetaIn, typename TMetaOut>
 void ComputeFxJob( FpFxJob<TYOut, TMetaIn, TMetaOut>* job )
@@ -1172,6 +1434,49 @@ void ComputeFxJob( FpFxJob<TYOut, TMetaIn, TMetaOut>* job )
     }
 }
 
+//-----------------------------------------------------------
+uint64 ComputeFxForPair( TableId table, uint64 yL, const uint64 metaL[2], const uint64 metaR[2], uint64 outMeta[2] )
+{
+    uint64 lrMetadata[4];
+
+    switch( table )
+    {
+        case TableId::Table2:
+            // Both 32-bit x values in a single field, as ComputeFxJob reads them
+            lrMetadata[0] = ( metaR[0] << 32 ) | (uint32)metaL[0];
+            return ComputeFx<1, 2, kExtraBits>( yL, lrMetadata, outMeta );
+
+        case TableId::Table3:
+            lrMetadata[0] = metaL[0];
+            lrMetadata[1] = metaR[0];
+            return ComputeFx<2, 4, kExtraBits>( yL, lrMetadata, outMeta );
+
+        case TableId::Table7:
+            lrMetadata[0] = metaL[0];
+            lrMetadata[1] = metaR[0];
+            return ComputeFx<2, 0, 0>( yL, lrMetadata, outMeta );
+
+        default:
+            break;
+    }
+
+    lrMetadata[0] = metaL[0];
+    lrMetadata[1] = metaL[1];
+    lrMetadata[2] = metaR[0];
+    lrMetadata[3] = metaR[1];
+
+    switch( table )
+    {
+        case TableId::Table4: return ComputeFx<4, 4, kExtraBits>( yL, lrMetadata, outMeta );
+        case TableId::Table5: return ComputeFx<4, 3, kExtraBits>( yL, lrMetadata, outMeta );
+        case TableId::Table6: return ComputeFx<3, 2, kExtraBits>( yL, lrMetadata, outMeta );
+
+        default:
+            Fatal( "Invalid table for fx." );
+            return 0;
+    }
+}
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wattributes"
 
@@ -1181,6 +1486,10 @@ FORCE_INLINE uint64 ComputeFx( uint64 y, uint64* metaData, uint64* metaOut )
 {
     static_assert( metaKMultiplierIn != 0, "Invalid metaKMultiplier" );
 
+    // The serialization below is laid out for k32
+    if constexpr ( _K != 32 )
+        return ComputeFxAnyK<metaKMultiplierIn, metaKMultiplierOut, ShiftBits>( y, metaData, metaOut );
+
     // Helper consts
     const uint   k           = _K;
     const uint32 ySize       = k + kExtraBits;         // = 38
@@ -1337,6 +1646,136 @@ FORCE_INLINE uint64 ComputeFx( uint64 y, uint64* metaData, uint64* metaOut )
     return f;
 }
 
+//-----------------------------------------------------------
+inline void AppendBits( uint64* fields, uint& bitCount, const uint64 value, const uint bits )
+{
+    ASSERT( bits > 0 && bits <= 64 );
+
+    const uint   field  = bitCount / 64;
+    const uint   offset = bitCount % 64;
+    const uint64 msb    = value << ( 64 - bits );
+
+    fields[field] |= msb >> offset;
+
+    if( offset + bits > 64 )
+        fields[field+1] |= value << ( 128 - offset - bits );
+
+    bitCount += bits;
+}
+
+//-----------------------------------------------------------
+inline uint64 ExtractBits( const uint64* fields, const uint bitStart, const uint bits )
+{
+    ASSERT( bits > 0 && bits <= 64 );
+
+    const uint field  = bitStart / 64;
+    const uint offset = bitStart % 64;
+
+    uint64 value = fields[field] << offset;
+    if( offset + bits > 64 )
+        value |= fields[field+1] >> ( 64 - offset );
+
+    return value >> ( 64 - bits );
+}
+
+/// Fx for any k, serializing the entries bit by bit.
+/// Metadata wider than 64 bits keeps its high 64 bits in the first
+/// field and the rest in the second one, as it does at k32.
+//-----------------------------------------------------------
+template<size_t metaKMultiplierIn, size_t metaKMultiplierOut, uint ShiftBits>
+uint64 ComputeFxAnyK( uint64 y, const uint64* metaData, uint64* metaOut )
+{
+    const uint k        = _K;
+    const uint ySize    = k + kExtraBits;
+    const uint metaBits = k * metaKMultiplierIn;
+    const uint outBits  = k * metaKMultiplierOut;
+
+    uint64 l[2] = { 0 };
+    uint64 r[2] = { 0 };
+
+    if constexpr( metaKMultiplierIn == 1 )
+    {
+        l[0] = reinterpret_cast<const uint32*>( metaData )[0];
+        r[0] = reinterpret_cast<const uint32*>( metaData )[1];
+    }
+    else if constexpr( metaKMultiplierIn == 2 )
+    {
+        l[0] = metaData[0];
+        r[0] = metaData[1];
+    }
+    else
+    {
+        l[0] = metaData[0]; l[1] = metaData[1];
+        r[0] = metaData[2]; r[1] = metaData[3];
+    }
+
+    // Serialize y + L + R
+    uint64 input[5] = { 0 };
+    uint   bitCount = 0;
+
+    auto appendMeta = [&]( const uint64 meta[2] ) {
+
+        if( metaBits <= 64 )
+            AppendBits( input, bitCount, meta[0], metaBits );
+        else
+        {
+            AppendBits( input, bitCount, meta[0], 64 );
+            AppendBits( input, bitCount, meta[1], metaBits - 64 );
+        }
+    };
+
+    AppendBits( input, bitCount, y, ySize );
+    appendMeta( l );
+    appendMeta( r );
+
+    for( uint i = 0; i < 5; i++ )
+        input[i] = Swap64( input[i] );
+
+    uint64 output[4];
+
+    blake3_hasher hasher;
+    blake3_hasher_init( &hasher );
+    blake3_hasher_update( &hasher, input, CDiv( bitCount, 8 ) );
+    blake3_hasher_finalize( &hasher, (uint8_t*)output, sizeof( output ) );
+
+    for( uint i = 0; i < 4; i++ )
+        output[i] = Swap64( output[i] );
+
+    const uint64 f = output[0] >> ( 64 - ( k + ShiftBits ) );
+
+    // Tables 2 and 3 output L + R. The others take their metadata from the hash, after y.
+    if constexpr( metaKMultiplierOut == 0 )
+        return f;
+    else if constexpr( metaKMultiplierIn == 1 )
+    {
+        metaOut[0] = l[0] << k | r[0];
+    }
+    else if constexpr( metaKMultiplierIn == 2 && metaKMultiplierOut == 4 )
+    {
+        if( outBits <= 64 )
+            metaOut[0] = l[0] << metaBits | r[0];
+        else
+        {
+            metaOut[0] = l[0] << ( 64 - metaBits ) | r[0] >> ( outBits - 64 );
+            metaOut[1] = r[0] & ( ( 1ull << ( outBits - 64 ) ) - 1 );
+        }
+    }
+    else if( outBits <= 64 )
+    {
+        metaOut[0] = ExtractBits( output, ySize, outBits );
+
+        if constexpr( metaKMultiplierOut > 2 )
+            metaOut[1] = 0;
+    }
+    else
+    {
+        metaOut[0] = ExtractBits( output, ySize, 64 );
+        metaOut[1] = ExtractBits( output, ySize + 64, outBits - 64 );
+    }
+
+    return f;
+}
+
 #pragma GCC diagnostic pop
 
 
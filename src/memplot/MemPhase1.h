@@ -1,7 +1,20 @@
 #pragma once
 #include "PlotContext.h"
+#include "MemArena.h"
 
-struct kBCJob;
+struct kBCJob
+{
+    const uint64* yBuffer;
+    uint64        maxCount;         // Max group count
+    uint64        groupCount;
+    uint32*       groupBoundaries;
+    uint64        startIndex;
+    uint64        endIndex;
+
+#if DEBUG
+    uint32 jobIdx;
+#endif
+};
 
 template<typename T>
 struct ReadWriteBuffer
@@ -56,17 +69,27 @@ template<> struct TableMetaType<TableId::Table7> { using MetaIn = uint64; using
 template<TableId table> struct YOut                  { using Type = uint64; };
 template<>              struct YOut<TableId::Table7> { using Type = uint32; };
 
+// Computes the y and output metadata of the table entry made from a single pair
+// of the previous table's entries. Each entry's metadata takes 2 uint64s, laid out as
+// in the metadata buffers (the x value for table 1). Table 7 has no output metadata.
+uint64 ComputeFxForPair( TableId table, uint64 yL, const uint64 metaL[2], const uint64 metaR[2], uint64 outMeta[2] );
+
 
 
 class MemPhase1
 {
+    friend class PhaseBench;
 public:
     MemPhase1( MemPlotContext& context );
 
     void Run();
 
+    // Declare the buffers used by this phase in the plot's memory arena
+    static void DeclareBuffers( MemArena& arena, MemPlotContext& cx );
+
 private:
-    uint64 GenerateF1();
+    // Generates and sorts the first totalEntries entries of table 1
+    uint64 GenerateF1( const uint64 totalEntries );
 
     void ForwardPropagate( uint64 entryCount );
     uint64 FpScan( const uint64 entryCount, const uint64* yBuffer, 
@@ -91,8 +114,15 @@ private:
                       TMetaOut* outMetaBuffer, uint64* outYBuffer );
     
     
+    // Wait until the previous plot, if it's still being written to disk,
+    // has released the memory that this plot uses in the given step.
+    void WaitForPreviousPlotBuffers( MemStep step );
+
     void WaitForPreviousPlotWriter();
 
 private:
     MemPlotContext& _context;
+
+    std::chrono::steady_clock::time_point _startTime;
+    double                                _writerWaitTime = 0;    // Time spent waiting for the previous plot's writes
 };
\ No newline at end of file
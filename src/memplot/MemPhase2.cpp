@@ -1,5 +1,7 @@
 #include "MemPhase2.h"
 #include "DbgHelper.h"
+#include "MemSpill.h"
+#include "util/PerfCounters.h"
 
 ///
 /// Job structs
@@ -11,11 +13,13 @@ struct ClearMarkingBufferJob
     size_t size;
 };
 
+// TPairs is either const Pair* or PackedPairs
+template<typename TPairs>
 struct MarkJob
 {
     uint64      startIndex;
     uint64      rightEntryCount;
-    const Pair* rightEntries;
+    TPairs      rightEntries;
     const byte* rightMarkedEntries;  // Used in tables <= 5
     byte*       leftMarkingBuffer;
 
@@ -27,8 +31,8 @@ struct MarkJob
 ///
 void ClearMarkedEntriesThread( ClearMarkingBufferJob* job );
 
-template<bool HasRightTableMarkingBuffer>
-void MarkEntriesThread( MarkJob* job );
+template<bool HasRightTableMarkingBuffer, typename TPairs>
+void MarkEntriesThread( MarkJob<TPairs>* job );
 
 
 void DbgReadPhase1TableFiles( MemPlotContext& cx );
@@ -64,6 +68,19 @@ void MemPhase2::Run()
         }
     #endif
 
+    // Tables are loaded back from disk into 2 alternating slots, starting with table 6
+    if( cx.spill )
+    {
+        cx.t2LRBuffer = cx.loadSlots[0];
+        cx.t3LRBuffer = cx.loadSlots[1];
+        cx.t4LRBuffer = cx.loadSlots[0];
+        cx.t5LRBuffer = cx.loadSlots[1];
+        cx.t6LRBuffer = cx.loadSlots[0];
+        cx.t1XBuffer  = cx.t1XLoadBuffer;
+
+        cx.spill->LoadTable( TableId::Table6, cx.t6LRBuffer );
+    }
+
     // Prep our marking buffers
     ClearMarkingBuffers();
 
@@ -91,6 +108,18 @@ void MemPhase2::Run()
 
         Log::Line( "  Prunning table %d...", i );
         auto timer = TimerBegin();
+        PerfSpan perf( cx.perf );
+
+        // Read the next table while we mark this one.
+        // Table 2 and table 1's x are read ahead for Phase 3.
+        if( cx.spill && i < (int)TableId::Table7 )
+        {
+            cx.spill->WaitForTable( (TableId)i );
+            cx.spill->LoadTable( (TableId)(i-1), (void*)rTables[i-1] );
+
+            if( i == (int)TableId::Table3 )
+                cx.spill->LoadTable( TableId::Table1, cx.t1XBuffer );
+        }
 
         if( i == (int)TableId::Table7 )
         {
@@ -101,24 +130,49 @@ void MemPhase2::Run()
         {
             const byte* rTableMarkedEntries = (byte*)cx.usedEntries[i];
 
-            MarkTable<true>( rTable, rTableCount, rTableMarkedEntries, lTableMarkingBuffer );
+            if( cx.compactPairs )
+                MarkTable<true>( PackedPairs( (void*)rTable ), rTableCount, rTableMarkedEntries, lTableMarkingBuffer );
+            else
+                MarkTable<true>( rTable, rTableCount, rTableMarkedEntries, lTableMarkingBuffer );
         }
 
         double elapsed = TimerEnd( timer );
         Log::Line( "  Finished prunning table %d in %.2lf seconds.", i, elapsed );
+        perf.Log( "  Marking" );
+        cx.stats.p2TableSeconds[i-1] = elapsed;
     }
 
     // DbgCountMarkedEntries( cx );
     DbgWritePhase2MarkedEntries( cx );
 }
 
+//-----------------------------------------------------------
+void MemPhase2::DeclareBuffers( MemArena& arena, MemPlotContext& cx )
+{
+    // We need 5 marking buffers, for tables 2-6.
+    // Table 6's marks are the last ones used by Phase 3.
+    arena.Declare( "markingBuffer", cx.markingBuffer, ENTRIES_PER_TABLE * 5, MemStep::P2, MemStep::P3Table6 );
+
+    // Spilled tables are loaded back for this phase and Phase 3.
+    // The load slots end up holding parks, which Phase 3 waits to be written to disk.
+    if( cx.spillDir )
+    {
+        const size_t lrBufferSize = cx.compactPairs ? PackedPairs::TableSize : ENTRIES_PER_TABLE * sizeof( Pair );
+        const size_t xBufferSize  = ENTRIES_PER_TABLE * sizeof( uint32 );
+
+        arena.Declare( "loadSlot0"    , cx.loadSlots[0] , lrBufferSize, MemStep::P2, MemStep::P3Table7 );
+        arena.Declare( "loadSlot1"    , cx.loadSlots[1] , lrBufferSize, MemStep::P2, MemStep::P3Table7 );
+        arena.Declare( "t1XLoad"      , cx.t1XLoadBuffer, xBufferSize , MemStep::P2, MemStep::P4       );
+    }
+}
+
 //-----------------------------------------------------------
 void MemPhase2::ClearMarkingBuffers()
 {
     MemPlotContext& cx = _context;
 
     const uint64 maxEntries    = 1ull << _K;
-    byte*        markingBuffer = (byte*)cx.yBuffer0;
+    byte*        markingBuffer = cx.markingBuffer;
 
     const size_t totalSize     = maxEntries * 5;  // We need 5 buffers, for tables 2-6 
     const uint   threadCount   = cx.threadCount;
@@ -147,15 +201,15 @@ void MemPhase2::ClearMarkingBuffers()
 }
 
 //-----------------------------------------------------------
-template<bool HasRightTableMarkingBuffer>
-void MemPhase2::MarkTable( const Pair* rightTable, uint64 rightEntryCount, const byte* rMarkedEntries, byte* lMarkingBuffer )
+template<bool HasRightTableMarkingBuffer, typename TPairs>
+void MemPhase2::MarkTable( TPairs rightTable, uint64 rightEntryCount, const byte* rMarkedEntries, byte* lMarkingBuffer )
 {
     MemPlotContext& cx = _context;
 
     const uint   threadCount           = cx.threadCount;
     const uint64 rightEntriesPerThread = rightEntryCount / threadCount;
 
-    MarkJob jobs[MAX_THREADS];
+    MarkJob<TPairs> jobs[MAX_THREADS];
 
     for( uint i = 0; i < threadCount; i++ )
     {
@@ -171,9 +225,13 @@ void MemPhase2::MarkTable( const Pair* rightTable, uint64 rightEntryCount, const
     // Add trailing entries to the last job
     jobs[threadCount-1].rightEntryCount += (rightEntryCount - ( rightEntriesPerThread  * threadCount ) );
 
-    cx.threadPool->RunJob( MarkEntriesThread<HasRightTableMarkingBuffer>, jobs, threadCount );
+    cx.threadPool->RunJob( MarkEntriesThread<HasRightTableMarkingBuffer, TPairs>, jobs, threadCount );
 }
 
+// Unpacked variants, also run by the benchmarks
+template void MemPhase2::MarkTable<false, const Pair*>( const Pair*, uint64, const byte*, byte* );
+template void MemPhase2::MarkTable<true , const Pair*>( const Pair*, uint64, const byte*, byte* );
+
 //-----------------------------------------------------------
 void ClearMarkedEntriesThread( ClearMarkingBufferJob* job )
 {
@@ -181,13 +239,13 @@ void ClearMarkedEntriesThread( ClearMarkingBufferJob* job )
 }
 
 //-----------------------------------------------------------
-template<bool HasRightTableMarkingBuffer>
-void MarkEntriesThread( MarkJob* job )
+template<bool HasRightTableMarkingBuffer, typename TPairs>
+void MarkEntriesThread( MarkJob<TPairs>* job )
 {
     const uint64 startIndex  = job->startIndex;
     const uint64 endIndex    = startIndex + job->rightEntryCount;
 
-    const Pair* rightEntries = job->rightEntries;
+    const TPairs rightEntries = job->rightEntries;
 
     const byte* rightMarkedEntries = job->rightMarkedEntries;
     byte* markingBuffer            = job->leftMarkingBuffer;
@@ -215,10 +273,20 @@ void MarkEntriesThread( MarkJob* job )
                 continue;
         }
 
-        const Pair& entry = rightEntries[i];
+        if constexpr ( std::is_same<TPairs, PackedPairs>::value )
+        {
+            const uint32 left = rightEntries.left[i];
 
-        markingBuffer[entry.left ] = 1;
-        markingBuffer[entry.right] = 1;
+            markingBuffer[left] = 1;
+            markingBuffer[left + rightEntries.offset[i]] = 1;
+        }
+        else
+        {
+            const Pair& entry = rightEntries[i];
+
+            markingBuffer[entry.left ] = 1;
+            markingBuffer[entry.right] = 1;
+        }
     }
 }
 
@@ -256,6 +324,9 @@ void DbgCountMarkedEntries( MemPlotContext& cx )
 void DbgReadPhase1TableFiles( MemPlotContext& cx )
 {
     #if DBG_READ_PHASE_1_TABLES && !DBG_WRITE_PHASE_1_TABLES
+        if( cx.compactPairs || cx.spill )
+            Fatal( "Reading phase 1 tables is not supported with compact pairs or spilling." );
+
         DbgReadTableFromFile( *cx.threadPool, DBG_P1_TABLE1_FNAME  , cx.entryCount[0], cx.t1XBuffer , true );
         DbgReadTableFromFile( *cx.threadPool, DBG_P1_TABLE2_FNAME  , cx.entryCount[1], cx.t2LRBuffer, true );
         DbgReadTableFromFile( *cx.threadPool, DBG_P1_TABLE3_FNAME  , cx.entryCount[2], cx.t3LRBuffer, true );
@@ -271,7 +342,7 @@ void DbgReadPhase1TableFiles( MemPlotContext& cx )
 void DbgReadWritePhase2MarkedEntries( MemPlotContext& cx, bool write )
 {
     const uint64 maxEntries    = 1ull << _K;
-    byte*        markingBuffer = (byte*)cx.yBuffer0;
+    byte*        markingBuffer = cx.markingBuffer;
     const size_t sizePerTable  = maxEntries;
 
     const char* fileNames[6] = {
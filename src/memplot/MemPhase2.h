@@ -1,5 +1,6 @@
 #pragma once
 #include "PlotContext.h"
+#include "MemArena.h"
 
 
 /**
@@ -9,19 +10,24 @@
 class MemPhase2
 {
     friend class MemPlotter;
+    friend class PhaseBench;
 public:
 
     MemPhase2( MemPlotContext& context );
 
     void Run();
 
+    // Declare the buffers used by this phase in the plot's memory arena
+    static void DeclareBuffers( MemArena& arena, MemPlotContext& cx );
+
 
 private:
 
     void ClearMarkingBuffers();
 
-    template<bool HasRightTableMarkingBuffer>
-    void MarkTable( const Pair* rightTable, uint64 rightEntryCount, const byte* rMarkedEntries, byte* lMarkingBuffer );
+    // TPairs is either const Pair* or PackedPairs
+    template<bool HasRightTableMarkingBuffer, typename TPairs>
+    void MarkTable( TPairs rightTable, uint64 rightEntryCount, const byte* rMarkedEntries, byte* lMarkingBuffer );
 
 private:
     MemPlotContext& _context;
@@ -7,6 +7,8 @@
 #include <cmath>
 
 #include "DbgHelper.h"
+#include "util/PerfCounters.h"
+#include "MemSpill.h"
 #include "SysHost.h"
 
 
@@ -15,6 +17,23 @@ MemPhase3::MemPhase3( MemPlotContext& context )
     : _context( context )
 {}
 
+//-----------------------------------------------------------
+void MemPhase3::DeclareBuffers( MemArena& arena, MemPlotContext& cx )
+{
+    // The table 6 park is written to the LP buffer, so it lives
+    // into the next plot, until this one has finished writing.
+    const MemStep writeEnd = cx.overlapWrites ? MemStep::P1Table7 : MemStep::P1Table2Fx;
+
+    const size_t lpSize  = ENTRIES_PER_TABLE * sizeof( uint64 );
+    const size_t f7Size  = ENTRIES_PER_TABLE * sizeof( uint32 );
+
+    arena.Declare( "lpBuffer"    , cx.lpBuffer    , lpSize, MemStep::P3Table2, writeEnd            );
+    arena.Declare( "lpSortTmp"   , cx.lpSortTmp   , lpSize, MemStep::P3Table2, MemStep::P3Table6   );
+    arena.Declare( "lpMapBuffer" , cx.lpMapBuffer , lpSize, MemStep::P3Table2, MemStep::P3Table7   );
+    arena.Declare( "f7SortTmp"   , cx.f7SortTmp   , f7Size, MemStep::P3Table7, MemStep::P3Table7   );
+    arena.Declare( "t7IdxSortTmp", cx.t7IdxSortTmp, f7Size, MemStep::P3Table7, MemStep::P3Table7   );
+}
+
 //-----------------------------------------------------------
 void MemPhase3::Run()
 {
@@ -38,7 +57,7 @@ void MemPhase3::Run()
     // Use the same buffer for LPs, it will be serialized to 
     // park back in the rTable.
     // Therefore after each iteration rTable will be a park buffer
-    uint64* lpBuffer = cx.metaBuffer0;
+    uint64* lpBuffer = cx.lpBuffer;
 
     for( uint i = (uint)TableId::Table1; i < (uint)TableId::Table7; i++ )
     {
@@ -48,6 +67,15 @@ void MemPhase3::Run()
 
         Log::Line( "  Compressing tables %u and %u...", i+1, i+2 );
         auto tableTimer = TimerBegin();
+
+        // Make sure the spilled tables we use have been loaded
+        if( cx.spill && i < (uint)TableId::Table6 )
+        {
+            if( i == (uint)TableId::Table1 )
+                cx.spill->WaitForTable( TableId::Table1 );
+
+            cx.spill->WaitForTable( (TableId)(i+1) );
+        }
         
         uint64 newCount;
         if( i == (uint)TableId::Table6 )
@@ -55,11 +83,37 @@ void MemPhase3::Run()
         else
             newCount = ProcessTable<false>( lTable, lpBuffer, rTable, rTableCount, rUsedEntries, (TableId)i ); 
 
+        // rTable now holds this table's park. Once it's been written to disk,
+        // load the table that goes in the same slot, 2 tables ahead.
+        if( cx.spill && i + 3 < (uint)TableId::Table7 )
+            cx.spill->LoadTable( (TableId)(i+3), rTables[i+3], cx.plotWriter, i+1 );
+
         double tElapsed = TimerEnd( tableTimer );
         Log::Line( "  Finished compressing tables %u and %u in %.2lf seconds", i+1, i+2, tElapsed );
+
+        PlotStats::P3Table& stats = cx.stats.p3Tables[i];
+        stats.seconds     = tElapsed;
+        stats.entryCount  = rTableCount;
+        stats.keptCount   = newCount;
+
         Log::Line( "  Table %d now has %llu / %llu entries ( %.2lf%% ).", 
             i+1, newCount, rTableCount, (newCount / (double)rTableCount) * 100 );
     }
+
+    // The load slots still hold the parks of tables 4 and 5,
+    // which must be written before the slots are released.
+    if( cx.spill )
+    {
+        Log::Line( "  Waiting for parks to be written to disk..." );
+        auto timer = TimerBegin();
+
+        if( !cx.plotWriter->WaitForTablesWritten( 5 ) )
+            Fatal( "Failed to write plot file %s with error: %d", 
+                cx.plotWriter->FilePath().c_str(), cx.plotWriter->GetError() );
+
+        double elapsed = TimerEnd( timer );
+        Log::Line( "  Waited %.2lf seconds for parks to be written.", elapsed );
+    }
 }
 
 //-----------------------------------------------------------
@@ -69,81 +123,141 @@ uint64 MemPhase3::ProcessTable( uint32* lEntries, uint64* lpBuffer, Pair* rTable
 {
     auto& cx = _context;
 
-    const uint   threadCount      = cx.threadCount;
-    const uint64 entriesPerThread = rTableCount / threadCount;
-    const uint64 trailingEntries  = rTableCount - ( entriesPerThread * threadCount );
+    // - Scan the table and determine how many valid entries we have
+    // - Now we know where to place them in the new table
+    // - Prune the table by copying valid entries to the new buffer
+    //  - Write the original index of the entry into a map
+    // - Convert pruned entries to LinePoint using the 'left' table.
+    //      In table 1, these are the x's. In the others, it is the lookup table.
+    // - Sort on line point, sorting along with it the map
+    // - Using the map, write a lookup table by writing
+    //      on the lookup table's original index (obtained from the map)
+    //      the final index (current index of the map) of the entry.
+    // - Use the lookup table as the 'left' table for the next table.
+    //      Since the lookup table maps to the final indices, the 
+    //      LinePoints can be generated from it.
 
     if constexpr ( IsTable6 )
     {
-        // ConverToLinePointThread reads fron lpBuffer,
+        // ConvertToLinePoints reads fron lpBuffer,
         // but since we haven't pruned rTable and moved it to lpBuffer,
-        // we need to swap it here, so that we read/write from/to it in ConverToLinePointThread
+        // we need to swap it here, so that we read/write from/to it in ConvertToLinePoints
         uint64* tmp = (uint64*)rTable;
         rTable   = (Pair*)lpBuffer;
         lpBuffer = tmp;
     }
 
-    uint32* map = (uint32*)cx.metaBuffer1;
+    uint32* map = cx.lpMapBuffer;
 
-    std::atomic<uint> threadSignal = 0;
-    std::atomic<uint> releaseLock  = 0;
-    
-    LPJob jobs[MAX_THREADS];
+    LPJob job;
+    job.lTable        = lEntries;
+    job.rTable        = rTable;
+    job.packedRTable  = PackedPairs( rTable );
+    job.lpBuffer      = lpBuffer;
+    job.markedEntries = markedEntries;
+    job.map           = map;
 
-    for( uint i = 0; i < threadCount; i++ )
-    {
-        auto& job = jobs[i];
-        job.Init( (uint)i, threadCount, threadSignal, releaseLock );
-
-        job.lTable        = lEntries;
-        job.length        = entriesPerThread;
-        job.offset        = i * entriesPerThread;
-        job.rTable        = (Pair*)rTable;
-        job.lpBuffer      = lpBuffer;
-        job.jobs          = jobs;
-
-        job.markedEntries = markedEntries;
-        job.map           = map;
-    }
+    // Entries are processed in chunks that threads can steal from each other.
+    // The chunk count is bounded so that we can keep per-chunk prune counts on the stack.
+    const uint64 MAX_CHUNKS      = 4096;
+    const uint64 entriesPerChunk = std::max( ( rTableCount + MAX_CHUNKS - 1 ) / MAX_CHUNKS, (uint64)( 64 * 1024 ) );
+    const uint64 chunkCount      = ( rTableCount + entriesPerChunk - 1 ) / entriesPerChunk;
 
-    jobs[threadCount-1].length += trailingEntries;
-
-    constexpr bool PruneTable = !IsTable6;
-    cx.threadPool->RunJob( ProcessTableThread<PruneTable>, jobs, threadCount );
+    uint64 newLength;
 
+    PerfSpan lpPerf( cx.perf );
 
-    // Get the new total length after the prune
-    uint64 newLength;
     if constexpr ( !IsTable6 )
     {
-        newLength = jobs[0].length;
-        
-        for( uint i = 1; i < threadCount; i++ )
-            newLength += jobs[i].length;
+        // Count the entries we keep in each chunk
+        uint64 chunkCounts[MAX_CHUNKS];
+
+        cx.threadPool->ParallelFor( rTableCount, entriesPerChunk, [&]( uint64 start, uint64 end, uint ) {
+            chunkCounts[start / entriesPerChunk] = CountMarkedEntries( markedEntries, start, end );
+        });
+
+        // Now we know where each chunk's entries go in the pruned table
+        uint64 chunkOffsets[MAX_CHUNKS];
+        newLength = 0;
+
+        for( uint64 i = 0; i < chunkCount; i++ )
+        {
+            chunkOffsets[i] = newLength;
+            newLength += chunkCounts[i];
+        }
+
+        // Prune to the LP buffer, then convert to line points
+        cx.threadPool->ParallelFor( rTableCount, entriesPerChunk, [&]( uint64 start, uint64 end, uint ) {
+
+            const uint64 chunk = start / entriesPerChunk;
+
+            // Table 7 is never packed
+            if( cx.compactPairs )
+                PruneAndMap<true> ( job, start, end, chunkOffsets[chunk] );
+            else
+                PruneAndMap<false>( job, start, end, chunkOffsets[chunk] );
+
+            ConvertToLinePoints( job, chunkOffsets[chunk], chunkOffsets[chunk] + chunkCounts[chunk] );
+        });
     }
     else
     {
         // No prunning for table 6, so same length
         newLength = rTableCount;
+
+        cx.threadPool->ParallelFor( newLength, entriesPerChunk, [&]( uint64 start, uint64 end, uint ) {
+
+            ConvertToLinePoints( job, start, end );
+
+            // Generate a simple sequential sort key for sorting
+            // on y, then sorting on line point. This will
+            // finally be used to map the final index table
+            // that maps from f7 to table 6's line points.
+            for( uint64 i = start; i < end; i++ )
+                map[i] = (uint32)i;
+        });
     }
 
 
-    // Sort LinePoints, along with the map
+    lpPerf.Log( "  LP convert" );
+
+    // Sort LinePoints, along with the map.
+    // For table 6, rTable was swapped with the LP buffer, so it's big enough to be used as the temporary buffer.
+    uint64* lpSortTmp = IsTable6 ? (uint64*)rTable : cx.lpSortTmp;
+
+    PerfSpan sortPerf( cx.perf );
+
     RadixSort256::SortWithKey<MAX_THREADS>( *cx.threadPool,
-        lpBuffer, (uint64*)rTable,
-        map,      map + newLength,  // This is meta1, so there's plenty of space to hold both buffers
+        lpBuffer, lpSortTmp,
+        map,      map + newLength,  // The map buffer has space to hold both buffers
         newLength );
+
+    sortPerf.Log( "  LP sort" );
     
 
     // Write lookup table (map it based on sort key)
     // After this step lEntries will contain the new index map into the LP's
-    cx.threadPool->RunJob( WriteLookupTableThread, jobs, threadCount );
+    PerfSpan lookupPerf( cx.perf );
+
+    // The map buffer, which holds 2 uint32 per entry, and the LP sort buffer are free now
+    if( newLength >= P3_LOOKUP_REGION_MIN_ENTRIES )
+    {
+        WriteLookupTableByRegion( *cx.threadPool, job, newLength, lpSortTmp, (uint64*)map );
+    }
+    else
+    {
+        cx.threadPool->ParallelFor( newLength, entriesPerChunk, [&]( uint64 start, uint64 end, uint ) {
+            WriteLookupTable( job, start, end );
+        });
+    }
+
+    lookupPerf.Log( "  Lookup table" );
 
 
     if constexpr ( IsTable6 )
     {
-        uint32* t7SortTmp       = (uint32*)cx.yBuffer0; // Don't need yBuffer0 at this point, safe to use
-        uint32* lEntriesSortTmp = (uint32*)cx.yBuffer1;
+        uint32* t7SortTmp       = cx.f7SortTmp;
+        uint32* lEntriesSortTmp = cx.t7IdxSortTmp;
 
         // We need to sort on f7 now, with lEntries with
         // contain now the index into table 6's LinePoints
@@ -154,7 +268,7 @@ uint64 MemPhase3::ProcessTable( uint32* lEntries, uint64* lpBuffer, Pair* rTable
 
         // #NOTE: Because the C2 table size is inferred by substracting table pointers
         //        in chiapos, we need to make sure we don't have any f7 entries with the
-        //        value of 0xFFFFFFFF. See WriteC12Parallel in Phase4 for more details.
+        //        value of 0xFFFFFFFF. See WriteP4Parallel in Phase4 for more details.
         while( newLength && cx.t7YBuffer[newLength-1] == 0xFFFFFFFF )
             --newLength;
 
@@ -169,15 +283,22 @@ uint64 MemPhase3::ProcessTable( uint32* lEntries, uint64* lpBuffer, Pair* rTable
     }
     #endif
 
-    // Write park for table (re-use rTable for it)
-    // #NOTE: For table 6: rTable is meta0 here.
+    // Write park for table (re-use rTable for it).
+    // Parks take less than 4.5 bytes per entry, so they fit in packed tables as well.
+    // #NOTE: For table 6: rTable is the LP buffer here.
+    PerfSpan parkPerf( cx.perf );
+
     byte*  parkBuffer     = _context.plotWriter->AlignPointerToBlockSize<byte>( (void*)rTable );
-    size_t sizeTableParks = WriteParks<MAX_THREADS>( *cx.threadPool, newLength, lpBuffer, parkBuffer, tableId );
+    size_t sizeTableParks = WriteParks( *cx.threadPool, newLength, lpBuffer, parkBuffer, tableId );
+
+    parkPerf.Log( "  Park write" );
     
     // Send over the park for writing in the plot file in the background
     if( !cx.plotWriter->WriteTable( parkBuffer, sizeTableParks ) )
         Fatal( "Failed to write table %d to disk.", (int)tableId+1 );
 
+    cx.stats.tableBytes[(uint)tableId] = sizeTableParks;
+
     if constexpr ( IsTable6 )
     {
         #if DBG_WRITE_SORTED_F7_TABLE
@@ -191,129 +312,339 @@ uint64 MemPhase3::ProcessTable( uint32* lEntries, uint64* lpBuffer, Pair* rTable
     return newLength;
 }
 
-//-----------------------------------------------------------
-template<bool PruneTable>
-void ProcessTableThread( LPJob* job )
+// The pruning and line point kernels have AVX-512 and AVX2 paths,
+// picked at compile time from the target's instruction sets.
+#if defined( __AVX512F__ ) && defined( __AVX512BW__ ) && defined( __AVX512VL__ )
+    #define P3_AVX512 1
+#elif defined( __AVX2__ )
+    #define P3_AVX2 1
+#endif
+
+#if P3_AVX512 || P3_AVX2
+    #define P3_SIMD 1
+    #include <immintrin.h>
+#endif
+
+///
+/// Pruning kernels
+///
+/// Marked entries are processed in blocks of 64, for which a 64-bit mask of
+/// the marked entries is built. The mask gives the count with a popcount, and
+/// the pairs and their map indices are compacted with it: with vpcompress on
+/// AVX-512, or with permutes from a lookup table of the compacted lane order on AVX2.
+/// The remaining entries of a range are processed one by one.
+#if P3_SIMD
+
+static constexpr uint PRUNE_BLOCK_SIZE = 64;
+
+#if P3_AVX2
+// Lane indices of a 32-bit lane permute that moves the lanes selected by a
+// mask to the front, in order. 64-bit lanes are moved as 2 32-bit lanes.
+template<uint LaneCount, uint LaneWidth>
+struct CompressTable
 {
-    // - Scan the table and determine how many valid entries we have
-    // - Now we know where to place them in the new table
-    // - Prune the table by copying valid entries to the new buffer
-    //  - Write the original index of the entry into a map
-    // - Convert pruned entries to LinePoint using the 'left' table.
-    //      In table 1, these are the x's. In the others, it is the lookup table.
-    // - Sort on line point, sorting along with it the map
-    // - Using the map, write a lookup table by writing
-    //      on the lookup table's original index (obtained from the map)
-    //      the final index (current index of the map) of the entry.
-    // - Use the lookup table as the 'left' table for the next table.
-    //      Since the lookup table maps to the final indices, the 
-    //      LinePoints can be generated from it.
+    uint32 lanes[1u << LaneCount][8];
 
-    if constexpr ( PruneTable )
+    constexpr CompressTable() : lanes{}
     {
-        PruneAndMapThread( job );
-        job->WaitForThreads();
+        for( uint mask = 0; mask < ( 1u << LaneCount ); mask++ )
+        {
+            uint dst = 0;
+            for( uint lane = 0; lane < LaneCount; lane++ )
+            {
+                if( !( mask & ( 1u << lane ) ) )
+                    continue;
+
+                for( uint i = 0; i < LaneWidth; i++ )
+                    lanes[mask][dst++] = lane * LaneWidth + i;
+            }
+        }
     }
+};
 
-    // Convert to LinePoint
-    ConverToLinePointThread( job );
+static constexpr CompressTable<4, 2> CompressPairTable;     // 4 pairs per vector
+static constexpr CompressTable<8, 1> CompressIndexTable;    // 8 indices per vector
+#endif
 
-
-    // If it's the last table pair, perform a few things differently.
-    if constexpr ( !PruneTable )
-    {
-        job->WaitForThreads();
-        
-        // Generate a simple sequential sort key for sorting
-        // on y, then sorting on line point. This will
-        // finally be used to map the final index table
-        // that maps from f7 to table 6's line points.
-
-        uint32* map = job->map;
-        
-        uint64 i = job->offset;
-        const uint64 end = i + job->length;
-
-        for( ; i < end; i++ )
-            map[i] = (uint32)i;
-    }
+// Bit i is set if entry i of the block is marked
+//-----------------------------------------------------------
+inline uint64 GetMarkMask( const byte* markedEntries )
+{
+    #if P3_AVX512
+        const __m512i marks = _mm512_loadu_si512( markedEntries );
+        return (uint64)_mm512_test_epi8_mask( marks, marks );
+    #else
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i lo   = _mm256_loadu_si256( (const __m256i*)markedEntries );
+        const __m256i hi   = _mm256_loadu_si256( (const __m256i*)( markedEntries + 32 ) );
+
+        const uint64 unmarkedLo = (uint32)_mm256_movemask_epi8( _mm256_cmpeq_epi8( lo, zero ) );
+        const uint64 unmarkedHi = (uint32)_mm256_movemask_epi8( _mm256_cmpeq_epi8( hi, zero ) );
+
+        return ~( unmarkedLo | ( unmarkedHi << 32 ) );
+    #endif
 }
 
+// Copies the marked pairs and their indices of a block of 64 entries starting at index i.
+// Returns the number of entries copied.
 //-----------------------------------------------------------
-void PruneAndMapThread( LPJob* job )
+template<bool CompactPairs>
+inline uint64 PruneBlock( const uint64 mask, const uint64 i, const Pair* pairs, const PackedPairs& packedPairs,
+                          Pair* newPairs, uint32* map )
 {
-    const byte*  markedEntries = job->markedEntries;
+    #if P3_AVX512
+        // Pairs, 8 per vector
+        uint64 dstI = 0;
 
-    uint64       length        = job->length;
+        for( uint j = 0; j < PRUNE_BLOCK_SIZE; j += 8 )
+        {
+            const __mmask8 m = (__mmask8)( mask >> j );
+            if( !m )
+                continue;
 
-    const uint64 srcOffset     = job->offset; 
-    const uint64 end           = srcOffset + length;
+            __m512i p;
 
-    Pair* pairs = job->rTable;
+            if constexpr ( CompactPairs )
+            {
+                // Load the 8 lefts and offsets into the low half
+                const __m512i left   = _mm512_maskz_loadu_epi32( 0xFF, packedPairs.left + i + j );
+                const __m512i offset = _mm512_maskz_cvtepu16_epi32( 0xFF, _mm256_maskz_loadu_epi16( 0xFF, packedPairs.offset + i + j ) );
+                const __m512i right  = _mm512_add_epi32( left, offset );
 
-    // Scan entries
-    {
-        uint64 newLength = 0;
-        
-        for( uint64 i = srcOffset; i < end; i++ )
+                // Interleave left and right into pairs
+                const __m512i interleave = _mm512_setr_epi32( 0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23 );
+
+                p = _mm512_permutex2var_epi32( left, interleave, right );
+            }
+            else
+                p = _mm512_loadu_si512( pairs + i + j );
+
+            const uint n = (uint)_mm_popcnt_u32( m );
+
+            _mm512_mask_storeu_epi64( newPairs + dstI, (__mmask8)( ( 1u << n ) - 1 ), _mm512_maskz_compress_epi64( m, p ) );
+            dstI += n;
+        }
+
+        // Indices, 16 per vector
+        const __m512i laneIndex = _mm512_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 );
+        uint64 mapI = 0;
+
+        for( uint j = 0; j < PRUNE_BLOCK_SIZE; j += 16 )
         {
-            if( markedEntries[i] )
-                newLength ++;
+            const __mmask16 m = (__mmask16)( mask >> j );
+            if( !m )
+                continue;
+
+            const __m512i index = _mm512_add_epi32( _mm512_set1_epi32( (int)(uint32)( i + j ) ), laneIndex );
+            const uint    n     = (uint)_mm_popcnt_u32( m );
+
+            _mm512_mask_storeu_epi32( map + mapI, (__mmask16)( ( 1u << n ) - 1 ), _mm512_maskz_compress_epi32( m, index ) );
+            mapI += n;
         }
+    #else
+        // Pairs, 4 per vector
+        const __m256i laneIndex64 = _mm256_setr_epi64x( 0, 1, 2, 3 );
+        uint64 dstI = 0;
 
-        length      = newLength;
-        job->length = newLength;
-    }
+        for( uint j = 0; j < PRUNE_BLOCK_SIZE; j += 4 )
+        {
+            const uint m = (uint)( mask >> j ) & 0xF;
+            if( !m )
+                continue;
+
+            __m256i p;
 
-    // Wait for other entries so that can determine
-    // the new position to copy to.
-    job->WaitForThreads();
+            if constexpr ( CompactPairs )
+            {
+                const __m128i left   = _mm_loadu_si128( (const __m128i*)( packedPairs.left + i + j ) );
+                const __m128i offset = _mm_cvtepu16_epi32( _mm_loadl_epi64( (const __m128i*)( packedPairs.offset + i + j ) ) );
+                const __m128i right  = _mm_add_epi32( left, offset );
 
-    ///
-    /// Prune to new buffer
-    ///
-     
-    // Get our new offset
-    uint64 dstOffset = 0;
+                p = _mm256_or_si256( _mm256_cvtepu32_epi64( left ), _mm256_slli_epi64( _mm256_cvtepu32_epi64( right ), 32 ) );
+            }
+            else
+                p = _mm256_loadu_si256( (const __m256i*)( pairs + i + j ) );
 
-    const uint  threadId = job->_threadId;
-    const auto* jobs     = job->jobs;
+            const uint    n         = (uint)_mm_popcnt_u32( m );
+            const __m256i lanes     = _mm256_loadu_si256( (const __m256i*)CompressPairTable.lanes[m] );
+            const __m256i storeMask = _mm256_cmpgt_epi64( _mm256_set1_epi64x( n ), laneIndex64 );
+
+            _mm256_maskstore_epi64( (long long*)( newPairs + dstI ), storeMask, _mm256_permutevar8x32_epi32( p, lanes ) );
+            dstI += n;
+        }
 
-    for( uint i = 0; i < threadId; i++ )
-        dstOffset += jobs[i].length;
+        // Indices, 8 per vector
+        const __m256i laneIndex32 = _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 );
+        uint64 mapI = 0;
 
-    // Store new offset
-    job->offset = dstOffset;
+        for( uint j = 0; j < PRUNE_BLOCK_SIZE; j += 8 )
+        {
+            const uint m = (uint)( mask >> j ) & 0xFF;
+            if( !m )
+                continue;
+
+            const __m256i index     = _mm256_add_epi32( _mm256_set1_epi32( (int)(uint32)( i + j ) ), laneIndex32 );
+            const uint    n         = (uint)_mm_popcnt_u32( m );
+            const __m256i lanes     = _mm256_loadu_si256( (const __m256i*)CompressIndexTable.lanes[m] );
+            const __m256i storeMask = _mm256_cmpgt_epi32( _mm256_set1_epi32( (int)n ), laneIndex32 );
+
+            _mm256_maskstore_epi32( (int*)( map + mapI ), storeMask, _mm256_permutevar8x32_epi32( index, lanes ) );
+            mapI += n;
+        }
+    #endif
+
+    ASSERT( dstI == mapI );
+    return dstI;
+}
+
+#endif // P3_SIMD
+
+//-----------------------------------------------------------
+uint64 CountMarkedEntries( const byte* markedEntries, uint64 start, uint64 end )
+{
+    uint64 count = 0;
+    uint64 i     = start;
+
+    #if P3_SIMD
+        for( ; i + PRUNE_BLOCK_SIZE <= end; i += PRUNE_BLOCK_SIZE )
+            count += (uint64)_mm_popcnt_u64( GetMarkMask( markedEntries + i ) );
+    #endif
+
+    for( ; i < end; i++ )
+    {
+        if( markedEntries[i] )
+            count ++;
+    }
+
+    return count;
+}
+
+//-----------------------------------------------------------
+template<bool CompactPairs>
+void PruneAndMap( const LPJob& job, uint64 start, uint64 end, uint64 dstOffset )
+{
+    const byte*       markedEntries = job.markedEntries;
+    const Pair*       pairs         = job.rTable;
+    const PackedPairs packedPairs   = job.packedRTable;
 
     // Copy our valid entries to the new buffer
-    uint32* map      = job->map + dstOffset;
-    Pair*   newPairs = (Pair*)(job->lpBuffer + dstOffset);
+    uint32* map      = job.map + dstOffset;
+    Pair*   newPairs = (Pair*)(job.lpBuffer + dstOffset);
 
     uint64 dstI = 0;
+    uint64 i    = start;
+
+    #if P3_SIMD
+        for( ; i + PRUNE_BLOCK_SIZE <= end; i += PRUNE_BLOCK_SIZE )
+        {
+            const uint64 mask = GetMarkMask( markedEntries + i );
+
+            if( mask )
+                dstI += PruneBlock<CompactPairs>( mask, i, pairs, packedPairs, newPairs + dstI, map + dstI );
+        }
+    #endif
 
-    for( uint64 i = srcOffset; i < end; i++ )
+    for( ; i < end; i++ )
     {
         if( !markedEntries[i] )
             continue;
         
-        newPairs[dstI] = pairs[i];  // Copy to new location
+        // Copy to new location, unpacking if needed
+        if constexpr ( CompactPairs )
+            newPairs[dstI] = packedPairs.Get( i );
+        else
+            newPairs[dstI] = pairs[i];
+
         map     [dstI] = (uint32)i; // Map the entry back to its original location
 
         dstI++; 
     }
+}
 
-    ASSERT( dstI == length );
+template void PruneAndMap<false>( const LPJob& job, uint64 start, uint64 end, uint64 dstOffset );
+template void PruneAndMap<true> ( const LPJob& job, uint64 start, uint64 end, uint64 dstOffset );
+
+///
+/// Line point kernel
+///
+/// The x (or lookup table index) of both sides of a pair is gathered for a whole
+/// vector of pairs at once, then converted to line points with vector math.
+/// Pairs are ordered by left, and right is close to left, so the gathers mostly
+/// hit cache lines that were just loaded. They're limited by the number of loads
+/// issued, not by DRAM latency, which is why the pairs are not prefetched.
+#if P3_SIMD
+
+#if P3_AVX512
+static constexpr uint LP_VECTOR_SIZE = 8;
+#else
+static constexpr uint LP_VECTOR_SIZE = 4;
+#endif
+
+// GCC's AVX-512 intrinsics pass undefined vectors as merge sources, which it then reports as uninitialized
+#if P3_AVX512 && defined( __GNUC__ ) && !defined( __clang__ )
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+// Converts LP_VECTOR_SIZE pairs, in place
+//-----------------------------------------------------------
+inline void ConvertToLinePointsVector( uint64* pairs, const uint32* lTable )
+{
+    // x and y are less than 2^32, so x * (x-1) fits in 64 bits,
+    // and GetXEnc( x ) is ( x * (x-1) ) / 2, without rounding.
+    #if P3_AVX512
+        const __m512i p     = _mm512_loadu_si512( pairs );
+        const __m512i left  = _mm512_and_si512 ( p, _mm512_set1_epi64( 0xFFFFFFFF ) );
+        const __m512i right = _mm512_srli_epi64( p, 32 );
+
+        const __m512i x = _mm512_maskz_cvtepu32_epi64( 0xFF, _mm512_i64gather_epi32( left , lTable, 4 ) );
+        const __m512i y = _mm512_maskz_cvtepu32_epi64( 0xFF, _mm512_i64gather_epi32( right, lTable, 4 ) );
+
+        const __m512i a = _mm512_max_epu64( x, y );
+        const __m512i b = _mm512_min_epu64( x, y );
+
+        const __m512i xEnc = _mm512_srli_epi64( _mm512_mul_epu32( a, _mm512_sub_epi64( a, _mm512_set1_epi64( 1 ) ) ), 1 );
+
+        _mm512_storeu_si512( pairs, _mm512_add_epi64( xEnc, b ) );
+    #else
+        const __m256i p     = _mm256_loadu_si256( (const __m256i*)pairs );
+        const __m256i left  = _mm256_and_si256 ( p, _mm256_set1_epi64x( 0xFFFFFFFF ) );
+        const __m256i right = _mm256_srli_epi64( p, 32 );
+
+        const __m256i x = _mm256_cvtepu32_epi64( _mm256_i64gather_epi32( (const int*)lTable, left , 4 ) );
+        const __m256i y = _mm256_cvtepu32_epi64( _mm256_i64gather_epi32( (const int*)lTable, right, 4 ) );
+
+        // Both are below 2^63, so a signed compare orders them
+        const __m256i xGreater = _mm256_cmpgt_epi64( x, y );
+        const __m256i a = _mm256_blendv_epi8( y, x, xGreater );
+        const __m256i b = _mm256_blendv_epi8( x, y, xGreater );
+
+        const __m256i xEnc = _mm256_srli_epi64( _mm256_mul_epu32( a, _mm256_sub_epi64( a, _mm256_set1_epi64x( 1 ) ) ), 1 );
+
+        _mm256_storeu_si256( (__m256i*)pairs, _mm256_add_epi64( xEnc, b ) );
+    #endif
 }
 
+#if P3_AVX512 && defined( __GNUC__ ) && !defined( __clang__ )
+    #pragma GCC diagnostic pop
+#endif
+
+#endif // P3_SIMD
+
 //-----------------------------------------------------------
-void ConverToLinePointThread( LPJob* job )
+void ConvertToLinePoints( const LPJob& job, uint64 start, uint64 end )
 {
-    const uint64  length = job->length;
+    Pair*         rTable = (Pair*)job.lpBuffer;
+    const uint32* lTable = job.lTable;
+
+    uint64 i = start;
 
-    Pair*         rTable = (Pair*)(job->lpBuffer + job->offset);
-    const uint32* lTable = job->lTable;
+    #if P3_SIMD
+        for( ; i + LP_VECTOR_SIZE <= end; i += LP_VECTOR_SIZE )
+            ConvertToLinePointsVector( job.lpBuffer + i, lTable );
+    #endif
 
-    for( uint64 i = 0; i < length; i++ )
+    for( ; i < end; i++ )
     {
         const Pair* rEntry = &rTable[i];
         
@@ -328,17 +659,60 @@ void ConverToLinePointThread( LPJob* job )
 }
 
 //-----------------------------------------------------------
-void WriteLookupTableThread( LPJob* job )
+void WriteLookupTable( const LPJob& job, uint64 start, uint64 end )
 {
-    const uint64  length = job->length;
-    const uint64  offset = job->offset;
-    const uint64  end    = offset + length;
+    const uint32* map    = job.map;
+    uint32*       lookup = job.lTable;
 
-    const uint32* map    = job->map;
-    uint32*       lookup = job->lTable;
-
-    for( uint64 i = offset; i < end; i++ )
+    for( uint64 i = start; i < end; i++ )
         lookup[map[i]] = (uint32)i;
 }
 
+//-----------------------------------------------------------
+void WriteLookupTableByRegion( ThreadPool& pool, const LPJob& job, uint64 length, uint64* packed, uint64* tmp )
+{
+    // Regions of 64K entries (256 KiB) fit in L2. The lookup index of each entry is
+    // packed with its region number in the top bits of the bytes we sort on, so that it's the
+    // most significant digit of the sort. Its offset in the region goes right above them.
+    constexpr uint   REGION_BITS     = 16;
+    constexpr uint   REGION_KEY_BITS = _K > REGION_BITS ? _K - REGION_BITS : 1;
+    constexpr int    SORT_BYTES      = (int)CDiv( REGION_KEY_BITS, 8 );
+    constexpr uint   SORT_BITS       = SORT_BYTES * 8;
+    constexpr uint   REGION_SHIFT    = SORT_BITS - REGION_KEY_BITS;
+    constexpr uint32 REGION_MASK     = ( 1u << REGION_BITS ) - 1;
+    constexpr uint32 REGION_KEY_MASK = ( 1u << REGION_KEY_BITS ) - 1;
+
+    static_assert( SORT_BITS + REGION_BITS <= 32 );
+
+    const uint32* map    = job.map;
+    uint32*       lookup = job.lTable;
+
+    const uint64 grain = std::max( CDiv( length, 4096 ), (uint64)( 64 * 1024 ) );
+
+    // Pack the lookup index and the final index of each entry
+    pool.ParallelFor( length, grain, [=]( uint64 start, uint64 end, uint ) {
 
+        for( uint64 i = start; i < end; i++ )
+        {
+            const uint32 index = map[i];
+            packed[i] = ( (uint64)( index >> REGION_BITS ) << REGION_SHIFT ) | ( (uint64)( index & REGION_MASK ) << SORT_BITS ) | ( i << 32 );
+        }
+    });
+
+    RadixSort256::SortOnLowBytes<MAX_THREADS, SORT_BYTES>( pool, packed, tmp, length );
+
+    const uint64* sorted = ( SORT_BYTES & 1 ) ? tmp : packed;
+
+    // Each chunk now writes to a few consecutive regions only
+    pool.ParallelFor( length, grain, [=]( uint64 start, uint64 end, uint ) {
+
+        for( uint64 i = start; i < end; i++ )
+        {
+            const uint64 entry = sorted[i];
+            const uint32 key   = (uint32)entry;
+            const uint32 index = ( ( ( key >> REGION_SHIFT ) & REGION_KEY_MASK ) << REGION_BITS ) | ( ( key >> SORT_BITS ) & REGION_MASK );
+
+            lookup[index] = (uint32)( entry >> 32 );
+        }
+    });
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include "PlotContext.h"
+#include "MemArena.h"
 
 class MemPhase3
 {
@@ -10,6 +11,9 @@ public:
 
     void Run();
 
+    // Declare the buffers used by this phase in the plot's memory arena
+    static void DeclareBuffers( MemArena& arena, MemPlotContext& cx );
+
 private:
     template<bool IsTable6>
     uint64 ProcessTable( uint32* lEntries, uint64* lpBuffer,
@@ -1,122 +1,84 @@
 #include "MemPhase4.h"
 #include "CTables.h"
 #include "util/Log.h"
+#include "util/PerfCounters.h"
 
 //-----------------------------------------------------------
 MemPhase4::MemPhase4( MemPlotContext& context )
     : _context( context )
 {}
 
+//-----------------------------------------------------------
+void MemPhase4::DeclareBuffers( MemArena& arena, MemPlotContext& cx )
+{
+    // Lives into the next plot, until this one has finished writing
+    const MemStep writeEnd = cx.overlapWrites ? MemStep::P1Table7 : MemStep::P1Table2Fx;
+
+    arena.Declare( "p4Buffer", cx.p4Buffer, ENTRIES_PER_TABLE * sizeof( uint64 ), MemStep::P4, writeEnd );
+}
+
 //-----------------------------------------------------------
 void MemPhase4::Run()
 {
-    // Use meta0 to write the final tables to disk
     MemPlotContext& cx = _context;
     
-    // The first 32 GiB of meta0 are used by phase 3 to write the table 6 park,
-    // so we need to offset here to write the rest.
-    cx.p4WriteBuffer = ((byte*)cx.metaBuffer0) + 32ull GB;
+    cx.p4WriteBuffer = cx.p4Buffer;
     cx.p4WriteBufferWriter = cx.p4WriteBuffer;
 
-    WriteP7();
-    WriteC1();
-    WriteC2();
-    WriteC3();
+    WriteTables();
 }
 
 //-----------------------------------------------------------
-void MemPhase4::WriteP7()
+void MemPhase4::WriteTables()
 {
-    // Write P7 (Table 7 park), which are indices into
-    // the previous table's LinePoints (which are parked as well).
+    // P7 (Table 7 park) holds the indices into the previous table's LinePoints
+    // (which are parked as well), and C1, C2 and C3 the f7s. They're all written
+    // in the same sweep over table 7, instead of one pass over it per table.
 
     MemPlotContext& cx = _context;
 
     const uint32* lTable     = cx.t1XBuffer;          // L table is passed around in the t1XBuffer
     const uint64  entryCount = cx.entryCount[(int)TableId::Table7];
-    byte*         p7Buffer   = cx.plotWriter->AlignPointerToBlockSize<byte>( cx.p4WriteBufferWriter ); // This buffer is big enough to hold the whole park
-    
-    Log::Line( "  Writing P7." );
-    auto timer = TimerBegin();
 
-    const size_t sizeWritten = WriteP7Parallel<MAX_THREADS>( *cx.threadPool, entryCount, lTable, p7Buffer );
-    
-    cx.p4WriteBufferWriter = ((byte*)p7Buffer) + sizeWritten;
-    
-    if( !cx.plotWriter->WriteTable( p7Buffer, sizeWritten ) )
-        Fatal( "Failed to write P7 to disk." );
+    // The sizes are known up front, so each table is placed at its block-aligned offset
+    // in the write buffer (which is big enough to hold all of them) before they're written.
+    size_t sizes[4];
+    GetP4TableSizes( entryCount, sizes );
 
-    double elapsed = TimerEnd( timer );
-    Log::Line( "  Finished writing P7 in %.2lf seconds.", elapsed );
-}
+    DiskPlotWriter& writer = *cx.plotWriter;
 
-//-----------------------------------------------------------
-void MemPhase4::WriteC1()
-{
-    MemPlotContext& cx = _context;
- 
-    const uint64 entryCount  = cx.entryCount[(int)TableId::Table7];
-    uint32*      writeBuffer = cx.plotWriter->AlignPointerToBlockSize<uint32>( cx.p4WriteBufferWriter );
+    P4Tables tables;
+    tables.p7 = writer.AlignPointerToBlockSize<byte>  ( cx.p4WriteBufferWriter );
+    tables.c1 = writer.AlignPointerToBlockSize<uint32>( tables.p7 + sizes[0] );
+    tables.c2 = writer.AlignPointerToBlockSize<uint32>( ((byte*)tables.c1) + sizes[1] );
+    tables.c3 = writer.AlignPointerToBlockSize<byte>  ( ((byte*)tables.c2) + sizes[2] );
 
-    Log::Line( "  Writing C1 table." );
+    Log::Line( "  Writing P7, C1, C2 and C3 tables." );
     auto timer = TimerBegin();
+    PerfSpan perf( cx.perf );
 
-    const size_t sizeWritten = WriteC12Parallel<MAX_THREADS, kCheckpoint1Interval>( 
-        *cx.threadPool, entryCount, cx.t7YBuffer, writeBuffer );
-
-    cx.p4WriteBufferWriter = ((byte*)writeBuffer) + sizeWritten;
+    WriteP4Parallel<MAX_THREADS>( *cx.threadPool, entryCount, lTable, cx.t7YBuffer, tables );
 
-    if( !cx.plotWriter->WriteTable( writeBuffer, sizeWritten ) )
-        Fatal( "Failed to write C1 to disk." );
+    cx.p4WriteBufferWriter = tables.c3 + sizes[3];
 
-    double elapsed = TimerEnd( timer );
-    Log::Line( "  Finished writing C1 table in %.2lf seconds.", elapsed );
-}
-
-//-----------------------------------------------------------
-void MemPhase4::WriteC2()
-{
-    MemPlotContext& cx = _context;
- 
-    const uint64 entryCount  = cx.entryCount[(int)TableId::Table7];
-    uint32*      writeBuffer = cx.plotWriter->AlignPointerToBlockSize<uint32>( cx.p4WriteBufferWriter );
-
-    Log::Line( "  Writing C2 table." );
-    auto timer = TimerBegin();
-
-    const size_t sizeWritten = WriteC12Parallel<MAX_THREADS, kCheckpoint1Interval*kCheckpoint2Interval>( 
-        *cx.threadPool, entryCount, cx.t7YBuffer, writeBuffer );
+    if( !writer.WriteTable( tables.p7, sizes[0] ) )
+        Fatal( "Failed to write P7 to disk." );
 
-    cx.p4WriteBufferWriter = ((byte*)writeBuffer) + sizeWritten;
+    if( !writer.WriteTable( tables.c1, sizes[1] ) )
+        Fatal( "Failed to write C1 to disk." );
 
-    if( !cx.plotWriter->WriteTable( writeBuffer, sizeWritten ) )
+    if( !writer.WriteTable( tables.c2, sizes[2] ) )
         Fatal( "Failed to write C2 to disk." );
 
-    double elapsed = TimerEnd( timer );
-    Log::Line( "  Finished writing C2 table in %.2lf seconds.", elapsed );
-}
-
-//-----------------------------------------------------------
-void MemPhase4::WriteC3()
-{
-    MemPlotContext& cx = _context;
- 
-    const uint64 entryCount  = cx.entryCount[(int)TableId::Table7];
-    byte*        writeBuffer = cx.plotWriter->AlignPointerToBlockSize<byte>( cx.p4WriteBufferWriter );
-
-    Log::Line( "  Writing C3 table." );
-    auto timer = TimerBegin();
-
-    const size_t sizeWritten = WriteC3Parallel<MAX_THREADS>( 
-         *cx.threadPool, entryCount, cx.t7YBuffer, writeBuffer );
-
-    cx.p4WriteBufferWriter = ((byte*)writeBuffer) + sizeWritten;
-
-    if( !cx.plotWriter->WriteTable( writeBuffer, sizeWritten ) )
+    if( !writer.WriteTable( tables.c3, sizes[3] ) )
         Fatal( "Failed to write C3 to disk." );
 
     double elapsed = TimerEnd( timer );
-    Log::Line( "  Finished writing C3 table in %.2lf seconds.", elapsed );
-}
+    Log::Line( "  Finished writing P7, C1, C2 and C3 tables in %.2lf seconds.", elapsed );
+    perf.Log( "  P7-C3" );
 
+    cx.stats.p4TablesSeconds = elapsed;
 
+    for( uint i = 0; i < 4; i++ )
+        cx.stats.tableBytes[6+i] = sizes[i];
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include "PlotContext.h"
+#include "MemArena.h"
 #include "CTables.h"
 
 class MemPhase4
@@ -11,154 +12,195 @@ public:
 
     void Run();
 
-    void WriteP7();
-    void WriteC1();
-    void WriteC2();
-    void WriteC3();
+    // Declare the buffers used by this phase in the plot's memory arena
+    static void DeclareBuffers( MemArena& arena, MemPlotContext& cx );
+
+    // Writes P7, C1, C2 and C3 in a single pass over table 7
+    void WriteTables();
 
 private:
     MemPlotContext& _context;
 };
 
-struct P7Job
+// Output buffers of the Phase 4 tables, in plot file order
+struct P4Tables
 {
-    uint64        parkCount;
-    const uint32* indices;
-    byte*         parkBuffer;
+    byte*   p7;
+    uint32* c1;
+    uint32* c2;
+    byte*   c3;
 };
 
-struct C12Job
+struct P4Job
 {
-    uint64        length;
-    const uint32* f7Entries;
-    uint32*       writeBuffer;
-
-    #if DEBUG
-        uint32 jobIndex;
-    #endif
+    uint64        entryStart;   // Starts at a C3 park boundary
+    uint64        entryEnd;
+    uint64        entryCount;   // Table 7's entry count
+    const uint32* lEntries;
+    uint32*       f7Entries;
+    P4Tables      tables;
 };
 
-struct C3Job
-{
-    uint64  parkCount;
-    uint32* f7Entries;
-    byte*   writeBuffer;
-};
+// P7, C1, C2 & C3 tables
+void GetP4TableSizes( const uint64 length, size_t outSizes[4] );
 
-// P7
 template<uint MAX_JOBS>
-size_t WriteP7Parallel( ThreadPool& pool, const uint64 length, 
-                        const uint32* indices, byte* parkBuffer );
-
-void WriteP7Parks( const uint64 parkCount, const uint32* indices, byte* parkBuffer );
-void WriteP7Entries( const uint64 length, const uint32* indices, byte* parkBuffer );
+void WriteP4Parallel( ThreadPool& pool, const uint64 length, const uint32* lEntries,
+                      uint32* f7Entries, const P4Tables& tables );
 
+void WriteP4Thread( P4Job* job );
 
-// C1 & C2 tables
-size_t WriteC12Parallel( ThreadPool& pool, const uint64 length, 
-                         const uint32* f7Entries, uint32* parkBuffer );
-
-template<uint CInterval>
-void WriteC12Entries( const uint64 length, const uint32* f7Entries, uint32* c1Buffer );
+// P7
+void WriteP7Park( const uint64 park, const uint64 length, const uint32* indices, byte* p7Buffer );
+void WriteP7Entries( const uint64 length, const uint32* indices, byte* parkBuffer );
 
 // C3 parks
 uint64 GetC3ParkCount( const uint64 length );
 uint64 GetC3ParkCount( const uint64 length, uint64& outLastParkRemainder );
 
-template<uint MAX_JOBS>
-size_t WriteC3Parallel( ThreadPool& pool, const uint64 length, uint32* f7Entries, byte* c3Buffer );
-
-void WriteC3Parks( const uint64 parkCount, uint32* f7Entries, byte* writeBuffer );
 void WriteC3Park( const uint64 length, uint32* f7Entries, byte* parkBuffer );
 
 
 ///
-/// P7
+/// P7, C1, C2 & C3
 ///
 
 //-----------------------------------------------------------
-inline void WriteP7Thread( P7Job* job )
+inline void GetP4TableSizes( const uint64 length, size_t outSizes[4] )
 {
-    WriteP7Parks( job->parkCount, job->indices, job->parkBuffer );
+    const size_t p7ParkSize = CDiv( (_K + 1) * kEntriesPerPark, 8 );
+
+    // C1 and C2 end with an extra entry (see WriteP4Parallel)
+    outSizes[0] = CDiv( length, kEntriesPerPark ) * p7ParkSize;
+    outSizes[1] = ( CDiv( length, kCheckpoint1Interval ) + 1 ) * sizeof( uint32 );
+    outSizes[2] = ( CDiv( length, (uint64)kCheckpoint1Interval * kCheckpoint2Interval ) + 1 ) * sizeof( uint32 );
+    outSizes[3] = GetC3ParkCount( length ) * CalculateC3Size();
 }
 
 //-----------------------------------------------------------
 template<uint MAX_JOBS>
-inline size_t WriteP7Parallel( ThreadPool& pool, const uint64 length, const uint32* indices, byte* parkBuffer )
+inline void WriteP4Parallel( ThreadPool& pool, const uint64 length, const uint32* lEntries,
+                             uint32* f7Entries, const P4Tables& tables )
 {
-    const uint32 threadCount     = std::min( pool.ThreadCount(), MAX_JOBS );
+    // Threads get whole C3 parks, which also gives them whole C1 and C2 entries
+    const uint64 c1Count        = CDiv( length, kCheckpoint1Interval );
+    const uint64 c2Count        = CDiv( length, (uint64)kCheckpoint1Interval * kCheckpoint2Interval );
+    const uint32 threadCount    = (uint32)std::min( (uint64)std::min( pool.ThreadCount(), MAX_JOBS ), std::max( c1Count, (uint64)1 ) );
+    const uint64 parksPerThread = c1Count / threadCount;
 
-    const uint64 parkCount       = length / kEntriesPerPark;           // Number of parks that are completely filled with entries
-    const uint64 parksPerThread  = parkCount / threadCount;
-    
-    uint64 trailingParks = parkCount - ( parksPerThread * threadCount );
+    uint64 trailingParks = c1Count - ( parksPerThread * threadCount );
 
-    const uint64 trailingEntries   = length - ( parkCount * kEntriesPerPark );
-    const uint64 totalParksWritten = parkCount + ( trailingEntries ? 1 : 0 );
+    P4Job jobs[MAX_JOBS];
 
-    /**
-     * #NOTE: 8-byte (uint64s) fields fit perfectly into the 
-     *        park size buffer, so we don't have to worry about
-     *        race conditions where a thread might write to its last field
-     *        which is shared with the first thread's field as well.
-     *          33 (K+1) * kEntriesPerPark (2048)
-     *          = 67584 / 8
-     *          = 8448 / 8
-     *          = 1056 64-bit fields
-     */
-    const size_t parkSize = CDiv( (_K + 1) * kEntriesPerPark, 8 );
-    static_assert( parkSize / 8 == 1056 );
-    
-    P7Job jobs[MAX_JOBS];
+    uint64 entryStart = 0;
 
-    const uint32* threadIndices    = indices;
-    byte*         threadParkBuffer = parkBuffer;
-
-    for( uint i = 0; i < threadCount; i++ )
+    for( uint32 i = 0; i < threadCount; i++ )
     {
         auto& job = jobs[i];
 
-        job.parkCount  = parksPerThread;
-        job.indices    = threadIndices;
-        job.parkBuffer = threadParkBuffer;
+        uint64 parkCount = parksPerThread;
 
-        // Assign trailing parks accross threads
+        // Distribute trailing parks accross threads
         if( trailingParks )
         {
-            job.parkCount ++;
+            parkCount ++;
             trailingParks --;
         }
 
-        threadIndices    += job.parkCount * kEntriesPerPark;
-        threadParkBuffer += job.parkCount * parkSize;
+        job.entryStart = entryStart;
+        job.entryEnd   = std::min( entryStart + parkCount * kCheckpoint1Interval, length );
+        job.entryCount = length;
+        job.lEntries   = lEntries;
+        job.f7Entries  = f7Entries;
+        job.tables     = tables;
+
+        entryStart = job.entryEnd;
     }
 
-    // Run jobs
-    pool.RunJob( WriteP7Thread, jobs, threadCount );
+    pool.RunJob( WriteP4Thread, jobs, threadCount );
 
-    // Write trailing entries into a park, if we have any
-    if( trailingEntries )
-    {
-        memset( threadParkBuffer, 0, parkSize );
-        WriteP7Entries( trailingEntries, threadIndices, threadParkBuffer );
-    }
+    // Write an empty C1 entry at the end (compatibility with chiapos)
+    tables.c1[c1Count] = 0;
 
-    return totalParksWritten * parkSize;
+    // #NOTE: Unfortunately, chiapos infers the size of the C2 table by substracting
+    //  the C3 pointer by the C2 pointer. This does not work for us
+    //  because since we do block-aligned writes we, our C2 size disk-occupied size
+    //  will most likely be greater than the actual C2 size. 
+    //  To work around this, we can add a trailing entry with the maximum k32 value size.
+    //  This will force chiapos to stop at that point as the f7 is lesser than max k32 value.
+    //  #IMPORTANT: This means that we can't have any f7's that are 0xFFFFFFFF!.
+    tables.c2[c2Count] = 0xFFFFFFFF;
 }
 
 //-----------------------------------------------------------
-inline void WriteP7Parks( const uint64 parkCount, const uint32* indices, byte* parkBuffer )
+inline void WriteP4Thread( P4Job* job )
 {
-    const size_t parkSize = CDiv( (_K + 1) * kEntriesPerPark, 8 );
+    const uint64 length     = job->entryCount;
+    const uint64 c2Interval = (uint64)kCheckpoint1Interval * kCheckpoint2Interval;
+    const size_t c3Size     = CalculateC3Size();
+
+    // P7 parks are owned by the thread in which they start
+    uint64       p7Park    = CDiv( job->entryStart, kEntriesPerPark );
+    const uint64 p7ParkEnd = CDiv( job->entryEnd  , kEntriesPerPark );
 
-    for( uint64 i = 0; i < parkCount; i++ )
+    for( uint64 entry = job->entryStart; entry < job->entryEnd; entry += kCheckpoint1Interval )
     {
-        WriteP7Entries( kEntriesPerPark, indices, parkBuffer );
-        indices    += kEntriesPerPark;
-        parkBuffer += parkSize;
+        const uint64 c1Index = entry / kCheckpoint1Interval;
+        uint32*      f7      = job->f7Entries + entry;
+
+        // C1 and C2 get the first f7 of the park, before C3 overwrites the f7s with deltas
+        job->tables.c1[c1Index] = Swap32( *f7 );
+
+        if( entry % c2Interval == 0 )
+            job->tables.c2[entry / c2Interval] = Swap32( *f7 );
+
+        // The first f7 is stored in C1, so a park needs at least 1 delta
+        const uint64 parkLength = std::min( (uint64)kCheckpoint1Interval, length - entry );
+
+        if( parkLength > 1 )
+            WriteC3Park( parkLength - 1, f7, job->tables.c3 + c1Index * c3Size );
+
+        // Pack the P7 parks of the entries swept so far, while they're still in the cache
+        const uint64 sweepEnd = std::min( entry + kCheckpoint1Interval, job->entryEnd );
+
+        for( ; p7Park < p7ParkEnd && p7Park * kEntriesPerPark < sweepEnd; p7Park++ )
+            WriteP7Park( p7Park, length, job->lEntries, job->tables.p7 );
     }
 }
 
+
+///
+/// P7
+///
+
+//-----------------------------------------------------------
+inline void WriteP7Park( const uint64 park, const uint64 length, const uint32* indices, byte* p7Buffer )
+{
+    /**
+     * #NOTE: 8-byte (uint64s) fields fit perfectly into the 
+     *        park size buffer, so we don't have to worry about
+     *        race conditions where a thread might write to its last field
+     *        which is shared with the first thread's field as well.
+     *          33 (K+1) * kEntriesPerPark (2048)
+     *          = 67584 / 8
+     *          = 8448 / 8
+     *          = 1056 64-bit fields
+     *        This holds for any k, as kEntriesPerPark is a multiple of 64.
+     */
+    const size_t parkSize = CDiv( (_K + 1) * kEntriesPerPark, 8 );
+    static_assert( parkSize % 8 == 0 );
+
+    const uint64 parkStart  = park * kEntriesPerPark;
+    const uint64 parkLength = std::min( (uint64)kEntriesPerPark, length - parkStart );
+    byte*        parkBuffer = p7Buffer + park * parkSize;
+
+    // The last park may not be completely filled with entries
+    if( parkLength < kEntriesPerPark )
+        memset( parkBuffer, 0, parkSize );
+
+    WriteP7Entries( parkLength, indices + parkStart, parkBuffer );
+}
+
 //-----------------------------------------------------------
 inline void WriteP7Entries( const uint64 length, const uint32* indices, byte* parkBuffer )
 {
@@ -216,86 +258,6 @@ inline void WriteP7Entries( const uint64 length, const uint32* indices, byte* pa
 }
 
 
-///
-/// C1 & C2
-///
-//-----------------------------------------------------------
-template<uint CInterval>
-inline void WriteC12Thread( C12Job* job )
-{
-    WriteC12Entries<CInterval>( job->length, job->f7Entries, job->writeBuffer );
-}
-
-//-----------------------------------------------------------
-template<uint MAX_JOBS, uint CInterval>
-inline size_t WriteC12Parallel( ThreadPool& pool, const uint64 length, 
-                                const uint32* f7Entries, uint32* parkBuffer )
-{
-    const uint32 threadCount      = std::min( pool.ThreadCount(), MAX_JOBS );
-
-    const uint64 parkEntries      = CDiv( length, (int) CInterval );
-    const uint64 entriesPerThread = parkEntries / threadCount;
-    const uint64 trailingEntries  = parkEntries - (entriesPerThread * threadCount);
-
-    C12Job jobs[MAX_JOBS];
-
-    const uint32* threadf7Entries = f7Entries;
-    uint32*       parkWriter      = parkBuffer;
-
-    for( uint32 i = 0; i < threadCount; i++ )
-    {
-        auto& job = jobs[i];
-        
-        job.length      = entriesPerThread;
-        job.f7Entries   = threadf7Entries;
-        job.writeBuffer = parkWriter;
-
-        #if DEBUG
-            job.jobIndex = i;
-        #endif
-        
-        threadf7Entries += entriesPerThread * CInterval;
-        parkWriter      += entriesPerThread;
-    }
-
-    pool.RunJob( WriteC12Thread<CInterval>, jobs, threadCount );
-
-    // Write trailing entries, if any
-    if( trailingEntries )
-        WriteC12Entries<CInterval>( trailingEntries, threadf7Entries, parkWriter );
-
-
-    if constexpr ( CInterval == kCheckpoint1Interval * kCheckpoint2Interval )
-    {
-        // #NOTE: Unfortunately, chiapos infers the size of the C2 table by substracting
-        //  the C3 pointer by the C2 pointer. This does not work for us
-        //  because since we do block-aligned writes we, our C2 size disk-occupied size
-        //  will most likely be greater than the actual C2 size. 
-        //  To work around this, we can add a trailing entry with the maximum k32 value size.
-        //  This will force chiapos to stop at that point as the f7 is lesser than max k32 value.
-        //  #IMPORTANT: This means that we can't have any f7's that are 0xFFFFFFFF!.
-        parkWriter[trailingEntries] = 0xFFFFFFFF;
-    }
-    else
-    {
-        
-        // Write an empty one at the end (compatibility with chiapos)
-        parkWriter[trailingEntries] = 0;
-    }
-
-    return (parkEntries + 1) * sizeof( uint32 );
-}
-
-//-----------------------------------------------------------
-template<uint CInterval>
-inline void WriteC12Entries( const uint64 length, const uint32* f7Entries, uint32* c1Buffer )
-{
-    uint64 f7Src = 0;
-    for( uint64 i = 0; i < length; i++, f7Src += CInterval )
-        c1Buffer[i] = Swap32( f7Entries[f7Src] );
-}
-
-
 ///
 /// C3
 ///
@@ -325,80 +287,6 @@ inline uint64 GetC3ParkCount( const uint64 length )
     return GetC3ParkCount( length, remainder );
 }
 
-//-----------------------------------------------------------
-inline void WriteC3Thread( C3Job* job )
-{
-    WriteC3Parks( job->parkCount, job->f7Entries, job->writeBuffer );
-}
-
-//-----------------------------------------------------------
-template<uint MAX_JOBS>
-inline size_t WriteC3Parallel( ThreadPool& pool, const uint64 length, uint32* f7Entries, byte* c3Buffer )
-{
-    const uint32 threadCount       = std::min( pool.ThreadCount(), MAX_JOBS );
-
-    const uint64 parkCount         = length / kCheckpoint1Interval;
-    const uint64 parksPerThread    = parkCount / threadCount;
-    
-    uint64 trailingParks           = parkCount - ( parksPerThread * threadCount );
-    
-    const uint64 trailingEntries    = length - ( parkCount * kCheckpoint1Interval );
-    
-    // We need to check trailingEntries > 1 because the first entry is stored in C1.
-    // Therefore, we need to have at least 1 delta to write an extra C3 park.
-    const bool   hasTrailingEntries = trailingEntries > 1;
-    const uint64 totalParksWritten  = parkCount + ( hasTrailingEntries ? 1 : 0 );
-    
-    const size_t c3Size = CalculateC3Size();
-
-    C3Job jobs[MAX_JOBS];
-
-    uint32* threadF7Entries = f7Entries;
-    byte*   threadC3Buffer  = c3Buffer;
-
-    for( uint32 i = 0; i < threadCount; i++ )
-    {
-        auto& job = jobs[i];
-
-        job.parkCount   = parksPerThread;
-        job.f7Entries   = threadF7Entries;
-        job.writeBuffer = threadC3Buffer;
-
-        // Distribute trailing parks accross threads
-        if( trailingParks )
-        {
-            job.parkCount ++;
-            trailingParks --;
-        }
-
-        threadF7Entries += job.parkCount * kCheckpoint1Interval;
-        threadC3Buffer  += job.parkCount * c3Size;
-    }
-
-    // Run jobs
-    pool.RunJob( WriteC3Thread, jobs, threadCount );
-
-    // Write any trailing entries to a park
-    if( hasTrailingEntries )
-        WriteC3Park( trailingEntries-1, threadF7Entries, threadC3Buffer );
-
-    return totalParksWritten * c3Size;
-}
-
-//-----------------------------------------------------------
-inline void WriteC3Parks( const uint64 parkCount, uint32* f7Entries, byte* writeBuffer )
-{
-    const size_t c3Size = CalculateC3Size();
-
-    for( uint64 i = 0; i < parkCount; i++ )
-    {
-        WriteC3Park( kCheckpoint1Interval-1, f7Entries, writeBuffer );
-
-        f7Entries   += kCheckpoint1Interval;
-        writeBuffer += c3Size;
-    }
-}
-
 //-----------------------------------------------------------
 inline void WriteC3Park( const uint64 length, uint32* f7Entries, byte* parkBuffer )
 {
@@ -435,10 +323,10 @@ inline void WriteC3Park( const uint64 length, uint32* f7Entries, byte* parkBuffe
     // Store size in the first 2 bytes
     *((uint16*)parkBuffer) = Swap16( (uint16)compressedSize );
 
-    // Zero-out remainder (not necessarry, though...)
+    // Zero-out the remainder, so that the output doesn't depend on what the buffer held before
     const size_t remainder = c3Size - (compressedSize + 2);
     if( remainder )
-        memset( deltaWriter + compressedSize + 2, 0, remainder );
+        memset( parkBuffer + compressedSize + 2, 0, remainder );
 }
 
 
@@ -8,6 +8,10 @@
 #include "MemPhase2.h"
 #include "MemPhase3.h"
 #include "MemPhase4.h"
+#include "MemSpill.h"
+#include "MemCheckpoint.h"
+#include "util/PerfCounters.h"
+#include "util/Trace.h"
 
 
 //----------------------------------------------------------
@@ -30,11 +34,42 @@ MemPlotter::MemPlotter( const MemPlotConfig& cfg )
         //     Log::Error( "Warning: Failed to set NUMA interleaved mode." );
     }
 
-    _context.threadCount = cfg.threadCount;
+    _context.threadCount  = cfg.threadCount;
+    _context.compactPairs  = cfg.compactPairs;
+    _context.spillDir      = cfg.spillDir;
+    _context.overlapWrites = cfg.overlapWrites;
+    _context.arena         = &_arena;
+    _statsPath             = cfg.statsPath;
+    _traceDir              = cfg.traceDir;
+    _benchmark             = cfg.benchmark;
+    _benchmarkWriteSpeed   = cfg.benchmarkWriteSpeed;
+    _replayPhase           = cfg.replayPhase;
+
+    // Tracing must be enabled before the pool threads start
+    if( cfg.traceDir )
+    {
+        Trace::Enable();
+        Trace::SetThreadName( "Main" );
+    }
     
     // Create a thread pool
     _context.threadPool = new ThreadPool( cfg.threadCount, ThreadPool::Mode::Fixed, cfg.noCPUAffinity );
 
+    if( cfg.spillDir )
+        _context.spill = new MemSpill( cfg.spillDir, SPILL_IO_THREADS );
+
+    if( cfg.checkpointDir )
+        _context.checkpoint = new MemCheckpoint( cfg.checkpointDir, CHECKPOINT_IO_THREADS );
+
+    if( cfg.perfCounters )
+    {
+        _context.perf = PerfCounters::Create( *_context.threadPool );
+
+        if( !_context.perf )
+            Log::Error( "Warning: Hardware performance counters are not available. "
+                        "They may require a lower /proc/sys/kernel/perf_event_paranoid setting." );
+    }
+
     // Allocate buffers
     {
         const size_t totalMemory = SysHost::GetTotalSystemMemory();
@@ -42,78 +77,81 @@ MemPlotter::MemPlotter( const MemPlotConfig& cfg )
 
         Log::Line( "System Memory: %llu/%llu GiB.", availMemory BtoGB , totalMemory BtoGB );
 
-        // YBuffers need to round up to chacha block size, so we just add an extra block always
-        const size_t chachaBlockSize  = kF1BlockSizeBits / 8;
-
-        const size_t t1XBuffer   = 16ull GB;
-        const size_t t2LRBuffer  = 32ull GB;
-        const size_t t3LRBuffer  = 32ull GB;
-        const size_t t4LRBuffer  = 32ull GB;
-        const size_t t5LRBuffer  = 32ull GB;
-        const size_t t6LRBuffer  = 32ull GB;
-        const size_t t7LRBuffer  = 32ull GB;
-        const size_t t7YBuffer   = 16ull GB;
-
-        const size_t yBuffer0    = 32ull GB + chachaBlockSize;
-        const size_t yBuffer1    = 32ull GB + chachaBlockSize;
-        const size_t metaBuffer0 = 64ull GB;
-        const size_t metaBuffer1 = 64ull GB;
-
-        const size_t reqMem = 
-            t1XBuffer   +
-            t2LRBuffer  +
-            t3LRBuffer  +
-            t4LRBuffer  +
-            t5LRBuffer  +
-            t6LRBuffer  +
-            t7LRBuffer  +
-            t7YBuffer   +
-            yBuffer0    +
-            yBuffer1    +
-            metaBuffer0 +
-            metaBuffer1;
-
-        Log::Line( "Memory required: %llu GiB.", reqMem BtoGB );
+        // Plan the memory layout of all the buffers
+        MemArena& arena = _arena;
+        DeclareBuffers( arena, _context );
+
+        const size_t reqMem = arena.Plan();
+
+        Log::Line( "Memory required: %.2lf GiB ( %.2lf GiB without buffer sharing ).", 
+            (double)reqMem / (1ull GB), (double)arena.UnplannedSize() / (1ull GB) );
         if( availMemory < reqMem  )
             Log::Line( "Warning: Not enough memory available. Buffer allocation may fail." );
 
         Log::Line( "Allocating buffers." );
-        _context.t1XBuffer   = SafeAlloc<uint32>( t1XBuffer  , warmStart, numa );
+        byte* buffer = SafeAlloc<byte>( "arena", reqMem, warmStart, cfg.hugePages, numa );
 
-        _context.t2LRBuffer  = SafeAlloc<Pair>  ( t2LRBuffer , warmStart, numa );
-        _context.t3LRBuffer  = SafeAlloc<Pair>  ( t3LRBuffer , warmStart, numa );
-        _context.t4LRBuffer  = SafeAlloc<Pair>  ( t4LRBuffer , warmStart, numa );
-        _context.t5LRBuffer  = SafeAlloc<Pair>  ( t5LRBuffer , warmStart, numa );
-        _context.t6LRBuffer  = SafeAlloc<Pair>  ( t6LRBuffer , warmStart, numa );
+        arena.Bind( buffer );
+        arena.PrintPlan();
+    }
+}
 
-        _context.t7YBuffer   = SafeAlloc<uint32>( t7YBuffer  , warmStart, numa );
-        _context.t7LRBuffer  = SafeAlloc<Pair>  ( t7LRBuffer , warmStart, numa );
+//----------------------------------------------------------
+MemPlotter::~MemPlotter()
+{
+    if( _context.spill )
+        delete _context.spill;
 
-        _context.yBuffer0    = SafeAlloc<uint64>( yBuffer0   , warmStart, numa );
-        _context.yBuffer1    = SafeAlloc<uint64>( yBuffer1   , warmStart, numa );
-        _context.metaBuffer0 = SafeAlloc<uint64>( metaBuffer0, warmStart, numa );
-        _context.metaBuffer1 = SafeAlloc<uint64>( metaBuffer1, warmStart, numa );
+    if( _context.checkpoint )
+        delete _context.checkpoint;
 
+    if( _context.perf )
+        delete _context.perf;
+}
 
-        // Some table's kBC group pairings yield more values than 2^k. 
-        // Therefore, we need to have some overflow space for kBC pairs.
-        // We get an average of 236 entries per group.
-        // We use a yBuffer for to mark group boundaries, 
-        // so we fit as many as we can in it.
-        const size_t maxKbcGroups  = yBuffer0 / sizeof( uint32 );
+//----------------------------------------------------------
+void MemPlotter::DeclareBuffers( MemArena& arena, MemPlotContext& cx )
+{
+    MemPhase1::DeclareBuffers( arena, cx );
+    MemPhase2::DeclareBuffers( arena, cx );
+    MemPhase3::DeclareBuffers( arena, cx );
+    MemPhase4::DeclareBuffers( arena, cx );
+}
 
-        // Since we use a meta buffer (64GiB) for pairing,
-        // we can just use all its space to fit pairs.
-        const size_t maxPairs      = metaBuffer0 / sizeof( Pair );
+//----------------------------------------------------------
+size_t MemPlotter::GetRequiredMemory( const MemPlotConfig& cfg )
+{
+    MemPlotContext cx;
+    ZeroMem( &cx );
 
-        _context.maxPairs     = maxPairs;
-        _context.maxKBCGroups = maxKbcGroups;
-    }
+    cx.compactPairs  = cfg.compactPairs;
+    cx.spillDir      = cfg.spillDir;
+    cx.overlapWrites = cfg.overlapWrites;
+
+    MemArena arena;
+    DeclareBuffers( arena, cx );
+
+    return arena.Plan();
 }
 
 //----------------------------------------------------------
-MemPlotter::~MemPlotter()
-{}
+bool MemPlotter::GetCheckpointedPlot( byte plotId[32], byte memo[128], uint16& memoSize )
+{
+    if( !_context.checkpoint )
+        return false;
+
+    bool compactPairs;
+    if( _context.checkpoint->Find( plotId, memo, memoSize, compactPairs ) == CheckpointPhase::None )
+        return false;
+
+    if( compactPairs != _context.compactPairs )
+    {
+        Log::Line( "Ignoring the checkpoint found, as it was saved with%s --compact-pairs.", compactPairs ? "" : "out" );
+        return false;
+    }
+
+    return true;
+}
 
 //----------------------------------------------------------
 bool MemPlotter::Run( const PlotRequest& request )
@@ -125,12 +163,13 @@ bool MemPlotter::Run( const PlotRequest& request )
     cx.plotMemo     = request.memo;
     cx.plotMemoSize = request.memoSize;
     
-    // Open the plot file for writing before we actually start plotting
+    // Open the plot file for writing before we actually start plotting.
+    // When benchmarking, the plot is discarded, so the file is never opened.
     const int PLOT_FILE_RETRIES = 16;
     FileStream* plotfile = new FileStream();
     ASSERT( plotfile );
 
-    for( int i = 0; i < PLOT_FILE_RETRIES; i++ )
+    for( int i = 0; i < PLOT_FILE_RETRIES && !_benchmark; i++ )
     {
         if( !plotfile->Open( request.outPath, FileMode::Create, FileAccess::Write, FileFlags::NoBuffering | FileFlags::LargeFile ) )
         {
@@ -150,57 +189,120 @@ bool MemPlotter::Run( const PlotRequest& request )
     // Start plotting
     auto plotTimer = TimerBegin();
 
+    ZeroMem( &cx.stats );
+    cx.stats.plotIndex = cx.plotCount;
+    cx.stats.benchmark           = _benchmark;
+    cx.stats.simulatedWriteSpeed = _benchmark ? _benchmarkWriteSpeed : 0;
+    {
+        size_t numEncoded;
+        BytesToHexStr( request.plotId, 32, cx.stats.plotId, sizeof( cx.stats.plotId ), numEncoded );
+    }
+
+    // Resume from the last phase saved, if this plot was interrupted
+    CheckpointPhase resumePhase = CheckpointPhase::None;
+
+    if( cx.checkpoint )
+    {
+        // When replaying, only the state needed to start at the requested phase is loaded
+        const CheckpointPhase maxPhase = _replayPhase ? (CheckpointPhase)( _replayPhase - 1 ) : CheckpointPhase::Phase2;
+
+        auto timer = TimerBegin();
+        resumePhase = cx.checkpoint->Restore( cx, maxPhase );
+
+        if( _replayPhase && resumePhase != maxPhase )
+        {
+            Log::Error( "Error: The checkpoint can't be replayed from Phase %u, it was saved at the end of Phase %u.",
+                _replayPhase, (uint)resumePhase );
+            delete plotfile;
+            return false;
+        }
+
+        if( resumePhase != CheckpointPhase::None )
+            Log::Line( "Resumed plot from its Phase %u checkpoint in %.2lf seconds.", (uint)resumePhase, TimerEnd( timer ) );
+    }
+
     #if DBG_READ_PHASE_1_TABLES
     if( cx.plotCount > 0 )
     #endif
+    if( resumePhase < CheckpointPhase::Phase1 )
     {
         auto timeStart = plotTimer;
         Log::Line( "Running Phase 1" );
+        TraceScope trace( "phase", "Phase 1" );
+        PerfSpan perf( cx.perf );
 
         MemPhase1 phase1( cx );
         phase1.Run();
 
         double elapsed = TimerEnd( timeStart );
         Log::Line( "Finished Phase 1 in %.2lf seconds.", elapsed );
+        perf.Log( "Phase 1" );
+        cx.stats.phaseSeconds[0] = elapsed;
+
+        // Phase 2 only reads the tables, so they're saved while it runs
+        if( cx.checkpoint && !_replayPhase )
+            cx.checkpoint->SaveTables( cx );
     }
 
+    if( resumePhase < CheckpointPhase::Phase2 )
     {
         MemPhase2 phase2( cx );
         auto timeStart = TimerBegin();
         Log::Line( "Running Phase 2" );
+        TraceScope trace( "phase", "Phase 2" );
+        PerfSpan perf( cx.perf );
 
         phase2.Run();
 
         double elapsed = TimerEnd( timeStart );
         Log::Line( "Finished Phase 2 in %.2lf seconds.", elapsed );
+        perf.Log( "Phase 2" );
+        cx.stats.phaseSeconds[1] = elapsed;
+
+        if( cx.checkpoint && !_replayPhase )
+        {
+            Log::Line( "Saving the Phase 2 checkpoint..." );
+            timeStart = TimerBegin();
+
+            cx.checkpoint->SaveMarks( cx );
+            Log::Line( "Saved the Phase 2 checkpoint in %.2lf seconds.", TimerEnd( timeStart ) );
+        }
     }
 
     // Start writing the plot file
     if( !_context.plotWriter )
-        _context.plotWriter = new DiskPlotWriter();
+        _context.plotWriter = new DiskPlotWriter( _benchmark, _benchmarkWriteSpeed );
     
     cx.plotWriter->BeginPlot( request.outPath, *plotfile, request.plotId, request.memo, request.memoSize );
 
     {
         auto timeStart = TimerBegin();
         Log::Line( "Running Phase 3" );
+        TraceScope trace( "phase", "Phase 3" );
+        PerfSpan perf( cx.perf );
 
         MemPhase3 phase3( cx );
         phase3.Run();
 
         double elapsed = TimerEnd( timeStart );
         Log::Line( "Finished Phase 3 in %.2lf seconds.", elapsed );
+        perf.Log( "Phase 3" );
+        cx.stats.phaseSeconds[2] = elapsed;
     }
 
     {
         auto timeStart = TimerBegin();
         Log::Line( "Running Phase 4" );
+        TraceScope trace( "phase", "Phase 4" );
+        PerfSpan perf( cx.perf );
 
         MemPhase4 phase4( cx );
         phase4.Run();
 
         double elapsed = TimerEnd( timeStart );
         Log::Line( "Finished Phase 4 in %.2lf seconds.", elapsed );
+        perf.Log( "Phase 4" );
+        cx.stats.phaseSeconds[3] = elapsed;
     }
 
     // Wait flush writer, if this is the final plot
@@ -214,12 +316,34 @@ bool MemPlotter::Run( const PlotRequest& request )
         double elapsed = TimerEnd( timeStart );
         Log::Line( "Finished writing tables to disk in %.2lf seconds.", elapsed );
         Log::Flush();
+
+        cx.stats.finalWriteSeconds = elapsed;
     }
 
     double plotElapsed = TimerEnd( plotTimer );
     Log::Line( "Finished plotting in %.2lf seconds (%.2lf minutes).", 
         plotElapsed, plotElapsed / 60.0 );
 
+    cx.stats.seconds = plotElapsed;
+
+    if( _benchmark )
+        LogBenchmark();
+
+    if( _statsPath && !cx.stats.AppendJsonLine( _statsPath ) )
+        Log::Error( "Warning: Failed to write plot stats to %s.", _statsPath );
+
+    // The pool is idle now, so no thread is recording events
+    if( _traceDir )
+    {
+        char tracePath[1024];
+        snprintf( tracePath, sizeof( tracePath ), "%s/plot-%s.trace.json", _traceDir, cx.stats.plotId );
+
+        if( Trace::Dump( tracePath ) )
+            Log::Line( "Wrote thread timeline to %s", tracePath );
+        else
+            Log::Error( "Warning: Failed to write thread timeline to %s.", tracePath );
+    }
+
     cx.plotCount ++;
     return true;
 }
@@ -237,6 +361,22 @@ void MemPlotter::WaitPlotWriter()
                 _context.plotWriter->FilePath().c_str(),
                 _context.plotWriter->GetError() );
 
+        // The plot is complete, its checkpoint is no longer needed, unless it's being replayed
+        if( _context.checkpoint && !_replayPhase )
+            _context.checkpoint->Clear();
+
+        if( _context.plotWriter->IsDiscarding() )
+        {
+            Log::Line( "" );
+            Log::Line( "Plot %s was discarded (benchmark mode).", _context.plotWriter->FilePath().c_str() );
+            Log::Line( "  Checksum (BLAKE3) : %s", _context.plotWriter->GetChecksum() );
+            Log::Line( "" );
+
+            // Don't let the next plot finish this one again
+            _context.p4WriteBuffer = nullptr;
+            return;
+        }
+
         // Rename plot file to final plot file name (remove .tmp suffix)
         const char*  tmpName       = _context.plotWriter->FilePath().c_str();
         const size_t tmpNameLength = strlen( tmpName );
@@ -257,6 +397,9 @@ void MemPlotter::WaitPlotWriter()
         Log::Line( "" );
         Log::Line( "Plot %s finished writing to disk:", r ? tmpName : plotName );
 
+        if( !_context.plotWriter->WriteChecksumFile( r ? tmpName : plotName ) )
+            Log::Error( "Warning: Failed to write checksum file for plot %s.", r ? tmpName : plotName );
+
         delete[] plotName;
 
         // Print final pointer offsets
@@ -272,16 +415,52 @@ void MemPlotter::WaitPlotWriter()
             const uint64 ptr = Swap64( tablePointers[i] );
             Log::Line( "  C%u table pointer : %16lu ( 0x%016lx )", i+1-7, ptr, ptr);
         }
+        Log::Line( "  Checksum (BLAKE3) : %s", _context.plotWriter->GetChecksum() );
         Log::Line( "" );
+
+        _context.p4WriteBuffer = nullptr;
     // }
 }
 
+//-----------------------------------------------------------
+void MemPlotter::LogBenchmark()
+{
+    const PlotStats& stats = _context.stats;
+
+    const double computeSeconds = stats.phaseSeconds[0] + stats.phaseSeconds[1] + 
+                                  stats.phaseSeconds[2] + stats.phaseSeconds[3];
+    const double waitSeconds    = stats.finalWriteSeconds + stats.prevWriteWaitSeconds;
+
+    uint64 plotSize = 0;
+    for( uint i = 0; i < 10; i++ )
+        plotSize += stats.tableBytes[i];
+
+    // The drive speed at which back-to-back plots would not have to wait on writes
+    const double throughput = ( plotSize BtoMB ) / std::max( computeSeconds, 0.001 );
+    const double driveSpeed = (double)_benchmarkWriteSpeed / (1ull MB);
+
+    Log::Line( "Benchmark:" );
+    Log::Line( " Compute time          : %.2lf seconds (Phases 1-4)", computeSeconds );
+    Log::Line( " Waiting on writes     : %.2lf seconds", waitSeconds );
+    Log::Line( " Plot size             : %.2lf GiB", (double)plotSize / (1ull GB) );
+
+    if( _benchmarkWriteSpeed )
+        Log::Line( " Simulated drive speed : %.2lf MiB/s", driveSpeed );
+    else
+        Log::Line( " Simulated drive speed : unthrottled" );
+
+    Log::Line( " Compute throughput    : %.2lf MiB/s (drive speed needed to keep up)", throughput );
+
+    if( _benchmarkWriteSpeed && throughput > driveSpeed )
+        Log::Line( " The simulated drive is %.2lfx too slow to keep up with plotting.", throughput / driveSpeed );
+}
+
 ///
 /// Internal methods
 ///
 //-----------------------------------------------------------
 template<typename T>
-T* MemPlotter::SafeAlloc( size_t size, bool warmStart, const NumaInfo* numa )
+T* MemPlotter::SafeAlloc( const char* name, size_t size, bool warmStart, HugePageMode hugePages, const NumaInfo* numa )
 {
     #if DEBUG || BOUNDS_PROTECTION
     
@@ -289,15 +468,24 @@ T* MemPlotter::SafeAlloc( size_t size, bool warmStart, const NumaInfo* numa )
         const size_t pageSize     = SysHost::GetPageSize();
         size = pageSize * 2 + RoundUpToNextBoundary( size, (int)pageSize );
 
+        // Guard pages can't be protected inside a huge page
+        if( hugePages != HugePageMode::Transparent )
+            hugePages = HugePageMode::None;
     #endif
 
-    T* ptr = (T*)SysHost::VirtualAlloc( size, false );
+    HugePageMode pageMode = HugePageMode::None;
+    T* ptr = (T*)SysHost::VirtualAlloc( size, hugePages, pageMode );
 
     if( !ptr )
     {
         Fatal( "Error: Failed to allocate required buffers." );
     }
 
+    {
+        const char* pageNames[] = { "default", "transparent huge", "2 MiB", "1 GiB" };
+        Log::Line( "  %-11s : %3llu GiB with %s pages.", name, size BtoGB, pageNames[(int)pageMode] );
+    }
+
     if( numa )
     {
         if( !SysHost::NumaSetMemoryInterleavedMode( ptr, size ) )
@@ -345,7 +533,8 @@ T* MemPlotter::SafeAlloc( size_t size, bool warmStart, const NumaInfo* numa )
 
         InitJob jobs[MAX_THREADS];
 
-        const uint   threadCount    = _context.threadPool->ThreadCount();
+        // Faulting pages is bound by the kernel and memory, SMT siblings don't help
+        const uint   threadCount    = _context.threadPool->PhysicalCoreCount();
         const size_t pageSize       = SysHost::GetPageSize();
         const uint64 pageCount      = CDiv( size, (int)pageSize );
         const uint64 pagesPerThread = pageCount / threadCount;
@@ -370,7 +559,7 @@ T* MemPlotter::SafeAlloc( size_t size, bool warmStart, const NumaInfo* numa )
             pages += pageSize * job.pageCount;
         }
 
-        _context.threadPool->RunJob( InitJob::Run, jobs, threadCount );
+        _context.threadPool->RunJobPerCore( InitJob::Run, jobs, threadCount );
     }
 
     return ptr;
@@ -1,14 +1,27 @@
 #pragma once
 #include "PlotContext.h"
+#include "MemArena.h"
 
 struct NumaInfo;
+enum class HugePageMode : uint;
 
 struct MemPlotConfig
 {
-    uint threadCount;
-    bool warmStart;
-    bool noNUMA;
-    bool noCPUAffinity;
+    uint         threadCount;
+    bool         warmStart;
+    bool         noNUMA;
+    bool         noCPUAffinity;
+    HugePageMode hugePages;
+    bool         compactPairs;  // Store L/R pairs in a reduced footprint format
+    const char*  spillDir;      // If set, spill finished tables to scratch files in this directory
+    bool         overlapWrites; // Run all of Phase 1 while the previous plot is being written
+    const char*  statsPath;     // If set, append the metrics of each plot to this file as a JSON line
+    bool         perfCounters;  // Report hardware performance counters for each stage
+    const char*  traceDir;      // If set, write a timeline of the thread pool jobs of each plot to this directory
+    bool         benchmark;     // Discard the plots instead of writing them
+    uint64       benchmarkWriteSpeed; // In benchmark mode, simulate a drive with this write speed, in bytes per second. 0 = unthrottled
+    const char*  checkpointDir; // If set, save checkpoints of each plot to this directory, and resume from the one found in it
+    uint         replayPhase;   // If set, rerun the plot of the checkpoint in checkpointDir from this phase (2 or 3), leaving the checkpoint untouched
 };
 
 // This plotter performs the whole plotting process in-memory.
@@ -21,15 +34,37 @@ public:
 
     bool Run( const PlotRequest& request );
 
+    // Gets the plot id and memo of a plot that was interrupted and can be resumed from a checkpoint.
+    // Returns false if there's none.
+    bool GetCheckpointedPlot( byte plotId[32], byte memo[128], uint16& memoSize );
+
+    // Metrics and checksum of the last plot run
+    inline const PlotStats& LastPlotStats() const { return _context.stats; }
+    inline const char* LastPlotChecksum() const { return _context.plotWriter ? _context.plotWriter->GetChecksum() : nullptr; }
+
+    // Planned peak memory required to plot with the given configuration
+    static size_t GetRequiredMemory( const MemPlotConfig& cfg );
+
 private:
 
+    static void DeclareBuffers( MemArena& arena, MemPlotContext& cx );
+
     template<typename T>
-    T* SafeAlloc( size_t size, bool warmStart, const NumaInfo* numa );
+    T* SafeAlloc( const char* name, size_t size, bool warmStart, HugePageMode hugePages, const NumaInfo* numa );
 
     // Check if the background plot writer finished
     void WaitPlotWriter();
 
+    // Reports how the plot's compute time compares to the speed of the simulated drive
+    void LogBenchmark();
+
 private:
 
     MemPlotContext _context;
+    MemArena       _arena;
+    const char*    _statsPath = nullptr;
+    const char*    _traceDir  = nullptr;
+    bool           _benchmark           = false;
+    uint64         _benchmarkWriteSpeed = 0;
+    uint           _replayPhase         = 0;
 };
\ No newline at end of file
@@ -0,0 +1,264 @@
+#include "MemSpill.h"
+#include "PlotContext.h"
+#include "io/ParallelIO.h"
+#include "io/FileStream.h"
+#include "threading/ThreadPool.h"
+#include "Util.h"
+
+//-----------------------------------------------------------
+MemSpill::MemSpill( const char* spillDir, uint ioThreadCount )
+    : _spillDir         ( spillDir )
+    , _opSignal         ( 0 )
+    , _opCompletedSignal( 0 )
+{
+    ASSERT( spillDir );
+    ASSERT( ioThreadCount );
+
+    // I/O threads are mostly blocked, so don't pin them to the plotting cores
+    _ioPool = new ThreadPool( ioThreadCount, ThreadPool::Mode::Fixed, true );
+
+    // Fail early if we can't write to the spill directory
+    {
+        char path[1024];
+        GetTablePath( TableId::Table1, path, sizeof( path ) );
+
+        FileStream file;
+        if( !file.Open( path, FileMode::Create, FileAccess::Write ) )
+            Fatal( "Failed to create spill file %s with error: %d", path, file.GetError() );
+
+        _fileCreated[(uint)TableId::Table1] = true;
+    }
+
+    _workerThread.Run( WorkerMain, this );
+}
+
+//-----------------------------------------------------------
+MemSpill::~MemSpill()
+{
+    WaitAll();
+
+    _exitSignal.store( true, std::memory_order_release );
+    _opSignal.Release();
+    _workerThread.WaitForExit();
+
+    delete _ioPool;
+
+    // Delete the scratch files
+    for( uint i = 0; i < (uint)TableId::_Count; i++ )
+    {
+        if( !_fileCreated[i] )
+            continue;
+
+        char path[1024];
+        GetTablePath( (TableId)i, path, sizeof( path ) );
+        remove( path );
+    }
+}
+
+//-----------------------------------------------------------
+uint64 MemSpill::GetRequiredDiskSpace( bool compactPairs )
+{
+    // Table 1's x values, and the pairs of tables 2-6
+    const uint64 pairsSize = compactPairs ? PackedPairs::TableSize : ENTRIES_PER_TABLE * sizeof( Pair );
+
+    return ENTRIES_PER_TABLE * sizeof( uint32 ) + pairsSize * 5;
+}
+
+//-----------------------------------------------------------
+void MemSpill::SpillTable( TableId table, const void* buffer, uint64 entryCount, bool packedPairs )
+{
+    ASSERT( table >= TableId::Table1 && table <= TableId::Table6 );
+    ASSERT( table != TableId::Table1 || !packedPairs );
+
+    Op op;
+    op.type             = OpType::Spill;
+    op.table            = table;
+    op.buffer           = (byte*)buffer;
+    op.entryCount       = entryCount;
+    op.packedPairs      = packedPairs;
+    op.writer           = nullptr;
+    op.writerTableCount = 0;
+
+    Submit( op );
+}
+
+//-----------------------------------------------------------
+void MemSpill::LoadTable( TableId table, void* dst, DiskPlotWriter* writer, uint writerTableCount )
+{
+    ASSERT( table >= TableId::Table1 && table <= TableId::Table6 );
+
+    Op op;
+    op.type             = OpType::Load;
+    op.table            = table;
+    op.buffer           = (byte*)dst;
+    op.entryCount       = 0;
+    op.packedPairs      = false;
+    op.writer           = writer;
+    op.writerTableCount = writerTableCount;
+
+    Submit( op );
+}
+
+//-----------------------------------------------------------
+void MemSpill::WaitForTable( TableId table )
+{
+    WaitForOp( _tableSequence[(uint)table] );
+}
+
+//-----------------------------------------------------------
+void MemSpill::WaitAll()
+{
+    WaitForOp( _submitted );
+}
+
+//-----------------------------------------------------------
+void MemSpill::Submit( const Op& op )
+{
+    ASSERT( ( (uintptr_t)op.buffer & ( IOAlignment - 1 ) ) == 0 );
+
+    // Wait for a free slot in the queue
+    if( _submitted - _completed.load( std::memory_order_acquire ) >= MAX_OPS )
+        WaitForOp( _submitted - MAX_OPS + 1 );
+
+    _ops[_submitted % MAX_OPS] = op;
+    _submitted++;
+
+    _tableSequence[(uint)op.table] = _submitted;
+
+    _opSignal.Release();
+}
+
+//-----------------------------------------------------------
+void MemSpill::WaitForOp( uint64 sequence )
+{
+    // The main thread is the only waiter, so every op completed
+    // after we start waiting will wake us up.
+    while( _completed.load( std::memory_order_acquire ) < sequence )
+        _opCompletedSignal.Wait();
+}
+
+//-----------------------------------------------------------
+void MemSpill::WorkerMain( void* data )
+{
+    ASSERT( data );
+    reinterpret_cast<MemSpill*>( data )->WorkerThread();
+}
+
+//-----------------------------------------------------------
+void MemSpill::WorkerThread()
+{
+    for( ;; )
+    {
+        _opSignal.Wait();
+
+        if( _exitSignal.load( std::memory_order_acquire ) )
+            break;
+
+        const uint64 sequence = _completed.load( std::memory_order_relaxed );
+        ProcessOp( _ops[sequence % MAX_OPS] );
+
+        _completed.store( sequence + 1, std::memory_order_release );
+        _opCompletedSignal.Release();
+    }
+}
+
+//-----------------------------------------------------------
+void MemSpill::ProcessOp( const Op& op )
+{
+    const uint tableIdx = (uint)op.table;
+
+    char path[1024];
+    GetTablePath( op.table, path, sizeof( path ) );
+
+    uint64 entryCount;
+    bool   packedPairs;
+
+    if( op.type == OpType::Spill )
+    {
+        entryCount  = op.entryCount;
+        packedPairs = op.packedPairs;
+
+        _spilledCount [tableIdx] = entryCount;
+        _spilledPacked[tableIdx] = packedPairs;
+        _fileCreated  [tableIdx] = true;
+    }
+    else
+    {
+        ASSERT( _fileCreated[tableIdx] );
+
+        entryCount  = _spilledCount [tableIdx];
+        packedPairs = _spilledPacked[tableIdx];
+
+        // The destination buffer may still hold a park being written to the plot file
+        if( op.writer && !op.writer->WaitForTablesWritten( op.writerTableCount ) )
+            Fatal( "Failed to write plot file %s with error: %d",
+                op.writer->FilePath().c_str(), op.writer->GetError() );
+    }
+
+    // Tables are stored in 1 or 2 planes: x values, pairs or packed pair planes.
+    struct Plane
+    {
+        byte*  buffer;
+        uint64 fileOffset;
+        size_t size;
+    };
+
+    Plane planes[2];
+    uint  planeCount = 1;
+
+    if( op.table == TableId::Table1 )
+    {
+        planes[0] = { op.buffer, 0, RoundUpToNextBoundary( entryCount * sizeof( uint32 ), (int)IOAlignment ) };
+    }
+    else if( packedPairs )
+    {
+        PackedPairs pairs( op.buffer );
+
+        const size_t leftSize   = RoundUpToNextBoundary( entryCount * sizeof( uint32 ), (int)IOAlignment );
+        const size_t offsetSize = RoundUpToNextBoundary( entryCount * sizeof( uint16 ), (int)IOAlignment );
+
+        planes[0] = { (byte*)pairs.left  , 0       , leftSize   };
+        planes[1] = { (byte*)pairs.offset, leftSize, offsetSize };
+        planeCount = 2;
+    }
+    else
+    {
+        planes[0] = { op.buffer, 0, RoundUpToNextBoundary( entryCount * sizeof( Pair ), (int)IOAlignment ) };
+    }
+
+    // Create the file once, as the planes are written to it separately
+    if( op.type == OpType::Spill )
+    {
+        const Plane& last = planes[planeCount-1];
+
+        int error = 0;
+        if( !CreateParallelIOFile( path, last.fileOffset + last.size, error ) )
+            Fatal( "Failed to create spill file %s with error: %d", path, error );
+    }
+
+    for( uint i = 0; i < planeCount; i++ )
+    {
+        const Plane& plane = planes[i];
+
+        int  error = 0;
+        bool ok;
+
+        if( op.type == OpType::Spill )
+            ok = ParallelWriteFile( *_ioPool, path, plane.fileOffset, plane.buffer, plane.size, error );
+        else
+            ok = ParallelReadFile( *_ioPool, path, plane.fileOffset, plane.buffer, plane.size, error );
+
+        if( !ok )
+            Fatal( "Failed to %s spill file %s with error: %d",
+                op.type == OpType::Spill ? "write" : "read", path, error );
+    }
+}
+
+//-----------------------------------------------------------
+void MemSpill::GetTablePath( TableId table, char* path, size_t pathSize )
+{
+    const size_t dirLength = strlen( _spillDir );
+    const bool   hasSlash  = dirLength && ( _spillDir[dirLength-1] == '/' || _spillDir[dirLength-1] == '\\' );
+
+    snprintf( path, pathSize, "%s%sbladebit_spill_t%u.tmp", _spillDir, hasSlash ? "" : "/", (uint)table+1 );
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include "ChiaConsts.h"
+#include "threading/Thread.h"
+#include "threading/Semaphore.h"
+
+class ThreadPool;
+class DiskPlotWriter;
+
+/**
+ * Moves finished tables out of memory into scratch files while they are not
+ * needed, and reads them back when a later phase is about to use them.
+ *
+ * Requests are queued and processed in order by a background thread,
+ * so that the I/O overlaps with the plotting work of the main thread.
+ * Each table is written/read with large sequential direct I/O, split
+ * across a small pool of I/O threads.
+ */
+class MemSpill
+{
+public:
+    MemSpill( const char* spillDir, uint ioThreadCount );
+    ~MemSpill();
+
+    // Queue writing a table to its scratch file.
+    // Table 1 holds x values, tables 2-6 hold L/R pairs, which may be packed.
+    // The buffer must not be modified until the table has been spilled.
+    void SpillTable( TableId table, const void* buffer, uint64 entryCount, bool packedPairs );
+
+    // Queue reading a spilled table back into dst.
+    // If a plot writer is given, the read waits until it has written
+    // at least writerTableCount tables, as dst may still hold one of its parks.
+    void LoadTable( TableId table, void* dst, DiskPlotWriter* writer = nullptr, uint writerTableCount = 0 );
+
+    // Wait until all the requests queued for a table have completed
+    void WaitForTable( TableId table );
+
+    // Wait until all queued requests have completed
+    void WaitAll();
+
+    // Free space needed in the spill directory for the scratch files of tables 1-6
+    static uint64 GetRequiredDiskSpace( bool compactPairs );
+
+    // Buffers and sizes are rounded up to this boundary for direct I/O
+    static constexpr size_t IOAlignment = 4096;
+
+private:
+    enum class OpType : uint
+    {
+        Spill = 0,
+        Load
+    };
+
+    struct Op
+    {
+        OpType          type;
+        TableId         table;
+        byte*           buffer;
+        uint64          entryCount;
+        bool            packedPairs;
+        DiskPlotWriter* writer;
+        uint            writerTableCount;
+    };
+
+    void Submit( const Op& op );
+    void WaitForOp( uint64 sequence );
+
+    static void WorkerMain( void* data );
+    void WorkerThread();
+    void ProcessOp( const Op& op );
+
+    void GetTablePath( TableId table, char* path, size_t pathSize );
+
+private:
+    static constexpr uint MAX_OPS = 16;
+
+    const char*         _spillDir;
+    ThreadPool*         _ioPool;
+
+    Op                  _ops[MAX_OPS];
+    uint64              _submitted = 0;                         // Number of ops queued (owned by the main thread)
+    std::atomic<uint64> _completed = 0;                         // Number of ops completed (owned by the worker thread)
+    uint64              _tableSequence[(uint)TableId::_Count] = { 0 };  // Sequence number (+1) of the last op queued per table
+
+    // State of the spilled tables. Owned by the worker thread.
+    uint64              _spilledCount [(uint)TableId::_Count] = { 0 };
+    bool                _spilledPacked[(uint)TableId::_Count] = { false };
+    bool                _fileCreated  [(uint)TableId::_Count] = { false };
+
+    Thread              _workerThread;
+    Semaphore           _opSignal;                              // Main thread signals that an op was queued
+    Semaphore           _opCompletedSignal;                     // Worker thread signals that an op completed
+    std::atomic<bool>   _exitSignal = false;
+};
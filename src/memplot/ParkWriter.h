@@ -14,7 +14,6 @@ struct WriteParkJob
 
 // Write parks in parallel
 // Returns the total size written
-template<uint MaxJobs>
 size_t WriteParks( ThreadPool& pool, const uint64 length, uint64* linePoints, byte* parkBuffer, TableId tableId );
 
 // Write a single park.
@@ -24,53 +23,33 @@ void WritePark( const size_t parkSize, const uint64 count, uint64* linePoints, b
 void WriteParkThread( WriteParkJob* job );
 
 //-----------------------------------------------------------
-template<uint MaxJobs>
 inline size_t WriteParks( ThreadPool& pool, const uint64 length, uint64* linePoints, byte* parkBuffer, TableId tableId )
 {
-    const uint   threadCount    = MaxJobs > pool.ThreadCount() ? pool.ThreadCount() : MaxJobs;
-    const size_t parkSize       = CalculateParkSize( tableId );
-    const uint64 parkCount      = length / kEntriesPerPark;
-    const uint64 parksPerThread = parkCount / threadCount;
-    
-    uint64 trailingParks        = parkCount - ( parksPerThread * threadCount );
-    ASSERT( trailingParks < threadCount );
+    // Parks are handed out in small chunks so that threads can balance the load
+    const uint64 parksPerChunk = 16;
+
+    const size_t parkSize      = CalculateParkSize( tableId );
+    const uint64 parkCount     = length / kEntriesPerPark;
 
     const uint64 parkEntriesWritten = parkCount * kEntriesPerPark;
     const uint64 trailingEntries    = length - parkEntriesWritten;
     ASSERT( trailingEntries <= kEntriesPerPark );
 
-    WriteParkJob jobs[MaxJobs];
-    
-    uint64* threadLinePoints = linePoints;
-    byte*   threadParkBuffer = parkBuffer;
-
-    for( uint i = 0; i < threadCount; i++ )
-    {
-        auto& job = jobs[i];
+    pool.ParallelFor( parkCount, parksPerChunk, [=]( uint64 start, uint64 end, uint ) {
 
+        WriteParkJob job;
         job.parkSize   = parkSize;
-        job.parkCount  = parksPerThread;
-        job.linePoints = threadLinePoints;
-        job.parkBuffer = threadParkBuffer;
+        job.parkCount  = end - start;
+        job.linePoints = linePoints + start * kEntriesPerPark;
+        job.parkBuffer = parkBuffer + start * parkSize;
         job.tableId    = tableId;
 
-        // Assign trailer parks accross threads. hehe
-        if( trailingParks )
-        {
-            job.parkCount ++;
-            trailingParks --;
-        }
-
-        threadLinePoints += job.parkCount * kEntriesPerPark;
-        threadParkBuffer += job.parkCount * parkSize;
-    }
-
-    ASSERT( !trailingParks );
-    pool.RunJob( WriteParkThread, jobs, threadCount );
+        WriteParkThread( &job );
+    });
 
     // Write trailing entries if any
     if( trailingEntries )
-        WritePark( parkSize, trailingEntries, threadLinePoints, threadParkBuffer, tableId );
+        WritePark( parkSize, trailingEntries, linePoints + parkEntriesWritten, parkBuffer + parkCount * parkSize, tableId );
     
     
     const size_t sizeWritten = parkSize * ( parkCount + (trailingEntries ? 1 : 0) );
@@ -83,12 +62,15 @@ inline void WritePark( const size_t parkSize, const uint64 count, uint64* linePo
 {
     ASSERT( count <= kEntriesPerPark );
 
-    uint64* writer = (uint64*)parkBuffer;
+    // Write the first LinePoint as a full LinePoint, in 2k bits rounded up to bytes (8 bytes at k32)
+    const size_t linePointSize = CDiv( _K * 2, 8 );
 
-    // Write the first LinePoint as a full LinePoint
     uint64 prevLinePoint = linePoints[0];
 
-    *writer++ = Swap64( prevLinePoint );
+    const uint64 linePointField = Swap64( prevLinePoint << ( 64 - _K * 2 ) );
+    memcpy( parkBuffer, &linePointField, linePointSize );
+
+    uint64* writer = (uint64*)( parkBuffer + linePointSize );
 
     // Convert to deltas
     for( uint64 i = 1; i < count; i++ )
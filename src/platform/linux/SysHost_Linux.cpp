@@ -8,6 +8,20 @@
 #include <atomic>
 #include <numa.h>
 #include <numaif.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// Older headers may lack the huge page size selection flags
+#ifndef MAP_HUGE_SHIFT
+    #define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+    #define MAP_HUGE_2MB ( 21 << MAP_HUGE_SHIFT )
+#endif
+#ifndef MAP_HUGE_1GB
+    #define MAP_HUGE_1GB ( 30 << MAP_HUGE_SHIFT )
+#endif
 
 // #if _DEBUG
     #include "util/Log.h"
@@ -41,6 +55,25 @@ size_t SysHost::GetAvailableSystemMemory()
     return (uint)get_nprocs();
  }
 
+//-----------------------------------------------------------
+uint SysHost::GetCpuCoreId( uint cpuId )
+{
+    char path[128];
+    snprintf( path, sizeof( path ), "/sys/devices/system/cpu/cpu%u/topology/thread_siblings_list", cpuId );
+
+    FILE* file = fopen( path, "r" );
+    if( !file )
+        return cpuId;
+
+    // The list is sorted, formatted as "0,64" or "0-1"
+    uint firstSibling = cpuId;
+    if( fscanf( file, "%u", &firstSibling ) != 1 )
+        firstSibling = cpuId;
+
+    fclose( file );
+    return firstSibling;
+}
+
 //-----------------------------------------------------------
 void* SysHost::VirtualAlloc( size_t size, bool initialize )
 {
@@ -89,6 +122,53 @@ void* SysHost::VirtualAlloc( size_t size, bool initialize )
     return ((byte*)ptr)+pageSize;
 }
 
+//-----------------------------------------------------------
+void* SysHost::VirtualAlloc( size_t size, HugePageMode mode, HugePageMode& outMode )
+{
+    const size_t pageSize = GetPageSize();
+
+    // Try reserved huge pages first. The whole mapping must be a multiple of the huge page size.
+    // We still store our size header one regular page from the start, so that VirtualFree works as usual.
+    while( mode == HugePageMode::Huge1GiB || mode == HugePageMode::Huge2MiB )
+    {
+        const bool   is1GiB       = mode == HugePageMode::Huge1GiB;
+        const size_t hugePageSize = is1GiB ? 1ull GB : 2ull MB;
+        const int    hugeFlags    = MAP_HUGETLB | ( is1GiB ? MAP_HUGE_1GB : MAP_HUGE_2MB );
+
+        const size_t allocSize = RoundUpToNextBoundary( RoundUpToNextBoundary( size, (int)pageSize ) + pageSize, (int)hugePageSize );
+
+        void* ptr = mmap( NULL, allocSize, 
+            PROT_READ | PROT_WRITE, 
+            MAP_ANONYMOUS | MAP_PRIVATE | hugeFlags,
+            -1, 0
+        );
+
+        if( ptr != MAP_FAILED )
+        {
+            *((size_t*)ptr) = allocSize;
+            outMode = mode;
+
+            return ((byte*)ptr)+pageSize;
+        }
+
+        mode = is1GiB ? HugePageMode::Huge2MiB : HugePageMode::Transparent;
+    }
+
+    byte* ptr = (byte*)VirtualAlloc( size, false );
+    outMode   = HugePageMode::None;
+
+    if( ptr && mode == HugePageMode::Transparent )
+    {
+        // Must be set before the pages are faulted
+        const size_t allocSize = *((size_t*)(ptr - pageSize));
+
+        if( madvise( ptr - pageSize, allocSize, MADV_HUGEPAGE ) == 0 )
+            outMode = HugePageMode::Transparent;
+    }
+
+    return ptr;
+}
+
 //-----------------------------------------------------------
 void SysHost::VirtualFree( void* ptr )
 {
@@ -399,4 +479,97 @@ int SysHost::NumaGetNodeFromPage( void* ptr )
     }
 
     return node;
-}
\ No newline at end of file
+}
+
+//-----------------------------------------------------------
+bool SysHost::PerfCountersOpen( PerfCounterGroup& group )
+{
+    struct EventDesc { uint32 type; uint64 config; };
+
+    const EventDesc events[(uint)PerfCounter::_Count] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES       },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS     },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES     },     // Last level cache misses
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+                              ( PERF_COUNT_HW_CACHE_OP_READ     << 8  ) |
+                              ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 ) },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES    },
+    };
+
+    int leader = -1;
+
+    for( uint i = 0; i < (uint)PerfCounter::_Count; i++ )
+    {
+        perf_event_attr attr;
+        memset( &attr, 0, sizeof( attr ) );
+
+        attr.size           = sizeof( attr );
+        attr.type           = events[i].type;
+        attr.config         = events[i].config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        attr.read_format    = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        // Calling thread, on any cpu
+        const int fd = (int)syscall( SYS_perf_event_open, &attr, 0, -1, leader, 0 );
+
+        group.fds[i] = fd < 0 ? -1 : fd;
+
+        if( fd >= 0 && leader < 0 )
+            leader = fd;
+    }
+
+    return leader >= 0;
+}
+
+//-----------------------------------------------------------
+bool SysHost::PerfCountersRead( const PerfCounterGroup& group, uint64 values[(uint)PerfCounter::_Count] )
+{
+    memset( values, 0, sizeof( uint64 ) * (uint)PerfCounter::_Count );
+
+    // The first counter opened leads the group, and its read
+    // returns the values of all the counters in the order they were opened.
+    int leader = -1;
+    for( uint i = 0; i < (uint)PerfCounter::_Count && leader < 0; i++ )
+        leader = group.fds[i];
+
+    if( leader < 0 )
+        return false;
+
+    struct
+    {
+        uint64 count;
+        uint64 timeEnabled;
+        uint64 timeRunning;
+        uint64 values[(uint)PerfCounter::_Count];
+    } data;
+
+    const ssize_t sizeRead = read( leader, &data, sizeof( data ) );
+    if( sizeRead < (ssize_t)( sizeof( uint64 ) * 3 ) )
+        return false;
+
+    // Scale if the group had to share the PMU with other events
+    const double scale = data.timeRunning ? data.timeEnabled / (double)data.timeRunning : 0.0;
+
+    uint j = 0;
+    for( uint i = 0; i < (uint)PerfCounter::_Count && j < data.count; i++ )
+    {
+        if( group.fds[i] >= 0 )
+            values[i] = (uint64)( data.values[j++] * scale );
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+void SysHost::PerfCountersClose( PerfCounterGroup& group )
+{
+    // Close the members before the leader
+    for( int i = (int)PerfCounter::_Count - 1; i >= 0; i-- )
+    {
+        if( group.fds[i] >= 0 )
+            close( group.fds[i] );
+
+        group.fds[i] = -1;
+    }
+}
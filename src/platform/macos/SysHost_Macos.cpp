@@ -64,6 +64,13 @@ uint SysHost::GetLogicalCPUCount()
     return (uint)info.avail_cpus;
 }
 
+//-----------------------------------------------------------
+uint SysHost::GetCpuCoreId( uint cpuId )
+{
+    // #NOTE: The topology is not exposed on macOS, and affinity is not supported anyway.
+    return cpuId;
+}
+
 //-----------------------------------------------------------
 void* SysHost::VirtualAlloc( size_t size, bool initialize )
 {
@@ -144,6 +151,15 @@ void* SysHost::VirtualAlloc( size_t size, bool initialize )
 //    return ptr;
 }
 
+//-----------------------------------------------------------
+void* SysHost::VirtualAlloc( size_t size, HugePageMode mode, HugePageMode& outMode )
+{
+    // #TODO: Support superpages
+    (void)mode;
+    outMode = HugePageMode::None;
+    return VirtualAlloc( size, false );
+}
+
 //-----------------------------------------------------------
 void SysHost::VirtualFree( void* ptr )
 {
@@ -269,3 +285,25 @@ bool SysHost::NumaSetMemoryInterleavedMode( void* ptr, size_t size )
 //     // Not supported
 //     return 0;
 // }
+
+//-----------------------------------------------------------
+bool SysHost::PerfCountersOpen( PerfCounterGroup& group )
+{
+    // #NOTE: Not supported on macOS
+    for( uint i = 0; i < (uint)PerfCounter::_Count; i++ )
+        group.fds[i] = -1;
+
+    return false;
+}
+
+//-----------------------------------------------------------
+bool SysHost::PerfCountersRead( const PerfCounterGroup& group, uint64 values[(uint)PerfCounter::_Count] )
+{
+    memset( values, 0, sizeof( uint64 ) * (uint)PerfCounter::_Count );
+    return false;
+}
+
+//-----------------------------------------------------------
+void SysHost::PerfCountersClose( PerfCounterGroup& group )
+{
+}
@@ -139,6 +139,30 @@ ssize_t FileStream::Read( void* buffer, size_t size )
     return sizeRead;
 }
 
+//-----------------------------------------------------------
+ssize_t FileStream::ReadAt( void* buffer, size_t size, uint64 offset )
+{
+    ASSERT( buffer );
+
+    if( buffer == nullptr )
+        return -1;
+
+    if( ! IsFlagSet( _access, FileAccess::Read ) )
+        return -1;
+
+    if( _fd < 0 )
+        return -1;
+
+    if( size < 1 )
+        return 0;
+
+    const ssize_t sizeRead = pread( _fd, buffer, size, (off_t)offset );
+    if( sizeRead < 0 )
+        _error = errno;
+
+    return sizeRead;
+}
+
 //-----------------------------------------------------------
 ssize_t FileStream::Write( const void* buffer, size_t size )
 {
@@ -39,7 +39,7 @@ bool FileStream::Open( const char* path, FileStream& file, FileMode mode, FileAc
     if( access == FileAccess::None )
         access = FileAccess::Read;
 
-    const DWORD dwShareMode           = 0;
+    const DWORD dwShareMode           = IsFlagSet( flags, FileFlags::Shared ) ? FILE_SHARE_READ | FILE_SHARE_WRITE : 0;
     const DWORD dwCreationDisposition = mode == FileMode::Create ? CREATE_ALWAYS : 
                                         mode == FileMode::Open   ? OPEN_ALWAYS   :
                                                                    OPEN_EXISTING;
@@ -155,6 +155,51 @@ ssize_t FileStream::Read( void* buffer, size_t size )
     return (ssize_t)bytesRead;
 }
 
+//-----------------------------------------------------------
+ssize_t FileStream::ReadAt( void* buffer, size_t size, uint64 offset )
+{
+    ASSERT( buffer );
+
+    if( buffer == nullptr )
+        return -1;
+
+    if( !IsFlagSet( _access, FileAccess::Read ) )
+        return -1;
+
+    if( !HasValidFD() )
+        return -1;
+
+    if( size < 1 )
+        return 0;
+
+    // Cap size to 32-bit range
+    const DWORD bytesToRead = size > std::numeric_limits<DWORD>::max() ?
+                                     std::numeric_limits<DWORD>::max() :
+                                     (DWORD)size;
+
+    // #NOTE: On synchronous handles the offset is taken from the OVERLAPPED struct,
+    //        so concurrent reads don't race on the file pointer.
+    OVERLAPPED overlapped = {};
+    overlapped.Offset     = (DWORD)( offset & 0xFFFFFFFF );
+    overlapped.OffsetHigh = (DWORD)( offset >> 32 );
+
+    DWORD bytesRead = 0;
+
+    const BOOL r = ReadFile( _fd, buffer, bytesToRead, &bytesRead, &overlapped );
+
+    if( !r )
+    {
+        const DWORD err = GetLastError();
+        if( err == ERROR_HANDLE_EOF )
+            return 0;
+
+        _error = (int)err;
+        return (ssize_t)-1;
+    }
+
+    return (ssize_t)bytesRead;
+}
+
 //-----------------------------------------------------------
 ssize_t FileStream::Write( const void* buffer, size_t size )
 {
@@ -207,8 +252,25 @@ bool FileStream::Reserve( ssize_t size )
 {
     // #TODO: Use SetFileValidData()?
     // #See: https://docs.microsoft.com/en-us/windows/win32/api/fileapi/nf-fileapi-setfilevaliddata
-    
-    return false;
+
+    if( !HasValidFD() )
+        return false;
+
+    LARGE_INTEGER pos  = { 0 };
+    LARGE_INTEGER end;
+    end.QuadPart = (LONGLONG)size;
+
+    // Set the end of file, then go back to where we were
+    if( !SetFilePointerEx( _fd, pos, &pos, FILE_CURRENT ) ||
+        !SetFilePointerEx( _fd, end, NULL, FILE_BEGIN   ) ||
+        !SetEndOfFile( _fd ) ||
+        !SetFilePointerEx( _fd, pos, NULL, FILE_BEGIN   ) )
+    {
+        _error = (int)GetLastError();
+        return false;
+    }
+
+    return true;
 }
 
 //----------------------------------------------------------
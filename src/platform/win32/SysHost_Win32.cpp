@@ -100,6 +100,71 @@ uint SysHost::GetLogicalCPUCount()
     return (uint)GetActiveProcessorCount( ALL_PROCESSOR_GROUPS );
 }
 
+//-----------------------------------------------------------
+uint SysHost::GetCpuCoreId( uint cpuId )
+{
+    static uint* coreIds = nullptr;
+
+    // Build a table of the core id of each cpu the first time
+    if( !coreIds )
+    {
+        const uint cpuCount = GetLogicalCPUCount();
+
+        DWORD infoLength = 0;
+        if( GetLogicalProcessorInformationEx( RelationProcessorCore, nullptr, &infoLength ) ||
+            GetLastError() != ERROR_INSUFFICIENT_BUFFER )
+            return cpuId;
+
+        auto* info = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*)malloc( infoLength );
+        FatalIf( !info, "Failed to allocate processor info buffer." );
+
+        if( !GetLogicalProcessorInformationEx( RelationProcessorCore, info, &infoLength ) )
+        {
+            free( info );
+            return cpuId;
+        }
+
+        uint* ids = (uint*)malloc( sizeof( uint ) * cpuCount );
+        FatalIf( !ids, "Failed to allocate CPU id buffer." );
+
+        for( uint i = 0; i < cpuCount; i++ )
+            ids[i] = i;
+
+        // Cpu ids are global across processor groups, as in SetCurrentThreadAffinityCpuId()
+        PocessorInfoIter<PROCESSOR_RELATIONSHIP> iter( info, infoLength );
+        while( iter.HasNext() )
+        {
+            const PROCESSOR_RELATIONSHIP& core = iter.Next();
+            const GROUP_AFFINITY&         grp  = core.GroupMask[0];
+
+            uint groupBase = 0;
+            for( WORD g = 0; g < grp.Group; g++ )
+                groupBase += (uint)GetActiveProcessorCount( g );
+
+            uint firstCpu = 0xFFFFFFFF;
+            for( uint bit = 0; bit < 64; bit++ )
+            {
+                if( !( grp.Mask & ( 1ull << bit ) ) )
+                    continue;
+
+                const uint cpu = groupBase + bit;
+                if( cpu >= cpuCount )
+                    break;
+
+                if( firstCpu == 0xFFFFFFFF )
+                    firstCpu = cpu;
+
+                ids[cpu] = firstCpu;
+            }
+        }
+
+        free( info );
+        coreIds = ids;
+    }
+
+    return coreIds[cpuId];
+}
+
 //-----------------------------------------------------------
 void* SysHost::VirtualAlloc( size_t size, bool initialize )
 {
@@ -130,6 +195,33 @@ void* SysHost::VirtualAlloc( size_t size, bool initialize )
     return ptr;
 }
 
+//-----------------------------------------------------------
+void* SysHost::VirtualAlloc( size_t size, HugePageMode mode, HugePageMode& outMode )
+{
+    // Large pages require the 'Lock pages in memory' privilege.
+    // 1 GiB pages are not supported through VirtualAlloc, so we treat them as 2 MiB ones.
+    // There's no transparent huge page hint.
+    if( mode == HugePageMode::Huge1GiB || mode == HugePageMode::Huge2MiB )
+    {
+        const size_t largePageSize = ::GetLargePageMinimum();
+
+        if( largePageSize )
+        {
+            const size_t allocSize = RoundUpToNextBoundary( size, (int)largePageSize );
+
+            void* ptr = ::VirtualAlloc( NULL, allocSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE );
+            if( ptr )
+            {
+                outMode = HugePageMode::Huge2MiB;
+                return ptr;
+            }
+        }
+    }
+
+    outMode = HugePageMode::None;
+    return VirtualAlloc( size, false );
+}
+
 //-----------------------------------------------------------
 void SysHost::VirtualFree( void* ptr )
 {
@@ -508,4 +600,26 @@ int SysHost::NumaGetNodeFromPage( void* ptr )
     // }
 
     return -1;
-}
\ No newline at end of file
+}
+
+//-----------------------------------------------------------
+bool SysHost::PerfCountersOpen( PerfCounterGroup& group )
+{
+    // #NOTE: Not supported on Windows
+    for( uint i = 0; i < (uint)PerfCounter::_Count; i++ )
+        group.fds[i] = -1;
+
+    return false;
+}
+
+//-----------------------------------------------------------
+bool SysHost::PerfCountersRead( const PerfCounterGroup& group, uint64 values[(uint)PerfCounter::_Count] )
+{
+    memset( values, 0, sizeof( uint64 ) * (uint)PerfCounter::_Count );
+    return false;
+}
+
+//-----------------------------------------------------------
+void SysHost::PerfCountersClose( PerfCounterGroup& group )
+{
+}
@@ -0,0 +1,36 @@
+#include "Barrier.h"
+#include "SysHost.h"
+#include "Config.h"
+#include "Util.h"
+#include "util/Trace.h"
+
+//-----------------------------------------------------------
+Barrier::Barrier( uint threadCount )
+    : _maxSpinCount( THREAD_SPIN_COUNT )
+    , _threadCount ( threadCount )
+{
+    ASSERT( threadCount );
+
+    // Spinning only steals time from the threads we're waiting for when oversubscribed
+    const bool oversubscribed = threadCount > SysHost::GetLogicalCPUCount();
+    _spinCount.store( oversubscribed ? 0 : _maxSpinCount, std::memory_order_relaxed );
+}
+
+//-----------------------------------------------------------
+void Barrier::WaitForGeneration( uint32 generation )
+{
+    TraceScope trace( "barrier", "Barrier wait" );
+
+    const uint32 spinCount = _spinCount.load( std::memory_order_relaxed );
+
+    const bool releasedWhileSpinning = _generation.WaitWhileEqual( generation, spinCount );
+
+    // Adapt the spin budget. Only write when it changes, as all threads read it.
+    if( releasedWhileSpinning )
+    {
+        if( spinCount < _maxSpinCount )
+            _spinCount.store( std::min( _maxSpinCount, spinCount * 2 + 64 ), std::memory_order_relaxed );
+    }
+    else if( spinCount > 0 )
+        _spinCount.store( spinCount / 2, std::memory_order_relaxed );
+}
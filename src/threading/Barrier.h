@@ -0,0 +1,57 @@
+#pragma once
+#include "Futex.h"
+
+///
+/// Reusable barrier for a fixed group of threads.
+///
+/// It's sense-reversing: Threads wait for a generation counter to change,
+/// which the last thread to arrive bumps after resetting the arrival count,
+/// so the barrier can be re-entered right away without a second phase.
+///
+/// Waiters spin for a while and then block on a futex. The spin budget adapts:
+/// It shrinks when waits end up blocking, and grows back when they are released
+/// while spinning. It starts at 0 if there are more threads than logical CPUs.
+///
+class Barrier
+{
+public:
+    explicit Barrier( uint threadCount );
+
+    // Wait until all threads have arrived
+    inline void Wait() { Wait( [](){} ); }
+
+    // Wait until all threads have arrived. The last thread to arrive
+    // calls serialFunc() before the other threads are released.
+    template<typename TFunc>
+    inline void Wait( const TFunc& serialFunc );
+
+    inline uint ThreadCount() const { return _threadCount; }
+
+private:
+    void WaitForGeneration( uint32 generation );
+
+private:
+    alignas( 64 ) std::atomic<uint32> _arrived = 0;
+    alignas( 64 ) FutexWord           _generation;
+    alignas( 64 ) std::atomic<uint32> _spinCount;
+    uint32                            _maxSpinCount;
+    uint32                            _threadCount;
+};
+
+//-----------------------------------------------------------
+template<typename TFunc>
+inline void Barrier::Wait( const TFunc& serialFunc )
+{
+    const uint32 generation = _generation.Load();
+
+    if( _arrived.fetch_add( 1, std::memory_order_acq_rel ) == _threadCount - 1 )
+    {
+        serialFunc();
+
+        _arrived.store( 0, std::memory_order_relaxed );
+        _generation.Store( generation + 1 );
+        return;
+    }
+
+    WaitForGeneration( generation );
+}
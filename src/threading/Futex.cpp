@@ -0,0 +1,81 @@
+#include "Futex.h"
+#include "Util.h"
+
+#if PLATFORM_IS_LINUX
+    #include <linux/futex.h>
+    #include <sys/syscall.h>
+#elif PLATFORM_IS_WINDOWS
+    #pragma comment( lib, "Synchronization.lib" )
+#endif
+
+static_assert( sizeof( std::atomic<uint32> ) == sizeof( uint32 ), "Futex words must be 32 bits." );
+
+//-----------------------------------------------------------
+void Futex::Wait( std::atomic<uint32>& word, uint32 expected )
+{
+    #if PLATFORM_IS_LINUX
+        const long r = syscall( SYS_futex, (uint32*)&word, FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0 );
+        if( r != 0 && errno != EAGAIN && errno != EINTR )
+            Fatal( "futex() wait failed with error: %d.", errno );
+    #elif PLATFORM_IS_WINDOWS
+        if( !WaitOnAddress( (volatile VOID*)&word, &expected, sizeof( uint32 ), INFINITE ) )
+            Fatal( "WaitOnAddress() failed with error: %d.", (int)GetLastError() );
+    #elif PLATFORM_IS_MACOS
+        if( word.load( std::memory_order_acquire ) == expected )
+            usleep( 50 );
+    #else
+        #error Unimplemented
+    #endif
+}
+
+//-----------------------------------------------------------
+void Futex::WakeOne( std::atomic<uint32>& word )
+{
+    #if PLATFORM_IS_LINUX
+        syscall( SYS_futex, (uint32*)&word, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0 );
+    #elif PLATFORM_IS_WINDOWS
+        WakeByAddressSingle( (PVOID)&word );
+    #elif PLATFORM_IS_MACOS
+        // Waiters poll
+    #else
+        #error Unimplemented
+    #endif
+}
+
+//-----------------------------------------------------------
+void Futex::WakeAll( std::atomic<uint32>& word )
+{
+    #if PLATFORM_IS_LINUX
+        syscall( SYS_futex, (uint32*)&word, FUTEX_WAKE_PRIVATE, 0x7FFFFFFF, nullptr, nullptr, 0 );
+    #elif PLATFORM_IS_WINDOWS
+        WakeByAddressAll( (PVOID)&word );
+    #elif PLATFORM_IS_MACOS
+        // Waiters poll
+    #else
+        #error Unimplemented
+    #endif
+}
+
+//-----------------------------------------------------------
+bool FutexWord::WaitWhileEqual( uint32 expected, uint spinCount )
+{
+    for( uint i = 0; i < spinCount; i++ )
+    {
+        if( _value.load( std::memory_order_acquire ) != expected )
+            return true;
+
+        CpuPause();
+    }
+
+    // Register as a waiter before the final check, so that
+    // a waker that changes the value after it will see us.
+    _waiters.fetch_add( 1, std::memory_order_seq_cst );
+
+    while( _value.load( std::memory_order_seq_cst ) == expected )
+        Futex::Wait( _value, expected );
+
+    _waiters.fetch_sub( 1, std::memory_order_relaxed );
+
+    std::atomic_thread_fence( std::memory_order_acquire );
+    return false;
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include "Platform.h"
+#include <atomic>
+
+#if PLATFORM_IS_ARM
+    // Nothing to include
+#elif defined( _MSC_VER )
+    #include <intrin.h>
+#else
+    #include <immintrin.h>
+#endif
+
+// Hint to the CPU that we're in a spin-wait loop, so that it
+// can yield resources to a sibling hyper-thread.
+inline void CpuPause()
+{
+    #if PLATFORM_IS_ARM
+        #if defined( _MSC_VER )
+            __yield();
+        #else
+            __asm__ __volatile__( "yield" );
+        #endif
+    #else
+        _mm_pause();
+    #endif
+}
+
+///
+/// Minimal wrapper over the OS' address-based wait/wake primitives:
+/// futex on Linux and WaitOnAddress on Windows.
+/// macOS has no public equivalent, so it falls back to polling with a short sleep.
+///
+class Futex
+{
+public:
+    // Block while word == expected. May return spuriously.
+    static void Wait( std::atomic<uint32>& word, uint32 expected );
+
+    static void WakeOne( std::atomic<uint32>& word );
+    static void WakeAll( std::atomic<uint32>& word );
+};
+
+///
+/// A 32-bit value threads can wait on to change.
+/// Waiters spin for a while before blocking in the kernel,
+/// and wakers only make a system call if a thread is blocked on it.
+///
+class FutexWord
+{
+public:
+    inline uint32 Load( std::memory_order order = std::memory_order_acquire ) const
+    {
+        return _value.load( order );
+    }
+
+    inline void Store( uint32 value )
+    {
+        _value.store( value, std::memory_order_release );
+        Wake();
+    }
+
+    // Returns the previous value
+    inline uint32 Add( uint32 value )
+    {
+        const uint32 prev = _value.fetch_add( value, std::memory_order_acq_rel );
+        Wake();
+        return prev;
+    }
+
+    // Does not wake waiters
+    inline uint32 SubNoWake( uint32 value )
+    {
+        return _value.fetch_sub( value, std::memory_order_acq_rel );
+    }
+
+    // Wake all blocked waiters, if any.
+    // Must be called after changing the value without waking.
+    inline void Wake()
+    {
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+        if( _waiters.load( std::memory_order_relaxed ) )
+            Futex::WakeAll( _value );
+    }
+
+    // Wait until the value is no longer equal to expected.
+    // Spins up to spinCount times before blocking.
+    // Returns false if the wait had to block.
+    bool WaitWhileEqual( uint32 expected, uint spinCount );
+
+private:
+    std::atomic<uint32> _value   = 0;
+    std::atomic<uint32> _waiters = 0;
+};
@@ -2,6 +2,9 @@
 #include "Util.h"
 #include "util/Log.h"
 #include "SysHost.h"
+#include "Config.h"
+#include "util/Trace.h"
+#include <algorithm>
 
 
 //-----------------------------------------------------------
@@ -9,23 +12,36 @@ ThreadPool::ThreadPool( uint threadCount, Mode mode, bool disableAffinity )
     : _threadCount( threadCount )
     , _mode           ( mode )
     , _disableAffinity( disableAffinity )
-    , _jobSignal      ( 0 )
-    , _poolSignal     ( 0 )
 {
     if( threadCount < 1 )
         Fatal( "threadCount must be greater than 0." );
+
+    // Don't spin if we have more threads than CPUs, we'd only be stealing time from the workers.
+    // The same goes for the dispatching thread if the pool occupies all CPUs.
+    const uint cpuCount = SysHost::GetLogicalCPUCount();
+
+    _spinCount     = threadCount >  cpuCount ? 0 : THREAD_SPIN_COUNT;
+    _joinSpinCount = threadCount >= cpuCount ? 0 : THREAD_SPIN_COUNT;
     
     _threads    = new Thread    [threadCount];
     _threadData = new ThreadData[threadCount];
+    _workRanges = new WorkRange [threadCount];
+
+    for( uint i = 0; i < threadCount; i++ )
+    {
+        _threadData[i].index    = (int)i;
+        _threadData[i].cpuId    = i;
+        _threadData[i].jobIndex = i;
+        _threadData[i].pool     = this;
+    }
+
+    // Assign CPUs
+    InitTopology();
 
     auto threadRunner = mode == Mode::Fixed ? FixedThreadRunner : GreedyThreadRunner;
 
     for( uint i = 0; i < threadCount; i++ )
     {
-        _threadData[i].index = (int)i;
-        _threadData[i].cpuId = i;
-        _threadData[i].pool  = this;
-        
         Thread& t = _threads[i];
 
         t.Run( threadRunner, &_threadData[i] );
@@ -41,24 +57,146 @@ ThreadPool::~ThreadPool()
     if( _mode == Mode::Fixed )
     {
         for( uint i = 0; i < _threadCount; i++ )
-            _threadData[i].jobSignal.Release();
+            _threadData[i].jobSignal.Add( 1 );
     }
     else
-    {
-        for( uint i = 0; i < _threadCount; i++ )
-            _jobSignal.Release();
-    }
+        _jobSignal.Add( 1 );
 
-    // #TODO: Wait for all threads to finish
-    
-    // #TODO: Signal thread for exit.
-    // #TODO: Wait for all threads to exit
+    // Threads may be spinning on their signal instead of blocking in
+    // a cancellation point, so wait for them to exit before freeing it.
+    for( uint i = 0; i < _threadCount; i++ )
+        _threads[i].WaitForExit();
 
     delete[] _threads;
     delete[] _threadData;
+    delete[] _workRanges;
+    delete[] _nodeThreads;
+    delete[] _nodeThreadStart;
+    delete[] _coreThreads;
     
-    _threads    = nullptr;
-    _threadData = nullptr;
+    _threads         = nullptr;
+    _threadData      = nullptr;
+    _workRanges      = nullptr;
+    _nodeThreads     = nullptr;
+    _nodeThreadStart = nullptr;
+    _coreThreads     = nullptr;
+}
+
+//-----------------------------------------------------------
+void ThreadPool::InitTopology()
+{
+    const uint threadCount = _threadCount;
+
+    _nodeThreads = new uint[threadCount];
+    _coreThreads = new uint[threadCount];
+
+    // Without affinity we can't tell where threads run,
+    // so treat them as all being on their own core, on a single node.
+    if( _disableAffinity )
+    {
+        _nodeCount       = 1;
+        _nodeThreadStart = new uint[2] { 0, threadCount };
+        _coreThreadCount = threadCount;
+
+        for( uint i = 0; i < threadCount; i++ )
+        {
+            _nodeThreads[i] = i;
+            _coreThreads[i] = i;
+        }
+
+        return;
+    }
+
+    const uint cpuCount = SysHost::GetLogicalCPUCount();
+
+    // Find the node of each CPU
+    uint* cpuNodes = new uint[cpuCount];
+    memset( cpuNodes, 0, sizeof( uint ) * cpuCount );
+
+    const NumaInfo* numa = SysHost::GetNUMAInfo();
+    _nodeCount = 1;
+
+    if( numa && numa->nodeCount > 1 )
+    {
+        _nodeCount = numa->nodeCount;
+
+        for( uint node = 0; node < numa->nodeCount; node++ )
+        {
+            const Span<uint>& nodeCpus = numa->cpuIds[node];
+
+            for( size_t i = 0; i < nodeCpus.length; i++ )
+            {
+                if( nodeCpus.values[i] < cpuCount )
+                    cpuNodes[nodeCpus.values[i]] = node;
+            }
+        }
+    }
+
+    // Order the CPUs: First the primary CPU of each physical core, then their siblings.
+    // Within each of those, round-robin across nodes.
+    struct CpuOrder
+    {
+        uint cpuId;
+        uint node;
+        uint isSibling;
+        uint rank;      // Index within the node's primaries or siblings
+    };
+
+    CpuOrder* order    = new CpuOrder[cpuCount];
+    uint*     rankBase = new uint[_nodeCount * 2];
+    memset( rankBase, 0, sizeof( uint ) * _nodeCount * 2 );
+
+    for( uint cpu = 0; cpu < cpuCount; cpu++ )
+    {
+        const uint node      = cpuNodes[cpu];
+        const uint isSibling = SysHost::GetCpuCoreId( cpu ) != cpu ? 1 : 0;
+
+        order[cpu] = { cpu, node, isSibling, rankBase[node * 2 + isSibling]++ };
+    }
+
+    std::sort( order, order + cpuCount, []( const CpuOrder& a, const CpuOrder& b ) {
+        if( a.isSibling != b.isSibling ) return a.isSibling < b.isSibling;
+        if( a.rank      != b.rank      ) return a.rank      < b.rank;
+        return a.node < b.node;
+    });
+
+    // Assign CPUs to threads in that order, wrapping around if we have more threads than CPUs
+    uint* threadNodes = new uint[threadCount];
+
+    _coreThreadCount = 0;
+    for( uint i = 0; i < threadCount; i++ )
+    {
+        const CpuOrder& cpu = order[i % cpuCount];
+
+        _threadData[i].cpuId = cpu.cpuId;
+        threadNodes[i]       = cpu.node;
+
+        if( i < cpuCount && !cpu.isSibling )
+            _coreThreads[_coreThreadCount++] = i;
+    }
+
+    // Group threads by node
+    _nodeThreadStart = new uint[_nodeCount + 1];
+
+    uint nodeThreadCount = 0;
+    for( uint node = 0; node < _nodeCount; node++ )
+    {
+        _nodeThreadStart[node] = nodeThreadCount;
+
+        for( uint i = 0; i < threadCount; i++ )
+        {
+            if( threadNodes[i] == node )
+                _nodeThreads[nodeThreadCount++] = i;
+        }
+    }
+
+    _nodeThreadStart[_nodeCount] = nodeThreadCount;
+    ASSERT( nodeThreadCount == threadCount );
+
+    delete[] threadNodes;
+    delete[] rankBase;
+    delete[] order;
+    delete[] cpuNodes;
 }
 
 //-----------------------------------------------------------
@@ -77,8 +215,174 @@ void ThreadPool::RunJob( JobFunc func, void* data, uint count, size_t dataSize )
 }
 
 //-----------------------------------------------------------
-void ThreadPool::DispatchFixed( JobFunc func, byte* data, uint count, size_t dataSize )
+void ThreadPool::RunJobOnNode( uint node, JobFunc func, void* data, uint count, size_t dataSize )
+{
+    ASSERT( func     );
+    ASSERT( data     );
+    ASSERT( dataSize );
+    ASSERT( _mode == Mode::Fixed );
+    ASSERT( node < _nodeCount );
+    ASSERT( count <= NodeThreadCount( node ) );
+
+    if( count > NodeThreadCount( node ) )
+        count = NodeThreadCount( node );
+
+    DispatchFixed( func, (byte*)data, count, dataSize, _nodeThreads + _nodeThreadStart[node] );
+}
+
+//-----------------------------------------------------------
+void ThreadPool::RunJobPerCore( JobFunc func, void* data, uint count, size_t dataSize )
+{
+    ASSERT( func     );
+    ASSERT( data     );
+    ASSERT( dataSize );
+    ASSERT( _mode == Mode::Fixed );
+    ASSERT( count <= _coreThreadCount );
+
+    if( count > _coreThreadCount )
+        count = _coreThreadCount;
+
+    DispatchFixed( func, (byte*)data, count, dataSize, _coreThreads );
+}
+
+//-----------------------------------------------------------
+void ThreadPool::ParallelFor( uint64 length, uint64 grain, ParallelForFunc func, void* data )
+{
+    ASSERT( func );
+
+    if( length == 0 )
+        return;
+
+    if( grain < 1 )
+        grain = 1;
+
+    // Chunk indices must fit in 32 bits
+    uint64 chunkCount = ( length + grain - 1 ) / grain;
+    if( chunkCount > 0xFFFFFFFFull )
+    {
+        grain      = ( length + 0xFFFFFFFEull ) / 0xFFFFFFFFull;
+        chunkCount = ( length + grain - 1 ) / grain;
+    }
+
+    const uint threadCount = _threadCount;
+
+    // Give each thread an even share of chunks to start with
+    const uint64 chunksPerThread = chunkCount / threadCount;
+    uint64       trailingChunks  = chunkCount - chunksPerThread * threadCount;
+
+    ParallelForJob jobs[MAX_THREADS];
+
+    uint64 chunk = 0;
+    for( uint i = 0; i < threadCount; i++ )
+    {
+        uint64 count = chunksPerThread;
+        if( trailingChunks )
+        {
+            count ++;
+            trailingChunks --;
+        }
+
+        _workRanges[i].range.store( ( chunk << 32 ) | ( chunk + count ), std::memory_order_relaxed );
+        chunk += count;
+
+        auto& job = jobs[i];
+        job.pool   = this;
+        job.index  = i;
+        job.func   = func;
+        job.data   = data;
+        job.length = length;
+        job.grain  = grain;
+    }
+
+    ASSERT( chunk == chunkCount );
+
+    RunJob( ParallelForThread, jobs, threadCount );
+}
+
+//-----------------------------------------------------------
+void ThreadPool::ParallelForThread( ParallelForJob* job )
 {
+    ThreadPool& pool  = *job->pool;
+    const uint  index = job->index;
+
+    const uint64 length = job->length;
+    const uint64 grain  = job->grain;
+
+    uint64 chunk;
+    while( pool.PopChunk( index, chunk ) || pool.StealChunk( index, chunk ) )
+    {
+        const uint64 start = chunk * grain;
+        const uint64 end   = std::min( start + grain, length );
+
+        job->func( start, end, index, job->data );
+    }
+}
+
+//-----------------------------------------------------------
+bool ThreadPool::PopChunk( uint threadIndex, uint64& outChunk )
+{
+    std::atomic<uint64>& range = _workRanges[threadIndex].range;
+
+    uint64 r = range.load( std::memory_order_acquire );
+    for( ;; )
+    {
+        const uint64 begin = r >> 32;
+        const uint64 end   = r & 0xFFFFFFFF;
+
+        if( begin >= end )
+            return false;
+
+        if( range.compare_exchange_weak( r, ( ( begin + 1 ) << 32 ) | end,
+                                         std::memory_order_acq_rel, std::memory_order_acquire ) )
+        {
+            outChunk = begin;
+            return true;
+        }
+    }
+}
+
+//-----------------------------------------------------------
+bool ThreadPool::StealChunk( uint threadIndex, uint64& outChunk )
+{
+    const uint threadCount = _threadCount;
+
+    // Our own range is empty at this point, so only we will write to it.
+    for( uint i = 1; i < threadCount; i++ )
+    {
+        std::atomic<uint64>& victim = _workRanges[( threadIndex + i ) % threadCount].range;
+
+        uint64 r = victim.load( std::memory_order_acquire );
+        for( ;; )
+        {
+            const uint64 begin = r >> 32;
+            const uint64 end   = r & 0xFFFFFFFF;
+
+            if( begin >= end )
+                break;
+
+            // Take the upper half, leaving the owner the chunks it's about to process
+            const uint64 newEnd = end - ( end - begin + 1 ) / 2;
+
+            if( victim.compare_exchange_weak( r, ( begin << 32 ) | newEnd,
+                                              std::memory_order_acq_rel, std::memory_order_acquire ) )
+            {
+                // Keep the first stolen chunk and make the rest our own range
+                _workRanges[threadIndex].range.store( ( ( newEnd + 1 ) << 32 ) | end, std::memory_order_release );
+
+                outChunk = newEnd;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+//-----------------------------------------------------------
+void ThreadPool::DispatchFixed( JobFunc func, byte* data, uint count, size_t dataSize, const uint* threadIndices )
+{
+    const uint64 traceStart = Trace::IsEnabled() ? Trace::Now() : 0;
+
     _jobFunc     = func;
     _jobData     = (byte*)data;
     _jobDataSize = dataSize;
@@ -88,48 +392,48 @@ void ThreadPool::DispatchFixed( JobFunc func, byte* data, uint count, size_t dat
     if( count > _threadCount )
         count = _threadCount;
 
-    for( uint i = 0; i < count; i++ )
-        _threadData[i].jobSignal.Release();
+    _pendingThreads.Store( count );
 
-    // Wait until all running jobs finish
-    uint releaseCount = 0;
-    while( releaseCount < count )
+    for( uint i = 0; i < count; i++ )
     {
-        _poolSignal.Wait();
-        releaseCount++;
+        ThreadData& t = _threadData[threadIndices ? threadIndices[i] : i];
+
+        t.jobIndex = i;
+        t.jobSignal.Add( 1 );
     }
+
+    WaitForJobs();
+
+    if( Trace::IsEnabled() )
+        Trace::Record( "dispatch", nullptr, JobFuncAddress( data ), traceStart, Trace::Now() );
 }
 
 //-----------------------------------------------------------
 void ThreadPool::DispatchGreedy( JobFunc func, byte* data, uint count, size_t dataSize )
 {
     // No jobs should currently be running
-    ASSERT( _jobSignal.GetCount() == 0 );
+    ASSERT( _pendingThreads.Load() == 0 );
     ASSERT( count );
 
+    const uint64 traceStart = Trace::IsEnabled() ? Trace::Now() : 0;
+
     _jobCount    = count;
     _jobFunc     = func;
     _jobData     = (byte*)data;
     _jobDataSize = dataSize;
     _jobIndex.store( 0, std::memory_order_release );
 
-    ASSERT( _poolSignal.GetCount() == 0 );
+    // Wake up all the threads, they will grab
+    // jobs from the pool as long as there is one.
+    _pendingThreads.Store( _threadCount );
+    _jobSignal.Add( 1 );
 
-    // Signal release the job semaphore <coun> amount of times.
-    // The job threads will grab jobs from the pool as long as there is one.
-    for( uint i = 0; i < count; i++ )
-        _jobSignal.Release();
+    WaitForJobs();
 
-    // Wait until all running jobs finish
-    uint releaseCount = 0;
-    while( releaseCount < count )
-    {
-        _poolSignal.Wait();
-        releaseCount++;
-    }
+    if( Trace::IsEnabled() )
+        Trace::Record( "dispatch", nullptr, JobFuncAddress( data ), traceStart, Trace::Now() );
 
     ASSERT( _jobIndex == count );
-    ASSERT( _poolSignal.GetCount() == 0 );
 
     // All jobs finished
     _jobFunc  = nullptr;
@@ -137,6 +441,42 @@ void ThreadPool::DispatchGreedy( JobFunc func, byte* data, uint count, size_t da
     _jobCount = 0;
 }
 
+//-----------------------------------------------------------
+void ThreadPool::NameTraceThread( int index )
+{
+    char name[32];
+    snprintf( name, sizeof( name ), "Pool thread %d/%u", index, _threadCount );
+    Trace::SetThreadName( name );
+}
+
+//-----------------------------------------------------------
+void ThreadPool::WaitForJobs()
+{
+    uint32 pending;
+    while( ( pending = _pendingThreads.Load() ) != 0 )
+        _pendingThreads.WaitWhileEqual( pending, _joinSpinCount );
+}
+
+//-----------------------------------------------------------
+const void* ThreadPool::JobFuncAddress( const byte* jobData ) const
+{
+    // Name ParallelFor jobs after their body
+    if( _jobFunc == (JobFunc)ParallelForThread )
+        return (const void*)( (const ParallelForJob*)jobData )->func;
+
+    return (const void*)_jobFunc;
+}
+
+//-----------------------------------------------------------
+void ThreadPool::RunTracedJob( uint jobIndex )
+{
+    byte* jobData = _jobData + _jobDataSize * jobIndex;
+
+    const uint64 start = Trace::Now();
+    _jobFunc( jobData );
+    Trace::Record( "job", nullptr, JobFuncAddress( jobData ), start, Trace::Now() );
+}
+
 //-----------------------------------------------------------
 void ThreadPool::FixedThreadRunner( void* tParam )
 {
@@ -147,11 +487,15 @@ void ThreadPool::FixedThreadRunner( void* tParam )
     if( !pool._disableAffinity )
         SysHost::SetCurrentThreadAffinityCpuId( d.cpuId );
 
-    const uint index = (uint)d.index;
+    const bool trace = Trace::IsEnabled();
+    if( trace )
+        pool.NameTraceThread( d.index );
 
     std::atomic<bool>& exitSignal = pool._exitSignal;
-    Semaphore&         poolSignal = pool._poolSignal;
-    Semaphore&         jobSignal  = d.jobSignal;
+    FutexWord&         jobSignal  = d.jobSignal;
+
+    // Our signal is only incremented once we've finished the previous job
+    uint32 jobGeneration = 0;
 
     for( ;; )
     {
@@ -159,17 +503,22 @@ void ThreadPool::FixedThreadRunner( void* tParam )
             return;
 
         // Wait until we are signalled to go
-        jobSignal.Wait();
+        jobSignal.WaitWhileEqual( jobGeneration, pool._spinCount );
+        jobGeneration++;
 
         // We may have been signalled to exit
         if( exitSignal.load( std::memory_order_acquire ) )
             return;
         
         // Run job
-        pool._jobFunc( pool._jobData + pool._jobDataSize * index );
-
-        // Finished job
-        poolSignal.Release();
+        if( trace )
+            pool.RunTracedJob( d.jobIndex );
+        else
+            pool._jobFunc( pool._jobData + pool._jobDataSize * d.jobIndex );
+
+        // Finished job, the last thread wakes the pool
+        if( pool._pendingThreads.SubNoWake( 1 ) == 1 )
+            pool._pendingThreads.Wake();
     }
 }
 
@@ -184,13 +533,21 @@ void ThreadPool::GreedyThreadRunner( void* tParam )
     if( !pool._disableAffinity )
         SysHost::SetCurrentThreadAffinityCpuId( d.cpuId );
 
+    const bool trace = Trace::IsEnabled();
+    if( trace )
+        pool.NameTraceThread( d.index );
+
+    // Every thread takes part in every job group, so we see each signal
+    uint32 jobGeneration = 0;
+
     for( ;; )
     {
         if( pool._exitSignal.load( std::memory_order::memory_order_acquire ) )
             return;
 
         // Wait until we are signalled to go
-        pool._jobSignal.Wait();
+        pool._jobSignal.WaitWhileEqual( jobGeneration, pool._spinCount );
+        jobGeneration++;
 
         // We may have been signalled to exit
         if( pool._exitSignal.load( std::memory_order_acquire ) )
@@ -210,11 +567,15 @@ void ThreadPool::GreedyThreadRunner( void* tParam )
                 ASSERT( pool._jobFunc );
 
                 // We acquired the job, run it
-                pool._jobFunc( pool._jobData + pool._jobDataSize * jobIndex );
+                if( trace )
+                    pool.RunTracedJob( jobIndex );
+                else
+                    pool._jobFunc( pool._jobData + pool._jobDataSize * jobIndex );
             }
         }
 
-        // Finished jobs, or there were no jobs to run,
-        pool._poolSignal.Release();
+        // Finished jobs, or there were no jobs to run
+        if( pool._pendingThreads.SubNoWake( 1 ) == 1 )
+            pool._pendingThreads.Wake();
     }
 }
\ No newline at end of file
@@ -1,14 +1,21 @@
 #pragma once
 
-#include "./Semaphore.h"
+#include "Futex.h"
 #include "Thread.h"
 #include <atomic>
 
 typedef void (*JobFunc)( void* data );
 
+// Body of a ParallelFor. Processes the items in [start, end) on the given thread.
+typedef void (*ParallelForFunc)( uint64 start, uint64 end, uint threadIndex, void* data );
+
 ///
 /// Used for running parallel jobs.
 ///
+/// Threads are pinned to CPUs in topology order: The first thread of each
+/// physical core, round-robin across NUMA nodes, and then their SMT siblings.
+/// So a pool smaller than the CPU count spreads evenly across nodes and cores.
+///
 class ThreadPool
 {
 public:
@@ -28,32 +35,108 @@ public:
     template<typename T>
     inline void RunJob( void (*TJobFunc)( T* ), T* data, uint count );
 
+    // Run jobs only on the threads pinned to a NUMA node's CPUs,
+    // so that they can work on memory local to that node.
+    // count must be <= NodeThreadCount( node ). Fixed mode only.
+    void RunJobOnNode( uint node, JobFunc func, void* data, uint count, size_t dataSize );
+
+    template<typename T>
+    inline void RunJobOnNode( uint node, void (*TJobFunc)( T* ), T* data, uint count );
+
+    // Run jobs on a single thread per physical core, for passes that
+    // are bound by memory bandwidth and gain nothing from SMT siblings.
+    // count must be <= PhysicalCoreCount(). Fixed mode only.
+    void RunJobPerCore( JobFunc func, void* data, uint count, size_t dataSize );
+
+    template<typename T>
+    inline void RunJobPerCore( void (*TJobFunc)( T* ), T* data, uint count );
+
+    // Splits [0, length) in chunks of grain items and runs them across all threads.
+    // Each thread starts with an even, contiguous share of the chunks.
+    // Once a thread runs out of chunks it steals half of the
+    // remaining chunks of another thread, so threads don't sit idle
+    // while others are still working.
+    void ParallelFor( uint64 length, uint64 grain, ParallelForFunc func, void* data );
+
+    // TFunc is callable as func( uint64 start, uint64 end, uint threadIndex )
+    template<typename TFunc>
+    inline void ParallelFor( uint64 length, uint64 grain, const TFunc& func );
+
     inline uint ThreadCount() { return _threadCount; }
+
+    // Number of NUMA nodes the threads are spread across.
+    // 1 if the system has no NUMA nodes or affinity is disabled.
+    inline uint NodeCount() const { return _nodeCount; }
+    inline uint NodeThreadCount( uint node ) const { return _nodeThreadStart[node+1] - _nodeThreadStart[node]; }
+
+    // Number of physical cores that have at least one of our threads
+    inline uint PhysicalCoreCount() const { return _coreThreadCount; }
+
 private:
+    void InitTopology();
 
-    void DispatchFixed( JobFunc func, byte* data, uint count, size_t dataSize );
+    void DispatchFixed( JobFunc func, byte* data, uint count, size_t dataSize, const uint* threadIndices = nullptr );
     void DispatchGreedy( JobFunc func, byte* data, uint count, size_t dataSize );
 
     static void FixedThreadRunner( void* tParam );
     static void GreedyThreadRunner( void* tParam );
 
+    struct ParallelForJob
+    {
+        ThreadPool*     pool;
+        uint            index;
+        ParallelForFunc func;
+        void*           data;
+        uint64          length;
+        uint64          grain;
+    };
+
+    static void ParallelForThread( ParallelForJob* job );
+    bool PopChunk  ( uint threadIndex, uint64& outChunk );
+    bool StealChunk( uint threadIndex, uint64& outChunk );
+
+    // Range of chunks left for a thread in a ParallelFor, packed as [begin:32 | end:32].
+    // The owner takes chunks from the beginning, thieves take them from the end.
+    struct alignas( 64 ) WorkRange
+    {
+        std::atomic<uint64> range;
+    };
+
     struct ThreadData
     {
         ThreadPool* pool;
         int         index;
         uint        cpuId;     // CPU Id affinity
-        Semaphore   jobSignal; // Used for fixed mode
+        uint        jobIndex;  // Index of the job to run. Used for fixed mode
+        FutexWord   jobSignal; // Incremented to signal a new job. Used for fixed mode
     };
 
+    void WaitForJobs();
+
+    // Tracing (--trace)
+    const void* JobFuncAddress( const byte* jobData ) const;
+    void RunTracedJob( uint jobIndex );
+    void NameTraceThread( int index );
+
 private:
     uint              _threadCount;         // Reserved number of thread running jobs
     Mode              _mode;
     bool              _disableAffinity;
     Thread*           _threads;
     ThreadData*       _threadData;
-    Semaphore         _jobSignal;           // Used to signal threads that there's a new job
-    Semaphore         _poolSignal;          // Used to signal the pool that a thread has finished its job
+    uint              _spinCount;           // How long pool threads spin on their job signal before blocking
+    uint              _joinSpinCount;       // How long the dispatching thread spins waiting for jobs to finish
+    FutexWord         _jobSignal;           // Incremented to signal threads that there's a new job. Used for greedy mode
+    FutexWord         _pendingThreads;      // Number of threads that have not finished the current job
     std::atomic<bool> _exitSignal = false;  // Used to signal threads to exit
+    WorkRange*        _workRanges;          // Per-thread chunk ranges for ParallelFor
+
+    // Topology
+    uint              _nodeCount       = 1;
+    uint*             _nodeThreads     = nullptr;  // Thread indices grouped by node
+    uint*             _nodeThreadStart = nullptr;  // Start of each node's threads in _nodeThreads, plus the end
+    uint*             _coreThreads     = nullptr;  // Index of the first thread on each physical core
+    uint              _coreThreadCount = 0;
 
 
     // Current job group
@@ -70,4 +153,27 @@ template<typename T>
 inline void ThreadPool::RunJob( void (*TJobFunc)( T* ), T* data, uint count )
 {
     RunJob( (JobFunc)TJobFunc, data, count, sizeof( T ) );
-}
\ No newline at end of file
+}
+
+//-----------------------------------------------------------
+template<typename T>
+inline void ThreadPool::RunJobOnNode( uint node, void (*TJobFunc)( T* ), T* data, uint count )
+{
+    RunJobOnNode( node, (JobFunc)TJobFunc, data, count, sizeof( T ) );
+}
+
+//-----------------------------------------------------------
+template<typename T>
+inline void ThreadPool::RunJobPerCore( void (*TJobFunc)( T* ), T* data, uint count )
+{
+    RunJobPerCore( (JobFunc)TJobFunc, data, count, sizeof( T ) );
+}
+
+//-----------------------------------------------------------
+template<typename TFunc>
+inline void ThreadPool::ParallelFor( uint64 length, uint64 grain, const TFunc& func )
+{
+    ParallelFor( length, grain, []( uint64 start, uint64 end, uint threadIndex, void* data ) {
+        (*(const TFunc*)data)( start, end, threadIndex );
+    }, (void*)&func );
+}
@@ -0,0 +1,611 @@
+#define FSE_STATIC_LINKING_ONLY
+#include "fse/fse.h"
+
+#include "PlotReader.h"
+#include "util/Log.h"
+#include "Util.h"
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <queue>
+#include <vector>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wreturn-type"
+#pragma GCC diagnostic ignored "-Wsign-compare"
+#include "bls.hpp"
+#pragma GCC diagnostic pop
+
+// Table log of the FSE tables of the park deltas
+#define PLOT_FSE_TABLE_LOG 14
+
+// Line point parks: first line point, stubs and deltas
+static constexpr size_t LP_POINT_SIZE = CDiv( _K * 2, 8 );
+static constexpr size_t LP_STUB_BITS  = _K - kStubMinusBits;
+static constexpr size_t LP_STUBS_SIZE = CDiv( ( kEntriesPerPark - 1 ) * LP_STUB_BITS, 8 );
+static constexpr size_t LP_PARK_MAX   = LP_POINT_SIZE + LP_STUBS_SIZE +    // Table 1 has the largest parks
+                                        CDiv( (size_t)( ( kEntriesPerPark - 1 ) * kMaxAverageDeltaTable1 ), 8 );
+
+// P7 parks: kEntriesPerPark k+1-bit entries
+static constexpr size_t P7_ENTRY_BITS = _K + 1;
+static constexpr size_t P7_PARK_SIZE  = CDiv( P7_ENTRY_BITS * kEntriesPerPark, 8 );
+
+// Decoding tables of the line point parks of tables 1-6, and of the C3 parks
+static FSE_DTable     _dTables[7][FSE_DTABLE_SIZE_U32( PLOT_FSE_TABLE_LOG )];
+static std::once_flag _dTablesInit;
+
+static void   BuildDTables();
+static uint   CreateNormalizedCount( double r, short counts[256] );
+static size_t DecodeDeltas( const byte* src, size_t srcSize, byte* deltas, size_t maxDeltas, uint dTable );
+static uint64 ReadBitsBE( const byte* buffer, uint64 bitOffset, uint bitCount );
+static bool   ReadFully( FileStream& file, uint64 offset, void* buffer, size_t size );
+
+//-----------------------------------------------------------
+PlotReader::PlotReader()
+{}
+
+//-----------------------------------------------------------
+PlotReader::~PlotReader()
+{
+    Close();
+}
+
+//-----------------------------------------------------------
+bool PlotReader::Open( const char* path )
+{
+    ASSERT( path );
+    Close();
+
+    std::call_once( _dTablesInit, BuildDTables );
+
+    if( !_file.Open( path, FileMode::Open, FileAccess::Read ) )
+    {
+        Log::Error( "Error: Failed to open plot file '%s'.", path );
+        return false;
+    }
+
+    // Header
+    byte header[1024] = { 0 };
+
+    const ssize_t headerRead = _file.ReadAt( header, sizeof( header ), 0 );
+    if( headerRead < 0 )
+    {
+        Log::Error( "Error: Failed to read the plot header with error %d.", _file.GetError() );
+        Close();
+        return false;
+    }
+
+    const size_t magicSize = sizeof( kPOSMagic ) - 1;
+
+    if( memcmp( header, kPOSMagic, magicSize ) != 0 )
+    {
+        Log::Error( "Error: '%s' is not a plot file.", path );
+        Close();
+        return false;
+    }
+
+    const byte* reader = header + magicSize;
+
+    memcpy( _plotId, reader, sizeof( _plotId ) );
+    reader += sizeof( _plotId );
+
+    _k = *reader++;
+    if( _k != _K )
+    {
+        Log::Error( "Error: Unsupported plot k-size %u. Only k%u plots can be read.", _k, (uint)_K );
+        Close();
+        return false;
+    }
+
+    const uint16 formatSize = Swap16( *(uint16*)reader );
+    reader += 2;
+
+    if( formatSize != sizeof( kFormatDescription ) - 1 || memcmp( reader, kFormatDescription, formatSize ) != 0 )
+    {
+        Log::Error( "Error: Unsupported plot format." );
+        Close();
+        return false;
+    }
+    reader += formatSize;
+
+    _memoSize = Swap16( *(uint16*)reader );
+    reader += 2;
+
+    if( _memoSize > sizeof( _memo ) )
+    {
+        Log::Error( "Error: Invalid plot memo size %u.", (uint)_memoSize );
+        Close();
+        return false;
+    }
+
+    memcpy( _memo, reader, _memoSize );
+    reader += _memoSize;
+
+    if( (ssize_t)( reader - header ) + (ssize_t)sizeof( _tablePointers ) > headerRead )
+    {
+        Log::Error( "Error: The plot header is truncated." );
+        Close();
+        return false;
+    }
+
+    for( uint i = 0; i < (uint)PlotTable::_Count; i++ )
+    {
+        _tablePointers[i] = Swap64( ((uint64*)reader)[i] );
+
+        if( i > 0 && _tablePointers[i] <= _tablePointers[i-1] )
+        {
+            Log::Error( "Error: Invalid table pointers in the plot header." );
+            Close();
+            return false;
+        }
+    }
+
+    // The C1 and C2 checkpoints are small enough to keep in memory (~1.7MiB for C1 at k32),
+    // so that lookups only read the C3 parks they need from disk.
+    if( !ReadCheckpoints( PlotTable::C1, _c1, _c1Count ) ||
+        !ReadCheckpoints( PlotTable::C2, _c2, _c2Count ) )
+    {
+        Close();
+        return false;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+void PlotReader::Close()
+{
+    _file.Close();
+
+    delete[] _c1;
+    _c1      = nullptr;
+    _c1Count = 0;
+
+    delete[] _c2;
+    _c2      = nullptr;
+    _c2Count = 0;
+}
+
+//-----------------------------------------------------------
+bool PlotReader::ReadCheckpoints( PlotTable table, uint32*& entries, uint64& outCount )
+{
+    ASSERT( table == PlotTable::C1 || table == PlotTable::C2 );
+
+    const char*  name     = table == PlotTable::C1 ? "C1" : "C2";
+    const size_t size     = TableAddress( (PlotTable)( (int)table + 1 ) ) - TableAddress( table );
+    const uint64 maxCount = size / sizeof( uint32 );
+
+    entries  = new uint32[maxCount];
+    outCount = 0;
+
+    if( !ReadFully( _file, TableAddress( table ), entries, maxCount * sizeof( uint32 ) ) )
+    {
+        Log::Error( "Error: Failed to read the %s table with error %d.", name, _file.GetError() );
+        return false;
+    }
+
+    // The entries end with a terminator (0 for C1, 0xFFFFFFFF for C2),
+    // followed by the table's alignment padding. The first C1 entry may be a 0 f7.
+    const uint32 terminator = table == PlotTable::C1 ? 0 : 0xFFFFFFFF;
+
+    for( ; outCount < maxCount; outCount++ )
+    {
+        const uint32 f7 = Swap32( entries[outCount] );
+
+        if( ( f7 == terminator && ( outCount > 0 || table == PlotTable::C2 ) ) ||
+            ( outCount > 0 && f7 < entries[outCount-1] ) )
+            break;
+
+        entries[outCount] = f7;
+    }
+
+    if( outCount == 0 )
+    {
+        Log::Error( "Error: The plot's %s table is empty.", name );
+        return false;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------
+uint32 PlotReader::ChallengeToF7( const byte challenge[32] )
+{
+    return Swap32( *(uint32*)challenge ) >> ( 32 - _K );
+}
+
+//-----------------------------------------------------------
+uint64 PlotReader::GetQualitiesForChallenge( const byte challenge[32], byte* outQualities, uint64 maxQualities )
+{
+    ASSERT( challenge );
+    ASSERT( outQualities || maxQualities == 0 );
+
+    uint64 positions[PLOT_READER_MAX_QUALITIES];
+
+    const uint64 matchCount = GetP7Positions( ChallengeToF7( challenge ), positions, PLOT_READER_MAX_QUALITIES );
+    const uint64 count      = std::min( { matchCount, maxQualities, (uint64)PLOT_READER_MAX_QUALITIES } );
+
+    for( uint64 i = 0; i < count; i++ )
+    {
+        if( !GetQualityForPosition( challenge, positions[i], outQualities + i * 32 ) )
+            return 0;
+    }
+
+    return matchCount;
+}
+
+//-----------------------------------------------------------
+bool PlotReader::GetQualityForPosition( const byte challenge[32], uint64 p7Position, byte outQuality[32] )
+{
+    const uint qualityIndex = challenge[31] & 31;
+
+    uint64 position;
+    if( !ReadP7Entry( p7Position, position ) )
+        return false;
+
+    // Take the larger or smaller back pointer, depending
+    // on this table's bit of the quality index.
+    for( int table = (int)PlotTable::Table6; table > (int)PlotTable::Table1; table-- )
+    {
+        uint64 linePoint, x, y;
+        if( !ReadLinePoint( (PlotTable)table, position, linePoint ) )
+            return false;
+
+        LinePointToSquare( linePoint, x, y );
+        position = ( ( qualityIndex >> ( table - 1 ) ) & 1 ) ? x : y;
+    }
+
+    uint64 linePoint, x1, x2;
+    if( !ReadLinePoint( PlotTable::Table1, position, linePoint ) )
+        return false;
+
+    LinePointToSquare( linePoint, x2, x1 );
+
+    // Hash the challenge followed by the smaller and the larger x, k bits each
+    const size_t xsSize = CDiv( _K * 2, 8 );
+    const uint64 xs     = Swap64( ( ( x1 << _K ) | x2 ) << ( 64 - _K * 2 ) );
+
+    byte hashInput[32 + sizeof( uint64 )];
+    memcpy( hashInput, challenge, 32 );
+    memcpy( hashInput + 32, &xs, xsSize );
+
+    bls::Util::Hash256( outQuality, hashInput, 32 + xsSize );
+    return true;
+}
+
+//-----------------------------------------------------------
+uint64 PlotReader::GetP7Positions( uint32 f7, uint64* positions, uint64 maxPositions )
+{
+    ASSERT( _c2 );
+
+    // Find the range of C1 entries to look at from the C2 checkpoints.
+    // f7s equal to a checkpoint may also be found right before it.
+    const uint64 c2Start = std::lower_bound( _c2, _c2 + _c2Count, f7 ) - _c2;
+    const uint64 c2End   = std::upper_bound( _c2, _c2 + _c2Count, f7 ) - _c2;
+
+    if( c2End == 0 )
+        return 0;
+
+    const uint64 c1Start = ( c2Start > 0 ? c2Start - 1 : 0 ) * kCheckpoint2Interval;
+    const uint64 c1End   = std::min( c2End * kCheckpoint2Interval, _c1Count );
+
+    if( c1Start >= c1End )
+        return 0;
+
+    // Same with the C1 checkpoints, to find the C3 parks
+    const uint64 parkStart = std::lower_bound( _c1 + c1Start, _c1 + c1End, f7 ) - _c1;
+    const uint64 parkEnd   = std::upper_bound( _c1 + c1Start, _c1 + c1End, f7 ) - _c1;
+
+    const size_t c3Size = CalculateC3Size();
+
+    byte   parkBuffer[CalculateC3Size()];
+    byte   deltas[kCheckpoint1Interval];
+    uint64 matchCount = 0;
+
+    for( uint64 park = parkStart > c1Start ? parkStart - 1 : c1Start; park < parkEnd; park++ )
+    {
+        uint64 position = park * kCheckpoint1Interval;
+        uint32 value    = _c1[park];
+
+        // The first f7 of a park is its C1 entry
+        if( value == f7 )
+        {
+            if( matchCount < maxPositions )
+                positions[matchCount] = position;
+            matchCount++;
+        }
+
+        // The last park may have no deltas, and so not be written.
+        // In that case we read past the end, or the padding, which reads as empty.
+        memset( parkBuffer, 0, sizeof( parkBuffer ) );
+
+        if( _file.ReadAt( parkBuffer, c3Size, TableAddress( PlotTable::C3 ) + park * c3Size ) < 2 )
+            continue;
+
+        const size_t compressedSize = Swap16( *(uint16*)parkBuffer );
+        if( compressedSize == 0 || compressedSize > c3Size - 2 )
+            continue;
+
+        const size_t deltaCount = DecodeDeltas( parkBuffer + 2, compressedSize, deltas, sizeof( deltas ), 6 );
+
+        for( size_t i = 0; i < deltaCount; i++ )
+        {
+            value += deltas[i];
+            position++;
+
+            if( value == f7 )
+            {
+                if( matchCount < maxPositions )
+                    positions[matchCount] = position;
+                matchCount++;
+            }
+            else if( value > f7 )
+                break;
+        }
+    }
+
+    return matchCount;
+}
+
+//-----------------------------------------------------------
+bool PlotReader::ReadP7Entry( uint64 position, uint64& outIndex )
+{
+    const uint64 park     = position / kEntriesPerPark;
+    const uint64 bitStart = ( position - park * kEntriesPerPark ) * P7_ENTRY_BITS;
+
+    // Read the 8 bytes holding the entry
+    byte field[8] = { 0 };
+
+    const uint64 address = TableAddress( PlotTable::Table7 ) + park * P7_PARK_SIZE + bitStart / 8;
+    if( _file.ReadAt( field, sizeof( field ), address ) < (ssize_t)CDiv( bitStart % 8 + P7_ENTRY_BITS, 8 ) )
+        return false;
+
+    outIndex = ReadBitsBE( field, bitStart % 8, P7_ENTRY_BITS );
+    return true;
+}
+
+//-----------------------------------------------------------
+bool PlotReader::ReadLinePoint( PlotTable table, uint64 index, uint64& outLinePoint )
+{
+    ASSERT( table <= PlotTable::Table6 );
+
+    const TableId tableId  = (TableId)table;
+    const size_t  parkSize = CalculateParkSize( tableId );
+    ASSERT( parkSize <= LP_PARK_MAX );
+    const uint64  park     = index / kEntriesPerPark;
+    const uint64  entry    = index - park * kEntriesPerPark;
+
+    // Padded so that stubs can be read as whole 64-bit fields
+    byte parkBuffer[LP_PARK_MAX + 8];
+    memset( parkBuffer + parkSize, 0, 8 );
+
+    if( !ReadFully( _file, TableAddress( table ) + park * parkSize, parkBuffer, parkSize ) )
+        return false;
+
+    // The first line point is stored in 2k bits
+    uint64 linePoint = Swap64( *(uint64*)parkBuffer ) >> ( 64 - _K * 2 );
+
+    if( entry == 0 )
+    {
+        outLinePoint = linePoint;
+        return true;
+    }
+
+    const byte*  stubs     = parkBuffer + LP_POINT_SIZE;
+    const byte*  deltaData = stubs + LP_STUBS_SIZE;
+    const uint16 deltaSize = *(uint16*)deltaData;
+    deltaData += 2;
+
+    const size_t maxDeltasSize = CalculateMaxDeltasSize( tableId );
+
+    byte   deltas[kEntriesPerPark];
+    size_t deltaCount;
+
+    // The high bit is set when the deltas are stored uncompressed
+    if( deltaSize & 0x8000 )
+    {
+        deltaCount = deltaSize & 0x7FFF;
+        if( deltaCount > maxDeltasSize )
+            return false;
+
+        memcpy( deltas, deltaData, deltaCount );
+    }
+    else
+    {
+        if( deltaSize == 0 || deltaSize > maxDeltasSize )
+            return false;
+
+        deltaCount = DecodeDeltas( deltaData, deltaSize, deltas, kEntriesPerPark - 1, (uint)tableId );
+    }
+
+    if( entry > deltaCount )
+        return false;
+
+    uint64 deltaSum = 0;
+    uint64 stubSum  = 0;
+
+    for( uint64 i = 0; i < entry; i++ )
+    {
+        deltaSum += deltas[i];
+        stubSum  += ReadBitsBE( stubs, i * LP_STUB_BITS, LP_STUB_BITS );
+    }
+
+    outLinePoint = linePoint + ( deltaSum << LP_STUB_BITS ) + stubSum;
+    return true;
+}
+
+//-----------------------------------------------------------
+bool PlotReader::FetchProof( uint64 p7Position, uint32 outXs[64] )
+{
+    // Follow the back pointers from table 6 down to table 1,
+    // where each line point holds a pair of x values.
+    uint64 positions[64];
+    uint64 next     [64];
+
+    if( !ReadP7Entry( p7Position, positions[0] ) )
+        return false;
+
+    uint count = 1;
+
+    for( int table = (int)PlotTable::Table6; table >= (int)PlotTable::Table1; table-- )
+    {
+        for( uint i = 0; i < count; i++ )
+        {
+            uint64 linePoint;
+            if( !ReadLinePoint( (PlotTable)table, positions[i], linePoint ) )
+                return false;
+
+            uint64 x, y;
+            LinePointToSquare( linePoint, x, y );
+
+            next[i*2  ] = y;
+            next[i*2+1] = x;
+        }
+
+        count *= 2;
+        memcpy( positions, next, count * sizeof( uint64 ) );
+    }
+
+    ASSERT( count == 64 );
+
+    for( uint i = 0; i < 64; i++ )
+        outXs[i] = (uint32)positions[i];
+
+    return true;
+}
+
+//-----------------------------------------------------------
+void LinePointToSquare( uint64 linePoint, uint64& outX, uint64& outY )
+{
+    // Integer square root, by finding the largest x where x * (x-1) / 2 <= linePoint.
+    // x fits in k+1 bits, which keeps x * (x-1) within 64 bits.
+    uint64 x = 0;
+
+    for( int i = _K; i >= 0; i-- )
+    {
+        const uint64 newX = x + ( 1ull << i );
+        const uint64 xEnc = ( newX & 1 ) ? newX * ( ( newX - 1 ) / 2 ) : ( newX / 2 ) * ( newX - 1 );
+
+        if( xEnc <= linePoint )
+            x = newX;
+    }
+
+    const uint64 xEnc = ( x & 1 ) ? x * ( ( x - 1 ) / 2 ) : ( x / 2 ) * ( x - 1 );
+
+    outX = x;
+    outY = linePoint - xEnc;
+}
+
+//-----------------------------------------------------------
+void BuildDTables()
+{
+    short counts[256];
+
+    for( uint i = 0; i < 7; i++ )
+    {
+        const double r = i < 6 ? kRValues[i] : kC3R;
+        const uint   n = CreateNormalizedCount( r, counts );
+
+        const size_t err = FSE_buildDTable( _dTables[i], counts, n - 1, PLOT_FSE_TABLE_LOG );
+        if( FSE_isError( err ) )
+            Fatal( "Failed to build the FSE decoding table %u.", i );
+    }
+}
+
+/// #NOTE: From chiapos. These are the same distributions as the ones
+///        the FSE tables in CTables.h were generated from.
+//-----------------------------------------------------------
+uint CreateNormalizedCount( double r, short counts[256] )
+{
+    const double E                 = 2.718281828459;
+    const double MIN_PRB_THRESHOLD = 1e-50;
+    const uint   TOTAL_QUANTA      = 1u << PLOT_FSE_TABLE_LOG;
+
+    double dpdf[256];
+    uint   n = 0;
+
+    double p = 1 - pow( ( E - 1 ) / E, 1.0 / r );
+
+    while( p > MIN_PRB_THRESHOLD && n < 255 )
+    {
+        dpdf[n++] = p;
+
+        p = ( pow( E, 1.0 / r ) - 1 ) * pow( E - 1, 1.0 / r );
+        p /= pow( E, ( n + 1 ) / r );
+    }
+
+    for( uint i = 0; i < n; i++ )
+        counts[i] = 1;
+
+    // Hand out the quanta to the symbols that gain the most from them
+    auto cmp = [&]( uint i, uint j ) {
+        return dpdf[i] * ( log2( counts[i] + 1 ) - log2( counts[i] ) ) <
+               dpdf[j] * ( log2( counts[j] + 1 ) - log2( counts[j] ) );
+    };
+
+    std::priority_queue<uint, std::vector<uint>, decltype( cmp )> queue( cmp );
+
+    for( uint i = 0; i < n; i++ )
+        queue.push( i );
+
+    for( uint i = n; i < TOTAL_QUANTA; i++ )
+    {
+        const uint s = queue.top();
+        queue.pop();
+
+        counts[s]++;
+        queue.push( s );
+    }
+
+    for( uint i = 0; i < n; i++ )
+    {
+        if( counts[i] == 1 )
+            counts[i] = -1;
+    }
+
+    return n;
+}
+
+// Returns the number of deltas decoded, or 0 on error.
+//-----------------------------------------------------------
+size_t DecodeDeltas( const byte* src, size_t srcSize, byte* deltas, size_t maxDeltas, uint dTable )
+{
+    const size_t count = FSE_decompress_usingDTable( deltas, maxDeltas, src, srcSize, _dTables[dTable] );
+
+    if( FSE_isError( count ) )
+        return 0;
+
+    return count;
+}
+
+// Reads bitCount bits, stored MSbit first, at a bit offset.
+// The bits must fit in the 8 bytes at the offset's byte.
+//-----------------------------------------------------------
+uint64 ReadBitsBE( const byte* buffer, uint64 bitOffset, uint bitCount )
+{
+    ASSERT( bitOffset % 8 + bitCount <= 64 );
+
+    uint64 field;
+    memcpy( &field, buffer + bitOffset / 8, sizeof( field ) );
+
+    return ( Swap64( field ) << ( bitOffset % 8 ) ) >> ( 64 - bitCount );
+}
+
+//-----------------------------------------------------------
+bool ReadFully( FileStream& file, uint64 offset, void* buffer, size_t size )
+{
+    byte* dst = (byte*)buffer;
+
+    while( size )
+    {
+        const ssize_t sizeRead = file.ReadAt( dst, size, offset );
+        if( sizeRead <= 0 )
+            return false;
+
+        dst    += sizeRead;
+        offset += (uint64)sizeRead;
+        size   -= (size_t)sizeRead;
+    }
+
+    return true;
+}
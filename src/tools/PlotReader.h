@@ -0,0 +1,95 @@
+#pragma once
+#include "ChiaConsts.h"
+#include "io/FileStream.h"
+
+// Tables of a plot file, in the order of the table pointers in its header
+enum class PlotTable
+{
+    Table1 = 0,
+    Table2,
+    Table3,
+    Table4,
+    Table5,
+    Table6,
+    Table7,
+    C1,
+    C2,
+    C3
+
+    ,_Count
+};
+
+// Most qualities returned for a single challenge
+#define PLOT_READER_MAX_QUALITIES 64
+
+/**
+ * Reads proofs and qualities from a finished plot, as written by DiskPlotWriter.
+ *
+ * The C1 and C2 tables are kept in memory. Everything else is read from disk
+ * with positional reads, so lookups can be run from multiple threads at once.
+ */
+class PlotReader
+{
+public:
+    PlotReader();
+    ~PlotReader();
+
+    // Opens a plot and reads its header and C2 table.
+    // Logs the reason and returns false if it's not a valid plot.
+    bool Open( const char* path );
+    void Close();
+
+    inline const byte*  PlotId()   const { return _plotId;   }
+    inline uint         K()        const { return _k;        }
+    inline const byte*  Memo()     const { return _memo;     }
+    inline uint16       MemoSize() const { return _memoSize; }
+
+    inline uint64 TableAddress( PlotTable table ) const { return _tablePointers[(int)table]; }
+
+    // The f7 a challenge is looked up with: Its first k bits.
+    static uint32 ChallengeToF7( const byte challenge[32] );
+
+    // Finds the qualities of the proofs of a challenge, as a farmer does for a signage point.
+    // Writes up to maxQualities (at most PLOT_READER_MAX_QUALITIES) 32-byte qualities
+    // and returns the number of proofs found, or 0 on a read error.
+    uint64 GetQualitiesForChallenge( const byte challenge[32], byte* outQualities, uint64 maxQualities );
+
+    // Computes the quality of the proof of the table 7 entry at position.
+    // The last 5 bits of the challenge select which half of the proof is followed
+    // at each table, down to the pair of x values hashed with the challenge.
+    bool GetQualityForPosition( const byte challenge[32], uint64 p7Position, byte outQuality[32] );
+
+    // Finds the positions of the table 7 entries whose f7 is the given one.
+    // Writes up to maxPositions positions and returns the number of matches found.
+    uint64 GetP7Positions( uint32 f7, uint64* positions, uint64 maxPositions );
+
+    // Reads the table 6 index stored in the P7 entry at position
+    bool ReadP7Entry( uint64 position, uint64& outIndex );
+
+    // Reads the line point at index of one of the line point tables (1 to 6)
+    bool ReadLinePoint( PlotTable table, uint64 index, uint64& outLinePoint );
+
+    // Fetches the 64 x values of the proof of the table 7 entry at position.
+    // The x values are in line point order. See ValidateFullProof() to get them in proof order.
+    bool FetchProof( uint64 p7Position, uint32 outXs[64] );
+
+private:
+    bool ReadCheckpoints( PlotTable table, uint32*& entries, uint64& outCount );
+
+private:
+    FileStream _file;
+    byte       _plotId[32] = { 0 };
+    uint       _k          = 0;
+    byte       _memo[128]  = { 0 };
+    uint16     _memoSize   = 0;
+    uint64     _tablePointers[(int)PlotTable::_Count] = { 0 };
+
+    uint32*    _c1         = nullptr;   // C1 entries, without the trailing 0
+    uint64     _c1Count    = 0;
+    uint32*    _c2         = nullptr;   // C2 entries, without the trailing sentinel
+    uint64     _c2Count    = 0;
+};
+
+// Converts a line point back to the two values it encodes.
+// x is always the larger of the two.
+void LinePointToSquare( uint64 linePoint, uint64& outX, uint64& outY );
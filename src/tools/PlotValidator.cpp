@@ -0,0 +1,262 @@
+#include "PlotValidator.h"
+#include "memplot/MemPhase1.h"
+#include "threading/ThreadPool.h"
+#include "pos/chacha8.h"
+#include "util/Log.h"
+#include "SysHost.h"
+#include "Util.h"
+#include <algorithm>
+#include <atomic>
+
+// Most proofs fetched for a single challenge
+#define CHECK_MAX_PROOFS 32
+
+static bool IsMatch( uint64 yL, uint64 yR );
+
+//-----------------------------------------------------------
+bool ValidateFullProof( const byte plotId[32], uint32 f7, const uint32 xs[64], uint32 outProof[64] )
+{
+    // F1 of each x, with the same key as in phase 1
+    byte key[32] = { 1 };
+    memcpy( key + 1, plotId, 31 );
+
+    chacha8_ctx chacha;
+    ZeroMem( &chacha );
+    chacha8_keysetup( &chacha, key, 256, NULL );
+
+    uint64 y   [64];
+    uint64 meta[64][2];
+
+    for( uint i = 0; i < 64; i++ )
+    {
+        const uint64 x = xs[i];
+
+        // The k bits of the keystream at x * k, which may straddle 2 blocks below k32
+        const uint64 bitStart   = x * _K;
+        const uint   bitOffset  = (uint)( bitStart % kF1BlockSizeBits );
+        const uint   blockCount = bitOffset + _K > kF1BlockSizeBits ? 2 : 1;
+
+        byte blocks[kF1BlockSizeBits / 8 * 2 + sizeof( uint64 )] = { 0 };
+        chacha8_get_keystream( &chacha, bitStart / kF1BlockSizeBits, blockCount, blocks );
+
+        uint64 field;
+        memcpy( &field, blocks + bitOffset / 8, sizeof( field ) );
+        const uint64 fx = ( Swap64( field ) << ( bitOffset % 8 ) ) >> ( 64 - _K );
+
+        y[i]       = ( fx << kExtraBits ) | ( x >> ( _K - kExtraBits ) );
+        meta[i][0] = x;
+        meta[i][1] = 0;
+    }
+
+    memcpy( outProof, xs, sizeof( uint32 ) * 64 );
+
+    // Combine the entries in pairs, up to table 7.
+    // Line points don't keep the order of each pair, so the entry with
+    // the smaller y is taken as the left one, as it is when pairing.
+    uint count = 64;
+
+    for( int table = (int)TableId::Table2; table <= (int)TableId::Table7; table++ )
+    {
+        const uint xsPerEntry = 64 / count;
+
+        for( uint i = 0; i < count / 2; i++ )
+        {
+            const uint l = i * 2;
+            const uint r = l + 1;
+
+            if( y[r] < y[l] )
+            {
+                std::swap( y[l], y[r] );
+                std::swap( meta[l], meta[r] );
+
+                uint32 tmp[32];
+                memcpy( tmp,                     outProof + l * xsPerEntry, xsPerEntry * sizeof( uint32 ) );
+                memcpy( outProof + l*xsPerEntry, outProof + r * xsPerEntry, xsPerEntry * sizeof( uint32 ) );
+                memcpy( outProof + r*xsPerEntry, tmp,                       xsPerEntry * sizeof( uint32 ) );
+            }
+
+            if( !IsMatch( y[l], y[r] ) )
+                return false;
+
+            uint64 outMeta[2] = { 0, 0 };
+            const uint64 yOut = ComputeFxForPair( (TableId)table, y[l], meta[l], meta[r], outMeta );
+
+            // Entries before l have been consumed already
+            y[i]       = yOut;
+            meta[i][0] = outMeta[0];
+            meta[i][1] = outMeta[1];
+        }
+
+        count /= 2;
+    }
+
+    return y[0] == f7;
+}
+
+//-----------------------------------------------------------
+bool IsMatch( uint64 yL, uint64 yR )
+{
+    const uint64 groupL = yL / kBC;
+    const uint64 groupR = yR / kBC;
+
+    if( groupR - groupL != 1 )
+        return false;
+
+    const uint16* targets = L_targets[groupL & 1][yL - groupL * kBC];
+    const uint64  localR  = yR - groupR * kBC;
+
+    for( uint m = 0; m < kExtraBitsPow; m++ )
+    {
+        if( targets[m] == localR )
+            return true;
+    }
+
+    return false;
+}
+
+//-----------------------------------------------------------
+bool CheckPlot( ThreadPool& pool, const PlotCheckConfig& cfg )
+{
+    ASSERT( cfg.plotPath );
+    ASSERT( cfg.challengeCount );
+
+    PlotReader reader;
+    if( !reader.Open( cfg.plotPath ) )
+        return false;
+
+    LoadLTargets();
+
+    char plotIdStr[65] = { 0 };
+    size_t numEncoded;
+    BytesToHexStr( reader.PlotId(), 32, plotIdStr, sizeof( plotIdStr ), numEncoded );
+
+    Log::Line( "Checking plot %s", cfg.plotPath );
+    Log::Line( " Plot id    : %s", plotIdStr );
+    Log::Line( " K          : %u", reader.K() );
+    Log::Line( " Challenges : %llu", cfg.challengeCount );
+    Log::Line( " Threads    : %u", pool.ThreadCount() );
+    Log::Line( "" );
+
+    const uint64 challengeCount = cfg.challengeCount;
+
+    byte*   challenges = (byte*)malloc( challengeCount * 32 );
+    double* latencies  = (double*)malloc( challengeCount * sizeof( double ) );
+    SysHost::Random( challenges, challengeCount * 32 );
+
+    // Quality lookups, as done by a farmer for each signage point.
+    // Each one is timed on its own, with all threads looking up concurrently.
+    std::atomic<uint64> qualityCount = 0;
+    std::atomic<uint64> errorCount   = 0;
+
+    auto timer = TimerBegin();
+
+    pool.ParallelFor( challengeCount, 1, [&]( uint64 start, uint64 end, uint ) {
+
+        byte qualities[PLOT_READER_MAX_QUALITIES * 32];
+
+        for( uint64 c = start; c < end; c++ )
+        {
+            const byte* challenge = challenges + c * 32;
+            const auto  lookupTimer = TimerBegin();
+
+            const uint64 count = reader.GetQualitiesForChallenge( challenge, qualities, PLOT_READER_MAX_QUALITIES );
+
+            latencies[c] = std::chrono::duration<double, std::milli>( TimerBegin() - lookupTimer ).count();
+
+            // A challenge with proofs and no qualities failed to read
+            uint64 positions[1];
+            if( count == 0 && reader.GetP7Positions( PlotReader::ChallengeToF7( challenge ), positions, 1 ) > 0 )
+            {
+                errorCount++;
+                Log::Error( "Error: Failed to read the qualities of challenge %llu.", c );
+            }
+
+            qualityCount += count;
+        }
+    });
+
+    const double qualityElapsed = std::max( TimerEnd( timer ), 0.001 );
+
+    std::sort( latencies, latencies + challengeCount );
+
+    double latencySum = 0;
+    for( uint64 c = 0; c < challengeCount; c++ )
+        latencySum += latencies[c];
+
+    auto percentile = [=]( double p ) {
+        return latencies[std::min( (uint64)( challengeCount * p ), challengeCount - 1 )];
+    };
+
+    Log::Line( "Looked up the qualities of %llu challenges in %.2lf seconds.", challengeCount, qualityElapsed );
+    Log::Line( " Qualities found    : %llu (%.3lf per challenge, ~1 is expected)",
+        qualityCount.load(), qualityCount.load() / (double)challengeCount );
+    Log::Line( " Lookups per second : %.2lf", challengeCount / qualityElapsed );
+    Log::Line( " Lookup latency     : avg %.3lf ms, p50 %.3lf ms, p99 %.3lf ms, max %.3lf ms",
+        latencySum / challengeCount, percentile( 0.5 ), percentile( 0.99 ), latencies[challengeCount-1] );
+    Log::Line( "" );
+
+    free( latencies );
+
+    if( cfg.qualitiesOnly )
+    {
+        free( challenges );
+        return errorCount == 0;
+    }
+
+    // Full proofs
+    std::atomic<uint64> proofCount   = 0;
+    std::atomic<uint64> validCount   = 0;
+    std::atomic<uint64> invalidCount = 0;
+
+    const byte* plotId = reader.PlotId();
+
+    timer = TimerBegin();
+
+    pool.ParallelFor( challengeCount, 1, [&]( uint64 start, uint64 end, uint ) {
+
+        uint64 positions[CHECK_MAX_PROOFS];
+        uint32 xs       [64];
+        uint32 proof    [64];
+
+        for( uint64 c = start; c < end; c++ )
+        {
+            const uint32 f7 = PlotReader::ChallengeToF7( challenges + c * 32 );
+
+            const uint64 matchCount = reader.GetP7Positions( f7, positions, CHECK_MAX_PROOFS );
+            const uint64 fetchCount = std::min( matchCount, (uint64)CHECK_MAX_PROOFS );
+
+            proofCount += matchCount;
+
+            for( uint64 i = 0; i < fetchCount; i++ )
+            {
+                if( !reader.FetchProof( positions[i], xs ) )
+                {
+                    errorCount++;
+                    Log::Error( "Error: Failed to read the proof at table 7 position %llu.", positions[i] );
+                    continue;
+                }
+
+                if( ValidateFullProof( plotId, f7, xs, proof ) )
+                    validCount++;
+                else
+                {
+                    invalidCount++;
+                    Log::Error( "Error: Invalid proof for challenge %llu (f7 %u) at table 7 position %llu.", c, f7, positions[i] );
+                }
+            }
+        }
+    });
+
+    const double elapsed = std::max( TimerEnd( timer ), 0.001 );
+
+    free( challenges );
+
+    Log::Line( "Checked the proofs of %llu challenges in %.2lf seconds.", challengeCount, elapsed );
+    Log::Line( " Proofs found       : %llu", proofCount.load() );
+    Log::Line( " Valid proofs       : %llu", validCount.load() );
+    Log::Line( " Invalid proofs     : %llu", invalidCount.load() );
+    Log::Line( " Read errors        : %llu", errorCount.load() );
+    Log::Line( " Proofs per second  : %.2lf", ( validCount.load() + invalidCount.load() ) / elapsed );
+
+    return invalidCount == 0 && errorCount == 0;
+}
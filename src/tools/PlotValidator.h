@@ -0,0 +1,22 @@
+#pragma once
+#include "PlotReader.h"
+
+class ThreadPool;
+
+struct PlotCheckConfig
+{
+    const char* plotPath       = nullptr;
+    uint64      challengeCount = 100;
+    bool        qualitiesOnly  = false;     // Don't fetch and validate the full proofs
+};
+
+// Checks that a full proof, with its x values in line point order (as fetched by
+// PlotReader::FetchProof()), is a valid proof of space for f7.
+// If it is, outProof gets its x values in proof order.
+// LoadLTargets() must have been called before.
+bool ValidateFullProof( const byte plotId[32], uint32 f7, const uint32 xs[64], uint32 outProof[64] );
+
+// Looks up the qualities of random challenges in a plot, in parallel, timing each lookup.
+// Then fetches and validates the full proofs found.
+// Returns false if the plot could not be read or if any proof is invalid.
+bool CheckPlot( ThreadPool& pool, const PlotCheckConfig& cfg );
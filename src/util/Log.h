@@ -18,6 +18,9 @@ public:
     static void WriteError( const char* msg, va_list args );
 
     inline static void SetVerbose( bool enabled ) { _verbose = enabled; }
+
+    // Redirect the regular output to a stream. nullptr restores stdout.
+    inline static void SetOutStream( FILE* stream ) { _outStream = stream; }
     
     static void Verbose( const char* msg, ...  );
     static void VerboseWrite( const char* msg, ...  );
@@ -0,0 +1,115 @@
+#include "PerfCounters.h"
+#include "threading/ThreadPool.h"
+#include "util/Log.h"
+#include "Util.h"
+#include "Config.h"
+
+struct PerfOpenJob
+{
+    PerfCounterGroup* group;
+    bool              opened;
+};
+
+//-----------------------------------------------------------
+static void PerfOpenThread( PerfOpenJob* job )
+{
+    job->opened = SysHost::PerfCountersOpen( *job->group );
+}
+
+//-----------------------------------------------------------
+PerfCounters* PerfCounters::Create( ThreadPool& pool )
+{
+    const uint threadCount = pool.ThreadCount();
+    ASSERT( threadCount <= MAX_THREADS );
+
+    PerfCounters* counters = new PerfCounters();
+    counters->_groupCount = threadCount + 1;
+    counters->_groups     = new PerfCounterGroup[threadCount + 1];
+
+    // Counters count the thread that opens them, so each pool thread opens its own.
+    // The last group is for the calling thread.
+    PerfOpenJob jobs[MAX_THREADS];
+    for( uint i = 0; i < threadCount; i++ )
+    {
+        jobs[i].group  = &counters->_groups[i];
+        jobs[i].opened = false;
+    }
+
+    pool.RunJob( PerfOpenThread, jobs, threadCount );
+
+    bool opened = SysHost::PerfCountersOpen( counters->_groups[threadCount] );
+    for( uint i = 0; i < threadCount; i++ )
+        opened = opened && jobs[i].opened;
+
+    if( !opened )
+    {
+        delete counters;
+        return nullptr;
+    }
+
+    // The same counters are available on all threads
+    for( uint i = 0; i < (uint)PerfCounter::_Count; i++ )
+        counters->_available[i] = counters->_groups[0].fds[i] >= 0;
+
+    return counters;
+}
+
+//-----------------------------------------------------------
+PerfCounters::~PerfCounters()
+{
+    for( uint i = 0; i < _groupCount; i++ )
+        SysHost::PerfCountersClose( _groups[i] );
+
+    delete[] _groups;
+}
+
+//-----------------------------------------------------------
+void PerfCounters::Read( PerfSample& sample ) const
+{
+    memset( &sample, 0, sizeof( sample ) );
+
+    for( uint i = 0; i < _groupCount; i++ )
+    {
+        uint64 values[(uint)PerfCounter::_Count];
+        SysHost::PerfCountersRead( _groups[i], values );
+
+        for( uint j = 0; j < (uint)PerfCounter::_Count; j++ )
+            sample.values[j] += values[j];
+    }
+}
+
+//-----------------------------------------------------------
+void PerfCounters::LogSince( const PerfSample& start, const char* label ) const
+{
+    PerfSample end;
+    Read( end );
+
+    uint64 delta[(uint)PerfCounter::_Count];
+    for( uint i = 0; i < (uint)PerfCounter::_Count; i++ )
+        delta[i] = end.values[i] - start.values[i];
+
+    const double cycles       = (double)delta[(uint)PerfCounter::Cycles];
+    const double instructions = (double)delta[(uint)PerfCounter::Instructions];
+
+    // Misses per 1000 instructions, or n/a
+    auto rate = [&]( PerfCounter counter, char* buffer, size_t size ) {
+        if( _available[(uint)counter] && instructions > 0 )
+            snprintf( buffer, size, "%.2lf", delta[(uint)counter] * 1000.0 / instructions );
+        else
+            snprintf( buffer, size, "n/a" );
+        return buffer;
+    };
+
+    char ipc[32], llc[32], dtlb[32], branch[32];
+
+    if( cycles > 0 && _available[(uint)PerfCounter::Instructions] )
+        snprintf( ipc, sizeof( ipc ), "%.2lf", instructions / cycles );
+    else
+        snprintf( ipc, sizeof( ipc ), "n/a" );
+
+    Log::Line( "%s: IPC %s | Misses per 1k instructions: LLC %s, dTLB %s, branch %s",
+        label, ipc,
+        rate( PerfCounter::LLCMisses   , llc   , sizeof( llc    ) ),
+        rate( PerfCounter::DTLBMisses  , dtlb  , sizeof( dtlb   ) ),
+        rate( PerfCounter::BranchMisses, branch, sizeof( branch ) ) );
+}
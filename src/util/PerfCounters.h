@@ -0,0 +1,63 @@
+#pragma once
+#include "SysHost.h"
+
+class ThreadPool;
+
+// Sum of the hardware counters of a set of threads at a point in time
+struct PerfSample
+{
+    uint64 values[(uint)PerfCounter::_Count];
+};
+
+/**
+ * Hardware performance counters of the calling thread and of all the threads of a pool.
+ *
+ * Samples are taken at stage boundaries and the difference between 2 samples
+ * is reported as instructions per cycle and misses per 1000 instructions,
+ * which tells whether a stage is bound by memory, branches or compute.
+ * Only user mode is counted.
+ */
+class PerfCounters
+{
+public:
+    // Open the counters on the calling thread and on every thread of the pool.
+    // Returns nullptr if hardware counters are not available.
+    static PerfCounters* Create( ThreadPool& pool );
+    ~PerfCounters();
+
+    void Read( PerfSample& sample ) const;
+
+    // Log the counter rates of the work done since the start sample
+    void LogSince( const PerfSample& start, const char* label ) const;
+
+private:
+    PerfCounters() = default;
+
+private:
+    PerfCounterGroup* _groups     = nullptr;
+    uint              _groupCount = 0;
+    bool              _available[(uint)PerfCounter::_Count] = { false };
+};
+
+// Samples the counters between its creation and Log().
+// Does nothing if counters is null, so that it can always be used.
+class PerfSpan
+{
+public:
+    inline explicit PerfSpan( const PerfCounters* counters )
+        : _counters( counters )
+    {
+        if( counters )
+            counters->Read( _start );
+    }
+
+    inline void Log( const char* label ) const
+    {
+        if( _counters )
+            _counters->LogSince( _start, label );
+    }
+
+private:
+    const PerfCounters* _counters;
+    PerfSample          _start;
+};
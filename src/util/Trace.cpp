@@ -0,0 +1,278 @@
+#include "Trace.h"
+#include "Util.h"
+#include "Config.h"
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+
+#if PLATFORM_IS_UNIX
+    #include <dlfcn.h>
+    #include <cxxabi.h>
+#endif
+
+struct TraceEvent
+{
+    const char* category;
+    const char* name;
+    const void* func;
+    uint64      start;
+    uint64      end;
+};
+
+struct TraceBuffer
+{
+    std::atomic<bool>   inUse;
+    std::atomic<uint64> written;    // Total events recorded by the owner
+    uint64              dumped;     // Total events written out or dropped. Only used when dumping.
+    char                name[32];
+    TraceEvent          events[TRACE_BUFFER_EVENTS];
+};
+
+// Releases the thread's buffer when it exits, so that a new thread can take it
+struct TraceThread
+{
+    TraceBuffer* buffer = nullptr;
+
+    inline ~TraceThread()
+    {
+        if( buffer )
+            buffer->inUse.store( false, std::memory_order_release );
+    }
+};
+
+bool Trace::_enabled = false;
+
+static std::chrono::steady_clock::time_point _traceEpoch;
+static TraceBuffer*          _traceBuffers[TRACE_MAX_THREADS];
+static std::atomic<uint>     _traceBufferCount = 0;
+static thread_local TraceThread _traceThread;
+
+static TraceBuffer* GetThreadBuffer();
+static void GetSymbolName( const void* func, std::string& outName );
+static void WriteJsonString( FILE* file, const char* str );
+
+//-----------------------------------------------------------
+void Trace::Enable()
+{
+    _traceEpoch = std::chrono::steady_clock::now();
+    _enabled    = true;
+}
+
+//-----------------------------------------------------------
+uint64 Trace::Now()
+{
+    return (uint64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - _traceEpoch ).count();
+}
+
+//-----------------------------------------------------------
+void Trace::Record( const char* category, const char* name, const void* func, uint64 start, uint64 end )
+{
+    TraceBuffer* buffer = GetThreadBuffer();
+    if( !buffer )
+        return;
+
+    const uint64 index = buffer->written.load( std::memory_order_relaxed );
+
+    TraceEvent& e = buffer->events[index % TRACE_BUFFER_EVENTS];
+    e.category = category;
+    e.name     = name;
+    e.func     = func;
+    e.start    = start;
+    e.end      = end;
+
+    buffer->written.store( index + 1, std::memory_order_release );
+}
+
+//-----------------------------------------------------------
+void Trace::SetThreadName( const char* name )
+{
+    TraceBuffer* buffer = GetThreadBuffer();
+    if( !buffer )
+        return;
+
+    snprintf( buffer->name, sizeof( buffer->name ), "%s", name );
+}
+
+//-----------------------------------------------------------
+bool Trace::Dump( const char* path )
+{
+    ASSERT( path );
+
+    FILE* file = fopen( path, "w" );
+    if( !file )
+        return false;
+
+    // Symbols are looked up once per function
+    std::unordered_map<const void*, std::string> symbols;
+
+    fprintf( file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n" );
+
+    bool   firstEvent   = true;
+    uint64 droppedCount = 0;
+
+    const uint bufferCount = std::min( _traceBufferCount.load( std::memory_order_acquire ), (uint)TRACE_MAX_THREADS );
+
+    for( uint tid = 0; tid < bufferCount; tid++ )
+    {
+        TraceBuffer* buffer = _traceBuffers[tid];
+        if( !buffer )
+            continue;
+
+        const uint64 written = buffer->written.load( std::memory_order_acquire );
+        uint64       start   = buffer->dumped;
+
+        // Skip what was overwritten
+        if( written - start > TRACE_BUFFER_EVENTS )
+        {
+            droppedCount += written - start - TRACE_BUFFER_EVENTS;
+            start = written - TRACE_BUFFER_EVENTS;
+        }
+
+        buffer->dumped = written;
+
+        if( start == written )
+            continue;
+
+        fprintf( file, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":",
+            firstEvent ? "" : ",\n", tid );
+
+        if( buffer->name[0] )
+            WriteJsonString( file, buffer->name );
+        else
+            fprintf( file, "\"Thread %u\"", tid );
+
+        fprintf( file, "}}" );
+        fprintf( file, ",\n{\"ph\":\"M\",\"name\":\"thread_sort_index\",\"pid\":1,\"tid\":%u,\"args\":{\"sort_index\":%u}}",
+            tid, tid );
+
+        firstEvent = false;
+
+        for( uint64 i = start; i < written; i++ )
+        {
+            const TraceEvent& e = buffer->events[i % TRACE_BUFFER_EVENTS];
+
+            fprintf( file, ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3lf,\"dur\":%.3lf,\"cat\":\"%s\",\"name\":",
+                tid, e.start / 1000.0, ( e.end - e.start ) / 1000.0, e.category );
+
+            if( e.func )
+            {
+                auto it = symbols.find( e.func );
+                if( it == symbols.end() )
+                {
+                    std::string symbol;
+                    GetSymbolName( e.func, symbol );
+                    it = symbols.emplace( e.func, std::move( symbol ) ).first;
+                }
+
+                WriteJsonString( file, it->second.c_str() );
+            }
+            else
+                WriteJsonString( file, e.name );
+
+            fprintf( file, "}" );
+        }
+    }
+
+    fprintf( file, "\n],\"otherData\":{\"dropped_events\":%llu}}\n", droppedCount );
+
+    const bool ok = !ferror( file );
+    return fclose( file ) == 0 && ok;
+}
+
+//-----------------------------------------------------------
+TraceBuffer* GetThreadBuffer()
+{
+    TraceBuffer* buffer = _traceThread.buffer;
+    if( buffer )
+        return buffer;
+
+    // Take the buffer of a thread that exited
+    const uint count = std::min( _traceBufferCount.load( std::memory_order_acquire ), (uint)TRACE_MAX_THREADS );
+
+    for( uint i = 0; i < count; i++ )
+    {
+        TraceBuffer* b = _traceBuffers[i];
+        bool inUse = false;
+
+        if( b && b->inUse.compare_exchange_strong( inUse, true, std::memory_order_acq_rel ) )
+        {
+            b->name[0] = 0;
+            _traceThread.buffer = b;
+            return b;
+        }
+    }
+
+    // Or add a new one
+    const uint index = _traceBufferCount.fetch_add( 1, std::memory_order_acq_rel );
+    if( index >= TRACE_MAX_THREADS )
+        return nullptr;
+
+    buffer = new TraceBuffer();
+    buffer->inUse.store( true, std::memory_order_relaxed );
+    buffer->written.store( 0, std::memory_order_relaxed );
+    buffer->dumped  = 0;
+    buffer->name[0] = 0;
+
+    _traceBuffers[index] = buffer;
+    _traceThread.buffer  = buffer;
+    return buffer;
+}
+
+//-----------------------------------------------------------
+void GetSymbolName( const void* func, std::string& outName )
+{
+    #if PLATFORM_IS_UNIX
+        // Only exported symbols can be found (-rdynamic)
+        Dl_info info;
+        if( dladdr( func, &info ) )
+        {
+            if( info.dli_sname )
+            {
+                int   status    = 0;
+                char* demangled = abi::__cxa_demangle( info.dli_sname, nullptr, nullptr, &status );
+
+                outName = status == 0 && demangled ? demangled : info.dli_sname;
+                free( demangled );
+                return;
+            }
+
+            // Functions with internal linkage, such as lambdas and static functions,
+            // are named by their offset in the module, which can be resolved with addr2line.
+            if( info.dli_fname && info.dli_fbase )
+            {
+                const char* moduleName = strrchr( info.dli_fname, '/' );
+                moduleName = moduleName ? moduleName + 1 : info.dli_fname;
+
+                char offset[32];
+                snprintf( offset, sizeof( offset ), "+0x%llx", (uint64)( (uintptr_t)func - (uintptr_t)info.dli_fbase ) );
+
+                outName  = moduleName;
+                outName += offset;
+                return;
+            }
+        }
+    #endif
+
+    char address[32];
+    snprintf( address, sizeof( address ), "%p", func );
+    outName = address;
+}
+
+//-----------------------------------------------------------
+void WriteJsonString( FILE* file, const char* str )
+{
+    fputc( '"', file );
+
+    for( const char* c = str; *c; c++ )
+    {
+        if( *c == '"' || *c == '\\' )
+            fputc( '\\', file );
+
+        if( (unsigned char)*c >= 0x20 )
+            fputc( *c, file );
+    }
+
+    fputc( '"', file );
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <atomic>
+
+/**
+ * Opt-in timeline of the work done by each thread, written as a
+ * Chrome trace-event file (open it in chrome://tracing or ui.perfetto.dev).
+ *
+ * Each thread records complete events in its own ring buffer, without locks.
+ * Once a buffer is full its oldest events are overwritten.
+ * Recording costs a single branch while tracing is disabled.
+ */
+class Trace
+{
+public:
+    // Must be called before the threads to trace are started
+    static void Enable();
+
+    inline static bool IsEnabled() { return _enabled; }
+
+    // Nanoseconds since tracing was enabled
+    static uint64 Now();
+
+    // Record an event of the calling thread.
+    // category and name must be string literals, they are stored by pointer.
+    // If func is set, the event is named after the function's symbol instead.
+    static void Record( const char* category, const char* name, const void* func, uint64 start, uint64 end );
+
+    // Name the calling thread in the timeline. The name is copied.
+    static void SetThreadName( const char* name );
+
+    // Write the events recorded since the last dump to a file and discard them.
+    // No thread may record events while dumping.
+    static bool Dump( const char* path );
+
+private:
+    static bool _enabled;
+};
+
+// Records the scope's duration as an event, if tracing is enabled
+class TraceScope
+{
+public:
+    inline TraceScope( const char* category, const char* name )
+        : _category( category )
+        , _name    ( name )
+        , _enabled ( Trace::IsEnabled() )
+    {
+        if( _enabled )
+            _start = Trace::Now();
+    }
+
+    inline ~TraceScope()
+    {
+        if( _enabled )
+            Trace::Record( _category, _name, nullptr, _start, Trace::Now() );
+    }
+
+private:
+    const char* _category;
+    const char* _name;
+    bool        _enabled;
+    uint64      _start = 0;
+};
@@ -0,0 +1,213 @@
+#include <catch2/catch_test_macros.hpp>
+#include "memplot/LPGen.h"
+#include "threading/ThreadPool.h"
+#include <algorithm>
+#include <random>
+#include <vector>
+
+// The Phase 3 kernels have SIMD paths, selected at compile time.
+// These check them against plain scalar loops.
+
+//-----------------------------------------------------------
+TEST_CASE( "PruneAndMap and CountMarkedEntries match the scalar loop", "[phase3]" )
+{
+    const uint64 n         = 4096 + 37;
+    const uint64 dstOffset = 3;
+    const uint64 sentinel  = 0xA5A5A5A5A5A5A5A5ull;
+
+    std::mt19937_64 rng( 7 );
+
+    std::vector<Pair>   pairs  ( n );
+    std::vector<uint32> lefts  ( n );
+    std::vector<uint16> offsets( n );
+
+    for( uint64 i = 0; i < n; i++ )
+    {
+        const uint32 left   = (uint32)rng();
+        const uint16 offset = (uint16)( 1 + rng() % 0xFFFF );
+
+        pairs  [i] = { left, left + offset };
+        lefts  [i] = left;
+        offsets[i] = offset;
+    }
+
+    PackedPairs packedPairs;
+    packedPairs.left   = lefts.data();
+    packedPairs.offset = offsets.data();
+
+    // Ranges don't start or end on a block boundary
+    const uint64 ranges[][2] = { { 0, n }, { 1, n - 1 }, { 63, 64 }, { 64, 128 }, { 5, 70 }, { 130, 4000 }, { 17, 17 } };
+
+    for( const double density : { 0.0, 0.01, 0.5, 0.99, 1.0 } )
+    {
+        std::vector<byte> marks( n );
+        for( uint64 i = 0; i < n; i++ )
+            marks[i] = ( rng() % 1000 ) < density * 1000 ? 1 : 0;
+
+        for( const auto& range : ranges )
+        {
+            const uint64 start = range[0];
+            const uint64 end   = range[1];
+
+            std::vector<Pair>   expectedPairs;
+            std::vector<uint32> expectedMap;
+
+            for( uint64 i = start; i < end; i++ )
+            {
+                if( marks[i] )
+                {
+                    expectedPairs.push_back( pairs[i] );
+                    expectedMap  .push_back( (uint32)i );
+                }
+            }
+
+            const uint64 count = expectedPairs.size();
+            REQUIRE( CountMarkedEntries( marks.data(), start, end ) == count );
+
+            for( const bool compactPairs : { false, true } )
+            {
+                std::vector<uint64> lpBuffer( n + dstOffset, sentinel );
+                std::vector<uint32> map     ( n + dstOffset, (uint32)sentinel );
+
+                LPJob job;
+                job.lTable        = nullptr;
+                job.rTable        = pairs.data();
+                job.packedRTable  = packedPairs;
+                job.lpBuffer      = lpBuffer.data();
+                job.markedEntries = marks.data();
+                job.map           = map.data();
+
+                if( compactPairs )
+                    PruneAndMap<true> ( job, start, end, dstOffset );
+                else
+                    PruneAndMap<false>( job, start, end, dstOffset );
+
+                const Pair* newPairs = (Pair*)( lpBuffer.data() + dstOffset );
+
+                for( uint64 i = 0; i < count; i++ )
+                {
+                    REQUIRE( newPairs[i].left  == expectedPairs[i].left  );
+                    REQUIRE( newPairs[i].right == expectedPairs[i].right );
+                    REQUIRE( map[dstOffset + i] == expectedMap[i] );
+                }
+
+                // Nothing is written outside of the pruned entries
+                for( uint64 i = 0; i < lpBuffer.size(); i++ )
+                {
+                    if( i < dstOffset || i >= dstOffset + count )
+                    {
+                        REQUIRE( lpBuffer[i] == sentinel );
+                        REQUIRE( map[i] == (uint32)sentinel );
+                    }
+                }
+            }
+        }
+    }
+}
+
+//-----------------------------------------------------------
+TEST_CASE( "ConvertToLinePoints matches the scalar conversion", "[phase3]" )
+{
+    const uint64 n = 4096 + 29;
+
+    std::mt19937_64 rng( 13 );
+
+    // Include the extremes of x: 0 and 2^32-1
+    std::vector<uint32> lTable( n );
+    const uint32 edgeValues[] = { 0, 1, 2, 3, 0xFFFFFFFE, 0xFFFFFFFF };
+
+    for( uint64 i = 0; i < n; i++ )
+        lTable[i] = i % 7 == 0 ? edgeValues[rng() % 6] : (uint32)rng();
+
+    std::vector<Pair> pairs( n );
+
+    for( uint64 i = 0; i < n; i++ )
+    {
+        // A pair with both x below 2 is never generated in a plot
+        Pair pair;
+        do {
+            pair.left  = (uint32)( rng() % n );
+            pair.right = (uint32)( rng() % n );
+        } while( std::max( lTable[pair.left], lTable[pair.right] ) < 2 );
+
+        pairs[i] = pair;
+    }
+
+    const uint64 ranges[][2] = { { 0, n }, { 1, n - 1 }, { 3, 10 }, { 8, 16 }, { 5, 6 }, { 130, 4000 }, { 17, 17 } };
+
+    for( const auto& range : ranges )
+    {
+        const uint64 start = range[0];
+        const uint64 end   = range[1];
+
+        std::vector<uint64> lpBuffer( n );
+        memcpy( lpBuffer.data(), pairs.data(), n * sizeof( Pair ) );
+
+        LPJob job = {};
+        job.lTable   = lTable.data();
+        job.lpBuffer = lpBuffer.data();
+
+        ConvertToLinePoints( job, start, end );
+
+        for( uint64 i = 0; i < n; i++ )
+        {
+            const uint64 x = lTable[pairs[i].left ];
+            const uint64 y = lTable[pairs[i].right];
+            const uint64 a = std::max( x, y );
+            const uint64 b = std::min( x, y );
+
+            if( i >= start && i < end )
+                REQUIRE( lpBuffer[i] == a * ( a - 1 ) / 2 + b );
+            else
+                REQUIRE( memcmp( &lpBuffer[i], &pairs[i], sizeof( Pair ) ) == 0 );
+        }
+    }
+}
+
+//-----------------------------------------------------------
+TEST_CASE( "WriteLookupTableByRegion matches WriteLookupTable", "[phase3]" )
+{
+    ThreadPool pool( 4, ThreadPool::Mode::Fixed, true );
+
+    std::mt19937_64 rng( 17 );
+
+    // Sparse, distinct lookup indices, spread over many regions
+    const uint64 tableSize = std::min( 1ull << 22, ENTRIES_PER_TABLE );
+
+    std::vector<uint32> indices( tableSize );
+    for( uint64 i = 0; i < tableSize; i++ )
+        indices[i] = (uint32)i;
+
+    for( const uint64 length : { 1ull, 1000ull, 300007ull } )
+    {
+        std::shuffle( indices.begin(), indices.end(), rng );
+
+        // The map is 2 uint32s per entry, so that it can be passed as the tmp buffer, as in Phase 3
+        std::vector<uint64> mapBuffer( length );
+        uint32* map = (uint32*)mapBuffer.data();
+        memcpy( map, indices.data(), length * sizeof( uint32 ) );
+
+        std::vector<uint32> expected( tableSize, 0xFFFFFFFF );
+
+        LPJob job = {};
+        job.map    = map;
+        job.lTable = expected.data();
+        WriteLookupTable( job, 0, length );
+
+        for( const bool tmpIsMap : { false, true } )
+        {
+            std::vector<uint32> mapCopy( map, map + length );
+            std::vector<uint32> actual ( tableSize, 0xFFFFFFFF );
+            std::vector<uint64> packed ( length );
+            std::vector<uint64> tmp    ( length );
+
+            job.lTable = actual.data();
+
+            WriteLookupTableByRegion( pool, job, length, packed.data(), tmpIsMap ? mapBuffer.data() : tmp.data() );
+
+            REQUIRE( actual == expected );
+
+            memcpy( map, mapCopy.data(), length * sizeof( uint32 ) );
+        }
+    }
+}
@@ -0,0 +1,101 @@
+#include <catch2/catch_test_macros.hpp>
+#include "memplot/MemPhase4.h"
+#include "threading/ThreadPool.h"
+#include <algorithm>
+#include <random>
+#include <vector>
+
+// WriteP4Parallel writes P7, C1, C2 and C3 in a single pass.
+// This checks it against the tables written one at a time, serially.
+
+//-----------------------------------------------------------
+static void WriteP4Serial( const uint64 length, const uint32* lEntries, uint32* f7Entries, const P4Tables& tables )
+{
+    const size_t p7ParkSize = CDiv( (_K + 1) * kEntriesPerPark, 8 );
+    const size_t c3Size     = CalculateC3Size();
+    const uint64 c2Interval = (uint64)kCheckpoint1Interval * kCheckpoint2Interval;
+
+    // P7
+    for( uint64 park = 0; park < CDiv( length, kEntriesPerPark ); park++ )
+    {
+        const uint64 parkStart  = park * kEntriesPerPark;
+        const uint64 parkLength = std::min( (uint64)kEntriesPerPark, length - parkStart );
+        byte*        parkBuffer = tables.p7 + park * p7ParkSize;
+
+        memset( parkBuffer, 0, p7ParkSize );
+        WriteP7Entries( parkLength, lEntries + parkStart, parkBuffer );
+    }
+
+    // C1 & C2
+    uint64 c1Count = 0;
+    for( uint64 i = 0; i < length; i += kCheckpoint1Interval )
+        tables.c1[c1Count++] = Swap32( f7Entries[i] );
+    tables.c1[c1Count] = 0;
+
+    uint64 c2Count = 0;
+    for( uint64 i = 0; i < length; i += c2Interval )
+        tables.c2[c2Count++] = Swap32( f7Entries[i] );
+    tables.c2[c2Count] = 0xFFFFFFFF;
+
+    // C3, which overwrites the f7s with deltas
+    const uint64 parkCount = length / kCheckpoint1Interval;
+
+    for( uint64 park = 0; park < parkCount; park++ )
+        WriteC3Park( kCheckpoint1Interval - 1, f7Entries + park * kCheckpoint1Interval, tables.c3 + park * c3Size );
+
+    const uint64 remainder = length - parkCount * kCheckpoint1Interval;
+
+    if( remainder > 1 )
+        WriteC3Park( remainder - 1, f7Entries + parkCount * kCheckpoint1Interval, tables.c3 + parkCount * c3Size );
+}
+
+//-----------------------------------------------------------
+TEST_CASE( "WriteP4Parallel matches the serial P7, C1, C2 and C3 writers", "[phase4]" )
+{
+    std::mt19937_64 rng( 11 );
+
+    for( const uint threadCount : { 1u, 4u } )
+    {
+        ThreadPool pool( threadCount, ThreadPool::Mode::Fixed, true );
+
+        for( const uint64 length : { 1ull, 2ull, 2047ull, 2048ull, 9999ull, 10000ull, 10001ull, 10002ull, 20000ull, 123457ull } )
+        {
+            std::vector<uint32> lEntries( length );
+            std::vector<uint32> f7Entries( length );
+
+            // Sorted f7s, spread like a real table 7 (about 1 entry per value),
+            // so that the C3 deltas compress as they would in a plot
+            const uint32 f7Base = (uint32)( rng() % ( 1ull << 20 ) );
+
+            for( uint64 i = 0; i < length; i++ )
+            {
+                f7Entries[i] = f7Base + (uint32)( rng() % length );
+                lEntries [i] = (uint32)( rng() & ( ENTRIES_PER_TABLE - 1 ) );
+            }
+
+            std::sort( f7Entries.begin(), f7Entries.end() );
+
+            size_t sizes[4];
+            GetP4TableSizes( length, sizes );
+
+            std::vector<byte> expected[4], actual[4];
+            for( int t = 0; t < 4; t++ )
+            {
+                // Fill with garbage, as the writers must overwrite all of it
+                expected[t].assign( sizes[t], 0xCD );
+                actual  [t].assign( sizes[t], 0xCD );
+            }
+
+            const P4Tables expectedTables = { expected[0].data(), (uint32*)expected[1].data(), (uint32*)expected[2].data(), expected[3].data() };
+            const P4Tables actualTables   = { actual  [0].data(), (uint32*)actual  [1].data(), (uint32*)actual  [2].data(), actual  [3].data() };
+
+            std::vector<uint32> f7Copy = f7Entries;
+            WriteP4Serial( length, lEntries.data(), f7Copy.data(), expectedTables );
+
+            WriteP4Parallel<16>( pool, length, lEntries.data(), f7Entries.data(), actualTables );
+
+            for( int t = 0; t < 4; t++ )
+                REQUIRE( expected[t] == actual[t] );
+        }
+    }
+}